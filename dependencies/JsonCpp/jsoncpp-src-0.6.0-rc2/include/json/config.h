@@ -24,6 +24,11 @@
 /// Only has effects if JSON_VALUE_USE_INTERNAL_MAP is defined.
 //#  define JSON_USE_SIMPLE_INTERNAL_ALLOCATOR 1
 
+/// If defined, the memory allocated for strings and for the members of arrays
+/// and objects is counted, see Json::allocationCounters(). Costs an atomic
+/// update per allocation and a strlen() per released string.
+//#  define JSON_VALUE_COUNT_ALLOCATIONS 1
+
 /// If defined, indicates that Json use exception to report invalid type manipulation
 /// instead of C assert macro.
 # define JSON_USE_EXCEPTION 1
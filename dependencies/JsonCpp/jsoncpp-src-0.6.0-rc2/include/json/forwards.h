@@ -19,6 +19,11 @@ namespace Json {
    // reader.h
    class Reader;
 
+   // stream_reader.h
+   class StreamHandler;
+   class ValueBuilder;
+   class StreamReader;
+
    // features.h
    class Features;
 
@@ -9,6 +9,7 @@
 # include "autolink.h"
 # include "value.h"
 # include "reader.h"
+# include "stream_reader.h"
 # include "writer.h"
 # include "jsoncpp_features.h"
 
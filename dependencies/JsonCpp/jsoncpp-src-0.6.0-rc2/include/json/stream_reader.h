@@ -0,0 +1,176 @@
+// Copyright 2007-2010 Baptiste Lepilleur
+// Distributed under MIT license, or public domain if desired and
+// recognized in your jurisdiction.
+// See file LICENSE for detail or copy at http://jsoncpp.sourceforge.net/LICENSE
+
+#ifndef CPPTL_JSON_STREAM_READER_H_INCLUDED
+# define CPPTL_JSON_STREAM_READER_H_INCLUDED
+
+#if !defined(JSON_IS_AMALGAMATION)
+# include "value.h"
+#endif // if !defined(JSON_IS_AMALGAMATION)
+# include <string>
+# include <vector>
+
+namespace Json {
+
+   /** \brief Receives the events produced by a StreamReader.
+    *
+    * Each callback returns \c false to stop parsing; the reader then reports
+    * an error at the current offset.
+    */
+   class JSON_API StreamHandler
+   {
+   public:
+      virtual ~StreamHandler();
+
+      virtual bool onNull() = 0;
+      virtual bool onBool( bool value ) = 0;
+      virtual bool onInt( LargestInt value ) = 0;
+      virtual bool onUInt( LargestUInt value ) = 0;
+      virtual bool onDouble( double value ) = 0;
+      virtual bool onString( const std::string &value ) = 0;
+      virtual bool onObjectBegin() = 0;
+      virtual bool onMemberName( const std::string &name ) = 0;
+      virtual bool onObjectEnd() = 0;
+      virtual bool onArrayBegin() = 0;
+      virtual bool onArrayEnd() = 0;
+   };
+
+   /** \brief StreamHandler that assembles the events into a Value.
+    */
+   class JSON_API ValueBuilder : public StreamHandler
+   {
+   public:
+      ValueBuilder();
+
+      /// Root of the document; complete once StreamReader::finish() succeeded.
+      Value &root();
+
+      /// Drop the partially built document.
+      void reset();
+
+      virtual bool onNull();
+      virtual bool onBool( bool value );
+      virtual bool onInt( LargestInt value );
+      virtual bool onUInt( LargestUInt value );
+      virtual bool onDouble( double value );
+      virtual bool onString( const std::string &value );
+      virtual bool onObjectBegin();
+      virtual bool onMemberName( const std::string &name );
+      virtual bool onObjectEnd();
+      virtual bool onArrayBegin();
+      virtual bool onArrayEnd();
+
+   private:
+      Value &nextValue();
+
+      Value root_;
+      std::vector<Value *> nodes_;
+      std::string memberName_;
+   };
+
+   /** \brief Resumable, push based <a HREF="http://www.json.org">JSON</a> parser.
+    *
+    * The document is handed over in chunks of any size, split at any byte,
+    * as they arrive (e.g. from a curl write callback). The parser keeps its
+    * state between calls and reports values to a StreamHandler as soon as
+    * they are complete, so only the token being read and the current nesting
+    * are held in memory.
+    *
+    * Only strict JSON is accepted: comments are not supported.
+    *
+    * Example of usage:
+    * \code
+    * Json::ValueBuilder builder;
+    * Json::StreamReader reader( builder );
+    * while ( ... )
+    *    if ( !reader.feed( chunk, chunkLength ) )
+    *       break;
+    * if ( reader.finish() )
+    *    use( builder.root() );
+    * \endcode
+    */
+   class JSON_API StreamReader
+   {
+   public:
+      StreamReader( StreamHandler &handler );
+
+      /** \brief Parse the next chunk of the document.
+       * \return \c false once an error has been found; further input is ignored.
+       */
+      bool feed( const char *data, size_t length );
+
+      /// Same as feed(const char *, size_t)
+      bool feed( const std::string &chunk );
+
+      /** \brief Signal the end of the document.
+       * \return \c true if exactly one complete value was read.
+       */
+      bool finish();
+
+      /// Forget all state so that a new document can be parsed.
+      void reset();
+
+      /// \c true while no error has been found.
+      bool good() const;
+
+      /// \c true once a complete top-level value has been read.
+      bool done() const;
+
+      /// Number of bytes consumed so far.
+      size_t offset() const;
+
+      /** \brief Returns a user friendly description of the error.
+       * \return Error message with the byte offset at which it occurred, or an
+       *         empty string if no error occurred.
+       */
+      std::string getFormattedErrorMessages() const;
+
+   private:
+      enum Expect
+      {
+         expectValue = 0,
+         expectValueOrArrayEnd,
+         expectMemberNameOrObjectEnd,
+         expectMemberName,
+         expectColon,
+         expectSeparatorOrEnd,
+         expectNothing
+      };
+
+      enum Lexeme
+      {
+         lexNone = 0,
+         lexString,
+         lexNumber,
+         lexLiteral
+      };
+
+      bool processChar( char c, bool &consumed );
+      bool startValue( char c );
+      bool valueCompleted();
+      bool closeContainer( char c );
+      bool stringChar( char c );
+      bool flushNumber();
+      bool literalChar( char c );
+      bool fail( const std::string &message );
+
+      StreamHandler &handler_;
+      std::vector<char> containers_;
+      std::string token_;
+      std::string literal_;
+      size_t offset_;
+      Expect expect_;
+      Lexeme lexeme_;
+      bool tokenIsMemberName_;
+      bool escape_;
+      int unicodeDigits_;
+      unsigned int unicode_;
+      unsigned int highSurrogate_;
+      std::string error_;
+   };
+
+} // namespace Json
+
+#endif // CPPTL_JSON_STREAM_READER_H_INCLUDED
@@ -20,6 +20,9 @@
 # ifdef JSON_USE_CPPTL
 #  include <cpptl/forwards.h>
 # endif
+# ifdef JSON_VALUE_COUNT_ALLOCATIONS
+#  include <memory>
+# endif
 
 /** \brief JSON (JavaScript Object Notation).
  */
@@ -88,6 +91,96 @@ namespace Json {
       const char *str_;
    };
 
+   /** \brief Memory footprint of a Value tree, as computed by Value::computeStats().
+    *
+    * Byte counts are estimates: they include the bookkeeping of the standard
+    * containers but not the overhead of the heap allocator itself. Members of
+    * shared subtrees (see Value::freeze()) are counted once per reference.
+    */
+   struct JSON_API ValueStats
+   {
+      ValueStats();
+
+      /// Total estimate: nodeBytes + stringBytes + containerBytes.
+      size_t totalBytes() const;
+
+      /// Number of values in the tree, including the root.
+      size_t nodeCount;
+      /// Bytes used by the Value objects themselves.
+      size_t nodeBytes;
+      /// Bytes owned by string values, member names and comments.
+      size_t stringBytes;
+      /// Bytes used by arrays and objects to hold their members.
+      size_t containerBytes;
+      /// Number of nested levels; 1 for a value that is not an array or object.
+      unsigned int maxDepth;
+   };
+
+# ifdef JSON_VALUE_COUNT_ALLOCATIONS
+   /** \brief Heap usage of all the values of the process, see JSON_VALUE_COUNT_ALLOCATIONS.
+    */
+   struct JSON_API AllocationCounters
+   {
+      LargestUInt allocations;
+      LargestUInt releases;
+      LargestUInt bytesInUse;
+      LargestUInt peakBytesInUse;
+   };
+
+   /// Return a snapshot of the allocation counters.
+   JSON_API AllocationCounters allocationCounters();
+
+   /// Reset the number of allocations and releases, and the peak to the current usage.
+   JSON_API void resetAllocationCounters();
+
+   JSON_API void countAllocation( size_t bytes );
+   JSON_API void countRelease( size_t bytes );
+
+   /** \brief std::allocator that reports to the allocation counters.
+    * Used for the members of arrays and objects.
+    */
+   template<typename T>
+   class CountingAllocator : public std::allocator<T>
+   {
+   public:
+      typedef size_t size_type;
+      typedef T *pointer;
+
+      template<typename U>
+      struct rebind
+      {
+         typedef CountingAllocator<U> other;
+      };
+
+      CountingAllocator()
+      {
+      }
+
+      CountingAllocator( const CountingAllocator &other )
+         : std::allocator<T>( other )
+      {
+      }
+
+      template<typename U>
+      CountingAllocator( const CountingAllocator<U> &other )
+         : std::allocator<T>( other )
+      {
+      }
+
+      pointer allocate( size_type count, const void * = 0 )
+      {
+         countAllocation( count * sizeof(T) );
+         return std::allocator<T>::allocate( count );
+      }
+
+      void deallocate( pointer p, size_type count )
+      {
+         countRelease( count * sizeof(T) );
+         std::allocator<T>::deallocate( p, count );
+      }
+   };
+# endif // ifdef JSON_VALUE_COUNT_ALLOCATIONS
+
    /** \brief Represents a <a HREF="http://www.json.org">JSON</a> value.
     *
     * This class is a discriminated union wrapper that can represents a:
@@ -187,11 +280,18 @@ namespace Json {
       };
 
    public:
-#  ifndef JSON_USE_CPPTL_SMALLMAP
+#  if defined(JSON_VALUE_COUNT_ALLOCATIONS)
+      typedef std::map<CZString, Value, std::less<CZString>,
+                       CountingAllocator<std::pair<const CZString, Value> > > ObjectValues;
+#  elif !defined(JSON_USE_CPPTL_SMALLMAP)
       typedef std::map<CZString, Value> ObjectValues;
 #  else
       typedef CppTL::SmallMap<CZString, Value> ObjectValues;
 #  endif // ifndef JSON_USE_CPPTL_SMALLMAP
+
+   private:
+      /// Reference counted members of a frozen value, see freeze().
+      struct SharedObjectValues;
 # endif // ifndef JSON_VALUE_USE_INTERNAL_MAP
 #endif // ifndef JSONCPP_DOC_EXCLUDE_IMPLEMENTATION
 
@@ -429,10 +529,38 @@ namespace Json {
       iterator begin();
       iterator end();
 
+      /** \brief Turn this array or object into an immutable, shareable subtree.
+       *
+       * Members are frozen recursively. Copying a frozen value afterwards only
+       * bumps a reference count instead of duplicating the tree, so caches can
+       * hand out prebuilt fragments in constant time. Any non-const access that
+       * may modify the value (non-const operator[], append(), resize(),
+       * removeMember(), clear(), non-const iterators) first gives that value a
+       * private copy of its members, whose own members stay shared until they
+       * are modified in turn.
+       *
+       * Has no effect on other types of values.
+       */
+      void freeze();
+
+      /// Return true if the members of this value are shared with other values.
+      bool isShared() const;
+
+      /** \brief Measure the memory used by this value and all its members.
+       *
+       * The whole tree is walked once, so the cost is linear in its size.
+       */
+      ValueStats computeStats() const;
+
    private:
       Value &resolveReference( const char *key, 
                                bool isStatic );
 
+      /// Give this value its own copy of shared members before modifying them.
+      void detach();
+
+      void addStats( ValueStats &stats, unsigned int depth ) const;
+
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
       inline bool isItemAvailable() const
       {
@@ -491,6 +619,7 @@ namespace Json {
       } value_;
       ValueType type_ : 8;
       int allocated_ : 1;     // Notes: if declared as bool, bitfield is useless.
+      int shared_ : 1;        // value_.map_ is a SharedObjectValues, see freeze().
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
       unsigned int itemIsUsed_ : 1;      // used by the ValueInternalMap container.
       int memberNameIsStatic_ : 1;       // used by the ValueInternalMap container.
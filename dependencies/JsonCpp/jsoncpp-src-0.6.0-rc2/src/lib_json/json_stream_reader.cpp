@@ -0,0 +1,584 @@
+// Copyright 2007-2010 Baptiste Lepilleur
+// Distributed under MIT license, or public domain if desired and
+// recognized in your jurisdiction.
+// See file LICENSE for detail or copy at http://jsoncpp.sourceforge.net/LICENSE
+
+#if !defined(JSON_IS_AMALGAMATION)
+# include <json/stream_reader.h>
+# include <json/value.h>
+# include "json_tool.h"
+#endif // if !defined(JSON_IS_AMALGAMATION)
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace Json {
+
+// Implementation of class StreamHandler
+// ////////////////////////////////
+
+StreamHandler::~StreamHandler()
+{
+}
+
+
+// Implementation of class ValueBuilder
+// ////////////////////////////////
+
+ValueBuilder::ValueBuilder()
+{
+}
+
+
+Value &
+ValueBuilder::root()
+{
+   return root_;
+}
+
+
+void
+ValueBuilder::reset()
+{
+   root_ = Value();
+   nodes_.clear();
+   memberName_.clear();
+}
+
+
+Value &
+ValueBuilder::nextValue()
+{
+   if ( nodes_.empty() )
+      return root_;
+   Value &container = *nodes_.back();
+   if ( container.isArray() )
+      return container.append( Value() );
+   return container[memberName_];
+}
+
+
+bool
+ValueBuilder::onNull()
+{
+   nextValue() = Value();
+   return true;
+}
+
+
+bool
+ValueBuilder::onBool( bool value )
+{
+   nextValue() = value;
+   return true;
+}
+
+
+bool
+ValueBuilder::onInt( LargestInt value )
+{
+   nextValue() = value;
+   return true;
+}
+
+
+bool
+ValueBuilder::onUInt( LargestUInt value )
+{
+   nextValue() = value;
+   return true;
+}
+
+
+bool
+ValueBuilder::onDouble( double value )
+{
+   nextValue() = value;
+   return true;
+}
+
+
+bool
+ValueBuilder::onString( const std::string &value )
+{
+   nextValue() = value;
+   return true;
+}
+
+
+bool
+ValueBuilder::onObjectBegin()
+{
+   Value &value = nextValue();
+   value = Value( objectValue );
+   nodes_.push_back( &value );
+   return true;
+}
+
+
+bool
+ValueBuilder::onMemberName( const std::string &name )
+{
+   memberName_ = name;
+   return true;
+}
+
+
+bool
+ValueBuilder::onObjectEnd()
+{
+   nodes_.pop_back();
+   return true;
+}
+
+
+bool
+ValueBuilder::onArrayBegin()
+{
+   Value &value = nextValue();
+   value = Value( arrayValue );
+   nodes_.push_back( &value );
+   return true;
+}
+
+
+bool
+ValueBuilder::onArrayEnd()
+{
+   nodes_.pop_back();
+   return true;
+}
+
+
+// Implementation of class StreamReader
+// ////////////////////////////////
+
+static inline bool
+isNumberChar( char c )
+{
+   return ( c >= '0'  &&  c <= '9' )  ||  c == '-'  ||  c == '+'  ||  c == '.'  ||  c == 'e'  ||  c == 'E';
+}
+
+
+static inline int
+hexDigit( char c )
+{
+   if ( c >= '0'  &&  c <= '9' )
+      return c - '0';
+   if ( c >= 'a'  &&  c <= 'f' )
+      return c - 'a' + 10;
+   if ( c >= 'A'  &&  c <= 'F' )
+      return c - 'A' + 10;
+   return -1;
+}
+
+
+StreamReader::StreamReader( StreamHandler &handler )
+   : handler_( handler )
+{
+   reset();
+}
+
+
+void
+StreamReader::reset()
+{
+   containers_.clear();
+   token_.clear();
+   literal_.clear();
+   offset_ = 0;
+   expect_ = expectValue;
+   lexeme_ = lexNone;
+   tokenIsMemberName_ = false;
+   escape_ = false;
+   unicodeDigits_ = 0;
+   unicode_ = 0;
+   highSurrogate_ = 0;
+   error_.clear();
+}
+
+
+bool
+StreamReader::good() const
+{
+   return error_.empty();
+}
+
+
+bool
+StreamReader::done() const
+{
+   return good()  &&  expect_ == expectNothing;
+}
+
+
+size_t
+StreamReader::offset() const
+{
+   return offset_;
+}
+
+
+std::string
+StreamReader::getFormattedErrorMessages() const
+{
+   return error_;
+}
+
+
+bool
+StreamReader::fail( const std::string &message )
+{
+   if ( error_.empty() )
+   {
+      char position[32];
+      snprintf( position, sizeof(position), "%lu", static_cast<unsigned long>( offset_ ) );
+      error_ = "* Offset ";
+      error_ += position;
+      error_ += "\n  " + message + "\n";
+   }
+   return false;
+}
+
+
+bool
+StreamReader::feed( const std::string &chunk )
+{
+   return feed( chunk.data(), chunk.size() );
+}
+
+
+bool
+StreamReader::feed( const char *data, size_t length )
+{
+   if ( !good() )
+      return false;
+
+   for ( size_t index = 0; index < length; )
+   {
+      bool consumed = true;
+      if ( !processChar( data[index], consumed ) )
+         return false;
+      if ( consumed )
+      {
+         ++index;
+         ++offset_;
+      }
+   }
+   return true;
+}
+
+
+bool
+StreamReader::finish()
+{
+   if ( !good() )
+      return false;
+   if ( lexeme_ == lexNumber  &&  !flushNumber() )
+      return false;
+   if ( lexeme_ != lexNone  ||  expect_ != expectNothing )
+      return fail( "Unexpected end of document" );
+   return true;
+}
+
+
+bool
+StreamReader::processChar( char c, bool &consumed )
+{
+   switch ( lexeme_ )
+   {
+   case lexString:
+      return stringChar( c );
+   case lexLiteral:
+      return literalChar( c );
+   case lexNumber:
+      if ( isNumberChar( c ) )
+      {
+         token_ += c;
+         return true;
+      }
+      // The terminating character belongs to the next token.
+      consumed = false;
+      return flushNumber();
+   default:
+      break;
+   }
+
+   if ( c == ' '  ||  c == '\t'  ||  c == '\r'  ||  c == '\n' )
+      return true;
+
+   switch ( expect_ )
+   {
+   case expectValueOrArrayEnd:
+      if ( c == ']' )
+         return closeContainer( c );
+      return startValue( c );
+   case expectValue:
+      return startValue( c );
+   case expectMemberNameOrObjectEnd:
+      if ( c == '}' )
+         return closeContainer( c );
+      // fall through
+   case expectMemberName:
+      if ( c != '"' )
+         return fail( "Missing '}' or object member name" );
+      lexeme_ = lexString;
+      tokenIsMemberName_ = true;
+      token_.clear();
+      return true;
+   case expectColon:
+      if ( c != ':' )
+         return fail( "Missing ':' after object member name" );
+      expect_ = expectValue;
+      return true;
+   case expectSeparatorOrEnd:
+      if ( c == ',' )
+      {
+         expect_ = containers_.back() == '{' ? expectMemberName : expectValue;
+         return true;
+      }
+      if ( c == '}'  ||  c == ']' )
+         return closeContainer( c );
+      return fail( containers_.back() == '{' ? "Missing ',' or '}' in object declaration"
+                                             : "Missing ',' or ']' in array declaration" );
+   default:
+      return fail( "Extra data after the end of the document" );
+   }
+}
+
+
+bool
+StreamReader::startValue( char c )
+{
+   switch ( c )
+   {
+   case '{':
+      containers_.push_back( '{' );
+      expect_ = expectMemberNameOrObjectEnd;
+      return handler_.onObjectBegin()  ||  fail( "Rejected by handler" );
+   case '[':
+      containers_.push_back( '[' );
+      expect_ = expectValueOrArrayEnd;
+      return handler_.onArrayBegin()  ||  fail( "Rejected by handler" );
+   case '"':
+      lexeme_ = lexString;
+      tokenIsMemberName_ = false;
+      token_.clear();
+      return true;
+   case 't':
+      literal_ = "true";
+      break;
+   case 'f':
+      literal_ = "false";
+      break;
+   case 'n':
+      literal_ = "null";
+      break;
+   default:
+      if ( c == '-'  ||  ( c >= '0'  &&  c <= '9' ) )
+      {
+         lexeme_ = lexNumber;
+         token_.assign( 1, c );
+         return true;
+      }
+      return fail( "Syntax error: value, object or array expected." );
+   }
+
+   lexeme_ = lexLiteral;
+   token_.assign( 1, c );
+   return true;
+}
+
+
+bool
+StreamReader::valueCompleted()
+{
+   expect_ = containers_.empty() ? expectNothing : expectSeparatorOrEnd;
+   return true;
+}
+
+
+bool
+StreamReader::closeContainer( char c )
+{
+   const char open = c == '}' ? '{' : '[';
+   if ( containers_.empty()  ||  containers_.back() != open )
+      return fail( "Mismatched closing bracket" );
+   containers_.pop_back();
+   const bool accepted = open == '{' ? handler_.onObjectEnd() : handler_.onArrayEnd();
+   if ( !accepted )
+      return fail( "Rejected by handler" );
+   return valueCompleted();
+}
+
+
+bool
+StreamReader::literalChar( char c )
+{
+   if ( c != literal_[token_.size()] )
+      return fail( "Syntax error: value, object or array expected." );
+   token_ += c;
+   if ( token_.size() < literal_.size() )
+      return true;
+
+   lexeme_ = lexNone;
+   bool accepted;
+   if ( literal_ == "null" )
+      accepted = handler_.onNull();
+   else
+      accepted = handler_.onBool( literal_ == "true" );
+   if ( !accepted )
+      return fail( "Rejected by handler" );
+   return valueCompleted();
+}
+
+
+bool
+StreamReader::stringChar( char c )
+{
+   if ( unicodeDigits_ > 0 )
+   {
+      const int digit = hexDigit( c );
+      if ( digit < 0 )
+         return fail( "Bad unicode escape sequence in string: hexadecimal digit expected." );
+      unicode_ = unicode_ * 16 + digit;
+      if ( --unicodeDigits_ > 0 )
+         return true;
+
+      if ( highSurrogate_ )
+      {
+         if ( unicode_ < 0xDC00  ||  unicode_ > 0xDFFF )
+            return fail( "expecting another \\u token to begin the second half of a unicode surrogate pair" );
+         unicode_ = 0x10000 + ( ( highSurrogate_ & 0x3FF ) << 10 ) + ( unicode_ & 0x3FF );
+         highSurrogate_ = 0;
+      }
+      else if ( unicode_ >= 0xD800  &&  unicode_ <= 0xDBFF )
+      {
+         highSurrogate_ = unicode_;
+         return true;
+      }
+      token_ += codePointToUTF8( unicode_ );
+      return true;
+   }
+
+   if ( highSurrogate_ )
+   {
+      // Only the "\u" introducing the low surrogate may follow a high surrogate.
+      if ( !escape_ )
+      {
+         if ( c != '\\' )
+            return fail( "additional six characters expected to parse unicode surrogate pair." );
+         escape_ = true;
+         return true;
+      }
+      if ( c != 'u' )
+         return fail( "expecting another \\u token to begin the second half of a unicode surrogate pair" );
+      escape_ = false;
+      unicode_ = 0;
+      unicodeDigits_ = 4;
+      return true;
+   }
+
+   if ( escape_ )
+   {
+      escape_ = false;
+      switch ( c )
+      {
+      case '"': token_ += '"'; break;
+      case '/': token_ += '/'; break;
+      case '\\': token_ += '\\'; break;
+      case 'b': token_ += '\b'; break;
+      case 'f': token_ += '\f'; break;
+      case 'n': token_ += '\n'; break;
+      case 'r': token_ += '\r'; break;
+      case 't': token_ += '\t'; break;
+      case 'u':
+         unicode_ = 0;
+         unicodeDigits_ = 4;
+         break;
+      default:
+         return fail( "Bad escape sequence in string" );
+      }
+      return true;
+   }
+
+   if ( c == '\\' )
+   {
+      escape_ = true;
+      return true;
+   }
+
+   if ( c != '"' )
+   {
+      token_ += c;
+      return true;
+   }
+
+   lexeme_ = lexNone;
+   if ( tokenIsMemberName_ )
+   {
+      expect_ = expectColon;
+      return handler_.onMemberName( token_ )  ||  fail( "Rejected by handler" );
+   }
+   if ( !handler_.onString( token_ ) )
+      return fail( "Rejected by handler" );
+   return valueCompleted();
+}
+
+
+bool
+StreamReader::flushNumber()
+{
+   lexeme_ = lexNone;
+
+   bool isDouble = false;
+   for ( std::string::size_type index = 0; index < token_.size(); ++index )
+   {
+      const char c = token_[index];
+      isDouble = isDouble  ||  c == '.'  ||  c == 'e'  ||  c == 'E'  ||  c == '+'  ||  ( c == '-'  &&  index != 0 );
+   }
+
+   bool accepted;
+   if ( !isDouble )
+   {
+      const bool isNegative = token_[0] == '-';
+      const LargestUInt maxIntegerValue = isNegative ? LargestUInt( -Value::minLargestInt )
+                                                     : Value::maxLargestUInt;
+      LargestUInt value = 0;
+      std::string::size_type index = isNegative ? 1 : 0;
+      if ( index == token_.size() )
+         return fail( "'" + token_ + "' is not a number." );
+      for ( ; index < token_.size(); ++index )
+      {
+         const unsigned int digit = token_[index] - '0';
+         if ( value > ( maxIntegerValue - digit ) / 10 )
+         {
+            isDouble = true;
+            break;
+         }
+         value = value * 10 + digit;
+      }
+      if ( !isDouble )
+      {
+         if ( isNegative )
+            accepted = handler_.onInt( -LargestInt( value ) );
+         else if ( value <= LargestUInt( Value::maxLargestInt ) )
+            accepted = handler_.onInt( LargestInt( value ) );
+         else
+            accepted = handler_.onUInt( value );
+         if ( !accepted )
+            return fail( "Rejected by handler" );
+         return valueCompleted();
+      }
+   }
+
+   char *end = 0;
+   const double value = strtod( token_.c_str(), &end );
+   if ( end != token_.c_str() + token_.size() )
+      return fail( "'" + token_ + "' is not a number." );
+   if ( !handler_.onDouble( value ) )
+      return fail( "Rejected by handler" );
+   return valueCompleted();
+}
+
+} // namespace Json
@@ -49,6 +49,76 @@ const LargestUInt Value::maxLargestUInt = LargestUInt(-1);
 static const unsigned int unknown = (unsigned)-1;
 
 
+#ifdef JSON_VALUE_COUNT_ALLOCATIONS
+// Kept as size_t so that updates are a single atomic instruction on 32 bits
+// targets too.
+static volatile size_t allocationCount = 0;
+static volatile size_t releaseCount = 0;
+static volatile size_t bytesInUse = 0;
+static volatile size_t peakBytesInUse = 0;
+
+
+static inline size_t
+atomicAdd( volatile size_t *counter, size_t delta )
+{
+# if defined(__GNUC__)
+   return __sync_add_and_fetch( counter, delta );
+# else
+   return *counter += delta;
+# endif
+}
+
+
+void
+countAllocation( size_t bytes )
+{
+   atomicAdd( &allocationCount, 1 );
+   size_t inUse = atomicAdd( &bytesInUse, bytes );
+   size_t peak = peakBytesInUse;
+   while ( inUse > peak )
+   {
+# if defined(__GNUC__)
+      size_t previous = __sync_val_compare_and_swap( &peakBytesInUse, peak, inUse );
+      if ( previous == peak )
+         break;
+      peak = previous;
+# else
+      peakBytesInUse = peak = inUse;
+# endif
+   }
+}
+
+
+void
+countRelease( size_t bytes )
+{
+   atomicAdd( &releaseCount, 1 );
+   atomicAdd( &bytesInUse, size_t(0) - bytes );
+}
+
+
+AllocationCounters
+allocationCounters()
+{
+   AllocationCounters counters;
+   counters.allocations = allocationCount;
+   counters.releases = releaseCount;
+   counters.bytesInUse = bytesInUse;
+   counters.peakBytesInUse = peakBytesInUse;
+   return counters;
+}
+
+
+void
+resetAllocationCounters()
+{
+   allocationCount = 0;
+   releaseCount = 0;
+   peakBytesInUse = bytesInUse;
+}
+#endif // ifdef JSON_VALUE_COUNT_ALLOCATIONS
+
+
 /** Duplicates the specified string value.
  * @param value Pointer to the string to duplicate. Must be zero-terminated if
  *              length is "unknown".
@@ -66,6 +136,10 @@ duplicateStringValue( const char *value,
    JSON_ASSERT_MESSAGE( newString != 0, "Failed to allocate string value buffer" );
    memcpy( newString, value, length );
    newString[length] = 0;
+#ifdef JSON_VALUE_COUNT_ALLOCATIONS
+   // measured like releaseStringValue() does, in case of embedded zeros
+   countAllocation( strlen( newString ) + 1 );
+#endif
    return newString;
 }
 
@@ -76,9 +150,54 @@ static inline void
 releaseStringValue( char *value )
 {
    if ( value )
+   {
+#ifdef JSON_VALUE_COUNT_ALLOCATIONS
+      countRelease( strlen( value ) + 1 );
+#endif
       free( value );
+   }
+}
+
+
+#ifndef JSON_VALUE_USE_INTERNAL_MAP
+/** Members shared by frozen values, see Value::freeze().
+ * Derives from ObjectValues so that Value::value_.map_ can point at it
+ * directly and all read-only accessors work unchanged.
+ */
+struct Value::SharedObjectValues : public Value::ObjectValues
+{
+   SharedObjectValues()
+      : refCount_( 1 )
+   {
+   }
+
+   volatile int refCount_;
+};
+
+
+// Frozen values may be copied and released from several threads at once.
+static inline void
+retainShared( volatile int *refCount )
+{
+#if defined(__GNUC__)
+   __sync_add_and_fetch( refCount, 1 );
+#else
+   ++*refCount;
+#endif
 }
 
+
+static inline bool
+releaseShared( volatile int *refCount )
+{
+#if defined(__GNUC__)
+   return __sync_sub_and_fetch( refCount, 1 ) == 0;
+#else
+   return --*refCount == 0;
+#endif
+}
+#endif // ifndef JSON_VALUE_USE_INTERNAL_MAP
+
 } // namespace Json
 
 
@@ -100,6 +219,31 @@ releaseStringValue( char *value )
 
 namespace Json {
 
+// //////////////////////////////////////////////////////////////////
+// //////////////////////////////////////////////////////////////////
+// //////////////////////////////////////////////////////////////////
+// class ValueStats
+// //////////////////////////////////////////////////////////////////
+// //////////////////////////////////////////////////////////////////
+// //////////////////////////////////////////////////////////////////
+
+ValueStats::ValueStats()
+   : nodeCount( 0 )
+   , nodeBytes( 0 )
+   , stringBytes( 0 )
+   , containerBytes( 0 )
+   , maxDepth( 0 )
+{
+}
+
+
+size_t
+ValueStats::totalBytes() const
+{
+   return nodeBytes + stringBytes + containerBytes;
+}
+
+
 // //////////////////////////////////////////////////////////////////
 // //////////////////////////////////////////////////////////////////
 // //////////////////////////////////////////////////////////////////
@@ -243,6 +387,7 @@ Value::CZString::isStaticString() const
 Value::Value( ValueType aType )
    : type_( aType )
    , allocated_( 0 )
+   , shared_( 0 )
    , comments_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
@@ -288,6 +433,7 @@ Value::Value( ValueType aType )
 Value::Value( UInt value )
    : type_( uintValue )
    , allocated_( 0 )
+   , shared_( 0 )
    , comments_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
@@ -299,6 +445,7 @@ Value::Value( UInt value )
 Value::Value( Int value )
    : type_( intValue )
    , allocated_( 0 )
+   , shared_( 0 )
    , comments_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
@@ -313,6 +460,7 @@ Value::Value( Int value )
 Value::Value( Int64 value )
    : type_( intValue )
    , allocated_( 0 )
+   , shared_( 0 )
    , comments_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
@@ -325,6 +473,7 @@ Value::Value( Int64 value )
 Value::Value( UInt64 value )
    : type_( uintValue )
    , allocated_( 0 )
+   , shared_( 0 )
    , comments_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
@@ -336,6 +485,7 @@ Value::Value( UInt64 value )
 Value::Value( double value )
    : type_( realValue )
    , allocated_( 0 )
+   , shared_( 0 )
    , comments_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
@@ -347,6 +497,7 @@ Value::Value( double value )
 Value::Value( const char *value )
    : type_( stringValue )
    , allocated_( true )
+   , shared_( 0 )
    , comments_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
@@ -360,6 +511,7 @@ Value::Value( const char *beginValue,
               const char *endValue )
    : type_( stringValue )
    , allocated_( true )
+   , shared_( 0 )
    , comments_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
@@ -373,6 +525,7 @@ Value::Value( const char *beginValue,
 Value::Value( const std::string &value )
    : type_( stringValue )
    , allocated_( true )
+   , shared_( 0 )
    , comments_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
@@ -386,6 +539,7 @@ Value::Value( const std::string &value )
 Value::Value( const StaticString &value )
    : type_( stringValue )
    , allocated_( false )
+   , shared_( 0 )
    , comments_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
@@ -399,6 +553,7 @@ Value::Value( const StaticString &value )
 Value::Value( const CppTL::ConstString &value )
    : type_( stringValue )
    , allocated_( true )
+   , shared_( 0 )
    , comments_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
@@ -411,6 +566,7 @@ Value::Value( const CppTL::ConstString &value )
 Value::Value( bool value )
    : type_( booleanValue )
    , allocated_( 0 )
+   , shared_( 0 )
    , comments_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
@@ -423,6 +579,7 @@ Value::Value( bool value )
 Value::Value( const Value &other )
    : type_( other.type_ )
    , allocated_( 0 )
+   , shared_( 0 )
    , comments_( 0 )
 # ifdef JSON_VALUE_USE_INTERNAL_MAP
    , itemIsUsed_( 0 )
@@ -449,7 +606,14 @@ Value::Value( const Value &other )
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
    case arrayValue:
    case objectValue:
-      value_.map_ = new ObjectValues( *other.value_.map_ );
+      if ( other.shared_ )
+      {
+         retainShared( &static_cast<SharedObjectValues *>( other.value_.map_ )->refCount_ );
+         value_.map_ = other.value_.map_;
+         shared_ = 1;
+      }
+      else
+         value_.map_ = new ObjectValues( *other.value_.map_ );
       break;
 #else
    case arrayValue:
@@ -492,7 +656,10 @@ Value::~Value()
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
    case arrayValue:
    case objectValue:
-      delete value_.map_;
+      if ( !shared_ )
+         delete value_.map_;
+      else if ( releaseShared( &static_cast<SharedObjectValues *>( value_.map_ )->refCount_ ) )
+         delete static_cast<SharedObjectValues *>( value_.map_ );
       break;
 #else
    case arrayValue:
@@ -528,6 +695,9 @@ Value::swap( Value &other )
    int temp2 = allocated_;
    allocated_ = other.allocated_;
    other.allocated_ = temp2;
+   int temp3 = shared_;
+   shared_ = other.shared_;
+   other.shared_ = temp3;
 }
 
 ValueType 
@@ -640,8 +810,9 @@ Value::operator ==( const Value &other ) const
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
    case arrayValue:
    case objectValue:
-      return value_.map_->size() == other.value_.map_->size()
-             && (*value_.map_) == (*other.value_.map_);
+      return value_.map_ == other.value_.map_
+             || ( value_.map_->size() == other.value_.map_->size()
+                  && (*value_.map_) == (*other.value_.map_) );
 #else
    case arrayValue:
       return value_.array_->compare( *(other.value_.array_) ) == 0;
@@ -1039,7 +1210,14 @@ Value::clear()
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
    case arrayValue:
    case objectValue:
-      value_.map_->clear();
+      if ( shared_ )
+      {
+         // Nothing worth copying: drop our reference and start empty.
+         Value empty( type_ );
+         swap( empty );
+      }
+      else
+         value_.map_->clear();
       break;
 #else
    case arrayValue:
@@ -1061,6 +1239,7 @@ Value::resize( ArrayIndex newSize )
    if ( type_ == nullValue )
       *this = Value( arrayValue );
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
+   detach();
    ArrayIndex oldSize = size();
    if ( newSize == 0 )
       clear();
@@ -1087,6 +1266,7 @@ Value::operator[]( ArrayIndex index )
    if ( type_ == nullValue )
       *this = Value( arrayValue );
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
+   detach();
    CZString key( index );
    ObjectValues::iterator it = value_.map_->lower_bound( key );
    if ( it != value_.map_->end()  &&  (*it).first == key )
@@ -1151,6 +1331,7 @@ Value::resolveReference( const char *key,
    if ( type_ == nullValue )
       *this = Value( objectValue );
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
+   detach();
    CZString actualKey( key, isStatic ? CZString::noDuplication 
                                      : CZString::duplicateOnCopy );
    ObjectValues::iterator it = value_.map_->lower_bound( actualKey );
@@ -1269,6 +1450,7 @@ Value::removeMember( const char* key )
    if ( type_ == nullValue )
       return null;
 #ifndef JSON_VALUE_USE_INTERNAL_MAP
+   detach();
    CZString actualKey( key, CZString::noDuplication );
    ObjectValues::iterator it = value_.map_->find( actualKey );
    if ( it == value_.map_->end() )
@@ -1489,6 +1671,116 @@ Value::toStyledString() const
 }
 
 
+void
+Value::freeze()
+{
+#ifndef JSON_VALUE_USE_INTERNAL_MAP
+   if ( ( type_ != arrayValue  &&  type_ != objectValue )  ||  shared_ )
+      return;
+   for ( ObjectValues::iterator it = value_.map_->begin(); it != value_.map_->end(); ++it )
+      (*it).second.freeze();
+   SharedObjectValues *shared = new SharedObjectValues();
+   shared->swap( *value_.map_ );
+   delete value_.map_;
+   value_.map_ = shared;
+   shared_ = 1;
+#endif
+}
+
+
+bool
+Value::isShared() const
+{
+   return shared_ != 0;
+}
+
+
+void
+Value::detach()
+{
+#ifndef JSON_VALUE_USE_INTERNAL_MAP
+   if ( !shared_ )
+      return;
+   SharedObjectValues *shared = static_cast<SharedObjectValues *>( value_.map_ );
+   ObjectValues *own = new ObjectValues();
+   // Sole owner: take the members over instead of copying them.
+   if ( shared->refCount_ == 1 )
+      own->swap( *shared );
+   else
+      *own = *shared;
+   if ( releaseShared( &shared->refCount_ ) )
+      delete shared;
+   value_.map_ = own;
+   shared_ = 0;
+#endif
+}
+
+
+ValueStats
+Value::computeStats() const
+{
+   ValueStats stats;
+   addStats( stats, 1 );
+   return stats;
+}
+
+
+void
+Value::addStats( ValueStats &stats, unsigned int depth ) const
+{
+   ++stats.nodeCount;
+   stats.nodeBytes += sizeof(Value);
+   if ( depth > stats.maxDepth )
+      stats.maxDepth = depth;
+   if ( comments_ )
+   {
+      stats.containerBytes += sizeof(CommentInfo) * numberOfCommentPlacement;
+      for ( int comment =0; comment < numberOfCommentPlacement; ++comment )
+         if ( comments_[comment].comment_ )
+            stats.stringBytes += strlen( comments_[comment].comment_ ) + 1;
+   }
+
+   switch ( type_ )
+   {
+   case stringValue:
+      if ( allocated_  &&  value_.string_ )
+         stats.stringBytes += strlen( value_.string_ ) + 1;
+      break;
+#ifndef JSON_VALUE_USE_INTERNAL_MAP
+   case arrayValue:
+   case objectValue:
+      {
+         // A std::map node holds the red-black tree links (color, parent,
+         // left, right) next to the key and the member value.
+         const size_t nodeOverhead = 4 * sizeof(void *) + sizeof(CZString);
+         stats.containerBytes += sizeof(ObjectValues) + nodeOverhead * value_.map_->size();
+         for ( ObjectValues::const_iterator it = value_.map_->begin(); it != value_.map_->end(); ++it )
+         {
+            const CZString &key = (*it).first;
+            if ( key.c_str()  &&  !key.isStaticString() )
+               stats.stringBytes += strlen( key.c_str() ) + 1;
+            (*it).second.addStats( stats, depth + 1 );
+         }
+      }
+      break;
+#else
+   case arrayValue:
+   case objectValue:
+      // The internal containers allocate by pages; only the members are measured.
+      for ( const_iterator it = begin(); it != end(); ++it )
+      {
+         if ( type_ == objectValue  &&  it.memberName() )
+            stats.stringBytes += strlen( it.memberName() ) + 1;
+         (*it).addStats( stats, depth + 1 );
+      }
+      break;
+#endif
+   default:
+      break;
+   }
+}
+
+
 Value::const_iterator 
 Value::begin() const
 {
@@ -1585,6 +1877,7 @@ Value::begin()
 #else
    case arrayValue:
    case objectValue:
+      detach();
       if ( value_.map_ )
          return iterator( value_.map_->begin() );
       break;
@@ -1620,6 +1913,7 @@ Value::end()
 #else
    case arrayValue:
    case objectValue:
+      detach();
       if ( value_.map_ )
          return iterator( value_.map_->end() );
       break;
@@ -366,6 +366,89 @@ JSONTEST_FIXTURE( ValueTest, compareType )
 }
 
 
+JSONTEST_FIXTURE( ValueTest, freeze )
+{
+    Json::Value folder;
+    folder["name"] = "Inbox";
+    folder["ids"].append( 1 );
+    folder["ids"].append( 2 );
+    folder.freeze();
+    const Json::Value &frozen = folder;
+    JSONTEST_ASSERT( frozen.isShared() );
+    JSONTEST_ASSERT( frozen["ids"].isShared() );
+
+    // copies share the members until one of them is modified
+    Json::Value copy( folder );
+    JSONTEST_ASSERT( copy.isShared() );
+    JSONTEST_ASSERT_PRED( checkIsEqual( folder, copy ) );
+    copy["ids"].append( 3 );
+    JSONTEST_ASSERT( !copy.isShared() );
+    JSONTEST_ASSERT( !copy["ids"].isShared() );
+    JSONTEST_ASSERT( folder.isShared() );
+    JSONTEST_ASSERT( frozen["ids"].size() == 2 );
+    JSONTEST_ASSERT( copy["ids"].size() == 3 );
+    JSONTEST_ASSERT( copy["name"] == frozen["name"] );
+
+    // a frozen value embedded in another one keeps being shared
+    Json::Value result;
+    result["folder"] = folder;
+    JSONTEST_ASSERT( result["folder"].isShared() );
+    result["folder"].removeMember( "name" );
+    JSONTEST_ASSERT( folder.isMember( "name" ) );
+
+    Json::Value cleared( folder );
+    cleared.clear();
+    JSONTEST_ASSERT( cleared.empty() );
+    JSONTEST_ASSERT( folder.size() == 2 );
+}
+
+
+JSONTEST_FIXTURE( ValueTest, computeStats )
+{
+    Json::ValueStats scalar = Json::Value( 12 ).computeStats();
+    JSONTEST_ASSERT( scalar.nodeCount == 1 );
+    JSONTEST_ASSERT( scalar.maxDepth == 1 );
+    JSONTEST_ASSERT( scalar.stringBytes == 0 );
+    JSONTEST_ASSERT( scalar.containerBytes == 0 );
+    JSONTEST_ASSERT( scalar.totalBytes() == sizeof(Json::Value) );
+
+    Json::Value root;
+    root["name"] = "abc";
+    root["list"].append( 1 );
+    root["list"].append( Json::Value( Json::objectValue ) );
+    root["list"][1u]["x"] = true;
+    Json::ValueStats stats = root.computeStats();
+    // root, name, list, 1, {}, x
+    JSONTEST_ASSERT( stats.nodeCount == 6 );
+    JSONTEST_ASSERT( stats.maxDepth == 4 );
+    // "abc" + member names "name", "list" and "x"
+    JSONTEST_ASSERT( stats.stringBytes == 4 + 5 + 5 + 2 );
+    JSONTEST_ASSERT( stats.containerBytes > 0 );
+    JSONTEST_ASSERT( stats.totalBytes() == stats.nodeBytes + stats.stringBytes + stats.containerBytes );
+}
+
+
+#ifdef JSON_VALUE_COUNT_ALLOCATIONS
+JSONTEST_FIXTURE( ValueTest, allocationCounters )
+{
+    Json::resetAllocationCounters();
+    const Json::AllocationCounters before = Json::allocationCounters();
+    {
+        Json::Value root;
+        root["name"] = "abc";
+        root["list"].append( "def" );
+        const Json::AllocationCounters during = Json::allocationCounters();
+        JSONTEST_ASSERT( during.allocations > 0 );
+        JSONTEST_ASSERT( during.bytesInUse > before.bytesInUse );
+    }
+    const Json::AllocationCounters after = Json::allocationCounters();
+    JSONTEST_ASSERT( after.allocations == after.releases );
+    JSONTEST_ASSERT( after.bytesInUse == before.bytesInUse );
+    JSONTEST_ASSERT( after.peakBytesInUse > before.bytesInUse );
+}
+#endif
+
+
 void 
 ValueTest::checkIsLess( const Json::Value &x, const Json::Value &y )
 {
@@ -402,6 +485,66 @@ ValueTest::checkIsEqual( const Json::Value &x, const Json::Value &y )
 }
 
 
+struct StreamReaderTest : JsonTest::TestCase
+{
+   /// Feed the document one byte at a time, then compare with Reader.
+   void checkByteByByte( const std::string &document );
+};
+
+
+void
+StreamReaderTest::checkByteByByte( const std::string &document )
+{
+   Json::Value expected;
+   JSONTEST_ASSERT( Json::Reader().parse( document, expected ) );
+
+   Json::ValueBuilder builder;
+   Json::StreamReader reader( builder );
+   for ( std::string::size_type index = 0; index < document.size(); ++index )
+      JSONTEST_ASSERT( reader.feed( document.data() + index, 1 ) );
+   JSONTEST_ASSERT( reader.finish() );
+   JSONTEST_ASSERT( builder.root() == expected );
+   JSONTEST_ASSERT( document.size() == reader.offset() );
+}
+
+
+JSONTEST_FIXTURE( StreamReaderTest, chunkBoundaries )
+{
+   JSONTEST_ASSERT_PRED( checkByteByByte( "{ \"a\" : [ 1, -2, 3.5e2, true, false, null ], \"b\" : { \"c\" : \"d\\\"e\" } }" ) );
+   JSONTEST_ASSERT_PRED( checkByteByByte( "[ \"\\u00e9\\ud834\\udd1e\", 18446744073709551615, -9223372036854775808 ]" ) );
+   JSONTEST_ASSERT_PRED( checkByteByByte( "[[],{},[{}]]" ) );
+   JSONTEST_ASSERT_PRED( checkByteByByte( "12345" ) );
+}
+
+
+JSONTEST_FIXTURE( StreamReaderTest, errors )
+{
+   Json::ValueBuilder builder;
+   Json::StreamReader reader( builder );
+
+   JSONTEST_ASSERT( !reader.feed( "{ \"a\" 1 }" ) );
+   JSONTEST_ASSERT( !reader.good() );
+   JSONTEST_ASSERT( !reader.getFormattedErrorMessages().empty() );
+
+   reader.reset();
+   builder.reset();
+   JSONTEST_ASSERT( reader.feed( "[1, 2" ) );
+   JSONTEST_ASSERT( !reader.finish() );
+
+   reader.reset();
+   builder.reset();
+   JSONTEST_ASSERT( !reader.feed( "[1] 2" ) );
+
+   reader.reset();
+   builder.reset();
+   JSONTEST_ASSERT( !reader.feed( "[tru3]" ) );
+
+   reader.reset();
+   builder.reset();
+   JSONTEST_ASSERT( !reader.feed( "[1}" ) );
+}
+
+
 int main( int argc, const char *argv[] )
 {
    JsonTest::Runner runner;
@@ -426,5 +569,12 @@ int main( int argc, const char *argv[] )
    JSONTEST_REGISTER_FIXTURE( runner, ValueTest, compareArray );
    JSONTEST_REGISTER_FIXTURE( runner, ValueTest, compareObject );
    JSONTEST_REGISTER_FIXTURE( runner, ValueTest, compareType );
+   JSONTEST_REGISTER_FIXTURE( runner, ValueTest, freeze );
+   JSONTEST_REGISTER_FIXTURE( runner, ValueTest, computeStats );
+#ifdef JSON_VALUE_COUNT_ALLOCATIONS
+   JSONTEST_REGISTER_FIXTURE( runner, ValueTest, allocationCounters );
+#endif
+   JSONTEST_REGISTER_FIXTURE( runner, StreamReaderTest, chunkBoundaries );
+   JSONTEST_REGISTER_FIXTURE( runner, StreamReaderTest, errors );
    return runner.runCommandLine( argc, argv );
 }
@@ -19,7 +19,37 @@ var filetransfer,
     _utils = require("./../../lib/utils"),
     Whitelist = require('../../lib/policy/whitelist').Whitelist,
     _whitelist = new Whitelist(),
-    resultObjs = {};
+    resultObjs = {},
+    transfers = {},
+    // the options of configure, each a number of transfers, KB or KB/s
+    limitNames = ["maxTransfers", "maxTransfersPerHost", "maxStreamsPerHost", "cacheSize",
+                  "maxRate", "maxRateHigh", "maxRateNormal", "maxRateLow"];
+
+// Each webview counts its transfers from 1, so a transferId is only unique
+// together with the id of its webview
+function transferKey(env, transferId) {
+    return env.webview.id + "/" + transferId;
+}
+
+// Remembers which callback carries the transfer the client knows by
+// transferId, so that it can be aborted. Only called once the request is
+// passed on: the entry goes when its result comes, which a request that
+// failed its checks never gets
+function track(result, args, env) {
+    if (args.transferId) {
+        transfers[result.callbackId] = transferKey(env, args.transferId);
+        delete args.transferId;
+    }
+}
+
+// Checks options.priority, which the native side would only refuse quietly
+function checkPriority(result, options) {
+    if (options && options.priority !== undefined && ["high", "normal", "low"].indexOf(options.priority) === -1) {
+        result.error("priority must be \"high\", \"normal\" or \"low\"", false);
+        return false;
+    }
+    return true;
+}
 
 module.exports = {
     upload: function (success, fail, args, env) {
@@ -63,8 +93,15 @@ module.exports = {
             return;
         }
 
+        if (!checkPriority(result, args.options)) {
+            return;
+        }
+
         // translate paths
         args.filePath = _utils.translatePath(args.filePath).replace(/file:\/\//, '');
+        if (args.options && args.options.responseFile) {
+            args.options.responseFile = _utils.translatePath(args.options.responseFile).replace(/file:\/\//, '');
+        }
 
         // check if url is whitelisted
         if (!_whitelist.isAccessAllowed(args.server)) {
@@ -72,6 +109,8 @@ module.exports = {
             return;
         }
 
+        track(result, args, env);
+
         // set user defined args into params
         for (key in args) {
             if (args[key]) {
@@ -89,6 +128,90 @@ module.exports = {
         result.noResult(true);
     },
 
+    uploadBatch: function (success, fail, args, env) {
+        var key,
+            key2,
+            result = new PluginResult(args, env),
+            params = {
+                "files": [],
+                "server": "",
+                "options": {
+                    "fileKey": "file",
+                    "mimeType": "image/jpeg",
+                    "params": {},
+                    "chunkedMode": true,
+                    "chunkSize": 1024,
+                    "windowGroup" : _webview.windowGroup()
+                }
+            },
+            undefined_params = [];
+
+        resultObjs[result.callbackId] = result;
+
+        /*jshint forin: false */
+        for (key in args) {
+            args[key] = JSON.parse(decodeURIComponent(args[key]));
+            if (!args[key]) {
+                undefined_params.push(key);
+            }
+        }
+
+        // validate params
+        if (undefined_params.length !== 0) {
+            result.error(undefined_params + (undefined_params.length === 1 ? " is " : " are ") + "null", false);
+            return;
+        }
+
+        if (!Array.isArray(args.files) || args.files.length === 0) {
+            result.error("files must be a non-empty array", false);
+            return;
+        }
+
+        if (args.options && args.options.chunkedMode !== false && args.options.chunkSize <= 0) {
+            result.error("chunkSize must be a positive number", false);
+            return;
+        }
+
+        if (!checkPriority(result, args.options)) {
+            return;
+        }
+
+        // each file is a path, or an object with its own fileKey, fileName
+        // and mimeType; translate the paths
+        args.files = args.files.map(function (file) {
+            var copy = typeof file === "string" ? { "filePath": file } : file;
+            copy.filePath = _utils.translatePath(copy.filePath).replace(/file:\/\//, '');
+            return copy;
+        });
+        if (args.options && args.options.responseFile) {
+            args.options.responseFile = _utils.translatePath(args.options.responseFile).replace(/file:\/\//, '');
+        }
+
+        // check if url is whitelisted
+        if (!_whitelist.isAccessAllowed(args.server)) {
+            result.error("URL denied by whitelist: " + args.server, false);
+            return;
+        }
+
+        track(result, args, env);
+
+        // set user defined args into params
+        for (key in args) {
+            if (args[key]) {
+                if (key === "options") {
+                    for (key2 in args[key]) {
+                        params[key][key2] = args[key][key2];
+                    }
+                } else {
+                    params[key] = args[key];
+                }
+            }
+        }
+
+        filetransfer.getInstance().uploadBatch(params);
+        result.noResult(true);
+    },
+
     download: function (success, fail, args, env) {
         var key,
             result = new PluginResult(args, env),
@@ -110,8 +233,25 @@ module.exports = {
             return;
         }
 
+        // a download kept in memory has no target
+        if (args.options && args.options.memory) {
+            if (args.options.memory !== "base64" && args.options.memory !== "text") {
+                result.error("memory must be \"base64\" or \"text\"", false);
+                return;
+            }
+        } else if (!args.target) {
+            result.error("target is null", false);
+            return;
+        }
+
+        if (!checkPriority(result, args.options)) {
+            return;
+        }
+
         // translate paths
-        args.target = _utils.translatePath(args.target).replace(/file:\/\//, '');
+        if (args.target) {
+            args.target = _utils.translatePath(args.target).replace(/file:\/\//, '');
+        }
 
         // check if url is whitelisted
         if (!_whitelist.isAccessAllowed(args.source)) {
@@ -119,10 +259,84 @@ module.exports = {
             return;
         }
 
+        track(result, args, env);
         args.windowGroup = _webview.windowGroup();
 
         filetransfer.getInstance().download(args);
         result.noResult(true);
+    },
+
+    configure: function (success, fail, args, env) {
+        var result = new PluginResult(args, env),
+            options = args.options ? JSON.parse(decodeURIComponent(args.options)) : {},
+            limits,
+            key;
+
+        // a bandwidth cap of 0 lifts it
+        for (key in options) {
+            if (options.hasOwnProperty(key)) {
+                if (limitNames.indexOf(key) === -1) {
+                    result.error("Unknown option " + key, false);
+                    return;
+                }
+                if (typeof options[key] !== "number" || !(options[key] > 0) && !(key.indexOf("maxRate") === 0 && options[key] === 0)) {
+                    result.error(key + " must be a positive number", false);
+                    return;
+                }
+            }
+        }
+
+        // the limits in effect, or an error the native side could not take
+        limits = JSON.parse(filetransfer.getInstance().configure(options));
+        if (limits.error) {
+            result.error(limits.error, false);
+        } else {
+            result.ok(limits, false);
+        }
+    },
+
+    stats: function (success, fail, args, env) {
+        var result = new PluginResult(args, env);
+
+        result.ok(JSON.parse(filetransfer.getInstance().stats()), false);
+    },
+
+    transfers: function (success, fail, args, env) {
+        var result = new PluginResult(args, env);
+
+        result.ok(JSON.parse(filetransfer.getInstance().transfers()), false);
+    },
+
+    abort: function (success, fail, args, env) {
+        var result = new PluginResult(args, env),
+            transferId = args.transferId ? JSON.parse(decodeURIComponent(args.transferId)) : null,
+            key = transferKey(env, transferId),
+            callbackId;
+
+        for (callbackId in transfers) {
+            if (transfers.hasOwnProperty(callbackId) && transfers[callbackId] === key) {
+                filetransfer.getInstance().abort({ "callbackId": callbackId });
+                result.ok(true, false);
+                return;
+            }
+        }
+
+        // Unknown, or already finished
+        result.error("No transfer " + transferId, false);
+    },
+
+    abortTransfer: function (success, fail, args, env) {
+        var result = new PluginResult(args, env),
+            id = args.id ? JSON.parse(decodeURIComponent(args.id)) : null;
+
+        // the id of an entry listed by transfers
+        if (typeof id !== "string" || id === "") {
+            result.error("id must be the id of a transfer", false);
+            return;
+        }
+
+        filetransfer.getInstance().abort({ "id": id });
+        result.ok(true, false);
     }
 };
 
@@ -139,28 +353,64 @@ JNEXT.FileTransfer = function () {
         return JNEXT.invoke(self.m_id, "upload " + JSON.stringify(args));
     };
 
+    self.uploadBatch = function (args) {
+        return JNEXT.invoke(self.m_id, "uploadBatch " + JSON.stringify(args));
+    };
+
     self.download = function (args) {
         return JNEXT.invoke(self.m_id, "download " + JSON.stringify(args));
     };
 
+    self.configure = function (args) {
+        return JNEXT.invoke(self.m_id, "configure " + JSON.stringify(args));
+    };
+
+    self.abort = function (args) {
+        return JNEXT.invoke(self.m_id, "abort " + JSON.stringify(args));
+    };
+
+    self.stats = function () {
+        return JNEXT.invoke(self.m_id, "stats");
+    };
+
+    self.transfers = function () {
+        return JNEXT.invoke(self.m_id, "transfers");
+    };
+
     self.getId = function () {
         return self.m_id;
     };
 
     self.onEvent = function (strData) {
-        var arData = strData.split(" ", 7),
+        var arData = strData.split(" ", 10),
             callbackId = arData[0],
             strEventDesc = arData[1],
             strEventResult = arData[2],
             result = resultObjs[callbackId],
             args = {};
 
+        // Progress keeps the callback for the final result
+        if (strEventResult === "progress") {
+            if (result) {
+                result.callbackOk({
+                    "result": strEventResult,
+                    "loaded": parseInt(arData[3], 10),
+                    "total": parseInt(arData[4], 10),
+                    "rate": parseInt(arData[5], 10)
+                }, true);
+            }
+            return;
+        }
+
         if (strEventDesc === "upload") {
             if (strEventResult === "success") {
                 args.result = strEventResult;
                 args.bytesSent = parseInt(arData[3], 10);
                 args.responseCode = parseInt(arData[4], 10);
-                args.response = escape(strData.split(" ").slice(5).join(" "));
+                args.digest = arData[5] === "-" ? null : arData[5];
+                args.responseSize = parseInt(arData[6], 10);
+                args.responseTruncated = arData[7] === "1";
+                args.response = escape(strData.split(" ").slice(8).join(" "));
             } else if (strEventResult === "error") {
                 args.result = strEventResult;
                 args.code = parseInt(arData[3], 10);
@@ -168,13 +418,50 @@ JNEXT.FileTransfer = function () {
                 args.target = unescape(arData[5]);
                 args.http_status = parseInt(arData[6], 10);
             }
+        } else if (strEventDesc === "uploadBatch") {
+            // parts has a code for each file, 0 for those that were sent
+            if (strEventResult === "success") {
+                args.result = strEventResult;
+                args.bytesSent = parseInt(arData[3], 10);
+                args.responseCode = parseInt(arData[4], 10);
+                args.parts = arData[5].split(",").map(function (code) {
+                    return parseInt(code, 10);
+                });
+                args.responseSize = parseInt(arData[6], 10);
+                args.responseTruncated = arData[7] === "1";
+                args.response = escape(strData.split(" ").slice(8).join(" "));
+            } else if (strEventResult === "error") {
+                args.result = strEventResult;
+                args.code = parseInt(arData[3], 10);
+                args.source = arData[4].split(",").map(unescape);
+                args.target = unescape(arData[5]);
+                args.http_status = parseInt(arData[6], 10);
+                args.parts = arData[7].split(",").map(function (code) {
+                    return parseInt(code, 10);
+                });
+            }
         } else if (strEventDesc === "download") {
             if (strEventResult === "success") {
                 args.result = strEventResult;
                 args.isFile = (arData[3] === "1" ? true : false);
                 args.isDirectory = (arData[4] === "1" ? true : false);
-                args.name = arData[5];
-                args.fullPath = escape(strData.split(" ").slice(6).join(" "));
+                args.cache = arData[5];
+                args.cacheHits = parseInt(arData[6], 10);
+                args.cacheMisses = parseInt(arData[7], 10);
+                args.digest = arData[8] === "-" ? null : arData[8];
+                args.name = arData[9];
+                args.fullPath = escape(strData.split(" ").slice(10).join(" "));
+            } else if (strEventResult === "data") {
+                // the body itself, base64 or a JSON string literal
+                args.result = "success";
+                args.responseCode = parseInt(arData[3], 10);
+                args.encoding = arData[4];
+                args.digest = arData[5] === "-" ? null : arData[5];
+                args.length = parseInt(arData[6], 10);
+                args.data = strData.split(" ").slice(7).join(" ");
+                if (args.encoding === "text") {
+                    args.data = JSON.parse(args.data);
+                }
             } else if (strEventResult === "error") {
                 args.result = strEventResult;
                 args.code = parseInt(arData[3], 10);
@@ -187,6 +474,7 @@ JNEXT.FileTransfer = function () {
             result.callbackOk(args, false);
             delete resultObjs[callbackId];
         }
+        delete transfers[callbackId];
     };
 
     self.init = function () {
@@ -11,12 +11,24 @@ include ../../../../../../meta.mk
 
 EXTRA_SRCVPATH+=../../../../../../ui.dialog/native
 
- SRCS+=filetransfer_curl.cpp \
+ SRCS+=filetransfer_cache.cpp \
+      filetransfer_compress.cpp \
+      filetransfer_context.cpp \
+      filetransfer_curl.cpp \
+      filetransfer_digest.cpp \
+      filetransfer_domains.cpp \
+      filetransfer_engine.cpp \
+      filetransfer_journal.cpp \
       filetransfer_js.cpp \
+      filetransfer_progress.cpp \
+      filetransfer_resume.cpp \
+      filetransfer_shaper.cpp \
+      filetransfer_sink.cpp \
+      filetransfer_source.cpp \
       ../../../../../../com.blackberry.ui.dialog/src/blackberry10/native/dialog_bps.cpp
 
 EXTRA_INCVPATH+=../../../../../../com.blackberry.ui.dialog/src/blackberry10/native
 
-LIBS+=bps curl
+LIBS+=bps curl crypto z
 
 include $(MKFILES_ROOT)/qtargets.mk
@@ -0,0 +1,393 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "filetransfer_cache.hpp"
+
+#include <curl/curl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+namespace webworks {
+
+DownloadCache *DownloadCache::s_instance = NULL;
+pthread_once_t DownloadCache::s_once = PTHREAD_ONCE_INIT;
+
+DownloadCache& DownloadCache::Instance()
+{
+    pthread_once(&s_once, createInstance);
+    return *s_instance;
+}
+
+void DownloadCache::createInstance()
+{
+    s_instance = new DownloadCache();
+}
+
+DownloadCache::DownloadCache() : m_capacity(0), m_size(0), m_loaded(false), m_hits(0), m_misses(0)
+{
+    pthread_mutex_init(&m_lock, NULL);
+
+    const char *home = getenv("HOME");
+    m_dir = std::string(home ? home : "") + "/downloadCache";
+}
+
+DownloadCache::~DownloadCache()
+{
+    // The cache lives as long as the process
+}
+
+void DownloadCache::SetCapacity(curl_off_t bytes)
+{
+    pthread_mutex_lock(&m_lock);
+    m_capacity = bytes;
+    if (m_loaded) {
+        evict(0);
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+bool DownloadCache::Lookup(const std::string& url, CacheValidators& validators)
+{
+    pthread_mutex_lock(&m_lock);
+    load();
+
+    const EntryMap::iterator it = m_entries.find(keyOf(url));
+    const bool found = it != m_entries.end() && it->second.url == url;
+    if (found) {
+        validators = it->second.validators;
+    }
+    pthread_mutex_unlock(&m_lock);
+
+    return found;
+}
+
+bool DownloadCache::Restore(const std::string& url, const std::string& target)
+{
+    pthread_mutex_lock(&m_lock);
+    load();
+
+    const std::string key = keyOf(url);
+    const EntryMap::iterator it = m_entries.find(key);
+    bool restored = false;
+
+    if (it != m_entries.end() && it->second.url == url) {
+        const std::string body = bodyPath(key);
+        const std::string temp = target + ".cache";
+        struct stat st;
+
+        // A target that was written to in place took the linked body with it
+        if (stat(body.c_str(), &st) != 0 || st.st_size != it->second.size || st.st_mtime != it->second.modified) {
+            drop(it);
+        } else {
+            remove(temp.c_str());
+            restored = shareFile(body, temp) && rename(temp.c_str(), target.c_str()) == 0;
+
+            // Renaming onto another link of the same file leaves both in place
+            remove(temp.c_str());
+
+            if (restored) {
+                touch(it);
+            }
+        }
+    }
+    pthread_mutex_unlock(&m_lock);
+
+    return restored;
+}
+
+void DownloadCache::Store(const std::string& url, const std::string& target, const CacheValidators& validators)
+{
+    struct stat st;
+    if ((validators.etag.empty() && validators.lastModified.empty()) || stat(target.c_str(), &st) != 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&m_lock);
+    load();
+
+    const std::string key = keyOf(url);
+    const EntryMap::iterator previous = m_entries.find(key);
+    if (previous != m_entries.end()) {
+        drop(previous);
+    }
+
+    if (st.st_size <= m_capacity && (mkdir(m_dir.c_str(), S_IRWXU) == 0 || errno == EEXIST)) {
+        evict(st.st_size);
+
+        const std::string body = bodyPath(key);
+        const std::string meta = metaPath(key);
+        const std::string temp = body + ".tmp";
+        struct stat stored;
+
+        // Linked bodies are never written to, a newer copy replaces them
+        remove(temp.c_str());
+        bool ok = shareFile(target, temp) && rename(temp.c_str(), body.c_str()) == 0 && stat(body.c_str(), &stored) == 0;
+
+        if (ok) {
+            FILE *file = fopen((meta + ".tmp").c_str(), "w");
+            ok = file != NULL;
+            if (ok) {
+                fprintf(file, "url %s\n", url.c_str());
+                fprintf(file, "etag %s\n", validators.etag.c_str());
+                fprintf(file, "modified %s\n", validators.lastModified.c_str());
+                fprintf(file, "size %" CURL_FORMAT_CURL_OFF_T "\n", static_cast<curl_off_t>(stored.st_size));
+                fprintf(file, "stored %ld\n", static_cast<long>(stored.st_mtime));
+                ok = !ferror(file);
+                ok = fclose(file) == 0 && ok;
+            }
+            ok = ok && rename((meta + ".tmp").c_str(), meta.c_str()) == 0;
+        }
+
+        if (ok) {
+            Entry& entry = m_entries[key];
+            entry.url = url;
+            entry.validators = validators;
+            entry.size = stored.st_size;
+            entry.modified = stored.st_mtime;
+            m_used.push_front(key);
+            entry.used = m_used.begin();
+            m_size += entry.size;
+        } else {
+            remove(temp.c_str());
+            remove(body.c_str());
+            remove((meta + ".tmp").c_str());
+        }
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+void DownloadCache::Count(bool hit)
+{
+    pthread_mutex_lock(&m_lock);
+    if (hit) {
+        m_hits++;
+    } else {
+        m_misses++;
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+void DownloadCache::Counters(long& hits, long& misses)
+{
+    pthread_mutex_lock(&m_lock);
+    hits = m_hits;
+    misses = m_misses;
+    pthread_mutex_unlock(&m_lock);
+}
+
+std::string DownloadCache::keyOf(const std::string& url)
+{
+    // 64-bit FNV-1a; entries remember their URL, so a clash is just a miss
+    unsigned long long hash = 14695981039346656037ULL;
+    for (std::string::size_type i = 0; i < url.length(); i++) {
+        hash ^= static_cast<unsigned char>(url[i]);
+        hash *= 1099511628211ULL;
+    }
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", hash);
+    return key;
+}
+
+bool DownloadCache::shareFile(const std::string& from, const std::string& to)
+{
+    if (cloneFile(from, to) || link(from.c_str(), to.c_str()) == 0) {
+        return true;
+    }
+
+    // Across file systems there is nothing to share
+    const int source = open(from.c_str(), O_RDONLY);
+    if (source < 0) {
+        return false;
+    }
+
+    const int copy = open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    bool ok = copy >= 0;
+    char buffer[64 * 1024];
+    ssize_t length;
+
+    while (ok && (length = read(source, buffer, sizeof(buffer))) != 0) {
+        ok = length > 0 && write(copy, buffer, length) == length;
+    }
+
+    if (copy >= 0) {
+        ok = close(copy) == 0 && ok;
+        if (!ok) {
+            remove(to.c_str());
+        }
+    }
+    close(source);
+
+    return ok;
+}
+
+bool DownloadCache::cloneFile(const std::string& from, const std::string& to)
+{
+#ifdef FICLONE
+    // A copy-on-write clone shares the data but not later writes to it
+    const int source = open(from.c_str(), O_RDONLY);
+    if (source < 0) {
+        return false;
+    }
+
+    const int clone = open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    bool ok = clone >= 0 && ioctl(clone, FICLONE, source) == 0;
+
+    if (clone >= 0) {
+        ok = close(clone) == 0 && ok;
+        if (!ok) {
+            remove(to.c_str());
+        }
+    }
+    close(source);
+
+    return ok;
+#else
+    (void)from;
+    (void)to;
+    return false;
+#endif
+}
+
+void DownloadCache::load()
+{
+    if (m_loaded) {
+        return;
+    }
+    m_loaded = true;
+
+    DIR *dir = opendir(m_dir.c_str());
+    if (!dir) {
+        return;
+    }
+
+    std::vector<std::pair<time_t, std::string> > byUse;
+    struct dirent *dirEntry;
+
+    while ((dirEntry = readdir(dir)) != NULL) {
+        const std::string name = dirEntry->d_name;
+        if (name.length() != 21 || name.compare(16, 5, ".meta") != 0) {
+            continue;
+        }
+
+        const std::string key = name.substr(0, 16);
+        std::ifstream meta(metaPath(key).c_str());
+        Entry entry;
+        std::string line;
+        bool haveSize = false;
+        long modified = -1;
+
+        while (std::getline(meta, line)) {
+            const std::string::size_type space = line.find(' ');
+            const std::string field = line.substr(0, space);
+            const std::string value = (space == std::string::npos) ? "" : line.substr(space + 1);
+
+            if (field == "url") {
+                entry.url = value;
+            } else if (field == "etag") {
+                entry.validators.etag = value;
+            } else if (field == "modified") {
+                entry.validators.lastModified = value;
+            } else if (field == "size") {
+                haveSize = sscanf(value.c_str(), "%" CURL_FORMAT_CURL_OFF_T, &entry.size) == 1;
+            } else if (field == "stored") {
+                modified = atol(value.c_str());
+            }
+        }
+
+        // Bodies are checked against what was stored, as the targets linked
+        // to them may have been written to while the application was closed
+        struct stat body;
+        struct stat used;
+        if (entry.url.empty() || keyOf(entry.url) != key || !haveSize || stat(bodyPath(key).c_str(), &body) != 0
+                || body.st_size != entry.size || body.st_mtime != modified || stat(metaPath(key).c_str(), &used) != 0) {
+            remove(metaPath(key).c_str());
+            remove(bodyPath(key).c_str());
+            continue;
+        }
+
+        entry.modified = body.st_mtime;
+        m_entries[key] = entry;
+        m_size += entry.size;
+        byUse.push_back(std::make_pair(used.st_mtime, key));
+    }
+
+    closedir(dir);
+
+    std::sort(byUse.begin(), byUse.end());
+    for (size_t i = 0; i < byUse.size(); i++) {
+        m_used.push_front(byUse[i].second);
+        m_entries[byUse[i].second].used = m_used.begin();
+    }
+
+    evict(0);
+}
+
+void DownloadCache::touch(EntryMap::iterator it)
+{
+    m_used.splice(m_used.begin(), m_used, it->second.used);
+
+    // Keeps the order of use across restarts
+    utimes(metaPath(it->first).c_str(), NULL);
+}
+
+void DownloadCache::evict(curl_off_t needed)
+{
+    while (!m_used.empty() && m_size + needed > m_capacity) {
+        drop(m_entries.find(m_used.back()));
+    }
+}
+
+void DownloadCache::drop(EntryMap::iterator it)
+{
+    remove(metaPath(it->first).c_str());
+    remove(bodyPath(it->first).c_str());
+
+    m_size -= it->second.size;
+    m_used.erase(it->second.used);
+    m_entries.erase(it);
+}
+
+std::string DownloadCache::bodyPath(const std::string& key) const
+{
+    return m_dir + "/" + key + ".body";
+}
+
+std::string DownloadCache::metaPath(const std::string& key) const
+{
+    return m_dir + "/" + key + ".meta";
+}
+
+} // namespace webworks
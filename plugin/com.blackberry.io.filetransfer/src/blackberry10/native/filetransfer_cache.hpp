@@ -0,0 +1,104 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FILETRANSFER_CACHE_H_
+#define FILETRANSFER_CACHE_H_
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <time.h>
+#include <list>
+#include <map>
+#include <string>
+
+namespace webworks {
+
+// What is needed to ask the server whether a cached copy is still current
+struct CacheValidators {
+    std::string etag;
+    std::string lastModified;
+};
+
+/*
+ * Downloads kept in $HOME/downloadCache for downloads that ask for it. Each
+ * URL has a "<key>.body" file, a hard link to (or copy of) the downloaded
+ * file, and a "<key>.meta" file with its validators, whose modification time
+ * records when the copy was last used. The least recently used copies are
+ * dropped once the cache outgrows its capacity.
+ */
+class DownloadCache {
+public:
+    static DownloadCache& Instance();
+
+    void SetCapacity(curl_off_t bytes);
+
+    // Validators of the copy of url; false if there is none
+    bool Lookup(const std::string& url, CacheValidators& validators);
+    // Puts the copy of url in place of target, preferably without copying
+    // the data; false if the copy is gone or was changed since
+    bool Restore(const std::string& url, const std::string& target);
+    // Keeps the downloaded target as the copy of url
+    void Store(const std::string& url, const std::string& target, const CacheValidators& validators);
+
+    // Downloads served from the cache, and those that could not be
+    void Count(bool hit);
+    void Counters(long& hits, long& misses);
+
+private:
+    struct Entry {
+        std::string url;
+        CacheValidators validators;
+        curl_off_t size;
+        // Of the body when it was stored; anything else means it was written to
+        time_t modified;
+        std::list<std::string>::iterator used;
+    };
+    typedef std::map<std::string, Entry> EntryMap;
+
+    DownloadCache();
+    ~DownloadCache();
+    explicit DownloadCache(DownloadCache const&);
+    void operator=(DownloadCache const&);
+
+    static void createInstance();
+    static std::string keyOf(const std::string& url);
+    static bool shareFile(const std::string& from, const std::string& to);
+    static bool cloneFile(const std::string& from, const std::string& to);
+    void load();
+    void touch(EntryMap::iterator it);
+    void evict(curl_off_t needed);
+    void drop(EntryMap::iterator it);
+    std::string bodyPath(const std::string& key) const;
+    std::string metaPath(const std::string& key) const;
+
+    std::string m_dir;
+    curl_off_t m_capacity;
+    curl_off_t m_size;
+    bool m_loaded;
+    EntryMap m_entries;
+    // Keys, most recently used first
+    std::list<std::string> m_used;
+    long m_hits;
+    long m_misses;
+    pthread_mutex_t m_lock;
+
+    static DownloadCache *s_instance;
+    static pthread_once_t s_once;
+};
+
+} // namespace webworks
+
+#endif // FILETRANSFER_CACHE_H_
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "filetransfer_compress.hpp"
+
+#include <string.h>
+#include <zlib.h>
+#include <string>
+#include <vector>
+
+namespace webworks {
+
+// Text compresses 5-7 times at any level; the higher levels only gain a few
+// percent for much more time, which slow phone CPUs cannot spare
+static const int COMPRESSION_LEVEL = 3;
+
+// Asks deflate for a gzip header and trailer instead of zlib ones
+static const int GZIP_WINDOW_BITS = MAX_WBITS + 16;
+
+CompressedBody::CompressedBody()
+    : m_open(false), m_source(NULL), m_part(DONE), m_maxRead(0), m_finished(false)
+{
+    memset(&m_stream, 0, sizeof(m_stream));
+}
+
+CompressedBody::~CompressedBody()
+{
+    Close();
+}
+
+bool CompressedBody::Open(UploadSource *source, const std::string& head, const std::string& tail)
+{
+    Close();
+
+    memset(&m_stream, 0, sizeof(m_stream));
+    if (deflateInit2(&m_stream, COMPRESSION_LEVEL, Z_DEFLATED, GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    m_open = true;
+    m_source = source;
+    m_head = head;
+    m_tail = tail;
+    m_input.resize(INPUT_SIZE);
+
+    return Rewind();
+}
+
+void CompressedBody::Close()
+{
+    if (m_open) {
+        deflateEnd(&m_stream);
+        m_open = false;
+    }
+
+    m_source = NULL;
+    std::vector<char>().swap(m_input);
+}
+
+bool CompressedBody::IsOpen() const
+{
+    return m_open;
+}
+
+void CompressedBody::SetMaxRead(size_t maxRead)
+{
+    m_maxRead = maxRead;
+}
+
+size_t CompressedBody::Read(char *buffer, size_t length)
+{
+    if (!m_open) {
+        return static_cast<size_t>(-1);
+    }
+
+    if (m_maxRead > 0 && length > m_maxRead) {
+        length = m_maxRead;
+    }
+
+    m_stream.next_out = reinterpret_cast<Bytef *>(buffer);
+    m_stream.avail_out = static_cast<uInt>(length);
+
+    while (m_stream.avail_out > 0 && !m_finished) {
+        if (m_stream.avail_in == 0 && m_part != DONE && !fillInput()) {
+            return static_cast<size_t>(-1);
+        }
+
+        const int status = deflate(&m_stream, m_part == DONE ? Z_FINISH : Z_NO_FLUSH);
+        if (status == Z_STREAM_END) {
+            m_finished = true;
+        } else if (status != Z_OK && status != Z_BUF_ERROR) {
+            return static_cast<size_t>(-1);
+        }
+    }
+
+    return length - m_stream.avail_out;
+}
+
+bool CompressedBody::Rewind()
+{
+    if (!m_open || deflateReset(&m_stream) != Z_OK || !m_source->Seek(0)) {
+        return false;
+    }
+
+    m_stream.next_in = NULL;
+    m_stream.avail_in = 0;
+    m_part = IN_HEAD;
+    m_finished = false;
+
+    return true;
+}
+
+// Points the stream at the next input there is; the file may be read in
+// many steps
+bool CompressedBody::fillInput()
+{
+    while (m_stream.avail_in == 0 && m_part != DONE) {
+        switch (m_part) {
+            case IN_HEAD:
+                m_stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(m_head.data()));
+                m_stream.avail_in = static_cast<uInt>(m_head.size());
+                m_part = IN_FILE;
+                break;
+            case IN_FILE: {
+                const size_t amount = m_source->Read(&m_input[0], m_input.size());
+                if (amount == static_cast<size_t>(-1)) {
+                    return false;
+                }
+                if (amount == 0) {
+                    m_part = IN_TAIL;
+                }
+                m_stream.next_in = reinterpret_cast<Bytef *>(&m_input[0]);
+                m_stream.avail_in = static_cast<uInt>(amount);
+                break;
+            }
+            case IN_TAIL:
+                m_stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(m_tail.data()));
+                m_stream.avail_in = static_cast<uInt>(m_tail.size());
+                m_part = DONE;
+                break;
+            default:
+                break;
+        }
+    }
+
+    return true;
+}
+
+} // namespace webworks
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FILETRANSFER_COMPRESS_H_
+#define FILETRANSFER_COMPRESS_H_
+
+#include <stddef.h>
+#include <zlib.h>
+#include <string>
+#include <vector>
+
+#include "filetransfer_source.hpp"
+
+namespace webworks {
+
+/*
+ * A request body made of a head, the file of an upload and a tail, gzip
+ * compressed while curl reads it. Nothing but a small input buffer is held
+ * in memory. The output only depends on the input, so a body can be sent
+ * again from the start, e.g. after a redirect.
+ */
+class CompressedBody {
+public:
+    CompressedBody();
+    ~CompressedBody();
+
+    // The source must stay open for as long as the body is read
+    bool Open(UploadSource *source, const std::string& head, const std::string& tail);
+    void Close();
+    bool IsOpen() const;
+
+    // Limits what one Read returns, e.g. to the size of an HTTP chunk; 0 for
+    // no limit
+    void SetMaxRead(size_t maxRead);
+    // Fills buffer with up to length compressed bytes; returns 0 at the end
+    // of the body and (size_t)-1 on error
+    size_t Read(char *buffer, size_t length);
+    // Starts the body over from its first byte
+    bool Rewind();
+
+private:
+    static const size_t INPUT_SIZE = 64 * 1024;
+
+    enum Part {
+        IN_HEAD,
+        IN_FILE,
+        IN_TAIL,
+        DONE
+    };
+
+    CompressedBody(CompressedBody const&);
+    void operator=(CompressedBody const&);
+
+    bool fillInput();
+
+    z_stream m_stream;
+    bool m_open;
+    UploadSource *m_source;
+    std::string m_head;
+    std::string m_tail;
+    Part m_part;
+    size_t m_maxRead;
+    bool m_finished;
+    std::vector<char> m_input;
+};
+
+} // namespace webworks
+
+#endif // FILETRANSFER_COMPRESS_H_
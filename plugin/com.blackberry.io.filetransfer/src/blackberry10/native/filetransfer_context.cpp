@@ -0,0 +1,136 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "filetransfer_context.hpp"
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+namespace webworks {
+
+TransferContext *TransferContext::s_instance = NULL;
+pthread_once_t TransferContext::s_once = PTHREAD_ONCE_INIT;
+
+TransferContext& TransferContext::Instance()
+{
+    pthread_once(&s_once, createInstance);
+    return *s_instance;
+}
+
+void TransferContext::createInstance()
+{
+    s_instance = new TransferContext();
+}
+
+TransferContext::TransferContext()
+{
+    // Not thread safe, which is why it only ever runs under pthread_once
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    pthread_mutex_init(&m_poolLock, NULL);
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&m_shareLocks[i], NULL);
+    }
+
+    m_share = curl_share_init();
+    if (m_share) {
+        curl_share_setopt(m_share, CURLSHOPT_LOCKFUNC, lockShare);
+        curl_share_setopt(m_share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+        curl_share_setopt(m_share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        // Connections are not shared: libcurl does not support that between
+        // threads, and the handles of the engine share the connections of
+        // its multi handle anyway
+    }
+}
+
+TransferContext::~TransferContext()
+{
+    // The context lives as long as the process; the handles may still be in
+    // use by detached transfer threads when the plugin is unloaded
+}
+
+CURL *TransferContext::AcquireHandle(const std::string& url)
+{
+    CURL *curl = NULL;
+
+    pthread_mutex_lock(&m_poolLock);
+    if (!m_idleHandles.empty()) {
+        curl = m_idleHandles.back();
+        m_idleHandles.pop_back();
+    }
+    pthread_mutex_unlock(&m_poolLock);
+
+    if (!curl) {
+        curl = curl_easy_init();
+    }
+
+    if (curl && m_share) {
+        curl_easy_setopt(curl, CURLOPT_SHARE, m_share);
+    }
+
+#if LIBCURL_VERSION_NUM >= 0x072f00
+    if (curl) {
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+        // Waits for a connection being set up rather than opening another,
+        // in case it can be shared. Only TLS connections may turn out to be
+        // HTTP/2; on the others curl would wait for the connection to be free
+        if (url.compare(0, 8, "https://") == 0 || url.compare(0, 8, "HTTPS://") == 0) {
+            curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+        }
+    }
+#endif
+
+    return curl;
+}
+
+void TransferContext::ReleaseHandle(CURL *curl)
+{
+    if (!curl) {
+        return;
+    }
+
+    // Clears the options but keeps the open connections of the handle
+    curl_easy_reset(curl);
+
+    pthread_mutex_lock(&m_poolLock);
+    if (m_idleHandles.size() < MAX_IDLE_HANDLES) {
+        m_idleHandles.push_back(curl);
+        curl = NULL;
+    }
+    pthread_mutex_unlock(&m_poolLock);
+
+    if (curl) {
+        curl_easy_cleanup(curl);
+    }
+}
+
+void TransferContext::lockShare(CURL *, curl_lock_data data, curl_lock_access, void *userptr)
+{
+    TransferContext *context = static_cast<TransferContext *>(userptr);
+    pthread_mutex_lock(&context->m_shareLocks[data]);
+}
+
+void TransferContext::unlockShare(CURL *, curl_lock_data data, void *userptr)
+{
+    TransferContext *context = static_cast<TransferContext *>(userptr);
+    pthread_mutex_unlock(&context->m_shareLocks[data]);
+}
+
+} // namespace webworks
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FILETRANSFER_CONTEXT_H_
+#define FILETRANSFER_CONTEXT_H_
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+namespace webworks {
+
+/*
+ * State shared by every transfer of the process: libcurl is initialized
+ * once, finished easy handles are kept for reuse together with their
+ * connections, and all handles share one DNS cache and TLS session cache.
+ * Servers that agree to HTTP/2 during the TLS handshake carry many transfers
+ * over one connection; the others are spoken to in HTTP/1.1 as before.
+ */
+class TransferContext {
+public:
+    static TransferContext& Instance();
+
+    // Returns a handle for url in its default state, attached to the shared
+    // caches and asking for HTTP/2 on TLS connections
+    CURL *AcquireHandle(const std::string& url);
+    // Hands a handle back for reuse; its options are reset
+    void ReleaseHandle(CURL *curl);
+
+private:
+    static const size_t MAX_IDLE_HANDLES = 8;
+
+    TransferContext();
+    ~TransferContext();
+    explicit TransferContext(TransferContext const&);
+    void operator=(TransferContext const&);
+
+    static void createInstance();
+    static void lockShare(CURL *curl, curl_lock_data data, curl_lock_access access, void *userptr);
+    static void unlockShare(CURL *curl, curl_lock_data data, void *userptr);
+
+    CURLSH *m_share;
+    pthread_mutex_t m_shareLocks[CURL_LOCK_DATA_LAST];
+    std::vector<CURL *> m_idleHandles;
+    pthread_mutex_t m_poolLock;
+
+    static TransferContext *s_instance;
+    static pthread_once_t s_once;
+};
+
+} // namespace webworks
+
+#endif // FILETRANSFER_CONTEXT_H_
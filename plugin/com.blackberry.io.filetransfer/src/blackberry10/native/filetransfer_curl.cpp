@@ -15,97 +15,221 @@
  */
 
 #include "filetransfer_curl.hpp"
+#include "filetransfer_context.hpp"
+#include "filetransfer_domains.hpp"
+#include "filetransfer_journal.hpp"
 
 #include <dialog_bps.hpp>
+#include <webworks_utils.hpp>
 #include <curl/curl.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <string>
 #include <vector>
 
 namespace webworks {
 
-FileTransferCurl::FileTransferCurl()
+// How often a failed download is tried again, and the delay before the first
+// retry; the delay doubles with every attempt
+static const int MAX_RETRIES = 3;
+static const int RETRY_DELAY_MS = 1000;
+
+// Bytes written to a .part file between two updates of its journal
+static const curl_off_t JOURNAL_INTERVAL = 4 * 1024 * 1024;
+
+// A download is abandoned when it stays below 1 byte/s for this long
+static const long STALL_TIMEOUT = 60;
+
+// Lets curl take large reads from an upload source
+static const long UPLOAD_BUFFER_SIZE = 512 * 1024;
+
+// The most taken for an upload response up front, whatever length the
+// server announces
+static const curl_off_t MAX_RESPONSE_RESERVE = 16 * 1024 * 1024;
+
+// Event strings are put together by hand rather than through a stream
+static void appendNumber(std::string& out, long long value)
 {
-    m_pVerifyMap = new DomainVerifyMap();
+    char digits[24];
+    snprintf(digits, sizeof(digits), "%lld", value);
+    out += digits;
+}
+
+// Saves the journal of a download once the data it vouches for is on disk,
+// see FileTransferCurl::checkpoint
+class JournalCheckpoint : public SinkCheckpoint {
+public:
+    JournalCheckpoint(const PartialDownload& partial, const std::string& target, const std::string& journalId)
+        : m_partial(partial), m_target(target), m_journalId(journalId)
+    {
+    }
+
+    virtual void Synced(bool ok)
+    {
+        if (ok && m_partial.Save(m_target) && !m_journalId.empty()) {
+            TransferJournal::Instance().Progress(m_journalId, m_partial.bytes);
+        }
+    }
 
-    curl_global_init(CURL_GLOBAL_ALL);
-    loadVerifyList();
+private:
+    const PartialDownload m_partial;
+    const std::string m_target;
+    const std::string m_journalId;
+};
+
+// The length of the request body curl sent, -1 if it was not known up front
+static curl_off_t uploadLength(CURL *curl)
+{
+#if LIBCURL_VERSION_NUM >= 0x073700
+    curl_off_t length = -1;
+    curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_UPLOAD_T, &length);
+    return length;
+#else
+    double length = -1;
+    curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_UPLOAD, &length);
+    return static_cast<curl_off_t>(length);
+#endif
 }
 
-FileTransferCurl::~FileTransferCurl()
+// Appends value as a JSON string literal; bytes from 0x80 up are taken to
+// be UTF-8 and passed through
+static void appendJsonString(std::string& out, const std::string& value)
 {
-    curl_global_cleanup();
+    static const char hex[] = "0123456789abcdef";
+
+    out += '"';
+    for (std::string::const_iterator it = value.begin(); it != value.end(); ++it) {
+        const unsigned char c = static_cast<unsigned char>(*it);
 
-    if (m_pVerifyMap) {
-        delete m_pVerifyMap;
+        switch (c) {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                if (c < 0x20) {
+                    out += "\\u00";
+                    out += hex[c >> 4];
+                    out += hex[c & 0xf];
+                } else {
+                    out += static_cast<char>(c);
+                }
+                break;
+        }
     }
+    out += '"';
 }
 
-std::string FileTransferCurl::parseDomain(const std::string &url)
+TransferJob::TransferJob(FileUploadInfo *info)
+    : pParent(info->pParent), eventId(info->eventId), priority(PRIORITY_NORMAL), uploadInfo(info), downloadInfo(NULL), curl(NULL),
+      formpost(NULL), headerlist(NULL), responseSize(0), responseFailed(false), host(FileTransferCurl::HostOf(info->targetURL)),
+      windowGroup(info->windowGroup), blockedDomain(false), skipVerify(false), prepared(false), answersSeen(0), journaled(0),
+      resumeFrom(0), rangeStart(-1), headerStatus(0), attempts(0), responseChecked(false), discardBody(false),
+      rangeRejected(false), segmentCount(1), minSegmentSize(0), probing(false), acceptRanges(false),
+      segment(NULL), useCache(false), revalidating(false), cacheHit(false), noStore(false)
 {
-    int index = std::string("https://").length();
-    return url.substr(index, url.substr(index, url.length()).find_first_of("/"));
+#if LIBCURL_VERSION_NUM >= 0x073800
+    mime = NULL;
+#endif
+    ParsePriority(info->priority, priority);
 }
 
-void FileTransferCurl::loadVerifyList()
+TransferJob::TransferJob(FileDownloadInfo *info)
+    : pParent(info->pParent), eventId(info->eventId), priority(PRIORITY_NORMAL), uploadInfo(NULL), downloadInfo(info), curl(NULL),
+      formpost(NULL), headerlist(NULL), responseSize(0), responseFailed(false), host(FileTransferCurl::HostOf(info->source)),
+      windowGroup(info->windowGroup), blockedDomain(false), skipVerify(false), prepared(false), answersSeen(0), journaled(0),
+      resumeFrom(0), rangeStart(-1), headerStatus(0), attempts(0), responseChecked(false), discardBody(false),
+      rangeRejected(false), segmentCount(info->segments), minSegmentSize(static_cast<curl_off_t>(info->minSegmentSize) * 1024),
+      probing(false), acceptRanges(false), segment(NULL), useCache(false), revalidating(false), cacheHit(false),
+      noStore(false)
 {
-    std::string fname = std::getenv("HOME");
-    fname.append("/verifiedDomainList");
+#if LIBCURL_VERSION_NUM >= 0x073800
+    mime = NULL;
+#endif
+    ParsePriority(info->priority, priority);
+}
 
-    std::string line;
-    std::ifstream domainList(fname.c_str());
+TransferJob::~TransferJob()
+{
+    for (std::vector<UploadSource *>::iterator it = batch.begin(); it != batch.end(); ++it) {
+        delete *it;
+    }
+    delete uploadInfo;
+    delete downloadInfo;
+    delete segment;
+}
 
-    if (domainList.is_open()) {
-        while (domainList.good()) {
-            std::string accessLine;
-            std::string strDomain;
-            std::string strAllowed;
+SegmentedDownload::SegmentedDownload(int fd, const std::string& url, curl_off_t length, int count)
+    : fd(fd), url(url), remaining(count), failed(false), length(length), received(0)
+{
+    pthread_mutex_init(&lock, NULL);
+}
 
-            std::getline(domainList, accessLine);
+SegmentedDownload::~SegmentedDownload()
+{
+    pthread_mutex_destroy(&lock);
+}
 
-            int index = accessLine.find_first_of(",");
+DownloadSegment::DownloadSegment(SegmentedDownload *download, curl_off_t start, curl_off_t end)
+    : download(download), start(start), end(end), done(0)
+{
+}
 
-            strDomain = accessLine.substr(0, index);
-            strAllowed = accessLine.substr(index + 1, accessLine.length());
+FileTransferCurl::FileTransferCurl()
+{
+    // Initializes libcurl on first use
+    TransferContext::Instance();
+}
 
-            if (!strDomain.empty()) {
-                m_pVerifyMap->insert(DomainVerifyMap::value_type(strDomain, static_cast<bool>(std::atoi(strAllowed.c_str()))));
-            }
-        }
+FileTransferCurl::~FileTransferCurl()
+{
+}
 
-        domainList.close();
-    }
+std::string FileTransferCurl::parseDomain(const std::string &url)
+{
+    int index = std::string("https://").length();
+    return url.substr(index, url.substr(index, url.length()).find_first_of("/"));
 }
 
-void FileTransferCurl::saveVerifyList()
+std::string FileTransferCurl::HostOf(const std::string& url)
 {
-    DomainVerifyMap::iterator it;
-    std::string fname = std::getenv("HOME");
-    fname.append("/verifiedDomainList");
+    std::string::size_type start = url.find("://");
+    start = (start == std::string::npos) ? 0 : start + 3;
 
-    if (m_pVerifyMap->size() > 0)
-    {
-        std::ofstream domainList(fname.c_str());
-        if (domainList.is_open()) {
-            for (it = m_pVerifyMap->begin(); it != m_pVerifyMap->end(); it++) {
-                domainList << it->first << "," << it->second << std::endl;
-            }
+    const std::string::size_type end = url.find_first_of("/?#", start);
+    std::string host = url.substr(start, end == std::string::npos ? std::string::npos : end - start);
 
-            domainList.close();
-        }
+    const std::string::size_type credentials = host.find_last_of('@');
+    if (credentials != std::string::npos) {
+        host.erase(0, credentials + 1);
     }
+
+    return host;
 }
 
-CURLcode FileTransferCurl::openDialog(CURL *curl, const std::string &windowGroup, const std::string &parsedDomain)
+int FileTransferCurl::openDialog(const std::string &windowGroup, const std::string &parsedDomain)
 {
     DialogConfig *dialogConfig = new DialogConfig();
     DialogBPS *dialog = new DialogBPS();
@@ -118,8 +242,6 @@ CURLcode FileTransferCurl::openDialog(CURL *curl, const std::string &windowGroup
 
     int button = dialog->Show(dialogConfig);
 
-    CURLcode result = CURLE_OK;
-
     if (dialogConfig) {
         delete dialogConfig;
     }
@@ -128,391 +250,1915 @@ CURLcode FileTransferCurl::openDialog(CURL *curl, const std::string &windowGroup
         delete dialog;
     }
 
+    return button;
+}
+
+bool FileTransferCurl::NeedsCertificatePrompt(TransferJob *job, CURLcode result)
+{
+    // Without verification, or without an owner whose window could show the
+    // dialog, there is nothing a prompt could change
+    return result == CURLE_SSL_CACERT && !job->blockedDomain && !job->skipVerify && job->pParent != NULL;
+}
+
+bool FileTransferCurl::PromptCertificate(TransferJob *job)
+{
+    if (!AskCertificate(job->windowGroup, job->parsedDomain)) {
+        return false;
+    }
+
+    AcceptCertificate(job);
+    return true;
+}
+
+bool FileTransferCurl::AskCertificate(const std::string& windowGroup, const std::string& domain)
+{
+    const int button = openDialog(windowGroup, domain);
+    bool accepted = false;
+
     switch (button) {
         case 0:
         case 1:
-            // restart transfer
-            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-            result = curl_easy_perform(curl);
-            if (button == 0)
-                break;
-            m_pVerifyMap->insert(DomainVerifyMap::value_type(parsedDomain, true));
+            accepted = true;
+            if (button == 1) {
+                DomainPolicy::Instance().Remember(domain, true);
+            }
             break;
         case 2:
             break;
         case 3:
-            m_pVerifyMap->insert(DomainVerifyMap::value_type(parsedDomain, false));
+            DomainPolicy::Instance().Remember(domain, false);
             break;
         default:
             break;
     }
-    saveVerifyList();
 
-    return result;
+    return accepted;
 }
 
-std::string FileTransferCurl::Upload(FileUploadInfo *uploadInfo)
+void FileTransferCurl::AcceptCertificate(TransferJob *job)
 {
-    CURL *curl = NULL;
-    CURLcode result;
-    std::string result_string;
-
-    struct curl_httppost *formpost = NULL;
-    struct curl_httppost *lastptr = NULL;
-    struct curl_slist *headerlist = NULL;
+    // Start over without verification; nothing was received yet
+    job->response.clear();
+    job->responseSize = 0;
+    if (job->uploadInfo && job->sink.IsOpen()) {
+        job->sink.Truncate(0);
+    }
+    job->skipVerify = true;
+    if (job->segment) {
+        requestSegment(job);
+    } else if (job->probing) {
+        // Still only asking for the headers
+    } else if (job->downloadInfo) {
+        requestRange(job);
+    } else if (job->body.IsOpen()) {
+        job->body.Rewind();
+    } else {
+        job->source.Seek(0);
+        for (std::vector<UploadSource *>::iterator it = job->batch.begin(); it != job->batch.end(); ++it) {
+            if (*it) {
+                (*it)->Seek(0);
+            }
+        }
+    }
+    curl_easy_setopt(job->curl, CURLOPT_SSL_VERIFYPEER, 0L);
+}
 
-    FILE *upload_file = NULL;
+void FileTransferCurl::checkDomain(TransferJob *job, const std::string& url)
+{
+    job->parsedDomain = parseDomain(url);
 
-    std::string source_escaped(curl_easy_escape(curl, curl_easy_escape(curl, uploadInfo->sourceFile.c_str(), 0), 0));
-    std::string target_escaped(curl_easy_escape(curl, curl_easy_escape(curl, uploadInfo->targetURL.c_str(), 0), 0));
+    bool allowed = false;
+    if (DomainPolicy::Instance().Lookup(job->parsedDomain, allowed)) {
+        if (allowed) {
+            job->skipVerify = true;
+        } else {
+            job->blockedDomain = true;
+        }
+    }
 
-    int http_status = 0;
+    if (job->skipVerify) {
+        curl_easy_setopt(job->curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    }
+}
 
-    // Initialize the easy interface for curl
-    curl = curl_easy_init();
-    if (!curl) {
-        return buildUploadErrorString(CONNECTION_ERR, source_escaped, target_escaped, http_status);
+void FileTransferCurl::describe(TransferJob *job)
+{
+    if (job->downloadInfo) {
+        job->sourceEscaped = escape(job->downloadInfo->source);
+        job->targetEscaped = escape(job->downloadInfo->target);
+        return;
     }
 
-    // Set up the form and fill in the file upload fields
-    if (uploadInfo->chunkedMode) {
-        upload_file = fopen(uploadInfo->sourceFile.c_str(), "r");
+    FileUploadInfo *uploadInfo = job->uploadInfo;
+    job->sourceEscaped = escape(uploadInfo->sourceFile);
+    job->targetEscaped = escape(uploadInfo->targetURL);
 
-        if (!upload_file) {
-            return buildUploadErrorString(FILE_NOT_FOUND_ERR, source_escaped, target_escaped, http_status);
+    // Batches list all their files, escaped one by one
+    if (!uploadInfo->files.empty()) {
+        job->sourceEscaped.clear();
+        for (std::vector<BatchFile>::const_iterator it = uploadInfo->files.begin(); it != uploadInfo->files.end(); ++it) {
+            job->sourceEscaped += (it == uploadInfo->files.begin() ? "" : ",") + escape(it->filePath);
         }
+    }
+}
 
-        // Find the file size
-        fseek(upload_file, 0L, SEEK_END);
-        int file_size = ftell(upload_file);
-        rewind(upload_file);
+std::string FileTransferCurl::escape(const std::string& value)
+{
+    // Escaped twice, the JavaScript side unescapes once more after splitting
+    char *once = curl_easy_escape(NULL, value.c_str(), 0);
+    char *twice = curl_easy_escape(NULL, once ? once : "", 0);
+    std::string escaped(twice ? twice : "");
 
-        uploadAttributes uploadAtt;
+    curl_free(once);
+    curl_free(twice);
 
-        uploadAtt.file = upload_file;
-        uploadAtt.max_chunk_size = uploadInfo->chunkSize;
+    return escaped;
+}
 
-        curl_formadd(&formpost,
-                     &lastptr,
-                     CURLFORM_STREAM, &uploadAtt,
-                     CURLFORM_CONTENTSLENGTH, file_size,
-                     CURLFORM_COPYNAME, uploadInfo->fileKey.c_str(),
-                     CURLFORM_FILENAME, uploadInfo->fileName.c_str(),
-                     CURLFORM_CONTENTTYPE, uploadInfo->mimeType.c_str(),
-                     CURLFORM_END);
-    } else {
-        curl_formadd(&formpost,
-                     &lastptr,
-                     CURLFORM_FILE, uploadInfo->sourceFile.c_str(),
-                     CURLFORM_COPYNAME, uploadInfo->fileKey.c_str(),
-                     CURLFORM_FILENAME, uploadInfo->fileName.c_str(),
-                     CURLFORM_CONTENTTYPE, uploadInfo->mimeType.c_str(),
-                     CURLFORM_END);
+std::string FileTransferCurl::formName(const std::string& value)
+{
+    // Quotes and line breaks would end the header early
+    std::string escaped;
+
+    for (std::string::const_iterator it = value.begin(); it != value.end(); ++it) {
+        switch (*it) {
+            case '"':
+                escaped += "%22";
+                break;
+            case '\r':
+                escaped += "%0D";
+                break;
+            case '\n':
+                escaped += "%0A";
+                break;
+            default:
+                escaped += *it;
+                break;
+        }
     }
 
-    if (uploadInfo->params.size() > 0) {
-        std::vector<std::string>::const_iterator it;
+    return escaped;
+}
 
-        for (it = uploadInfo->params.begin(); it < uploadInfo->params.end(); it++) {
-            const char *key = it->c_str();
-            it++;
-            const char *value = it->c_str();
+std::string FileTransferCurl::makeBoundary()
+{
+    unsigned char random[12];
+    const int fd = open("/dev/urandom", O_RDONLY);
+    const bool filled = fd >= 0 && read(fd, random, sizeof(random)) == static_cast<ssize_t>(sizeof(random));
 
-            curl_formadd(&formpost,
-                         &lastptr,
-                         CURLFORM_COPYNAME, key,
-                         CURLFORM_COPYCONTENTS, value,
-                         CURLFORM_END);
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    if (!filled) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        unsigned long seed = static_cast<unsigned long>(ts.tv_sec) ^ static_cast<unsigned long>(ts.tv_nsec) ^ getpid();
+        for (size_t i = 0; i < sizeof(random); i++) {
+            seed = seed * 1103515245 + 12345;
+            random[i] = static_cast<unsigned char>(seed >> 16);
         }
     }
 
+    char boundary[64] = "------------------------";
+    const size_t prefix = strlen(boundary);
+    for (size_t i = 0; i < sizeof(random); i++) {
+        snprintf(boundary + prefix + 2 * i, 3, "%02x", random[i]);
+    }
+
+    return boundary;
+}
+
+void FileTransferCurl::acceptEncodings(CURL *curl, bool accept)
+{
+    // An empty list offers every encoding this libcurl can decode
+#if LIBCURL_VERSION_NUM >= 0x071506
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, accept ? "" : static_cast<const char *>(NULL));
+#else
+    curl_easy_setopt(curl, CURLOPT_ENCODING, accept ? "" : static_cast<const char *>(NULL));
+#endif
+}
+
+FileTransferErrorCodes FileTransferCurl::errorCode(CURLcode result)
+{
+    switch (result)
+    {
+        case CURLE_READ_ERROR:
+        case CURLE_FILE_COULDNT_READ_FILE:
+            return FILE_NOT_FOUND_ERR;
+        case CURLE_URL_MALFORMAT:
+            return INVALID_URL_ERR;
+        default:
+            return CONNECTION_ERR;
+    }
+}
+
+bool FileTransferCurl::Prepare(TransferJob *job)
+{
+    job->prepared = true;
+
+    if (job->uploadInfo) {
+        return prepareUpload(job);
+    }
+
+    return job->segment ? prepareSegment(job) : prepareDownload(job);
+}
+
+bool FileTransferCurl::prepareUpload(TransferJob *job)
+{
+    FileUploadInfo *uploadInfo = job->uploadInfo;
+
+    describe(job);
+
+    // Get a handle, reusing the connections of previous transfers
+    job->curl = TransferContext::Instance().AcquireHandle(uploadInfo->targetURL);
+    if (!job->curl) {
+        job->result = uploadError(job, CONNECTION_ERR, 0);
+        return false;
+    }
+
+    const size_t chunkSize = uploadInfo->chunkedMode && uploadInfo->chunkSize > 0 ? uploadInfo->chunkSize : 0;
+    const bool prepared = uploadInfo->files.empty() ? prepareFile(job, chunkSize) : prepareBatch(job, chunkSize);
+
+    if (!prepared) {
+        release(job);
+        return false;
+    }
+
+    // The response body goes to a file of its own, buffered and put in
+    // place like a download
+    if (!uploadInfo->responseFile.empty() && !job->sink.Open(PartialDownload::PartPath(uploadInfo->responseFile), true)) {
+        job->result = uploadError(job, PERMISSIONS_ERR, 0);
+        release(job);
+        return false;
+    }
+
     // Set up the headers
-    headerlist = curl_slist_append(headerlist, "Expect:");
+    job->headerlist = curl_slist_append(job->headerlist, "Expect:");
 
-    if (uploadInfo->chunkedMode) {
-        headerlist = curl_slist_append(headerlist, "Transfer-Encoding: chunked");
+    // A compressed body has no length until all of it was sent
+    if (uploadInfo->chunkedMode || (uploadInfo->compress && uploadInfo->files.empty())) {
+        job->headerlist = curl_slist_append(job->headerlist, "Transfer-Encoding: chunked");
     }
 
     // Set up the callbacks
-    std::string write_data;
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, static_cast<void *>(&write_data));
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, UploadWriteCallback);
+    curl_easy_setopt(job->curl, CURLOPT_WRITEDATA, static_cast<void *>(job));
+    curl_easy_setopt(job->curl, CURLOPT_WRITEFUNCTION, UploadWriteCallback);
 
-    if (uploadInfo->chunkedMode) {
-        curl_easy_setopt(curl, CURLOPT_READFUNCTION, UploadReadCallback);
-    }
+#if LIBCURL_VERSION_NUM >= 0x073e00
+    curl_easy_setopt(job->curl, CURLOPT_UPLOAD_BUFFERSIZE, UPLOAD_BUFFER_SIZE);
+#endif
 
     // Allow redirects
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
-    curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
+    curl_easy_setopt(job->curl, CURLOPT_FOLLOWLOCATION, 1);
+    curl_easy_setopt(job->curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
 
-    // Attach the different components
-    curl_easy_setopt(curl, CURLOPT_HTTPPOST, formpost);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headerlist);
-    curl_easy_setopt(curl, CURLOPT_URL, uploadInfo->targetURL.c_str());
+    acceptEncodings(job->curl, true);
+    curl_easy_setopt(job->curl, CURLOPT_HTTPHEADER, job->headerlist);
+    curl_easy_setopt(job->curl, CURLOPT_URL, uploadInfo->targetURL.c_str());
+    curl_easy_setopt(job->curl, CURLOPT_PRIVATE, job);
 
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1);
+    curl_easy_setopt(job->curl, CURLOPT_SSL_VERIFYPEER, 1);
 
     // Check domain
-    bool blockedDomain = false;
-    const std::string parsedDomain(parseDomain(uploadInfo->targetURL.c_str()));
-    const DomainVerifyMap::iterator findDomain = m_pVerifyMap->find(parsedDomain);
+    checkDomain(job, uploadInfo->targetURL);
 
-    if (findDomain != m_pVerifyMap->end()) {
-        if (findDomain->second) {
-            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-        } else {
-            blockedDomain = true;
-        }
+    watchProgress(job, uploadInfo->progressInterval, uploadInfo->progressStep);
+
+    return true;
+}
+
+bool FileTransferCurl::prepareFile(TransferJob *job, size_t chunkSize)
+{
+    FileUploadInfo *uploadInfo = job->uploadInfo;
+
+    // The file is read through a memory mapping; in chunked mode each read
+    // makes one chunk
+    if (!job->source.Open(uploadInfo->sourceFile)) {
+        job->result = buildUploadErrorString(FILE_NOT_FOUND_ERR, job->sourceEscaped, job->targetEscaped, 0);
+        return false;
     }
 
-    // Perform file transfer (blocking)
-    result = curl_easy_perform(curl);
+    // The file is hashed as it is read
+    if (!uploadInfo->digest.empty()) {
+        if (!job->digest.Configure(uploadInfo->digest)) {
+            job->result = buildUploadErrorString(INTEGRITY_ERR, job->sourceEscaped, job->targetEscaped, 0);
+            return false;
+        }
+        job->source.SetDigest(&job->digest);
+    }
 
-    if (result == CURLE_SSL_CACERT) {
-        if (!blockedDomain) {
-            result = openDialog(curl, uploadInfo->windowGroup, parsedDomain);
+    if (uploadInfo->compress) {
+        // The multipart body is put together here so it can be compressed
+        // as a whole
+        if (!prepareCompressed(job, chunkSize)) {
+            job->result = buildUploadErrorString(FILE_NOT_FOUND_ERR, job->sourceEscaped, job->targetEscaped, 0);
+            return false;
         }
+    } else {
+        job->source.SetMaxRead(chunkSize);
+        prepareForm(job);
     }
 
-    if (result == CURLE_OK) {
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_status);
-        if (http_status >= 200 && http_status < 300) {
-            double bytes_sent;
-            curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_UPLOAD, &bytes_sent);
+    return true;
+}
 
-            result_string = buildUploadSuccessString(bytes_sent, http_status, write_data);
-        } else if (http_status == 404) {
-            result_string = buildUploadErrorString(INVALID_URL_ERR, source_escaped, target_escaped, http_status);
+bool FileTransferCurl::prepareBatch(TransferJob *job, size_t chunkSize)
+{
+    FileUploadInfo *uploadInfo = job->uploadInfo;
+    std::vector<BatchFile>& files = uploadInfo->files;
+    bool opened = false;
+
+    // Every file is streamed from a mapping of its own, like a single upload.
+    // Those that cannot be opened are left out of the request and reported
+    // in its result.
+    for (std::vector<BatchFile>::iterator it = files.begin(); it != files.end(); ++it) {
+        if (it->fileKey.empty()) {
+            it->fileKey = uploadInfo->fileKey;
+        }
+        if (it->fileName.empty()) {
+            it->fileName = it->filePath.substr(it->filePath.find_last_of('/') + 1);
+        }
+        if (it->mimeType.empty()) {
+            it->mimeType = uploadInfo->mimeType;
+        }
+
+        UploadSource *source = new UploadSource();
+        if (source->Open(it->filePath)) {
+            source->SetMaxRead(chunkSize);
+            opened = true;
         } else {
-            result_string = buildUploadErrorString(CONNECTION_ERR, source_escaped, target_escaped, http_status);
+            delete source;
+            source = NULL;
         }
+        job->batch.push_back(source);
+    }
+
+    if (!opened) {
+        job->result = buildBatchErrorString(FILE_NOT_FOUND_ERR, job->sourceEscaped, job->targetEscaped, 0, batchParts(job, 0));
+        return false;
+    }
+
+    prepareForm(job);
+
+    return true;
+}
+
+void FileTransferCurl::prepareForm(TransferJob *job)
+{
+    FileUploadInfo *uploadInfo = job->uploadInfo;
+    struct curl_httppost *lastptr = NULL;
+
+#if LIBCURL_VERSION_NUM >= 0x073800
+    job->mime = curl_mime_init(job->curl);
+#endif
+
+    if (uploadInfo->files.empty()) {
+        addFilePart(job, &job->source, uploadInfo->sourceFile, uploadInfo->fileKey, uploadInfo->fileName, uploadInfo->mimeType, &lastptr);
     } else {
-        FileTransferErrorCodes error_code;
-        switch (result)
-        {
-            case CURLE_READ_ERROR:
-            case CURLE_FILE_COULDNT_READ_FILE:
-                error_code = FILE_NOT_FOUND_ERR;
-                break;
-            case CURLE_URL_MALFORMAT:
-                error_code = INVALID_URL_ERR;
-                break;
-            default:
-                error_code = CONNECTION_ERR;
-                break;
+        for (size_t i = 0; i < uploadInfo->files.size(); i++) {
+            const BatchFile& file = uploadInfo->files[i];
+            if (job->batch[i]) {
+                addFilePart(job, job->batch[i], file.filePath, file.fileKey, file.fileName, file.mimeType, &lastptr);
+            }
         }
+    }
+
+#if LIBCURL_VERSION_NUM >= 0x073800
+    std::map<std::string, std::string>::const_iterator it;
+    for (it = uploadInfo->params.begin(); it != uploadInfo->params.end(); it++) {
+        curl_mimepart *part = curl_mime_addpart(job->mime);
+        curl_mime_name(part, it->first.c_str());
+        curl_mime_data(part, it->second.c_str(), CURL_ZERO_TERMINATED);
+    }
+#else
+    if (uploadInfo->params.size() > 0) {
+        std::map<std::string, std::string>::const_iterator it;
 
-        result_string = buildUploadErrorString(error_code, source_escaped, target_escaped, http_status);
+        for (it = uploadInfo->params.begin(); it != uploadInfo->params.end(); it++) {
+            curl_formadd(&job->formpost,
+                         &lastptr,
+                         CURLFORM_COPYNAME, it->first.c_str(),
+                         CURLFORM_COPYCONTENTS, it->second.c_str(),
+                         CURLFORM_END);
+        }
     }
+#endif
 
-    // Clean up
+#if LIBCURL_VERSION_NUM < 0x073800
     if (uploadInfo->chunkedMode) {
-        fclose(upload_file);
+        curl_easy_setopt(job->curl, CURLOPT_READFUNCTION, UploadReadCallback);
     }
+#endif
 
-    curl_easy_cleanup(curl);
-    curl_formfree(formpost);
-    curl_slist_free_all(headerlist);
+    // Attach the different components
+#if LIBCURL_VERSION_NUM >= 0x073800
+    curl_easy_setopt(job->curl, CURLOPT_MIMEPOST, job->mime);
+#else
+    curl_easy_setopt(job->curl, CURLOPT_HTTPPOST, job->formpost);
+#endif
+}
 
-    return result_string;
+void FileTransferCurl::addFilePart(TransferJob *job, UploadSource *source, const std::string& path, const std::string& key,
+                                   const std::string& name, const std::string& type, struct curl_httppost **lastptr)
+{
+#if LIBCURL_VERSION_NUM >= 0x073800
+    (void)path;
+    (void)lastptr;
+
+    curl_mimepart *part = curl_mime_addpart(job->mime);
+    curl_mime_name(part, key.c_str());
+    curl_mime_filename(part, name.c_str());
+    curl_mime_type(part, type.c_str());
+    curl_mime_data_cb(part, source->Size(), UploadReadCallback, UploadSeekCallback, NULL, source);
+#else
+    // Streamed form parts cannot be rewound before libcurl 7.56, which a
+    // redirect of a non-chunked upload needs, so curl reads those itself
+    if (job->uploadInfo->chunkedMode) {
+        curl_formadd(&job->formpost,
+                     lastptr,
+                     CURLFORM_STREAM, source,
+                     CURLFORM_CONTENTSLENGTH, static_cast<long>(source->Size()),
+                     CURLFORM_COPYNAME, key.c_str(),
+                     CURLFORM_FILENAME, name.c_str(),
+                     CURLFORM_CONTENTTYPE, type.c_str(),
+                     CURLFORM_END);
+    } else {
+        curl_formadd(&job->formpost,
+                     lastptr,
+                     CURLFORM_FILE, path.c_str(),
+                     CURLFORM_COPYNAME, key.c_str(),
+                     CURLFORM_FILENAME, name.c_str(),
+                     CURLFORM_CONTENTTYPE, type.c_str(),
+                     CURLFORM_END);
+    }
+#endif
 }
 
-std::string FileTransferCurl::Download(FileDownloadInfo *downloadInfo)
+bool FileTransferCurl::prepareCompressed(TransferJob *job, size_t chunkSize)
 {
-    CURL *curl = NULL;
-    FILE *fp = NULL;
-    CURLcode result;
-    std::string result_string;
-    bool error = 0;
-    int http_status = 0;
+    FileUploadInfo *uploadInfo = job->uploadInfo;
+    const std::string boundary = makeBoundary();
+
+    // The same parts curl would send, file first
+    std::string head = "--" + boundary + "\r\n";
+    head += "Content-Disposition: form-data; name=\"" + formName(uploadInfo->fileKey)
+        + "\"; filename=\"" + formName(uploadInfo->fileName) + "\"\r\n";
+    head += "Content-Type: " + uploadInfo->mimeType + "\r\n\r\n";
+
+    std::string tail = "\r\n";
+    std::map<std::string, std::string>::const_iterator it;
+    for (it = uploadInfo->params.begin(); it != uploadInfo->params.end(); it++) {
+        tail += "--" + boundary + "\r\n";
+        tail += "Content-Disposition: form-data; name=\"" + formName(it->first) + "\"\r\n\r\n";
+        tail += it->second + "\r\n";
+    }
+    tail += "--" + boundary + "--\r\n";
+
+    if (!job->body.Open(&job->source, head, tail)) {
+        return false;
+    }
+    job->body.SetMaxRead(chunkSize);
+
+    const std::string contentType = "Content-Type: multipart/form-data; boundary=" + boundary;
+    job->headerlist = curl_slist_append(job->headerlist, contentType.c_str());
+    job->headerlist = curl_slist_append(job->headerlist, "Content-Encoding: gzip");
+
+    curl_easy_setopt(job->curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(job->curl, CURLOPT_READFUNCTION, CompressedReadCallback);
+    curl_easy_setopt(job->curl, CURLOPT_READDATA, &job->body);
+    curl_easy_setopt(job->curl, CURLOPT_SEEKFUNCTION, CompressedSeekCallback);
+    curl_easy_setopt(job->curl, CURLOPT_SEEKDATA, &job->body);
+
+    return true;
+}
 
-    const char *source = (downloadInfo->source).c_str();
-    const char *target = (downloadInfo->target).c_str();
+bool FileTransferCurl::prepareDownload(TransferJob *job)
+{
+    FileDownloadInfo *downloadInfo = job->downloadInfo;
 
-    std::string source_escaped(curl_easy_escape(curl, curl_easy_escape(curl, source, 0), 0));
-    std::string target_escaped(curl_easy_escape(curl, curl_easy_escape(curl, target, 0), 0));
+    describe(job);
 
-    const char *targetDir = downloadInfo->target.substr(0, downloadInfo->target.find_last_of('/')).c_str();
+    const std::string targetDir = downloadInfo->target.substr(0, downloadInfo->target.find_last_of('/'));
 
     // Check if target directory exists with write permissions
-    if (access(targetDir, R_OK)) {
-        if (mkdir_p(targetDir, S_IRWXU | S_IRWXG)) {
-            return buildDownloadErrorString(PERMISSIONS_ERR, source_escaped, target_escaped, http_status);
+    if (downloadInfo->memory.empty() && access(targetDir.c_str(), R_OK)) {
+        if (mkdir_p(targetDir.c_str(), S_IRWXU | S_IRWXG)) {
+            job->result = buildDownloadErrorString(PERMISSIONS_ERR, job->sourceEscaped, job->targetEscaped, 0);
+            return false;
         }
     }
 
-    curl = curl_easy_init();
+    job->curl = TransferContext::Instance().AcquireHandle(downloadInfo->source);
 
-    if (!curl) {
-        return buildDownloadErrorString(CONNECTION_ERR, source_escaped, target_escaped, http_status);
+    if (!job->curl) {
+        job->result = buildDownloadErrorString(CONNECTION_ERR, job->sourceEscaped, job->targetEscaped, 0);
+        return false;
     }
 
-    fp = fopen(target, "wb");
-    curl_easy_setopt(curl, CURLOPT_URL, source);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, DownloadWriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
+    curl_easy_setopt(job->curl, CURLOPT_URL, downloadInfo->source.c_str());
+    curl_easy_setopt(job->curl, CURLOPT_HEADERFUNCTION, DownloadHeaderCallback);
+    curl_easy_setopt(job->curl, CURLOPT_HEADERDATA, job);
+    curl_easy_setopt(job->curl, CURLOPT_PRIVATE, job);
+
+    // Give up on connections that stop delivering data, so they can be retried
+    curl_easy_setopt(job->curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(job->curl, CURLOPT_LOW_SPEED_TIME, STALL_TIMEOUT);
 
     // Allow redirects
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+    curl_easy_setopt(job->curl, CURLOPT_FOLLOWLOCATION, 1);
 
     // Check domain
-    bool blockedDomain = false;
-    const std::string parsedDomain(parseDomain(downloadInfo->source.c_str()));
-    const DomainVerifyMap::iterator findDomain = m_pVerifyMap->find(parsedDomain);
-
-    if (findDomain != m_pVerifyMap->end()) {
-        if (findDomain->second) {
-            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-        } else {
-            blockedDomain = true;
+    checkDomain(job, downloadInfo->source);
+
+    // Ranges arrive out of order, so a download that is hashed on the way
+    // has to be a single stream
+    if (!downloadInfo->digest.empty()) {
+        if (!job->digest.Configure(downloadInfo->digest)) {
+            job->result = buildDownloadErrorString(INTEGRITY_ERR, job->sourceEscaped, job->targetEscaped, 0);
+            release(job);
+            return false;
         }
+        job->segmentCount = 1;
     }
 
-    result = curl_easy_perform(curl);
-
-    if (result == CURLE_SSL_CACERT) {
-        if (!blockedDomain) {
-            result = openDialog(curl, downloadInfo->windowGroup, parsedDomain);
-        }
+    // Small bodies are handed over without touching the disk
+    if (!downloadInfo->memory.empty()) {
+        prepareMemory(job);
+        return true;
     }
 
-    if (result == CURLE_OK) {
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_status);
+    // A copy in the cache is checked with a plain conditional request
+    if (downloadInfo->cache) {
+        job->useCache = true;
+        job->revalidating = DownloadCache::Instance().Lookup(downloadInfo->source, job->cached);
+    }
 
-        if (http_status >= 200 && http_status < 300) {
-            result_string = buildDownloadSuccessString(true, false, downloadInfo->source.substr(downloadInfo->source.find_last_of('/')+1), downloadInfo->target);
-        } else if (http_status == 404) {
-            error = 1;
-            result_string = buildDownloadErrorString(FILE_NOT_FOUND_ERR, source_escaped, target_escaped, http_status);
-        } else if (http_status >= 400 && http_status < 500) {
-            error = 1;
-            result_string = buildDownloadErrorString(INVALID_URL_ERR, source_escaped, target_escaped, http_status);
-        } else {
-            error = 1;
-            result_string = buildDownloadErrorString(CONNECTION_ERR, source_escaped, target_escaped, http_status);
-        }
-    } else {
-        FileTransferErrorCodes error_code;
+    // Find out the size of the file before deciding how to split it
+    if (job->segmentCount > 1 && !job->revalidating) {
+        job->probing = true;
+        curl_easy_setopt(job->curl, CURLOPT_NOBODY, 1L);
+        return true;
+    }
 
-        switch (result)
-        {
-            case CURLE_READ_ERROR:
-            case CURLE_FILE_COULDNT_READ_FILE:
-                error_code = FILE_NOT_FOUND_ERR;
-                break;
-            case CURLE_URL_MALFORMAT:
-                error_code = INVALID_URL_ERR;
-                break;
-            default:
-                error_code = CONNECTION_ERR;
-                break;
-        }
+    return prepareStream(job);
+}
 
-        error = 1;
-        result_string = buildDownloadErrorString(error_code, source_escaped, target_escaped, http_status);
+bool FileTransferCurl::prepareStream(TransferJob *job)
+{
+    // The target itself is only replaced once the download is complete
+    if (!openPartial(job)) {
+        job->result = buildDownloadErrorString(PERMISSIONS_ERR, job->sourceEscaped, job->targetEscaped, 0);
+        release(job);
+        return false;
     }
 
-    fclose(fp);
+    job->sink.SetWriteBehind(job->downloadInfo->writeBehind);
+    curl_easy_setopt(job->curl, CURLOPT_WRITEFUNCTION, DownloadWriteCallback);
+    curl_easy_setopt(job->curl, CURLOPT_WRITEDATA, job);
 
-    if (error) {
-        remove(downloadInfo->target.c_str());
-    }
+    // Continue a previous attempt if its data is still there
+    requestRange(job);
 
-    curl_easy_cleanup(curl);
+    watchProgress(job, job->downloadInfo->progressInterval, job->downloadInfo->progressStep);
 
-    return result_string;
+    return true;
 }
 
-std::string FileTransferCurl::buildUploadSuccessString(const int bytesSent, const int responseCode, const std::string& response)
+void FileTransferCurl::prepareMemory(TransferJob *job)
 {
-    std::stringstream ss;
-    ss << "upload success ";
-    ss << bytesSent;
-    ss << " ";
-    ss << responseCode;
-    ss << " ";
-    ss << response;
+    // Neither split, cached nor resumed; there is no file to do it with
+    job->segmentCount = 1;
+    curl_easy_setopt(job->curl, CURLOPT_WRITEFUNCTION, MemoryWriteCallback);
+    curl_easy_setopt(job->curl, CURLOPT_WRITEDATA, job);
+
+    requestRange(job);
 
-    return ss.str();
+    watchProgress(job, job->downloadInfo->progressInterval, job->downloadInfo->progressStep);
 }
 
-std::string FileTransferCurl::buildUploadErrorString(const int errorCode, const std::string& sourceFile, const std::string& targetURL, const int httpStatus)
+bool FileTransferCurl::Advance(TransferJob *job, CURLcode result, std::vector<TransferJob *>& next)
 {
-    std::stringstream ss;
-    ss << "upload error ";
-    ss << errorCode;
-    ss << " ";
-    ss << sourceFile;
-    ss << " ";
-    ss << targetURL;
-    ss << " ";
-    ss << httpStatus;
+    if (!job->probing || NeedsCertificatePrompt(job, result)) {
+        return false;
+    }
 
-    return ss.str();
-}
+    job->probing = false;
 
-std::string FileTransferCurl::buildDownloadSuccessString(const bool isFile, const bool isDirectory, const std::string& name, const std::string& fullPath)
-{
-    std::stringstream ss;
-    ss << "download success ";
-    ss << isFile;
-    ss << " ";
-    ss << isDirectory;
-    ss << " ";
-    ss << name;
-    ss << " ";
-    ss << fullPath;
+    long http_status = 0;
+    curl_off_t length = -1;
 
-    return ss.str();
-}
+    if (result == CURLE_OK) {
+        curl_easy_getinfo(job->curl, CURLINFO_RESPONSE_CODE, &http_status);
+#if LIBCURL_VERSION_NUM >= 0x073700
+        curl_easy_getinfo(job->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+#else
+        double contentLength = -1;
+        curl_easy_getinfo(job->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &contentLength);
+        length = static_cast<curl_off_t>(contentLength);
+#endif
+    }
 
-std::string FileTransferCurl::buildDownloadErrorString(const int code, const std::string& source, const std::string& target, const int httpStatus)
-{
-    std::stringstream ss;
-    ss << "download error ";
-    ss << code;
-    ss << " ";
-    ss << source;
-    ss << " ";
-    ss << target;
-    ss << " ";
-    ss << httpStatus;
+    // Ranges of a file that may change under us cannot be put together
+    const bool splittable = http_status == 200 && job->acceptRanges && !job->partial.Validator().empty();
+    curl_off_t count = job->segmentCount;
+    const curl_off_t minSize = job->minSegmentSize > 0 ? job->minSegmentSize : 1;
+
+    if (splittable && length > 0 && length / minSize < count) {
+        count = length / minSize;
+    }
+
+    curl_easy_setopt(job->curl, CURLOPT_NOBODY, 0L);
+    curl_easy_setopt(job->curl, CURLOPT_HTTPGET, 1L);
+
+    if (splittable && count > 1) {
+        splitDownload(job, length, static_cast<int>(count), next);
+        return true;
+    }
 
-    return ss.str();
+    // Anything unexpected, the stream will run into it again and report it
+    if (prepareStream(job)) {
+        next.push_back(job);
+    }
+
+    return true;
 }
 
-size_t FileTransferCurl::DownloadWriteCallback(void *ptr, size_t size, size_t nmemb, FILE *stream)
+void FileTransferCurl::splitDownload(TransferJob *job, curl_off_t length, int count, std::vector<TransferJob *>& next)
 {
-    size_t written;
-    written = fwrite(ptr, size, nmemb, stream);
-    return written;
+    const std::string& target = job->downloadInfo->target;
+    const std::string partPath = PartialDownload::PartPath(target);
+
+    char *effectiveUrl = NULL;
+    curl_easy_getinfo(job->curl, CURLINFO_EFFECTIVE_URL, &effectiveUrl);
+    const std::string url = effectiveUrl ? effectiveUrl : job->downloadInfo->source;
+
+    // Segmented downloads are not journaled; a stale journal would not match
+    PartialDownload::Remove(target, false);
+
+    const int fd = open(partPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || !DownloadSink::Preallocate(fd, length)) {
+        if (fd >= 0) {
+            close(fd);
+            remove(partPath.c_str());
+        }
+        job->result = buildDownloadErrorString(PERMISSIONS_ERR, job->sourceEscaped, job->targetEscaped, 0);
+        release(job);
+        return;
+    }
+
+    SegmentedDownload *download = new SegmentedDownload(fd, url, length, count);
+    download->progress.Start(job->downloadInfo->progressInterval, static_cast<curl_off_t>(job->downloadInfo->progressStep) * 1024);
+
+    for (int i = 0; i < count; i++) {
+        FileDownloadInfo *info = new FileDownloadInfo(*job->downloadInfo);
+        info->segments = 1;
+
+        TransferJob *segmentJob = new TransferJob(info);
+        segmentJob->segment = new DownloadSegment(download, length * i / count, length * (i + 1) / count - 1);
+        segmentJob->partial = job->partial;
+        segmentJob->skipVerify = job->skipVerify;
+        segmentJob->useCache = job->useCache;
+        segmentJob->noStore = job->noStore;
+        segmentJob->journalId = job->journalId;
+        // The job may have lost its owner since it was submitted
+        segmentJob->pParent = job->pParent;
+        next.push_back(segmentJob);
+    }
+
+    // The job itself is done; the segments report the result
+    release(job);
 }
 
-size_t FileTransferCurl::UploadReadCallback(void *ptr, size_t size, size_t nmemb, void *userdata)
+bool FileTransferCurl::prepareSegment(TransferJob *job)
 {
-    uploadAttributes *uploadAtt = static_cast<uploadAttributes *>(userdata);
+    SegmentedDownload *download = job->segment->download;
 
-    FILE *file = uploadAtt->file;
-    int max_chunk_size = uploadAtt->max_chunk_size;
+    describe(job);
 
-    size_t amount = 0;
+    pthread_mutex_lock(&download->lock);
+    const bool failed = download->failed;
+    pthread_mutex_unlock(&download->lock);
 
-    if (max_chunk_size < (size * nmemb)) {
-        amount = fread(ptr, 1, max_chunk_size, file);
-    } else {
-        amount = fread(ptr, size, nmemb, file);
+    job->curl = failed ? NULL : TransferContext::Instance().AcquireHandle(download->url);
+
+    if (!job->curl) {
+        // The download already failed, or cannot go on without this range
+        job->result = finishSegment(job, false, buildDownloadErrorString(CONNECTION_ERR, job->sourceEscaped, job->targetEscaped, 0));
+        return false;
     }
 
-    return amount;
+    curl_easy_setopt(job->curl, CURLOPT_URL, download->url.c_str());
+    job->sink.SetWriteBehind(job->downloadInfo->writeBehind);
+    curl_easy_setopt(job->curl, CURLOPT_WRITEFUNCTION, SegmentWriteCallback);
+    curl_easy_setopt(job->curl, CURLOPT_WRITEDATA, job);
+    curl_easy_setopt(job->curl, CURLOPT_HEADERFUNCTION, DownloadHeaderCallback);
+    curl_easy_setopt(job->curl, CURLOPT_HEADERDATA, job);
+    curl_easy_setopt(job->curl, CURLOPT_PRIVATE, job);
+    curl_easy_setopt(job->curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(job->curl, CURLOPT_LOW_SPEED_TIME, STALL_TIMEOUT);
+    curl_easy_setopt(job->curl, CURLOPT_FOLLOWLOCATION, 1);
+
+    checkDomain(job, job->downloadInfo->source);
+    requestSegment(job);
+
+#if LIBCURL_VERSION_NUM >= 0x072f00
+    // Segments are there to get connections of their own; HTTP/2 would put
+    // them all on one
+    curl_easy_setopt(job->curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+    curl_easy_setopt(job->curl, CURLOPT_PIPEWAIT, 0L);
+#endif
+
+    // The download as a whole is throttled, see SegmentedDownload
+    watchProgress(job, job->downloadInfo->progressInterval, 0);
+
+    return true;
 }
 
-size_t FileTransferCurl::UploadWriteCallback(void *ptr, size_t size, size_t nmemb, void *userdata)
+void FileTransferCurl::watchProgress(TransferJob *job, int intervalMs, int stepKb)
+{
+    if (intervalMs <= 0 || !job->pParent) {
+        return;
+    }
+
+    job->progress.Start(intervalMs, static_cast<curl_off_t>(stepKb) * 1024);
+
+    curl_easy_setopt(job->curl, CURLOPT_NOPROGRESS, 0L);
+#if LIBCURL_VERSION_NUM >= 0x072000
+    curl_easy_setopt(job->curl, CURLOPT_XFERINFOFUNCTION, ProgressCallback);
+    curl_easy_setopt(job->curl, CURLOPT_XFERINFODATA, job);
+#else
+    curl_easy_setopt(job->curl, CURLOPT_PROGRESSFUNCTION, LegacyProgressCallback);
+    curl_easy_setopt(job->curl, CURLOPT_PROGRESSDATA, job);
+#endif
+}
+
+void FileTransferCurl::requestSegment(TransferJob *job)
 {
-    std::string *write_data = static_cast<std::string *>(userdata);
+    const DownloadSegment *segment = job->segment;
+    const std::string validator = job->partial.Validator();
+    char range[64];
+
+    job->responseChecked = false;
+    job->rangeRejected = false;
+    job->rangeStart = -1;
+    job->resumeFrom = segment->start + segment->done;
+    job->sink.Attach(segment->download->fd, job->resumeFrom);
+
+    snprintf(range, sizeof(range), "%" CURL_FORMAT_CURL_OFF_T "-%" CURL_FORMAT_CURL_OFF_T,
+             job->resumeFrom, segment->end);
+    curl_easy_setopt(job->curl, CURLOPT_RANGE, range);
+
+    curl_slist_free_all(job->headerlist);
+    job->headerlist = NULL;
+
+    // A changed file comes back whole, which fails the segment
+    const std::string ifRange = "If-Range: " + validator;
+    job->headerlist = curl_slist_append(job->headerlist, ifRange.c_str());
+    curl_easy_setopt(job->curl, CURLOPT_HTTPHEADER, job->headerlist);
+}
+
+std::string FileTransferCurl::finishSegment(TransferJob *job, bool complete, const std::string& error)
+{
+    SegmentedDownload *download = job->segment->download;
+
+    pthread_mutex_lock(&download->lock);
+    if (!complete && !download->failed) {
+        download->failed = true;
+        download->error = error;
+    }
+    const bool last = --download->remaining == 0;
+    pthread_mutex_unlock(&download->lock);
+
+    // Only the last segment to finish reports on the whole download
+    if (!last) {
+        return "";
+    }
+
+    const FileDownloadInfo *downloadInfo = job->downloadInfo;
+    const std::string partPath = PartialDownload::PartPath(downloadInfo->target);
+    std::string result;
+
+    bool ok = !download->failed && fsync(download->fd) == 0;
+    ok = close(download->fd) == 0 && ok;
+
+    // Only a download taken over by a request with a digest has one here
+    if (ok && !downloadInfo->digest.empty()
+            && !(job->digest.Configure(downloadInfo->digest) && checkDigest(job, partPath, download->length))) {
+        result = buildDownloadErrorString(INTEGRITY_ERR, job->sourceEscaped, job->targetEscaped, 0);
+        remove(partPath.c_str());
+    } else if (!ok) {
+        result = download->failed ? download->error
+            : buildDownloadErrorString(PERMISSIONS_ERR, job->sourceEscaped, job->targetEscaped, 0);
+        remove(partPath.c_str());
+    } else if (rename(partPath.c_str(), downloadInfo->target.c_str()) != 0) {
+        result = buildDownloadErrorString(PERMISSIONS_ERR, job->sourceEscaped, job->targetEscaped, 0);
+        remove(partPath.c_str());
+    } else {
+        storeInCache(job);
+        result = downloadSuccess(job);
+    }
+
+    delete download;
+    return result;
+}
+
+bool FileTransferCurl::openPartial(TransferJob *job)
+{
+    const std::string& target = job->downloadInfo->target;
+    const std::string partPath = PartialDownload::PartPath(target);
+    PartialDownload previous;
+    struct stat st;
+
+    if (previous.Load(target) && previous.url == job->downloadInfo->source && !previous.Validator().empty()
+            && previous.bytes > 0 && stat(partPath.c_str(), &st) == 0 && st.st_size >= previous.bytes) {
+        // Anything past what the journal vouches for may not have reached the disk
+        if (job->sink.Open(partPath, false) && job->sink.Truncate(previous.bytes)) {
+            job->partial = previous;
+            job->journaled = previous.bytes;
+            return true;
+        }
+
+        job->sink.Close();
+    }
+
+    PartialDownload::Remove(target, false);
+
+    job->partial = PartialDownload();
+    job->partial.url = job->downloadInfo->source;
+    job->journaled = 0;
+
+    return job->sink.Open(partPath, true);
+}
+
+bool FileTransferCurl::NeedsCatchUp(TransferJob *job)
+{
+    if (job->uploadInfo) {
+        return uploadNeedsCatchUp(job);
+    }
+
+    return job->sink.IsOpen() && !job->segment && job->digest.IsEnabled()
+            && job->digest.Length() < job->partial.bytes;
+}
+
+bool FileTransferCurl::uploadNeedsCatchUp(TransferJob *job)
+{
+#if LIBCURL_VERSION_NUM < 0x073800
+    // curl reads a non-chunked file itself, see addFilePart, so it has to be
+    // hashed up front; the source is not read after that
+    FileUploadInfo *uploadInfo = job->uploadInfo;
+    return !uploadInfo->chunkedMode && uploadInfo->files.empty() && !uploadInfo->compress
+            && job->source.IsOpen() && job->digest.IsEnabled();
+#else
+    (void)job;
+    return false;
+#endif
+}
+
+void FileTransferCurl::CatchUp(TransferJob *job)
+{
+    if (!NeedsCatchUp(job)) {
+        return;
+    }
+
+    // A file that cannot be hashed fails the check when the upload is over
+    if (job->uploadInfo) {
+        job->digest.CatchUp(job->uploadInfo->sourceFile, job->source.Size());
+        job->source.Close();
+        return;
+    }
+
+    // What cannot be hashed is fetched again
+    if (!job->digest.CatchUp(PartialDownload::PartPath(job->downloadInfo->target), job->partial.bytes)) {
+        job->digest.Reset();
+        truncatePartial(job);
+        requestRange(job);
+    }
+}
+
+void FileTransferCurl::requestRange(TransferJob *job)
+{
+    const std::string validator = job->partial.Validator();
+
+    curl_slist_free_all(job->headerlist);
+    job->headerlist = NULL;
+
+    job->responseChecked = false;
+    job->discardBody = false;
+    job->rangeRejected = false;
+    job->rangeStart = -1;
+
+    if (job->partial.bytes > 0 && validator.empty()) {
+        // Without a validator the data could belong to another version
+        truncatePartial(job);
+    }
+
+    job->resumeFrom = job->partial.bytes;
+
+    if (job->resumeFrom > 0) {
+        char range[32];
+        snprintf(range, sizeof(range), "%" CURL_FORMAT_CURL_OFF_T "-", job->resumeFrom);
+        curl_easy_setopt(job->curl, CURLOPT_RANGE, range);
+
+        // The server sends the whole file if it changed in the meantime
+        const std::string ifRange = "If-Range: " + validator;
+        job->headerlist = curl_slist_append(job->headerlist, ifRange.c_str());
+
+        // Only a whole response can stand in for the cached copy
+        job->revalidating = false;
+
+        // Offsets count bytes of the file as it is, not as it was sent
+        acceptEncodings(job->curl, false);
+    } else {
+        curl_easy_setopt(job->curl, CURLOPT_RANGE, NULL);
+        acceptEncodings(job->curl, true);
+
+        if (job->revalidating && !job->cached.etag.empty()) {
+            const std::string ifNoneMatch = "If-None-Match: " + job->cached.etag;
+            job->headerlist = curl_slist_append(job->headerlist, ifNoneMatch.c_str());
+        }
+        if (job->revalidating && !job->cached.lastModified.empty()) {
+            const std::string ifModifiedSince = "If-Modified-Since: " + job->cached.lastModified;
+            job->headerlist = curl_slist_append(job->headerlist, ifModifiedSince.c_str());
+        }
+    }
+
+    curl_easy_setopt(job->curl, CURLOPT_HTTPHEADER, job->headerlist);
+}
+
+// Called before the first byte of the body is written
+bool FileTransferCurl::checkResponse(TransferJob *job)
+{
+    long http_status = 0;
+
+    job->responseChecked = true;
+    curl_easy_getinfo(job->curl, CURLINFO_RESPONSE_CODE, &http_status);
+
+    // Error pages never end up in the file
+    if (http_status < 200 || http_status >= 300) {
+        job->discardBody = true;
+        return true;
+    }
+
+    if (http_status == 206 && job->resumeFrom > 0) {
+        if (job->rangeStart != job->resumeFrom) {
+            job->rangeRejected = true;
+            return false;
+        }
+
+        return reserve(job, job->resumeFrom);
+    }
+
+    // The whole file is coming
+    return truncatePartial(job) && reserve(job, 0);
+}
+
+bool FileTransferCurl::reserve(TransferJob *job, curl_off_t offset)
+{
+    curl_off_t length = -1;
+#if LIBCURL_VERSION_NUM >= 0x073700
+    curl_easy_getinfo(job->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+#else
+    double contentLength = -1;
+    curl_easy_getinfo(job->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &contentLength);
+    length = static_cast<curl_off_t>(contentLength);
+#endif
+
+    // Fails early rather than halfway through when the disk is too small
+    return length <= 0 || job->sink.Preallocate(offset + length);
+}
+
+// Anything not hashed on the way, e.g. after a failed attempt, is read from
+// the file
+bool FileTransferCurl::checkDigest(TransferJob *job, const std::string& path, curl_off_t length)
+{
+    if (!job->digest.IsEnabled()) {
+        return true;
+    }
+
+    return job->digest.CatchUp(path, length) && job->digest.Matches();
+}
+
+bool FileTransferCurl::truncatePartial(TransferJob *job)
+{
+    if (!job->sink.Truncate(0)) {
+        return false;
+    }
+
+    job->partial.bytes = 0;
+    job->journaled = 0;
+    job->digest.Reset();
+    PartialDownload::Remove(job->downloadInfo->target, false);
+
+    return true;
+}
+
+void FileTransferCurl::saveJournal(TransferJob *job)
+{
+    if (job->partial.Validator().empty()) {
+        return;
+    }
+
+    // The journal must never claim more than what is on disk
+    if (job->sink.Sync()) {
+        if (job->partial.Save(job->downloadInfo->target) && !job->journalId.empty()) {
+            TransferJournal::Instance().Progress(job->journalId, job->partial.bytes);
+        }
+        job->journaled = job->partial.bytes;
+    }
+}
+
+// saveJournal() for a download on its way, which cannot wait for the disk
+void FileTransferCurl::checkpoint(TransferJob *job)
+{
+    if (job->partial.Validator().empty()) {
+        return;
+    }
+
+    job->sink.Checkpoint(new JournalCheckpoint(job->partial, job->downloadInfo->target, job->journalId));
+    job->journaled = job->partial.bytes;
+}
+
+bool FileTransferCurl::isTransient(CURLcode result)
+{
+    switch (result)
+    {
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_GOT_NOTHING:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool FileTransferCurl::PrepareRetry(TransferJob *job, CURLcode result, int& delayMs)
+{
+    if (job->revalidating && result == CURLE_OK) {
+        long http_status = 0;
+        curl_easy_getinfo(job->curl, CURLINFO_RESPONSE_CODE, &http_status);
+
+        if (http_status == 304) {
+            const std::string& target = job->downloadInfo->target;
+            struct stat st;
+
+            job->cacheHit = DownloadCache::Instance().Restore(job->downloadInfo->source, target);
+
+            // Nothing was streamed, so the copy is hashed where it is now
+            if (job->cacheHit && job->digest.IsEnabled()
+                    && (stat(target.c_str(), &st) != 0 || !checkDigest(job, target, st.st_size))) {
+                remove(target.c_str());
+                job->cacheHit = false;
+                job->digest.Reset();
+            }
+
+            if (job->cacheHit) {
+                return false;
+            }
+
+            // The copy went away in the meantime, so get the file itself
+            job->revalidating = false;
+            requestRange(job);
+            delayMs = 0;
+            return true;
+        }
+    }
+
+    if (!job->downloadInfo || !(job->sink.IsOpen() || job->segment) || job->attempts >= MAX_RETRIES) {
+        return false;
+    }
+
+    long http_status = 0;
+    curl_easy_getinfo(job->curl, CURLINFO_RESPONSE_CODE, &http_status);
+
+    if (job->segment) {
+        // A segment carries on from the last byte it wrote
+        if (!isTransient(result) && !(result == CURLE_OK && (http_status == 408 || http_status >= 500))) {
+            return false;
+        }
+
+        requestSegment(job);
+        delayMs = RETRY_DELAY_MS << job->attempts;
+        job->attempts++;
+
+        return true;
+    }
+
+    if (result == CURLE_OK) {
+        if (http_status == 416 && job->resumeFrom > 0) {
+            // The range no longer fits the file, get all of it
+            truncatePartial(job);
+        } else if (http_status != 408 && http_status < 500) {
+            return false;
+        }
+    } else if (result == CURLE_WRITE_ERROR && job->rangeRejected) {
+        truncatePartial(job);
+    } else if (!isTransient(result)) {
+        return false;
+    }
+
+    // Keep what arrived, in case the application is closed before the retry
+    if (job->partial.bytes > job->journaled) {
+        saveJournal(job);
+    }
+
+    requestRange(job);
+    delayMs = RETRY_DELAY_MS << job->attempts;
+    job->attempts++;
+
+    return true;
+}
+
+void FileTransferCurl::Finish(TransferJob *job, CURLcode result)
+{
+    long http_status = 0;
+    bool error = true;
+
+    if (result == CURLE_OK) {
+        curl_easy_getinfo(job->curl, CURLINFO_RESPONSE_CODE, &http_status);
+    }
+
+    // The response file has to be complete for the upload to succeed
+    const bool responseFile = job->uploadInfo && job->sink.IsOpen();
+    if (responseFile && !job->sink.Close()) {
+        job->responseFailed = true;
+    }
+
+    if (job->uploadInfo && !job->uploadInfo->files.empty()) {
+        job->result = batchResult(job, result, http_status, error);
+    } else if (job->uploadInfo) {
+        // A file that does not match is cut off before its last byte is sent
+        const bool hashed = job->digest.Length() == job->source.Size();
+
+        if ((result == CURLE_OK || hashed) && !checkDigest(job, job->uploadInfo->sourceFile, job->source.Size())) {
+            job->result = buildUploadErrorString(INTEGRITY_ERR, job->sourceEscaped, job->targetEscaped, http_status);
+        } else if (job->responseFailed) {
+            job->result = buildUploadErrorString(PERMISSIONS_ERR, job->sourceEscaped, job->targetEscaped, http_status);
+        } else if (result != CURLE_OK) {
+            job->result = buildUploadErrorString(errorCode(result), job->sourceEscaped, job->targetEscaped, http_status);
+        } else if (http_status >= 200 && http_status < 300) {
+            job->result = buildUploadSuccessString(uploadLength(job->curl), http_status, job->digest.Result(), job->responseSize, job->response);
+            error = false;
+        } else if (http_status == 404) {
+            job->result = buildUploadErrorString(INVALID_URL_ERR, job->sourceEscaped, job->targetEscaped, http_status);
+        } else {
+            job->result = buildUploadErrorString(CONNECTION_ERR, job->sourceEscaped, job->targetEscaped, http_status);
+        }
+    } else if (!job->downloadInfo->memory.empty()) {
+        job->result = memoryResult(job, result, http_status);
+        release(job);
+        std::string().swap(job->response);
+        return;
+    } else if (job->segment) {
+        const DownloadSegment *segment = job->segment;
+        const bool written = job->sink.Close();
+        const bool complete = written && result == CURLE_OK && http_status == 206
+                && segment->done == segment->end - segment->start + 1;
+
+        release(job);
+        job->result = finishSegment(job, complete, downloadError(job, result, http_status));
+        return;
+    } else {
+        if (job->cacheHit) {
+            job->result = downloadSuccess(job);
+            error = false;
+        } else if (result == CURLE_OK && http_status >= 200 && http_status < 300 && !job->sink.Finish()) {
+            job->result = buildDownloadErrorString(PERMISSIONS_ERR, job->sourceEscaped, job->targetEscaped, http_status);
+        } else if (result == CURLE_OK && http_status >= 200 && http_status < 300
+                && !checkDigest(job, PartialDownload::PartPath(job->downloadInfo->target), job->partial.bytes)) {
+            job->result = buildDownloadErrorString(INTEGRITY_ERR, job->sourceEscaped, job->targetEscaped, http_status);
+        } else if (result == CURLE_OK && http_status >= 200 && http_status < 300) {
+            job->result = downloadSuccess(job);
+            error = false;
+        } else {
+            job->result = downloadError(job, result, http_status);
+        }
+    }
+
+    if (job->probing) {
+        // Nothing was written yet
+        release(job);
+    } else if (job->downloadInfo) {
+        const std::string& target = job->downloadInfo->target;
+        const std::string partPath = PartialDownload::PartPath(target);
+
+        // A download cut short keeps its data for the next attempt
+        const bool keep = error && job->sink.IsOpen() && (isTransient(result) || http_status >= 500)
+                && job->partial.bytes > 0 && !job->partial.Validator().empty();
+        if (keep) {
+            saveJournal(job);
+        }
+
+        release(job);
+
+        if (!error && !job->cacheHit) {
+            if (rename(partPath.c_str(), target.c_str()) != 0) {
+                job->result = buildDownloadErrorString(PERMISSIONS_ERR, job->sourceEscaped, job->targetEscaped, http_status);
+                error = true;
+            } else {
+                storeInCache(job);
+            }
+        }
+
+        if (!keep) {
+            // A download served from the cache leaves an empty .part behind
+            PartialDownload::Remove(target, error || job->cacheHit);
+        }
+    } else {
+        release(job);
+
+        if (responseFile) {
+            const std::string& target = job->uploadInfo->responseFile;
+            const std::string partPath = PartialDownload::PartPath(target);
+
+            if (!error && rename(partPath.c_str(), target.c_str()) != 0) {
+                job->result = uploadError(job, PERMISSIONS_ERR, http_status);
+                error = true;
+            }
+            if (error) {
+                remove(partPath.c_str());
+            }
+        }
+    }
+
+    // Whatever it held is in the result now
+    std::string().swap(job->response);
+}
+
+void FileTransferCurl::Refuse(TransferJob *job)
+{
+    describe(job);
+    job->result = buildDownloadErrorString(PERMISSIONS_ERR, job->sourceEscaped, job->targetEscaped, 0);
+}
+
+bool FileTransferCurl::TakeOver(TransferJob *orphan, TransferJob *job)
+{
+    FileDownloadInfo *downloadInfo = orphan->downloadInfo;
+    const FileDownloadInfo *wanted = job->downloadInfo;
+
+    // The digest fails the same way it would have in Prepare
+    StreamDigest check;
+    if (!wanted->digest.empty() && !check.Configure(wanted->digest)) {
+        describe(job);
+        job->result = buildDownloadErrorString(INTEGRITY_ERR, job->sourceEscaped, job->targetEscaped, 0);
+        return false;
+    }
+
+    orphan->pParent = job->pParent;
+    orphan->eventId = job->eventId;
+    orphan->windowGroup = job->windowGroup;
+    downloadInfo->pParent = wanted->pParent;
+    downloadInfo->eventId = wanted->eventId;
+    downloadInfo->windowGroup = wanted->windowGroup;
+    downloadInfo->progressInterval = wanted->progressInterval;
+    downloadInfo->progressStep = wanted->progressStep;
+    downloadInfo->background = wanted->background;
+
+    // A job that is not prepared yet sets both up in Prepare
+    if (!orphan->curl) {
+        downloadInfo->digest = wanted->digest;
+        return true;
+    }
+
+    if (orphan->segment) {
+        SegmentedDownload *download = orphan->segment->download;
+        download->progress.Start(wanted->progressInterval, static_cast<curl_off_t>(wanted->progressStep) * 1024);
+        watchProgress(orphan, wanted->progressInterval, 0);
+    } else {
+        watchProgress(orphan, wanted->progressInterval, wanted->progressStep);
+    }
+
+    // A digest set up now starts with nothing: what the .part file already
+    // holds is read from it once the download is complete. Segments are only
+    // hashed then
+    if (downloadInfo->digest != wanted->digest) {
+        downloadInfo->digest = wanted->digest;
+        if (!orphan->segment) {
+            orphan->digest.Configure(wanted->digest);
+        }
+    }
+
+    return true;
+}
+
+void FileTransferCurl::Abort(TransferJob *job)
+{
+    // The job may not have been prepared yet
+    describe(job);
+
+    if (job->uploadInfo) {
+        const bool responseFile = job->sink.IsOpen();
+
+        job->result = uploadError(job, ABORT_ERR, 0);
+        release(job);
+
+        if (responseFile) {
+            remove(PartialDownload::PartPath(job->uploadInfo->responseFile).c_str());
+        }
+        return;
+    }
+
+    const std::string error = buildDownloadErrorString(ABORT_ERR, job->sourceEscaped, job->targetEscaped, 0);
+    release(job);
+
+    if (job->segment) {
+        // The last segment to go removes the .part file
+        job->result = finishSegment(job, false, error);
+        return;
+    }
+
+    job->result = error;
+
+    // Nothing of an aborted download is kept for later; a probe has not
+    // written anything yet, nor does a download to memory
+    if (job->prepared && !job->probing && job->downloadInfo->memory.empty()) {
+        PartialDownload::Remove(job->downloadInfo->target, true);
+    }
+}
+
+std::string FileTransferCurl::batchResult(TransferJob *job, CURLcode result, long httpStatus, bool& error)
+{
+    int code = 0;
+
+    if (job->responseFailed) {
+        code = PERMISSIONS_ERR;
+    } else if (result != CURLE_OK) {
+        code = errorCode(result);
+    } else if (httpStatus == 404) {
+        code = INVALID_URL_ERR;
+    } else if (httpStatus < 200 || httpStatus >= 300) {
+        code = CONNECTION_ERR;
+    }
+
+    if (code != 0) {
+        return uploadError(job, code, httpStatus);
+    }
+
+    error = false;
+    return buildBatchSuccessString(uploadLength(job->curl), httpStatus, batchParts(job, 0), job->responseSize, job->response);
+}
+
+std::string FileTransferCurl::uploadError(TransferJob *job, int code, long httpStatus)
+{
+    if (job->uploadInfo->files.empty()) {
+        return buildUploadErrorString(code, job->sourceEscaped, job->targetEscaped, httpStatus);
+    }
+
+    return buildBatchErrorString(code, job->sourceEscaped, job->targetEscaped, httpStatus, batchParts(job, code));
+}
+
+std::string FileTransferCurl::batchParts(TransferJob *job, int code)
+{
+    // One code for each file, in the order given: 0 if it was sent, the
+    // error of the request if that failed, FILE_NOT_FOUND_ERR if it was
+    // left out
+    std::string parts;
+
+    for (size_t i = 0; i < job->uploadInfo->files.size(); i++) {
+        if (i > 0) {
+            parts += ',';
+        }
+        appendNumber(parts, i < job->batch.size() && !job->batch[i] ? FILE_NOT_FOUND_ERR : code);
+    }
+
+    return parts;
+}
+
+std::string FileTransferCurl::downloadError(TransferJob *job, CURLcode result, long httpStatus)
+{
+    FileTransferErrorCodes code = CONNECTION_ERR;
+
+    if (result != CURLE_OK) {
+        code = errorCode(result);
+    } else if (httpStatus == 404) {
+        code = FILE_NOT_FOUND_ERR;
+    } else if (httpStatus >= 400 && httpStatus < 500) {
+        code = INVALID_URL_ERR;
+    }
+
+    return buildDownloadErrorString(code, job->sourceEscaped, job->targetEscaped, httpStatus);
+}
+
+std::string FileTransferCurl::downloadSuccess(TransferJob *job)
+{
+    const FileDownloadInfo *downloadInfo = job->downloadInfo;
+    std::string cache = "off";
+    long hits = 0;
+    long misses = 0;
+
+    if (job->useCache) {
+        cache = job->cacheHit ? "hit" : "miss";
+        DownloadCache::Instance().Count(job->cacheHit);
+    }
+    DownloadCache::Instance().Counters(hits, misses);
+
+    return buildDownloadSuccessString(true, false, cache, hits, misses, job->digest.Result(), downloadInfo->source.substr(downloadInfo->source.find_last_of('/')+1), downloadInfo->target);
+}
+
+std::string FileTransferCurl::memoryResult(TransferJob *job, CURLcode result, long httpStatus)
+{
+    if (job->responseFailed) {
+        // The transfer was cut short, so only the header has the status
+        return buildDownloadErrorString(TOO_LARGE_ERR, job->sourceEscaped, job->targetEscaped, job->headerStatus);
+    } else if (result != CURLE_OK || httpStatus < 200 || httpStatus >= 300) {
+        return downloadError(job, result, httpStatus);
+    } else if (job->digest.IsEnabled() && !job->digest.Matches()) {
+        return buildDownloadErrorString(INTEGRITY_ERR, job->sourceEscaped, job->targetEscaped, httpStatus);
+    }
+
+    return buildDownloadDataString(httpStatus, job->downloadInfo->memory, job->digest.Result(), job->response);
+}
+
+void FileTransferCurl::storeInCache(TransferJob *job)
+{
+    if (!job->useCache || job->cacheHit || job->noStore) {
+        return;
+    }
+
+    CacheValidators validators;
+    validators.etag = job->partial.etag;
+    validators.lastModified = job->partial.lastModified;
+
+    DownloadCache::Instance().Store(job->downloadInfo->source, job->downloadInfo->target, validators);
+}
+
+void FileTransferCurl::release(TransferJob *job)
+{
+    job->sink.Close();
+
+    TransferContext::Instance().ReleaseHandle(job->curl);
+    job->curl = NULL;
+
+#if LIBCURL_VERSION_NUM >= 0x073800
+    curl_mime_free(job->mime);
+    job->mime = NULL;
+#else
+    curl_formfree(job->formpost);
+    job->formpost = NULL;
+#endif
+    job->body.Close();
+    job->source.Close();
+    for (std::vector<UploadSource *>::iterator it = job->batch.begin(); it != job->batch.end(); ++it) {
+        if (*it) {
+            (*it)->Close();
+        }
+    }
+    curl_slist_free_all(job->headerlist);
+    job->headerlist = NULL;
+}
+
+std::string FileTransferCurl::run(TransferJob *job)
+{
+    // Segments need someone to drive them side by side
+    job->segmentCount = 1;
+
+    if (Prepare(job)) {
+        CatchUp(job);
+
+        // Perform file transfer (blocking)
+        CURLcode result = curl_easy_perform(job->curl);
+
+        if (NeedsCertificatePrompt(job, result) && PromptCertificate(job)) {
+            result = curl_easy_perform(job->curl);
+        }
+
+        int delayMs = 0;
+        while (PrepareRetry(job, result, delayMs)) {
+            usleep(delayMs * 1000);
+            result = curl_easy_perform(job->curl);
+        }
+
+        Finish(job, result);
+    }
+
+    return job->result;
+}
+
+std::string FileTransferCurl::Upload(FileUploadInfo *uploadInfo)
+{
+    TransferJob job(uploadInfo);
+    const std::string result = run(&job);
+
+    // The caller keeps ownership of the info
+    job.uploadInfo = NULL;
+    return result;
+}
+
+std::string FileTransferCurl::Download(FileDownloadInfo *downloadInfo)
+{
+    TransferJob job(downloadInfo);
+    const std::string result = run(&job);
+
+    job.downloadInfo = NULL;
+    return result;
+}
+
+std::string FileTransferCurl::buildUploadSuccessString(const curl_off_t bytesSent, const int responseCode, const std::string& digest, const curl_off_t responseSize, const std::string& response)
+{
+    // The response may be large, so it is copied once, into a string of
+    // the right size
+    std::string result;
+    result.reserve(64 + digest.size() + response.size());
+    result += "upload success ";
+    appendNumber(result, bytesSent);
+    result += ' ';
+    appendNumber(result, responseCode);
+    result += ' ';
+    result += digest.empty() ? "-" : digest;
+    result += ' ';
+    appendNumber(result, responseSize);
+    result += static_cast<curl_off_t>(response.size()) < responseSize ? " 1 " : " 0 ";
+    result += response;
+
+    return result;
+}
+
+std::string FileTransferCurl::buildUploadErrorString(const int errorCode, const std::string& sourceFile, const std::string& targetURL, const int httpStatus)
+{
+    std::string result = "upload error ";
+    appendNumber(result, errorCode);
+    result += ' ';
+    result += sourceFile;
+    result += ' ';
+    result += targetURL;
+    result += ' ';
+    appendNumber(result, httpStatus);
+
+    return result;
+}
+
+std::string FileTransferCurl::buildBatchSuccessString(const curl_off_t bytesSent, const int responseCode, const std::string& parts, const curl_off_t responseSize, const std::string& response)
+{
+    std::string result;
+    result.reserve(64 + parts.size() + response.size());
+    result += "uploadBatch success ";
+    appendNumber(result, bytesSent);
+    result += ' ';
+    appendNumber(result, responseCode);
+    result += ' ';
+    result += parts;
+    result += ' ';
+    appendNumber(result, responseSize);
+    result += static_cast<curl_off_t>(response.size()) < responseSize ? " 1 " : " 0 ";
+    result += response;
+
+    return result;
+}
+
+std::string FileTransferCurl::buildBatchErrorString(const int errorCode, const std::string& sourceFiles, const std::string& targetURL, const int httpStatus, const std::string& parts)
+{
+    std::string result = "uploadBatch error ";
+    appendNumber(result, errorCode);
+    result += ' ';
+    result += sourceFiles;
+    result += ' ';
+    result += targetURL;
+    result += ' ';
+    appendNumber(result, httpStatus);
+    result += ' ';
+    result += parts;
+
+    return result;
+}
+
+std::string FileTransferCurl::buildDownloadSuccessString(const bool isFile, const bool isDirectory, const std::string& cache, const long cacheHits, const long cacheMisses, const std::string& digest, const std::string& name, const std::string& fullPath)
+{
+    std::string result = "download success ";
+    appendNumber(result, isFile);
+    result += ' ';
+    appendNumber(result, isDirectory);
+    result += ' ';
+    result += cache;
+    result += ' ';
+    appendNumber(result, cacheHits);
+    result += ' ';
+    appendNumber(result, cacheMisses);
+    result += ' ';
+    result += digest.empty() ? "-" : digest;
+    result += ' ';
+    result += name;
+    result += ' ';
+    result += fullPath;
+
+    return result;
+}
+
+std::string FileTransferCurl::buildDownloadErrorString(const int code, const std::string& source, const std::string& target, const int httpStatus)
+{
+    std::string result = "download error ";
+    appendNumber(result, code);
+    result += ' ';
+    result += source;
+    result += ' ';
+    result += target;
+    result += ' ';
+    appendNumber(result, httpStatus);
+
+    return result;
+}
+
+std::string FileTransferCurl::buildDownloadDataString(const int responseCode, const std::string& encoding, const std::string& digest, const std::string& data)
+{
+    std::string result;
+    result.reserve(64 + digest.size() + (data.size() + 2) / 3 * 4);
+    result += "download data ";
+    appendNumber(result, responseCode);
+    result += ' ';
+    result += encoding;
+    result += ' ';
+    result += digest.empty() ? "-" : digest;
+    result += ' ';
+    appendNumber(result, data.size());
+    result += ' ';
+
+    if (encoding == "base64") {
+        result += Utils::toBase64(reinterpret_cast<const unsigned char *>(data.data()), data.size());
+    } else {
+        appendJsonString(result, data);
+    }
+
+    return result;
+}
+
+size_t FileTransferCurl::DownloadWriteCallback(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    TransferJob *job = static_cast<TransferJob *>(userdata);
+    const size_t realsize = size * nmemb;
+
+    if (!job->responseChecked && !checkResponse(job)) {
+        return 0;
+    }
+
+    if (job->discardBody) {
+        return realsize;
+    }
+
+    if (!job->sink.Write(static_cast<const char *>(ptr), realsize)) {
+        return 0;
+    }
+
+    // A digest set up halfway through has the start read from the file later
+    if (job->digest.Length() == job->partial.bytes) {
+        job->digest.Update(static_cast<const char *>(ptr), realsize);
+    }
+    job->partial.bytes += realsize;
+
+    if (job->partial.bytes - job->journaled >= JOURNAL_INTERVAL) {
+        checkpoint(job);
+    }
+
+    return realsize;
+}
+
+size_t FileTransferCurl::SegmentWriteCallback(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    TransferJob *job = static_cast<TransferJob *>(userdata);
+    DownloadSegment *segment = job->segment;
+    const size_t realsize = size * nmemb;
+
+    // Anything but the exact range asked for would end up in the wrong place
+    if (!job->responseChecked) {
+        long http_status = 0;
+        curl_easy_getinfo(job->curl, CURLINFO_RESPONSE_CODE, &http_status);
+
+        job->responseChecked = true;
+        job->rangeRejected = http_status != 206 || job->rangeStart != job->resumeFrom;
+    }
+
+    if (job->rangeRejected || segment->done + static_cast<curl_off_t>(realsize) > segment->end - segment->start + 1
+            || !job->sink.Write(static_cast<const char *>(ptr), realsize)) {
+        return 0;
+    }
+
+    segment->done += realsize;
+    segment->download->received += realsize;
+
+    return realsize;
+}
+
+int FileTransferCurl::ProgressCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+    TransferJob *job = static_cast<TransferJob *>(clientp);
+    ProgressThrottle *throttle = &job->progress;
+    curl_off_t done;
+    curl_off_t total;
+
+    // Its owner went away and left it to the journal
+    if (!job->pParent) {
+        return 0;
+    }
+
+    if (job->uploadInfo) {
+        done = ulnow;
+        total = ultotal;
+    } else if (job->segment) {
+        throttle = &job->segment->download->progress;
+        done = job->segment->download->received;
+        total = job->segment->download->length;
+    } else {
+        // Bytes kept from an earlier attempt count as done
+        done = job->resumeFrom + dlnow;
+        total = dltotal > 0 ? job->resumeFrom + dltotal : 0;
+    }
+
+    curl_off_t rate = 0;
+    if (throttle->Due(done, rate)) {
+        char event[128];
+        snprintf(event, sizeof(event), "%s progress %" CURL_FORMAT_CURL_OFF_T " %" CURL_FORMAT_CURL_OFF_T " %" CURL_FORMAT_CURL_OFF_T,
+                 job->uploadInfo ? "upload" : "download", done, total, rate);
+        ProgressReporter::Instance().Post(job->pParent, job->eventId, event);
+    }
+
+    return 0;
+}
+
+#if LIBCURL_VERSION_NUM < 0x072000
+int FileTransferCurl::LegacyProgressCallback(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow)
+{
+    return ProgressCallback(clientp, static_cast<curl_off_t>(dltotal), static_cast<curl_off_t>(dlnow),
+                            static_cast<curl_off_t>(ultotal), static_cast<curl_off_t>(ulnow));
+}
+#endif
+
+size_t FileTransferCurl::DownloadHeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata)
+{
+    TransferJob *job = static_cast<TransferJob *>(userdata);
+    const size_t realsize = size * nitems;
+
+    std::string line(buffer, realsize);
+    while (!line.empty() && (line[line.length() - 1] == '\n' || line[line.length() - 1] == '\r')) {
+        line.erase(line.length() - 1);
+    }
+
+    const std::string::size_type colon = line.find(':');
+
+    if (line.compare(0, 5, "HTTP/") == 0) {
+        // Each response of a redirect chain starts over; only the headers of
+        // a successful one describe the file
+        const std::string::size_type space = line.find(' ');
+        job->headerStatus = (space == std::string::npos) ? 0 : atol(line.c_str() + space + 1);
+
+        if (job->headerStatus >= 200 && job->headerStatus < 300) {
+            job->partial.etag.clear();
+            job->partial.lastModified.clear();
+            job->rangeStart = -1;
+            job->acceptRanges = false;
+            job->noStore = false;
+        }
+    } else if (colon != std::string::npos && job->headerStatus >= 200 && job->headerStatus < 300) {
+        const std::string name = line.substr(0, colon);
+        std::string::size_type start = line.find_first_not_of(" \t", colon + 1);
+        const std::string value = (start == std::string::npos) ? "" : line.substr(start);
+
+        if (strcasecmp(name.c_str(), "ETag") == 0) {
+            job->partial.etag = value;
+        } else if (strcasecmp(name.c_str(), "Last-Modified") == 0) {
+            job->partial.lastModified = value;
+        } else if (strcasecmp(name.c_str(), "Cache-Control") == 0) {
+            job->noStore = job->noStore || value.find("no-store") != std::string::npos;
+        } else if (strcasecmp(name.c_str(), "Accept-Ranges") == 0) {
+            job->acceptRanges = strcasecmp(value.c_str(), "bytes") == 0;
+        } else if (strcasecmp(name.c_str(), "Content-Range") == 0) {
+            curl_off_t first = -1;
+            if (sscanf(value.c_str(), "bytes %" CURL_FORMAT_CURL_OFF_T "-", &first) == 1) {
+                job->rangeStart = first;
+            }
+        }
+    }
+
+    return realsize;
+}
+
+size_t FileTransferCurl::UploadReadCallback(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    UploadSource *source = static_cast<UploadSource *>(userdata);
+    const size_t amount = source->Read(ptr, size * nmemb);
+
+    return amount == static_cast<size_t>(-1) ? CURL_READFUNC_ABORT : amount;
+}
+
+size_t FileTransferCurl::CompressedReadCallback(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    CompressedBody *body = static_cast<CompressedBody *>(userdata);
+    const size_t amount = body->Read(ptr, size * nmemb);
+
+    return amount == static_cast<size_t>(-1) ? CURL_READFUNC_ABORT : amount;
+}
+
+int FileTransferCurl::CompressedSeekCallback(void *userdata, curl_off_t offset, int origin)
+{
+    CompressedBody *body = static_cast<CompressedBody *>(userdata);
+
+    // Compressed output can only be produced again from the start
+    if (origin != SEEK_SET || offset != 0 || !body->Rewind()) {
+        return CURL_SEEKFUNC_CANTSEEK;
+    }
+
+    return CURL_SEEKFUNC_OK;
+}
+
+int FileTransferCurl::UploadSeekCallback(void *userdata, curl_off_t offset, int origin)
+{
+    UploadSource *source = static_cast<UploadSource *>(userdata);
+
+    if (origin != SEEK_SET || !source->Seek(offset)) {
+        return CURL_SEEKFUNC_CANTSEEK;
+    }
+
+    return CURL_SEEKFUNC_OK;
+}
+
+size_t FileTransferCurl::MemoryWriteCallback(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    TransferJob *job = static_cast<TransferJob *>(userdata);
+    const size_t realsize = size * nmemb;
+    const size_t limit = static_cast<size_t>(job->downloadInfo->maxMemorySize) * 1024;
+
+    // Only the body of a successful response is kept; an error has its
+    // status reported instead
+    if (job->headerStatus >= 300) {
+        return realsize;
+    }
+
+    // A body announced as too large is refused before it arrives
+    if (job->response.empty()) {
+        curl_off_t length = -1;
+#if LIBCURL_VERSION_NUM >= 0x073700
+        curl_easy_getinfo(job->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+#else
+        double contentLength = -1;
+        curl_easy_getinfo(job->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &contentLength);
+        length = static_cast<curl_off_t>(contentLength);
+#endif
+        if (length > static_cast<curl_off_t>(limit)) {
+            job->responseFailed = true;
+            return 0;
+        }
+        if (length > 0) {
+            job->response.reserve(static_cast<size_t>(length));
+        }
+    }
+
+    if (job->response.size() + realsize > limit) {
+        job->responseFailed = true;
+        return 0;
+    }
+
+    if (job->digest.IsEnabled()) {
+        job->digest.Update(static_cast<char *>(ptr), realsize);
+    }
+    job->response.append(static_cast<char *>(ptr), realsize);
+    job->responseSize += realsize;
+
+    return realsize;
+}
+
+size_t FileTransferCurl::UploadWriteCallback(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    TransferJob *job = static_cast<TransferJob *>(userdata);
+    const FileUploadInfo *uploadInfo = job->uploadInfo;
+    const size_t realsize = size * nmemb;
+
+    if (job->sink.IsOpen()) {
+        if (!job->sink.Write(static_cast<char *>(ptr), realsize)) {
+            job->responseFailed = true;
+            return 0;
+        }
+        job->responseSize += realsize;
+        return realsize;
+    }
+
+    // Only so much of the body is kept, if there is a limit
+    const bool limited = uploadInfo->maxResponseSize >= 0;
+    const size_t limit = limited ? static_cast<size_t>(uploadInfo->maxResponseSize) * 1024 : 0;
+    const size_t kept = job->response.size();
+    const size_t keep = !limited ? realsize : (kept < limit ? std::min(realsize, limit - kept) : 0);
+
+    // Room for what is kept up front, instead of growing the string piece
+    // by piece
+    if (job->responseSize == 0 && keep > 0) {
+        curl_off_t length = -1;
+#if LIBCURL_VERSION_NUM >= 0x073700
+        curl_easy_getinfo(job->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+#else
+        double contentLength = -1;
+        curl_easy_getinfo(job->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &contentLength);
+        length = static_cast<curl_off_t>(contentLength);
+#endif
+        if (limited && length > static_cast<curl_off_t>(limit)) {
+            length = limit;
+        }
+        if (length > 0) {
+            job->response.reserve(static_cast<size_t>(std::min(length, MAX_RESPONSE_RESERVE)));
+        }
+    }
 
-    size_t realsize = size * nmemb;
-    write_data->append(static_cast<char *>(ptr), realsize);
+    job->response.append(static_cast<char *>(ptr), keep);
+    job->responseSize += realsize;
 
     return realsize;
 }
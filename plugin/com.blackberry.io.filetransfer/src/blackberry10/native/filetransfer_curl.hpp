@@ -18,16 +18,35 @@
 #define FILETRANSFER_CURL_H_
 
 #include <curl/curl.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <stdio.h>
 #include <map>
 #include <string>
 #include <vector>
 
+#include "filetransfer_cache.hpp"
+#include "filetransfer_compress.hpp"
+#include "filetransfer_digest.hpp"
+#include "filetransfer_progress.hpp"
+#include "filetransfer_resume.hpp"
+#include "filetransfer_shaper.hpp"
+#include "filetransfer_sink.hpp"
+#include "filetransfer_source.hpp"
+
 class FileTransfer;
 
 namespace webworks {
 
+// One file of a batch upload; the fields left empty take the values of the
+// batch, or the name of the file for fileName
+struct BatchFile {
+    std::string filePath;
+    std::string fileKey;
+    std::string fileName;
+    std::string mimeType;
+};
+
 struct FileUploadInfo {
     FileTransfer *pParent;
     std::string eventId;
@@ -36,10 +55,30 @@ struct FileUploadInfo {
     std::string fileKey;
     std::string fileName;
     std::string mimeType;
-    std::vector<std::string> params;
+    std::map<std::string, std::string> params;
+    // Files sent as the parts of one request instead of sourceFile; batches
+    // are neither compressed nor hashed
+    std::vector<BatchFile> files;
     bool chunkedMode;
     int chunkSize;
+    // Sends the request body gzip compressed, with Content-Encoding: gzip;
+    // such a body is always sent chunked
+    bool compress;
+    // Checksum of the file, see StreamDigest; empty for none
+    std::string digest;
     std::string windowGroup;
+    // Progress is reported at most every progressInterval ms, and only after
+    // progressStep KB more were sent; no progress is reported if it is 0
+    int progressInterval;
+    int progressStep;
+    // KB of the response body kept for the result; the rest is dropped. 0
+    // drops it all, a negative value keeps it all
+    int maxResponseSize;
+    // Writes the response body to this file instead, only if the upload
+    // succeeds
+    std::string responseFile;
+    // "high", "normal" or "low", see TransferPriority; empty for normal
+    std::string priority;
 };
 
 struct FileDownloadInfo {
@@ -48,45 +87,270 @@ struct FileDownloadInfo {
     std::string source;
     std::string target;
     std::string windowGroup;
+    // Number of ranges fetched at the same time, 1 for a single stream
+    int segments;
+    // Smallest range worth a connection of its own, in KB
+    int minSegmentSize;
+    // Leaves the disk writes to a thread of their own
+    bool writeBehind;
+    // Keeps the file in the download cache, and takes it from there while
+    // the server says it is current
+    bool cache;
+    // As for uploads; the download is fetched as a single stream
+    std::string digest;
+    // As for uploads
+    int progressInterval;
+    int progressStep;
+    // Keeps the body in memory instead of writing target, and hands it over
+    // in the result, "base64" encoded or as a JSON "text" string; empty to
+    // write the file
+    std::string memory;
+    // Largest body kept in memory, in KB
+    int maxMemorySize;
+    // As for uploads
+    std::string priority;
+    // Keeps the download going, in the TransferJournal, once its owner goes
+    // away; otherwise it ends with its owner
+    bool background;
+};
+
+struct TransferJob;
+
+// A download split into byte ranges, each fetched by a job of its own and
+// written straight to its place in the preallocated .part file
+struct SegmentedDownload {
+    SegmentedDownload(int fd, const std::string& url, curl_off_t length, int count);
+    ~SegmentedDownload();
+
+    int fd;
+    // Where the ranges are fetched from, after redirects
+    std::string url;
+    pthread_mutex_t lock;
+    int remaining;
+    bool failed;
+    std::string error;
+    // Progress of all segments together
+    curl_off_t length;
+    curl_off_t received;
+    ProgressThrottle progress;
+};
+
+struct DownloadSegment {
+    DownloadSegment(SegmentedDownload *download, curl_off_t start, curl_off_t end);
+
+    SegmentedDownload *download;
+    curl_off_t start;
+    curl_off_t end;
+    curl_off_t done;
 };
 
-struct uploadAttributes {
-    FILE *file;
-    int max_chunk_size;
+// Everything that belongs to one transfer between its preparation and the
+// moment its result is known
+struct TransferJob {
+    explicit TransferJob(FileUploadInfo *info);
+    explicit TransferJob(FileDownloadInfo *info);
+    ~TransferJob();
+
+    FileTransfer *pParent;
+    std::string eventId;
+    TransferPriority priority;
+    FileUploadInfo *uploadInfo;
+    FileDownloadInfo *downloadInfo;
+    CURL *curl;
+    struct curl_httppost *formpost;
+    struct curl_slist *headerlist;
+#if LIBCURL_VERSION_NUM >= 0x073800
+    curl_mime *mime;
+#endif
+    UploadSource source;
+    // One for each file of a batch, NULL for those that could not be opened
+    std::vector<UploadSource *> batch;
+    CompressedBody body;
+    // Of the file, over the bytes read or written so far
+    StreamDigest digest;
+    // The response body of an upload as far as it is kept, or the body of a
+    // download kept in memory, and its length
+    std::string response;
+    curl_off_t responseSize;
+    bool responseFailed;
+    std::string sourceEscaped;
+    std::string targetEscaped;
+    std::string parsedDomain;
+    std::string host;
+    std::string windowGroup;
+    bool blockedDomain;
+    bool skipVerify;
+    bool prepared;
+    std::string result;
+    // Id of the transfer in the TransferJournal, empty if it is not kept there
+    std::string journalId;
+    // How many answers about certificates the TransferEngine had when it
+    // last started the job
+    unsigned long answersSeen;
+
+    // Downloads are written to a .part file; partial.bytes counts what it holds
+    DownloadSink sink;
+    PartialDownload partial;
+    curl_off_t journaled;
+    curl_off_t resumeFrom;
+    curl_off_t rangeStart;
+    long headerStatus;
+    int attempts;
+    bool responseChecked;
+    bool discardBody;
+    bool rangeRejected;
+
+    // Segmented downloads first probe the server with a HEAD request
+    int segmentCount;
+    curl_off_t minSegmentSize;
+    bool probing;
+    bool acceptRanges;
+    DownloadSegment *segment;
+
+    // Downloads using the cache ask whether the copy they have is current
+    bool useCache;
+    bool revalidating;
+    bool cacheHit;
+    bool noStore;
+    CacheValidators cached;
+
+    ProgressThrottle progress;
 };
 
 enum FileTransferErrorCodes {
     FILE_NOT_FOUND_ERR = 1,
     INVALID_URL_ERR = 2,
     CONNECTION_ERR = 3,
-    PERMISSIONS_ERR  = 4
+    PERMISSIONS_ERR  = 4,
+    INTEGRITY_ERR = 5,
+    ABORT_ERR = 6,
+    TOO_LARGE_ERR = 7
 };
 
-typedef std::map<std::string, bool> DomainVerifyMap;
-
 class FileTransferCurl {
 public:
     FileTransferCurl();
     ~FileTransferCurl();
+
+    // Blocking transfers
     std::string Upload(FileUploadInfo *uploadInfo);
     std::string Download(FileDownloadInfo *downloadInfo);
-    static size_t DownloadWriteCallback(void *ptr, size_t size, size_t nmemb, FILE *stream);
+
+    // Steps of a transfer driven by someone else, e.g. a curl multi handle.
+    // Prepare() sets up job->curl; if it returns false the transfer is over
+    // and job->result holds the error.
+    bool Prepare(TransferJob *job);
+    // Whether a download resumes data that was never hashed, e.g. from an
+    // earlier run of the application, or an upload is sent by curl straight
+    // from its file. CatchUp() reads it back from the file, or has the
+    // download start over if it cannot, and must be done before the transfer
+    // starts; the engine does it off its own thread.
+    bool NeedsCatchUp(TransferJob *job);
+    void CatchUp(TransferJob *job);
+    // Whether a failed transfer may be retried after asking the user about
+    // the certificate of the server
+    bool NeedsCertificatePrompt(TransferJob *job, CURLcode result);
+    // Shows the certificate dialog for the domain, and remembers an answer
+    // for always; returns whether the user accepted the certificate
+    bool AskCertificate(const std::string& windowGroup, const std::string& domain);
+    // Sets up a job that failed on the certificate to start over without
+    // verifying it
+    void AcceptCertificate(TransferJob *job);
+    // Both of the above for one job; returns true if the transfer should be
+    // restarted, in which case the job has been set up again
+    bool PromptCertificate(TransferJob *job);
+    // Whether a failed download should be tried again after delayMs; if so
+    // the job has been set up to continue where it stopped. May restore,
+    // hash or sync files, so the engine does not call it on its own thread
+    bool PrepareRetry(TransferJob *job, CURLcode result, int& delayMs);
+    // Moves a download past its probe. Returns false if the job was not
+    // probing; otherwise the job has been replaced by the jobs in next, which
+    // may include the job itself. A job left out of next is over, and has
+    // a result only if it must be reported.
+    bool Advance(TransferJob *job, CURLcode result, std::vector<TransferJob *>& next);
+    // Builds job->result and releases everything the transfer used
+    void Finish(TransferJob *job, CURLcode result);
+    // Ends a transfer that was cancelled at any point, prepared or not and
+    // no longer attached to a multi handle, the same way with ABORT_ERR.
+    // The partial data of a download is removed.
+    void Abort(TransferJob *job);
+    // Ends a download that was never prepared, as another transfer is
+    // writing its target, with PERMISSIONS_ERR
+    void Refuse(TransferJob *job);
+    // Hands orphan, a download that lost its owner, over to the owner of
+    // job, with the progress and digest options job was submitted with.
+    // Returns false if those cannot be used, leaving orphan as it was and
+    // the error in job->result
+    bool TakeOver(TransferJob *orphan, TransferJob *job);
+
+    static std::string HostOf(const std::string& url);
+    static size_t DownloadWriteCallback(void *ptr, size_t size, size_t nmemb, void *userdata);
+    static size_t DownloadHeaderCallback(char *buffer, size_t size, size_t nitems, void *userdata);
+    static size_t SegmentWriteCallback(void *ptr, size_t size, size_t nmemb, void *userdata);
+    static size_t MemoryWriteCallback(void *ptr, size_t size, size_t nmemb, void *userdata);
+    static int ProgressCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
+#if LIBCURL_VERSION_NUM < 0x072000
+    static int LegacyProgressCallback(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow);
+#endif
     static int mkdir_p (const char *pathname, mode_t mode);
-    static size_t UploadReadCallback(void *ptr, size_t size, size_t nmemb, void *userdata);
+    static size_t UploadReadCallback(char *ptr, size_t size, size_t nmemb, void *userdata);
+    static int UploadSeekCallback(void *userdata, curl_off_t offset, int origin);
+    static size_t CompressedReadCallback(char *ptr, size_t size, size_t nmemb, void *userdata);
+    static int CompressedSeekCallback(void *userdata, curl_off_t offset, int origin);
     static size_t UploadWriteCallback(void *ptr, size_t size, size_t nmemb, void *userdata);
 private:
-    DomainVerifyMap *m_pVerifyMap;
-    void loadVerifyList();
-    void saveVerifyList();
-    CURLcode openDialog(CURL *curl, const std::string &windowGroup, const std::string &parsedDomain);
+    bool prepareUpload(TransferJob *job);
+    bool prepareFile(TransferJob *job, size_t chunkSize);
+    bool prepareBatch(TransferJob *job, size_t chunkSize);
+    void prepareForm(TransferJob *job);
+    bool uploadNeedsCatchUp(TransferJob *job);
+    void addFilePart(TransferJob *job, UploadSource *source, const std::string& path, const std::string& key,
+                     const std::string& name, const std::string& type, struct curl_httppost **lastptr);
+    bool prepareCompressed(TransferJob *job, size_t chunkSize);
+    bool prepareDownload(TransferJob *job);
+    bool prepareStream(TransferJob *job);
+    static void prepareMemory(TransferJob *job);
+    bool prepareSegment(TransferJob *job);
+    void splitDownload(TransferJob *job, curl_off_t length, int count, std::vector<TransferJob *>& next);
+    std::string finishSegment(TransferJob *job, bool complete, const std::string& error);
+    std::string batchResult(TransferJob *job, CURLcode result, long httpStatus, bool& error);
+    std::string uploadError(TransferJob *job, int code, long httpStatus);
+    static std::string batchParts(TransferJob *job, int code);
+    std::string downloadError(TransferJob *job, CURLcode result, long httpStatus);
+    std::string downloadSuccess(TransferJob *job);
+    std::string memoryResult(TransferJob *job, CURLcode result, long httpStatus);
+    static void storeInCache(TransferJob *job);
+    void checkDomain(TransferJob *job, const std::string& url);
+    static void describe(TransferJob *job);
+    static bool openPartial(TransferJob *job);
+    static void requestRange(TransferJob *job);
+    static void requestSegment(TransferJob *job);
+    static void watchProgress(TransferJob *job, int intervalMs, int stepKb);
+    static bool checkResponse(TransferJob *job);
+    static bool truncatePartial(TransferJob *job);
+    static bool reserve(TransferJob *job, curl_off_t offset);
+    static bool checkDigest(TransferJob *job, const std::string& path, curl_off_t length);
+    static void saveJournal(TransferJob *job);
+    static void checkpoint(TransferJob *job);
+    static bool isTransient(CURLcode result);
+    void release(TransferJob *job);
+    std::string run(TransferJob *job);
+    int openDialog(const std::string &windowGroup, const std::string &parsedDomain);
     std::string parseDomain(const std::string& url);
-    std::string buildUploadSuccessString(const int bytesSent, const int responseCode, const std::string& response);
+    static std::string escape(const std::string& value);
+    static std::string formName(const std::string& value);
+    static std::string makeBoundary();
+    static void acceptEncodings(CURL *curl, bool accept);
+    static FileTransferErrorCodes errorCode(CURLcode result);
+    std::string buildUploadSuccessString(const curl_off_t bytesSent, const int responseCode, const std::string& digest, const curl_off_t responseSize, const std::string& response);
     std::string buildUploadErrorString(const int errorCode, const std::string& sourceFile, const std::string& targetURL, const int httpStatus);
-    std::string buildDownloadSuccessString(const bool isFile, const bool isDirectory, const std::string& name, const std::string& fullPath);
+    std::string buildBatchSuccessString(const curl_off_t bytesSent, const int responseCode, const std::string& parts, const curl_off_t responseSize, const std::string& response);
+    std::string buildBatchErrorString(const int errorCode, const std::string& sourceFiles, const std::string& targetURL, const int httpStatus, const std::string& parts);
+    std::string buildDownloadSuccessString(const bool isFile, const bool isDirectory, const std::string& cache, const long cacheHits, const long cacheMisses, const std::string& digest, const std::string& name, const std::string& fullPath);
     std::string buildDownloadErrorString(const int code, const std::string& source, const std::string& target, const int httpStatus);
+    std::string buildDownloadDataString(const int responseCode, const std::string& encoding, const std::string& digest, const std::string& data);
 };
 
 } // namespace webworks
 
 #endif // FILETRANSFER_CURL_H_
-
@@ -0,0 +1,349 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "filetransfer_digest.hpp"
+
+#include <curl/curl.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/evp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+namespace webworks {
+
+// Castagnoli polynomial, bit reversed
+static const uint32_t CRC32C_POLYNOMIAL = 0x82f63b78;
+
+// Files are read in pieces of this size when a digest has to catch up
+static const size_t CATCH_UP_SIZE = 256 * 1024;
+
+static uint32_t s_crcTable[8][256];
+static bool s_crcHardware = false;
+static pthread_once_t s_crcOnce = PTHREAD_ONCE_INIT;
+
+static void initCrc32c()
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+        }
+        s_crcTable[0][i] = crc;
+    }
+
+    for (int k = 1; k < 8; k++) {
+        for (int i = 0; i < 256; i++) {
+            s_crcTable[k][i] = (s_crcTable[k - 1][i] >> 8) ^ s_crcTable[0][s_crcTable[k - 1][i] & 0xff];
+        }
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    // SSE 4.2 brought an instruction for exactly this CRC
+    unsigned int eax, ebx, ecx, edx;
+    s_crcHardware = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2);
+#elif defined(__ARM_FEATURE_CRC32)
+    s_crcHardware = true;
+#endif
+}
+
+// Eight table lookups per eight bytes
+static uint32_t crc32cSoftware(uint32_t crc, const unsigned char *p, size_t length)
+{
+    while (length >= 8) {
+        const uint32_t low = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24));
+        const uint32_t high = p[4] | (p[5] << 8) | (p[6] << 16) | (static_cast<uint32_t>(p[7]) << 24);
+
+        crc = s_crcTable[7][low & 0xff] ^ s_crcTable[6][(low >> 8) & 0xff]
+            ^ s_crcTable[5][(low >> 16) & 0xff] ^ s_crcTable[4][low >> 24]
+            ^ s_crcTable[3][high & 0xff] ^ s_crcTable[2][(high >> 8) & 0xff]
+            ^ s_crcTable[1][(high >> 16) & 0xff] ^ s_crcTable[0][high >> 24];
+
+        p += 8;
+        length -= 8;
+    }
+
+    while (length-- > 0) {
+        crc = s_crcTable[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+static uint32_t crc32cHardware(uint32_t crc, const unsigned char *p, size_t length)
+{
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (length >= 8) {
+        uint64_t value;
+        memcpy(&value, p, sizeof(value));
+        __asm__("crc32q %1, %0" : "+r"(crc64) : "rm"(value));
+        p += 8;
+        length -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+    while (length >= 4) {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        __asm__("crc32l %1, %0" : "+r"(crc) : "rm"(value));
+        p += 4;
+        length -= 4;
+    }
+
+    while (length-- > 0) {
+        __asm__("crc32b %1, %0" : "+r"(crc) : "rm"(*p));
+        p++;
+    }
+#elif defined(__ARM_FEATURE_CRC32)
+    while (length >= 8) {
+        uint64_t value;
+        memcpy(&value, p, sizeof(value));
+        crc = __crc32cd(crc, value);
+        p += 8;
+        length -= 8;
+    }
+
+    while (length-- > 0) {
+        crc = __crc32cb(crc, *p++);
+    }
+#else
+    crc = crc32cSoftware(crc, p, length);
+#endif
+
+    return crc;
+}
+
+StreamDigest::StreamDigest()
+    : m_algorithm(NONE), m_md(NULL), m_context(NULL), m_crc(0), m_length(0), m_finished(false)
+{
+}
+
+StreamDigest::~StreamDigest()
+{
+    if (m_context) {
+        EVP_MD_CTX_destroy(m_context);
+    }
+}
+
+bool StreamDigest::Configure(const std::string& spec)
+{
+    const std::string::size_type colon = spec.find(':');
+    std::string name;
+    std::string expected;
+
+    // Names are compared without case and dashes, so "SHA256" works too
+    for (std::string::size_type i = 0; i < spec.size() && i < colon; i++) {
+        if (spec[i] != '-') {
+            name += static_cast<char>(tolower(static_cast<unsigned char>(spec[i])));
+        }
+    }
+
+    if (colon != std::string::npos) {
+        for (std::string::size_type i = colon + 1; i < spec.size(); i++) {
+            if (!isxdigit(static_cast<unsigned char>(spec[i]))) {
+                return false;
+            }
+            expected += static_cast<char>(tolower(static_cast<unsigned char>(spec[i])));
+        }
+    }
+
+    const EVP_MD *md = NULL;
+    size_t hexLength = 0;
+
+    if (name == "sha256") {
+        m_algorithm = SHA256;
+        m_name = "sha-256";
+        md = EVP_sha256();
+    } else if (name == "sha1") {
+        m_algorithm = SHA1;
+        m_name = "sha-1";
+        md = EVP_sha1();
+    } else if (name == "md5") {
+        m_algorithm = MD5;
+        m_name = "md5";
+        md = EVP_md5();
+    } else if (name == "crc32c") {
+        m_algorithm = CRC32C;
+        m_name = "crc32c";
+        hexLength = 8;
+        pthread_once(&s_crcOnce, initCrc32c);
+    } else {
+        m_algorithm = NONE;
+        return false;
+    }
+
+    if (md) {
+        hexLength = 2 * static_cast<size_t>(EVP_MD_size(md));
+        if (!m_context) {
+            m_context = EVP_MD_CTX_create();
+        }
+        if (!m_context || !EVP_DigestInit_ex(m_context, md, NULL)) {
+            m_algorithm = NONE;
+            return false;
+        }
+    }
+
+    m_md = md;
+
+    if (!expected.empty() && expected.size() != hexLength) {
+        m_algorithm = NONE;
+        return false;
+    }
+
+    m_expected = expected;
+    m_crc = 0;
+    m_length = 0;
+    m_finished = false;
+    m_result.clear();
+
+    return true;
+}
+
+bool StreamDigest::IsEnabled() const
+{
+    return m_algorithm != NONE;
+}
+
+void StreamDigest::Reset()
+{
+    if (m_context) {
+        EVP_DigestInit_ex(m_context, m_md, NULL);
+    }
+
+    m_crc = 0;
+    m_length = 0;
+    m_finished = false;
+    m_result.clear();
+}
+
+void StreamDigest::Update(const char *data, size_t length)
+{
+    if (m_algorithm == NONE || m_finished || length == 0) {
+        return;
+    }
+
+    if (m_algorithm == CRC32C) {
+        m_crc = Crc32c(m_crc, data, length);
+    } else {
+        EVP_DigestUpdate(m_context, data, length);
+    }
+
+    m_length += length;
+}
+
+curl_off_t StreamDigest::Length() const
+{
+    return m_length;
+}
+
+bool StreamDigest::CatchUp(const std::string& path, curl_off_t length)
+{
+    if (m_algorithm == NONE || m_length == length) {
+        return true;
+    }
+
+    if (m_length > length || m_finished) {
+        Reset();
+    }
+
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    std::vector<char> buffer(CATCH_UP_SIZE);
+    bool ok = true;
+
+    while (ok && m_length < length) {
+        const curl_off_t left = length - m_length;
+        const size_t wanted = left < static_cast<curl_off_t>(buffer.size()) ? static_cast<size_t>(left) : buffer.size();
+
+        ssize_t amount;
+        do {
+            amount = pread(fd, &buffer[0], wanted, m_length);
+        } while (amount < 0 && errno == EINTR);
+
+        if (amount <= 0) {
+            ok = false;
+        } else {
+            Update(&buffer[0], static_cast<size_t>(amount));
+        }
+    }
+
+    close(fd);
+    return ok;
+}
+
+std::string StreamDigest::Result()
+{
+    if (m_algorithm == NONE || m_finished) {
+        return m_result;
+    }
+
+    char hex[2 * EVP_MAX_MD_SIZE + 1] = "";
+
+    if (m_algorithm == CRC32C) {
+        snprintf(hex, sizeof(hex), "%08x", m_crc);
+    } else {
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int size = 0;
+
+        EVP_DigestFinal_ex(m_context, digest, &size);
+        for (unsigned int i = 0; i < size; i++) {
+            snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+        }
+    }
+
+    m_finished = true;
+    m_result = m_name + ":" + hex;
+
+    return m_result;
+}
+
+bool StreamDigest::Matches()
+{
+    const std::string result = Result();
+
+    return m_expected.empty() || result.compare(m_name.size() + 1, std::string::npos, m_expected) == 0;
+}
+
+uint32_t StreamDigest::Crc32c(uint32_t crc, const char *data, size_t length)
+{
+    pthread_once(&s_crcOnce, initCrc32c);
+
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+    crc = ~crc;
+    crc = s_crcHardware ? crc32cHardware(crc, p, length) : crc32cSoftware(crc, p, length);
+
+    return ~crc;
+}
+
+} // namespace webworks
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FILETRANSFER_DIGEST_H_
+#define FILETRANSFER_DIGEST_H_
+
+#include <curl/curl.h>
+#include <openssl/evp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace webworks {
+
+/*
+ * Checksum of a file computed from the bytes a transfer moves anyway, so
+ * the file does not have to be read again afterwards. Configured with
+ * "algorithm" or "algorithm:hex", e.g. "sha-256:9f86d0..."; in the second
+ * form the result must match the hex digest given.
+ */
+class StreamDigest {
+public:
+    enum Algorithm {
+        NONE,
+        SHA256,
+        SHA1,
+        MD5,
+        CRC32C
+    };
+
+    StreamDigest();
+    ~StreamDigest();
+
+    // Returns false for an unknown algorithm or a malformed digest
+    bool Configure(const std::string& spec);
+    bool IsEnabled() const;
+    void Reset();
+
+    // Bytes have to be added in order, each exactly once
+    void Update(const char *data, size_t length);
+    curl_off_t Length() const;
+    // Hashes what the file at path holds between Length() and length,
+    // starting over if more than that was hashed already
+    bool CatchUp(const std::string& path, curl_off_t length);
+
+    // "algorithm:hex"; no more bytes can be added after this
+    std::string Result();
+    // Whether Result() matches the digest asked for, if any
+    bool Matches();
+
+    static uint32_t Crc32c(uint32_t crc, const char *data, size_t length);
+
+private:
+    StreamDigest(StreamDigest const&);
+    void operator=(StreamDigest const&);
+
+    Algorithm m_algorithm;
+    std::string m_name;
+    std::string m_expected;
+    const EVP_MD *m_md;
+    EVP_MD_CTX *m_context;
+    uint32_t m_crc;
+    curl_off_t m_length;
+    bool m_finished;
+    std::string m_result;
+};
+
+} // namespace webworks
+
+#endif // FILETRANSFER_DIGEST_H_
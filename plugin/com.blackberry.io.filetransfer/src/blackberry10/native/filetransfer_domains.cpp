@@ -0,0 +1,150 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "filetransfer_domains.hpp"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <map>
+#include <string>
+
+namespace webworks {
+
+DomainPolicy *DomainPolicy::s_instance = NULL;
+pthread_once_t DomainPolicy::s_once = PTHREAD_ONCE_INIT;
+
+DomainPolicy& DomainPolicy::Instance()
+{
+    pthread_once(&s_once, createInstance);
+    return *s_instance;
+}
+
+void DomainPolicy::createInstance()
+{
+    s_instance = new DomainPolicy();
+}
+
+DomainPolicy::DomainPolicy() : m_lines(0)
+{
+    pthread_mutex_init(&m_lock, NULL);
+
+    const char *home = getenv("HOME");
+    m_path = std::string(home ? home : "") + "/verifiedDomainList";
+
+    load();
+}
+
+DomainPolicy::~DomainPolicy()
+{
+    // The policy lives as long as the process
+}
+
+bool DomainPolicy::Lookup(const std::string& domain, bool& allowed)
+{
+    pthread_mutex_lock(&m_lock);
+    const DomainMap::const_iterator it = m_domains.find(domain);
+    const bool found = it != m_domains.end();
+    if (found) {
+        allowed = it->second;
+    }
+    pthread_mutex_unlock(&m_lock);
+
+    return found;
+}
+
+void DomainPolicy::Remember(const std::string& domain, bool allowed)
+{
+    pthread_mutex_lock(&m_lock);
+    const DomainMap::iterator it = m_domains.find(domain);
+
+    if (it == m_domains.end() || it->second != allowed) {
+        m_domains[domain] = allowed;
+
+        const size_t stale = m_lines - m_domains.size();
+        if (!(stale >= MIN_STALE_LINES && stale >= m_domains.size() && compact())) {
+            append(domain, allowed);
+        }
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+void DomainPolicy::load()
+{
+    std::ifstream domainList(m_path.c_str());
+    std::string line;
+
+    while (std::getline(domainList, line)) {
+        const std::string::size_type comma = line.find_first_of(",");
+        if (comma == std::string::npos || comma == 0) {
+            continue;
+        }
+
+        m_domains[line.substr(0, comma)] = atoi(line.c_str() + comma + 1) != 0;
+        m_lines++;
+    }
+}
+
+bool DomainPolicy::append(const std::string& domain, bool allowed)
+{
+    const std::string line = domain + (allowed ? ",1\n" : ",0\n");
+
+    // One write per line, so lines of concurrent writers never mix
+    const int fd = open(m_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    const bool ok = write(fd, line.data(), line.length()) == static_cast<ssize_t>(line.length());
+    close(fd);
+
+    if (ok) {
+        m_lines++;
+    }
+
+    return ok;
+}
+
+bool DomainPolicy::compact()
+{
+    const std::string temp = m_path + ".tmp";
+
+    FILE *domainList = fopen(temp.c_str(), "w");
+    if (!domainList) {
+        return false;
+    }
+
+    for (DomainMap::const_iterator it = m_domains.begin(); it != m_domains.end(); ++it) {
+        fprintf(domainList, "%s,%d\n", it->first.c_str(), it->second ? 1 : 0);
+    }
+
+    bool ok = fflush(domainList) == 0 && fsync(fileno(domainList)) == 0;
+    ok = fclose(domainList) == 0 && ok;
+
+    // Readers see either the old list or the new one, never half of it
+    if (!ok || rename(temp.c_str(), m_path.c_str()) != 0) {
+        remove(temp.c_str());
+        return false;
+    }
+
+    m_lines = m_domains.size();
+    return true;
+}
+
+} // namespace webworks
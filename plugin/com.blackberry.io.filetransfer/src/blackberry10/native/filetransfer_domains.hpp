@@ -0,0 +1,70 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FILETRANSFER_DOMAINS_H_
+#define FILETRANSFER_DOMAINS_H_
+
+#include <pthread.h>
+#include <map>
+#include <string>
+
+namespace webworks {
+
+/*
+ * What the user decided about servers whose certificate could not be
+ * verified, shared by every transfer of the process. The list is read from
+ * $HOME/verifiedDomainList once; every decision is appended to it as a line
+ * of its own, later lines overriding earlier ones, and the file is rewritten
+ * without the overridden lines once they outnumber the live ones.
+ */
+class DomainPolicy {
+public:
+    static DomainPolicy& Instance();
+
+    // Whether the user decided about the domain; if so, allowed is set
+    bool Lookup(const std::string& domain, bool& allowed);
+    // Remembers a decision, on disk as well unless it was known already
+    void Remember(const std::string& domain, bool allowed);
+
+private:
+    typedef std::map<std::string, bool> DomainMap;
+
+    // Overridden lines tolerated before the file is rewritten
+    static const size_t MIN_STALE_LINES = 32;
+
+    DomainPolicy();
+    ~DomainPolicy();
+    explicit DomainPolicy(DomainPolicy const&);
+    void operator=(DomainPolicy const&);
+
+    static void createInstance();
+    void load();
+    bool append(const std::string& domain, bool allowed);
+    bool compact();
+
+    std::string m_path;
+    DomainMap m_domains;
+    // Lines in the file, including overridden ones
+    size_t m_lines;
+    pthread_mutex_t m_lock;
+
+    static DomainPolicy *s_instance;
+    static pthread_once_t s_once;
+};
+
+} // namespace webworks
+
+#endif // FILETRANSFER_DOMAINS_H_
@@ -0,0 +1,968 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "filetransfer_engine.hpp"
+#include "filetransfer_cache.hpp"
+#include "filetransfer_journal.hpp"
+#include "filetransfer_js.hpp"
+#include "filetransfer_progress.hpp"
+
+#include <curl/curl.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/select.h>
+#include <time.h>
+#include <unistd.h>
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace webworks {
+
+// Longest time the engine thread sleeps when curl has nothing to do
+static const int MAX_WAIT_MS = 1000;
+
+TransferLimits::TransferLimits()
+    : maxTransfers(8), maxTransfersPerHost(4), maxStreamsPerHost(32), cacheSize(20 * 1024), maxRate(0), maxRateHigh(0),
+      maxRateNormal(0), maxRateLow(0)
+{
+}
+
+TransferStats::TransferStats()
+    : queuedHigh(0), queuedNormal(0), queuedLow(0), runningHigh(0), runningNormal(0), runningLow(0), delayed(0),
+      prompting(0), rate(0)
+{
+}
+
+TransferEngine *TransferEngine::s_instance = NULL;
+pthread_once_t TransferEngine::s_once = PTHREAD_ONCE_INIT;
+
+TransferEngine& TransferEngine::Instance()
+{
+    pthread_once(&s_once, createInstance);
+    return *s_instance;
+}
+
+void TransferEngine::createInstance()
+{
+    s_instance = new TransferEngine();
+}
+
+TransferEngine::TransferEngine() : m_abortsQueued(0), m_abortsDone(0), m_answerCount(0), m_active(0)
+{
+    for (int i = 0; i < PRIORITY_CLASSES; i++) {
+        m_queued[i] = 0;
+        m_running[i] = 0;
+    }
+
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_abortsTaken, NULL);
+    pthread_cond_init(&m_settleQueued, NULL);
+
+    m_wakeFds[0] = m_wakeFds[1] = -1;
+    if (pipe(m_wakeFds) == 0) {
+        fcntl(m_wakeFds[0], F_SETFL, fcntl(m_wakeFds[0], F_GETFL) | O_NONBLOCK);
+        fcntl(m_wakeFds[1], F_SETFL, fcntl(m_wakeFds[1], F_GETFL) | O_NONBLOCK);
+    }
+
+    m_multi = curl_multi_init();
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    curl_multi_setopt(m_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+    DownloadCache::Instance().SetCapacity(static_cast<curl_off_t>(m_limits.cacheSize) * 1024);
+
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+
+    pthread_t thread;
+    pthread_create(&thread, &thread_attr, engineThread, this);
+    pthread_create(&thread, &thread_attr, settleThread, this);
+    pthread_attr_destroy(&thread_attr);
+}
+
+TransferEngine::~TransferEngine()
+{
+    // The engine lives as long as the process
+}
+
+void TransferEngine::Submit(TransferJob *job)
+{
+    pthread_mutex_lock(&m_lock);
+    m_submitted.push_back(job);
+    pthread_mutex_unlock(&m_lock);
+
+    wakeUp();
+}
+
+void TransferEngine::SetLimits(const TransferLimits& limits)
+{
+    pthread_mutex_lock(&m_lock);
+    m_limits.maxTransfers = limits.maxTransfers > 0 ? limits.maxTransfers : 1;
+    m_limits.maxTransfersPerHost = limits.maxTransfersPerHost > 0 ? limits.maxTransfersPerHost : 1;
+    m_limits.maxStreamsPerHost = limits.maxStreamsPerHost > 0 ? limits.maxStreamsPerHost : 1;
+    m_limits.cacheSize = limits.cacheSize > 0 ? limits.cacheSize : 0;
+    m_limits.maxRate = limits.maxRate > 0 ? limits.maxRate : 0;
+    m_limits.maxRateHigh = limits.maxRateHigh > 0 ? limits.maxRateHigh : 0;
+    m_limits.maxRateNormal = limits.maxRateNormal > 0 ? limits.maxRateNormal : 0;
+    m_limits.maxRateLow = limits.maxRateLow > 0 ? limits.maxRateLow : 0;
+    pthread_mutex_unlock(&m_lock);
+
+    DownloadCache::Instance().SetCapacity(static_cast<curl_off_t>(limits.cacheSize > 0 ? limits.cacheSize : 0) * 1024);
+
+    // Raised limits may let queued transfers start
+    wakeUp();
+}
+
+TransferLimits TransferEngine::Limits()
+{
+    pthread_mutex_lock(&m_lock);
+    const TransferLimits limits = m_limits;
+    pthread_mutex_unlock(&m_lock);
+
+    return limits;
+}
+
+TransferStats TransferEngine::Stats()
+{
+    pthread_mutex_lock(&m_lock);
+    const TransferStats stats = m_stats;
+    pthread_mutex_unlock(&m_lock);
+
+    return stats;
+}
+
+void TransferEngine::Abort(FileTransfer *owner, const std::string& eventId)
+{
+    AbortRequest request;
+    request.owner = owner;
+    request.eventId = eventId;
+    request.report = true;
+
+    pthread_mutex_lock(&m_lock);
+    m_aborts.push_back(request);
+    m_abortsQueued++;
+    pthread_mutex_unlock(&m_lock);
+
+    wakeUp();
+}
+
+void TransferEngine::AbortJournaled(const std::string& journalId)
+{
+    AbortRequest request;
+    request.owner = NULL;
+    request.journalId = journalId;
+    request.report = true;
+
+    pthread_mutex_lock(&m_lock);
+    m_aborts.push_back(request);
+    m_abortsQueued++;
+    pthread_mutex_unlock(&m_lock);
+
+    wakeUp();
+}
+
+void TransferEngine::AbortAll(FileTransfer *owner)
+{
+    AbortRequest request;
+    request.owner = owner;
+    request.report = false;
+
+    pthread_mutex_lock(&m_lock);
+    m_aborts.push_back(request);
+    const unsigned long ticket = ++m_abortsQueued;
+    pthread_mutex_unlock(&m_lock);
+
+    wakeUp();
+
+    pthread_mutex_lock(&m_lock);
+    while (m_abortsDone < ticket) {
+        pthread_cond_wait(&m_abortsTaken, &m_lock);
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+void TransferEngine::wakeUp()
+{
+    const char c = 0;
+    if (write(m_wakeFds[1], &c, 1) < 0) {
+        // Full pipe, the engine thread is already due to wake up
+    }
+}
+
+void *TransferEngine::engineThread(void *arg)
+{
+    static_cast<TransferEngine *>(arg)->run();
+    return NULL;
+}
+
+void TransferEngine::run()
+{
+    for (;;) {
+        takeSettled();
+        takeSubmitted();
+        takeAnswers();
+        takeAborts();
+
+        // Caps come first, so that transfers start under them
+        const TransferLimits limits = Limits();
+        shape(limits);
+        startDelayed();
+        startPending(limits);
+
+        int running = 0;
+        curl_multi_perform(m_multi, &running);
+
+        // Finished transfers free up slots, so go round again straight away
+        // to start the transfers waiting for them
+        const bool completed = readCompleted();
+        publishStats();
+        if (!completed) {
+            wait();
+        }
+    }
+}
+
+void TransferEngine::takeSubmitted()
+{
+    std::deque<TransferJob *> submitted;
+
+    pthread_mutex_lock(&m_lock);
+    submitted.swap(m_submitted);
+    pthread_mutex_unlock(&m_lock);
+
+    // Those held back by adopt() try again first
+    std::vector<TransferJob *> held;
+    held.swap(m_held);
+    for (std::vector<TransferJob *>::iterator it = held.begin(); it != held.end(); ++it) {
+        if (!adopt(*it)) {
+            enqueue(*it, false);
+        }
+    }
+
+    for (std::deque<TransferJob *>::iterator it = submitted.begin(); it != submitted.end(); ++it) {
+        m_inFlight.insert(std::make_pair((*it)->eventId, *it));
+        if (refuse(*it) || adopt(*it)) {
+            continue;
+        }
+        enqueue(*it, false);
+    }
+}
+
+// Ends a download to a file another transfer is writing already, but for the
+// jobs of its own journal entry that lost their owner, which adopt() takes
+bool TransferEngine::refuse(TransferJob *job)
+{
+    if (!job->downloadInfo || !job->downloadInfo->memory.empty()) {
+        return false;
+    }
+
+    for (std::multimap<std::string, TransferJob *>::const_iterator it = m_inFlight.begin(); it != m_inFlight.end(); ++it) {
+        const TransferJob *other = it->second;
+        if (other != job && other->downloadInfo && other->downloadInfo->memory.empty()
+                && other->downloadInfo->target == job->downloadInfo->target
+                && (other->pParent || other->journalId != job->journalId)) {
+            m_curl.Refuse(job);
+            complete(job);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Hands the jobs of the same journal entry that lost their owner over to the
+// owner of job, which is dropped, along with the options it asked for. Job is
+// held back while any of them is being settled
+bool TransferEngine::adopt(TransferJob *job)
+{
+    if (job->journalId.empty()) {
+        return false;
+    }
+
+    for (std::multimap<std::string, TransferJob *>::const_iterator it = m_inFlight.begin(); it != m_inFlight.end(); ++it) {
+        if (!it->second->pParent && it->second->journalId == job->journalId && m_settling.count(it->second)) {
+            m_held.push_back(job);
+            return true;
+        }
+    }
+
+    std::vector<TransferJob *> orphans;
+    for (std::multimap<std::string, TransferJob *>::iterator it = m_inFlight.begin(); it != m_inFlight.end();) {
+        if (!it->second->pParent && it->second->journalId == job->journalId) {
+            orphans.push_back(it->second);
+            m_inFlight.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+
+    if (orphans.empty()) {
+        return false;
+    }
+
+    // The options are the same for all of them, so if the first cannot take
+    // them none can; the orphans then go on as they were, and job fails
+    const bool taken = m_curl.TakeOver(orphans.front(), job);
+    for (std::vector<TransferJob *>::iterator it = orphans.begin(); it != orphans.end(); ++it) {
+        if (taken && it != orphans.begin()) {
+            m_curl.TakeOver(*it, job);
+        }
+        m_inFlight.insert(std::make_pair((*it)->eventId, *it));
+    }
+
+    if (!taken) {
+        TransferJournal::Instance().Detached(job->journalId);
+        job->journalId.clear();
+        complete(job);
+        return true;
+    }
+
+    forget(job);
+    delete job;
+    return true;
+}
+
+void TransferEngine::takeAnswers()
+{
+    std::deque<std::pair<std::string, bool> > answers;
+
+    pthread_mutex_lock(&m_lock);
+    answers.swap(m_answers);
+    pthread_mutex_unlock(&m_lock);
+
+    for (std::deque<std::pair<std::string, bool> >::const_iterator it = answers.begin(); it != answers.end(); ++it) {
+        m_answered[it->first] = std::make_pair(++m_answerCount, it->second);
+
+        std::map<std::string, std::vector<TransferJob *> >::iterator awaiting = m_awaiting.find(it->first);
+        if (awaiting == m_awaiting.end()) {
+            continue;
+        }
+
+        std::vector<TransferJob *> jobs;
+        jobs.swap(awaiting->second);
+        m_awaiting.erase(awaiting);
+
+        // In the order they failed; accepted jobs are queued again at the
+        // front, one before the other
+        if (it->second) {
+            for (std::vector<TransferJob *>::reverse_iterator job = jobs.rbegin(); job != jobs.rend(); ++job) {
+                answer(*job, true);
+            }
+        } else {
+            for (std::vector<TransferJob *>::iterator job = jobs.begin(); job != jobs.end(); ++job) {
+                answer(*job, false);
+            }
+        }
+    }
+}
+
+// Parks a job that failed on the certificate of its domain until the user
+// answers about it; returns false if the dialog cannot be shown
+bool TransferEngine::awaitAnswer(TransferJob *job)
+{
+    const std::string& domain = job->parsedDomain;
+
+    // The answer came while the job was running, set up without it
+    std::map<std::string, std::pair<unsigned long, bool> >::const_iterator answered = m_answered.find(domain);
+    if (answered != m_answered.end() && answered->second.first > job->answersSeen) {
+        answer(job, answered->second.second);
+        return true;
+    }
+
+    std::map<std::string, std::vector<TransferJob *> >::iterator awaiting = m_awaiting.find(domain);
+    if (awaiting == m_awaiting.end()) {
+        // The first job shows the dialog for every job of the domain
+        PromptRequest *request = new PromptRequest;
+        request->domain = domain;
+        request->windowGroup = job->windowGroup;
+
+        pthread_attr_t thread_attr;
+        pthread_attr_init(&thread_attr);
+        pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+
+        pthread_t thread;
+        const int created = pthread_create(&thread, &thread_attr, promptThread, request);
+        pthread_attr_destroy(&thread_attr);
+
+        if (created != 0) {
+            delete request;
+            return false;
+        }
+
+        awaiting = m_awaiting.insert(std::make_pair(domain, std::vector<TransferJob *>())).first;
+    }
+
+    awaiting->second.push_back(job);
+    return true;
+}
+
+void TransferEngine::answer(TransferJob *job, bool accepted)
+{
+    if (accepted) {
+        m_curl.AcceptCertificate(job);
+        enqueue(job, true);
+    } else {
+        finish(job, CURLE_SSL_CACERT);
+    }
+}
+
+void TransferEngine::takeAborts()
+{
+    std::deque<AbortRequest> aborts;
+
+    pthread_mutex_lock(&m_lock);
+    aborts.swap(m_aborts);
+    pthread_mutex_unlock(&m_lock);
+
+    if (aborts.empty()) {
+        return;
+    }
+
+    // A job submitted before it was aborted by its journal id has to be in
+    // flight to be found
+    for (std::deque<AbortRequest>::const_iterator request = aborts.begin(); request != aborts.end(); ++request) {
+        if (!request->journalId.empty()) {
+            takeSubmitted();
+            break;
+        }
+    }
+
+    // The jobs of all requests, in order, and whether they report ABORT_ERR;
+    // a job any request ends quietly reports nothing
+    std::vector<TransferJob *> jobs;
+    std::map<TransferJob *, bool> reports;
+    const std::set<TransferJob *> held(m_held.begin(), m_held.end());
+
+    for (std::deque<AbortRequest>::const_iterator request = aborts.begin(); request != aborts.end(); ++request) {
+        // Segments of a download share its callback id
+        std::multimap<std::string, TransferJob *>::iterator first = m_inFlight.begin();
+        std::multimap<std::string, TransferJob *>::iterator last = m_inFlight.end();
+        if (!request->eventId.empty()) {
+            first = m_inFlight.lower_bound(request->eventId);
+            last = m_inFlight.upper_bound(request->eventId);
+        }
+
+        for (std::multimap<std::string, TransferJob *>::iterator it = first; it != last; ++it) {
+            TransferJob *job = it->second;
+            if (request->journalId.empty() ? job->pParent != request->owner : job->journalId != request->journalId) {
+                continue;
+            }
+
+            std::map<TransferJob *, bool>::iterator report = reports.find(job);
+            if (report != reports.end()) {
+                report->second = report->second && request->report;
+            } else if (!request->report && job->downloadInfo && job->downloadInfo->background
+                    && !job->journalId.empty() && !held.count(job)) {
+                // Background downloads carry on when their owner goes away,
+                // and only report to the journal; jobs that have yet to take
+                // one over do not
+                job->pParent = NULL;
+                TransferJournal::Instance().Detached(job->journalId);
+            } else {
+                jobs.push_back(job);
+                reports[job] = request->report;
+            }
+        }
+    }
+
+    abort(jobs, reports);
+
+    pthread_mutex_lock(&m_lock);
+    m_abortsDone += aborts.size();
+    pthread_cond_broadcast(&m_abortsTaken);
+    pthread_mutex_unlock(&m_lock);
+}
+
+// Takes the jobs out of wherever they wait with a single pass over each
+// place, so that ending all transfers of an owner takes no longer than
+// looking at each job once; those found nowhere are running
+void TransferEngine::abort(const std::vector<TransferJob *>& jobs, const std::map<TransferJob *, bool>& reports)
+{
+    std::set<TransferJob *> running;
+
+    for (std::vector<TransferJob *>::const_iterator it = jobs.begin(); it != jobs.end(); ++it) {
+        TransferJob *job = *it;
+
+        // The settle thread has it; what is left is done once it is back
+        std::map<TransferJob *, bool>::iterator settling = m_settling.find(job);
+        if (settling != m_settling.end()) {
+            settling->second = true;
+            if (!reports.find(job)->second) {
+                job->pParent = NULL;
+            }
+        } else {
+            running.insert(job);
+        }
+    }
+
+    if (running.empty()) {
+        return;
+    }
+
+    for (std::vector<TransferJob *>::iterator it = m_held.begin(); it != m_held.end();) {
+        if (running.erase(*it)) {
+            // The download it was to take over goes on without it
+            TransferJournal::Instance().Detached((*it)->journalId);
+            (*it)->journalId.clear();
+            it = m_held.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (int priority = 0; priority < PRIORITY_CLASSES; priority++) {
+        std::list<TransferJob *>& queue = m_pending[priority];
+        for (std::list<TransferJob *>::iterator it = queue.begin(); it != queue.end();) {
+            if (running.erase(*it)) {
+                it = queue.erase(it);
+                m_queued[priority]--;
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    for (std::multimap<long long, TransferJob *>::iterator it = m_delayed.begin(); it != m_delayed.end();) {
+        if (running.erase(it->second)) {
+            m_delayed.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+
+    // Waiting for an answer about the certificate, not attached; the dialog
+    // stays up for the others
+    std::map<std::string, std::vector<TransferJob *> >::iterator awaiting;
+    for (awaiting = m_awaiting.begin(); awaiting != m_awaiting.end(); ++awaiting) {
+        std::vector<TransferJob *>& parked = awaiting->second;
+        for (std::vector<TransferJob *>::iterator it = parked.begin(); it != parked.end();) {
+            if (running.erase(*it)) {
+                it = parked.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    for (std::vector<TransferJob *>::const_iterator it = jobs.begin(); it != jobs.end(); ++it) {
+        TransferJob *job = *it;
+        if (m_settling.count(job)) {
+            continue;
+        }
+        if (running.count(job)) {
+            stopped(job);
+        }
+
+        m_curl.Abort(job);
+        if (!reports.find(job)->second) {
+            // Only the journal is told, of a download taken over from it
+            if (!job->journalId.empty()) {
+                TransferJournal::Instance().Finished(job->journalId, TransferJournal::ResultCode(job->result));
+            }
+            job->result.clear();
+        }
+        complete(job);
+    }
+}
+
+long long TransferEngine::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+void TransferEngine::startDelayed()
+{
+    const long long current = now();
+
+    // Retries go ahead of the jobs that have not run yet
+    while (!m_delayed.empty() && m_delayed.begin()->first <= current) {
+        enqueue(m_delayed.begin()->second, true);
+        m_delayed.erase(m_delayed.begin());
+    }
+}
+
+void TransferEngine::wait()
+{
+    int timeout = MAX_WAIT_MS;
+    long long due = m_delayed.empty() ? -1 : m_delayed.begin()->first;
+    if (m_shaper.Due() >= 0 && (due < 0 || m_shaper.Due() < due)) {
+        due = m_shaper.Due();
+    }
+    if (due >= 0) {
+        due -= now();
+        timeout = due <= 0 ? 0 : (due < timeout ? static_cast<int>(due) : timeout);
+    }
+
+#if LIBCURL_VERSION_NUM >= 0x071c00
+    struct curl_waitfd wake;
+    wake.fd = m_wakeFds[0];
+    wake.events = CURL_WAIT_POLLIN;
+    wake.revents = 0;
+
+    int numfds = 0;
+    curl_multi_wait(m_multi, &wake, 1, timeout, &numfds);
+#else
+    fd_set readfds;
+    fd_set writefds;
+    fd_set errorfds;
+    int maxfd = -1;
+
+    FD_ZERO(&readfds);
+    FD_ZERO(&writefds);
+    FD_ZERO(&errorfds);
+    curl_multi_fdset(m_multi, &readfds, &writefds, &errorfds, &maxfd);
+    FD_SET(m_wakeFds[0], &readfds);
+    if (m_wakeFds[0] > maxfd) {
+        maxfd = m_wakeFds[0];
+    }
+
+    long curlTimeout = -1;
+    curl_multi_timeout(m_multi, &curlTimeout);
+    if (curlTimeout >= 0 && curlTimeout < timeout) {
+        timeout = curlTimeout;
+    }
+
+    struct timeval tv;
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    select(maxfd + 1, &readfds, &writefds, &errorfds, &tv);
+#endif
+
+    char buffer[64];
+    while (read(m_wakeFds[0], buffer, sizeof(buffer)) > 0) {
+    }
+}
+
+void TransferEngine::enqueue(TransferJob *job, bool first)
+{
+    if (first) {
+        m_pending[job->priority].push_front(job);
+    } else {
+        m_pending[job->priority].push_back(job);
+    }
+    m_queued[job->priority]++;
+}
+
+void TransferEngine::startPending(const TransferLimits& limits)
+{
+    for (int priority = 0; priority < PRIORITY_CLASSES; priority++) {
+        std::list<TransferJob *>& queue = m_pending[priority];
+        std::list<TransferJob *>::iterator it = queue.begin();
+
+        while (it != queue.end() && m_active < limits.maxTransfers) {
+            TransferJob *job = *it;
+
+            // Jobs for busy hosts keep their place in the queue
+            const int perHost = m_multiplexed.count(job->host) ? limits.maxStreamsPerHost : limits.maxTransfersPerHost;
+            std::map<std::string, int>::iterator host = m_activePerHost.find(job->host);
+            if (host != m_activePerHost.end() && host->second >= perHost) {
+                ++it;
+                continue;
+            }
+
+            it = queue.erase(it);
+            m_queued[priority]--;
+
+            if (!job->prepared && !m_curl.Prepare(job)) {
+                complete(job);
+                continue;
+            }
+
+            // Comes back as a retry that is due straight away
+            if (m_curl.NeedsCatchUp(job)) {
+                settle(job, CURLE_OK, true);
+                continue;
+            }
+
+            started(job);
+        }
+    }
+}
+
+void TransferEngine::started(TransferJob *job)
+{
+    job->answersSeen = m_answerCount;
+    curl_multi_add_handle(m_multi, job->curl);
+    m_active++;
+    m_activePerHost[job->host]++;
+    m_running[job->priority]++;
+    m_shaper.Add(job->curl, job->priority, now());
+
+    if (!job->journalId.empty()) {
+        TransferJournal::Instance().Started(job->journalId);
+    }
+}
+
+void TransferEngine::stopped(TransferJob *job)
+{
+    m_shaper.Remove(job->curl);
+    curl_multi_remove_handle(m_multi, job->curl);
+    m_active--;
+    if (--m_activePerHost[job->host] <= 0) {
+        m_activePerHost.erase(job->host);
+    }
+    m_running[job->priority]--;
+}
+
+void TransferEngine::shape(const TransferLimits& limits)
+{
+    curl_off_t perClass[PRIORITY_CLASSES];
+    perClass[PRIORITY_HIGH] = static_cast<curl_off_t>(limits.maxRateHigh) * 1024;
+    perClass[PRIORITY_NORMAL] = static_cast<curl_off_t>(limits.maxRateNormal) * 1024;
+    perClass[PRIORITY_LOW] = static_cast<curl_off_t>(limits.maxRateLow) * 1024;
+
+    m_shaper.SetCaps(static_cast<curl_off_t>(limits.maxRate) * 1024, perClass);
+    m_shaper.Update(now());
+}
+
+void TransferEngine::publishStats()
+{
+    TransferStats stats;
+    stats.queuedHigh = m_queued[PRIORITY_HIGH];
+    stats.queuedNormal = m_queued[PRIORITY_NORMAL];
+    stats.queuedLow = m_queued[PRIORITY_LOW];
+    stats.runningHigh = m_running[PRIORITY_HIGH];
+    stats.runningNormal = m_running[PRIORITY_NORMAL];
+    stats.runningLow = m_running[PRIORITY_LOW];
+    stats.delayed = static_cast<int>(m_delayed.size());
+    stats.prompting = 0;
+    for (std::map<std::string, std::vector<TransferJob *> >::const_iterator it = m_awaiting.begin();
+            it != m_awaiting.end(); ++it) {
+        stats.prompting += static_cast<int>(it->second.size());
+    }
+    stats.rate = m_shaper.Rate();
+
+    pthread_mutex_lock(&m_lock);
+    m_stats = stats;
+    pthread_mutex_unlock(&m_lock);
+}
+
+bool TransferEngine::readCompleted()
+{
+    CURLMsg *msg;
+    int left;
+    bool completed = false;
+
+    while ((msg = curl_multi_info_read(m_multi, &left)) != NULL) {
+        if (msg->msg != CURLMSG_DONE) {
+            continue;
+        }
+
+        CURL *curl = msg->easy_handle;
+        const CURLcode result = msg->data.result;
+
+        char *priv = NULL;
+        curl_easy_getinfo(curl, CURLINFO_PRIVATE, &priv);
+        TransferJob *job = reinterpret_cast<TransferJob *>(priv);
+
+        stopped(job);
+        noteProtocol(job);
+        completed = true;
+
+        std::vector<TransferJob *> next;
+        if (m_curl.Advance(job, result, next)) {
+            bool carriesOn = false;
+            for (std::vector<TransferJob *>::reverse_iterator it = next.rbegin(); it != next.rend(); ++it) {
+                enqueue(*it, true);
+                if (*it == job) {
+                    carriesOn = true;
+                } else {
+                    m_inFlight.insert(std::make_pair((*it)->eventId, *it));
+                }
+            }
+            if (!carriesOn) {
+                complete(job);
+            }
+            continue;
+        }
+
+        // Certificate failures are never retried
+        if (m_curl.NeedsCertificatePrompt(job, result) && awaitAnswer(job)) {
+            continue;
+        }
+
+        finish(job, result);
+    }
+
+    return completed;
+}
+
+void TransferEngine::noteProtocol(TransferJob *job)
+{
+#if LIBCURL_VERSION_NUM >= 0x073200
+    long version = 0;
+    if (curl_easy_getinfo(job->curl, CURLINFO_HTTP_VERSION, &version) != CURLE_OK || version == 0) {
+        // Nothing was said, e.g. the connection failed
+        return;
+    }
+
+    if (version == CURL_HTTP_VERSION_2_0) {
+        m_multiplexed.insert(job->host);
+    } else if (!job->segment) {
+        // Segments ask for HTTP/1.1 whatever the host speaks
+        m_multiplexed.erase(job->host);
+    }
+#else
+    (void)job;
+#endif
+}
+
+void *TransferEngine::promptThread(void *arg)
+{
+    PromptRequest *request = static_cast<PromptRequest *>(arg);
+    TransferEngine& engine = Instance();
+
+    // The engine thread carries on with the jobs of the domain that are
+    // still waiting once the dialog is closed
+    const bool accepted = engine.m_curl.AskCertificate(request->windowGroup, request->domain);
+
+    pthread_mutex_lock(&engine.m_lock);
+    engine.m_answers.push_back(std::make_pair(request->domain, accepted));
+    pthread_mutex_unlock(&engine.m_lock);
+    delete request;
+
+    engine.wakeUp();
+
+    return NULL;
+}
+
+// Retries or finishes a transfer that stopped. Only downloads to a file can
+// be retried, on the settle thread
+void TransferEngine::finish(TransferJob *job, CURLcode result)
+{
+    if (job->downloadInfo && job->downloadInfo->memory.empty()) {
+        settle(job, result, false);
+        return;
+    }
+
+    m_curl.Finish(job, result);
+    complete(job);
+}
+
+void TransferEngine::settle(TransferJob *job, CURLcode result, bool catchUp)
+{
+    SettleRequest request;
+    request.job = job;
+    request.result = result;
+    request.catchUp = catchUp;
+
+    m_settling[job] = false;
+
+    pthread_mutex_lock(&m_lock);
+    m_toSettle.push_back(request);
+    pthread_cond_signal(&m_settleQueued);
+    pthread_mutex_unlock(&m_lock);
+}
+
+void TransferEngine::takeSettled()
+{
+    std::deque<Settled> settled;
+
+    pthread_mutex_lock(&m_lock);
+    settled.swap(m_settled);
+    pthread_mutex_unlock(&m_lock);
+
+    for (std::deque<Settled>::const_iterator it = settled.begin(); it != settled.end(); ++it) {
+        TransferJob *job = it->job;
+        const std::map<TransferJob *, bool>::iterator settling = m_settling.find(job);
+        const bool aborted = settling->second;
+        m_settling.erase(settling);
+
+        // A job that is over by now is reported as it ended
+        if (it->retry && aborted) {
+            m_curl.Abort(job);
+            complete(job);
+        } else if (it->retry) {
+            m_delayed.insert(std::make_pair(now() + it->delayMs, job));
+        } else {
+            complete(job);
+        }
+    }
+}
+
+void *TransferEngine::settleThread(void *arg)
+{
+    static_cast<TransferEngine *>(arg)->settleLoop();
+    return NULL;
+}
+
+void TransferEngine::settleLoop()
+{
+    for (;;) {
+        pthread_mutex_lock(&m_lock);
+        while (m_toSettle.empty()) {
+            pthread_cond_wait(&m_settleQueued, &m_lock);
+        }
+        const SettleRequest request = m_toSettle.front();
+        m_toSettle.pop_front();
+        pthread_mutex_unlock(&m_lock);
+
+        Settled settled;
+        settled.job = request.job;
+        settled.delayMs = 0;
+        if (request.catchUp) {
+            m_curl.CatchUp(request.job);
+            settled.retry = true;
+        } else {
+            settled.retry = m_curl.PrepareRetry(request.job, request.result, settled.delayMs);
+        }
+        if (!settled.retry) {
+            m_curl.Finish(request.job, request.result);
+        }
+
+        pthread_mutex_lock(&m_lock);
+        m_settled.push_back(settled);
+        pthread_mutex_unlock(&m_lock);
+
+        wakeUp();
+    }
+}
+
+void TransferEngine::forget(TransferJob *job)
+{
+    std::multimap<std::string, TransferJob *>::iterator it = m_inFlight.lower_bound(job->eventId);
+    while (it != m_inFlight.end() && it->first == job->eventId) {
+        if (it->second == job) {
+            m_inFlight.erase(it);
+            break;
+        }
+        ++it;
+    }
+}
+
+void TransferEngine::complete(TransferJob *job)
+{
+    forget(job);
+
+    // Jobs that only did part of a transfer leave the reporting to others
+    if (!job->result.empty() && !job->journalId.empty()) {
+        TransferJournal::Instance().Finished(job->journalId, TransferJournal::ResultCode(job->result));
+    }
+    if (!job->result.empty() && job->pParent) {
+        ProgressReporter::Instance().Discard(job->pParent, job->eventId);
+        job->pParent->NotifyEvent(job->eventId, job->result);
+    }
+    delete job;
+}
+
+} // namespace webworks
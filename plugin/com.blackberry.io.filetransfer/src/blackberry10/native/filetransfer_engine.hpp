@@ -0,0 +1,246 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FILETRANSFER_ENGINE_H_
+#define FILETRANSFER_ENGINE_H_
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "filetransfer_curl.hpp"
+#include "filetransfer_shaper.hpp"
+
+namespace webworks {
+
+struct TransferLimits {
+    TransferLimits();
+
+    // Transfers running at the same time, over all servers
+    int maxTransfers;
+    // Transfers running at the same time to one host:port
+    int maxTransfersPerHost;
+    // The same for a host that multiplexes them over one HTTP/2 connection
+    int maxStreamsPerHost;
+    // Disk space for cached downloads, in KB
+    int cacheSize;
+    // Bandwidth of all transfers together, and of those of each priority
+    // class, in KB/s; 0 for no cap
+    int maxRate;
+    int maxRateHigh;
+    int maxRateNormal;
+    int maxRateLow;
+};
+
+// How many transfers of each priority class wait and run, see
+// TransferEngine::Stats
+struct TransferStats {
+    TransferStats();
+
+    int queuedHigh;
+    int queuedNormal;
+    int queuedLow;
+    int runningHigh;
+    int runningNormal;
+    int runningLow;
+    // Downloads waiting to be retried
+    int delayed;
+    // Transfers waiting for the certificate dialog
+    int prompting;
+    // Bytes per second of the running transfers together
+    long long rate;
+};
+
+// Names a transfer to abort, by its callback id or by the id of its
+// journal entry
+struct AbortInfo {
+    std::string eventId;
+    std::string journalId;
+};
+
+/*
+ * Runs every transfer of the process on a single thread driving a curl
+ * multi handle. Submitted jobs wait in a queue for their priority class
+ * until the concurrency limits let them start, higher classes first;
+ * results are delivered with FileTransfer::NotifyEvent. Running transfers
+ * are held to the bandwidth caps by a BandwidthShaper.
+ * Transfers to a host that speaks HTTP/2 share its connection as streams,
+ * so more of them may run at once.
+ * Transfers that fail on the certificate of a domain wait for the user to
+ * answer about it, without a thread of their own: the first of them shows
+ * the dialog on a separate thread, as it blocks, and the others join in.
+ * The answer queues all of them again or fails them together. Downloads
+ * that fail on the way are queued again after a delay.
+ * Downloads to a file that stop are settled on a thread of their own, as
+ * retrying or finishing them may restore, hash, sync or move files; so are
+ * those that resume data their digest has yet to read. The engine thread
+ * only waits for the network.
+ * Every job is in a registry by callback id until it completes, so that it
+ * can be aborted wherever it is: running transfers are taken off the multi
+ * handle, queued ones are dropped before they start. Background downloads,
+ * which the TransferJournal keeps, are left running without an owner instead
+ * when theirs goes away, and report to the journal only, until a job for the
+ * same journal entry is submitted and takes them over, with its options, or
+ * they are aborted by their journal id. Any other download to a file that is
+ * being written already is refused.
+ */
+class TransferEngine {
+public:
+    static TransferEngine& Instance();
+
+    // Takes ownership of the job
+    void Submit(TransferJob *job);
+    void SetLimits(const TransferLimits& limits);
+    TransferLimits Limits();
+    // As of the last turn of the engine thread
+    TransferStats Stats();
+    // Ends the transfers of owner with that callback id with ABORT_ERR
+    void Abort(FileTransfer *owner, const std::string& eventId);
+    // Ends every transfer of owner without reporting anything, but for the
+    // background downloads, which carry on without it; returns once none of
+    // them can report to owner any more
+    void AbortAll(FileTransfer *owner);
+    // Ends the transfers of that journal entry, whoever owns them; those
+    // with an owner report ABORT_ERR to it
+    void AbortJournaled(const std::string& journalId);
+
+private:
+    TransferEngine();
+    ~TransferEngine();
+    explicit TransferEngine(TransferEngine const&);
+    void operator=(TransferEngine const&);
+
+    struct AbortRequest {
+        FileTransfer *owner;
+        // Empty for all transfers of owner
+        std::string eventId;
+        // If set, the transfers of that journal entry instead, of any owner
+        std::string journalId;
+        bool report;
+    };
+
+    // The dialog to show for a domain
+    struct PromptRequest {
+        std::string domain;
+        std::string windowGroup;
+    };
+
+    // A download that stopped, and how, or one that has to catch up with
+    // its digest before it starts
+    struct SettleRequest {
+        TransferJob *job;
+        CURLcode result;
+        bool catchUp;
+    };
+
+    // Whether the download goes back into the queue after delayMs; if not,
+    // it is finished
+    struct Settled {
+        TransferJob *job;
+        bool retry;
+        int delayMs;
+    };
+
+    static void createInstance();
+    static void *engineThread(void *arg);
+    static void *promptThread(void *arg);
+    static void *settleThread(void *arg);
+    void run();
+    void settleLoop();
+    void takeSubmitted();
+    bool refuse(TransferJob *job);
+    bool adopt(TransferJob *job);
+    void takeAnswers();
+    bool awaitAnswer(TransferJob *job);
+    void answer(TransferJob *job, bool accepted);
+    void takeAborts();
+    void abort(const std::vector<TransferJob *>& jobs, const std::map<TransferJob *, bool>& reports);
+    void wait();
+    void wakeUp();
+    void enqueue(TransferJob *job, bool first);
+    void startPending(const TransferLimits& limits);
+    void started(TransferJob *job);
+    void stopped(TransferJob *job);
+    void shape(const TransferLimits& limits);
+    void publishStats();
+    bool readCompleted();
+    void noteProtocol(TransferJob *job);
+    void startDelayed();
+    static long long now();
+    void finish(TransferJob *job, CURLcode result);
+    void settle(TransferJob *job, CURLcode result, bool catchUp);
+    void takeSettled();
+    void forget(TransferJob *job);
+    void complete(TransferJob *job);
+
+    CURLM *m_multi;
+    FileTransferCurl m_curl;
+    TransferLimits m_limits;
+    TransferStats m_stats;
+    std::deque<TransferJob *> m_submitted;
+    // Domains whose certificate dialog was closed, and whether it was
+    // accepted
+    std::deque<std::pair<std::string, bool> > m_answers;
+    std::deque<AbortRequest> m_aborts;
+    unsigned long m_abortsQueued;
+    unsigned long m_abortsDone;
+    // For the settle thread, and back from it
+    std::deque<SettleRequest> m_toSettle;
+    std::deque<Settled> m_settled;
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_abortsTaken;
+    pthread_cond_t m_settleQueued;
+    int m_wakeFds[2];
+
+    // Only used by the engine thread
+    std::multimap<std::string, TransferJob *> m_inFlight;
+    // Jobs the settle thread has, and whether they were aborted meanwhile;
+    // nothing else touches them until they are back
+    std::map<TransferJob *, bool> m_settling;
+    // Submitted jobs waiting for the downloads they take over to be back
+    // from the settle thread
+    std::vector<TransferJob *> m_held;
+    // Jobs waiting for the answer about the certificate of a domain, by
+    // domain; a domain is listed while its dialog is shown
+    std::map<std::string, std::vector<TransferJob *> > m_awaiting;
+    // The last answer for each domain, and how many answers there were by
+    // then, see TransferJob::answersSeen
+    std::map<std::string, std::pair<unsigned long, bool> > m_answered;
+    unsigned long m_answerCount;
+    std::list<TransferJob *> m_pending[PRIORITY_CLASSES];
+    int m_queued[PRIORITY_CLASSES];
+    // Downloads waiting to be retried, by the time they are due at
+    std::multimap<long long, TransferJob *> m_delayed;
+    std::map<std::string, int> m_activePerHost;
+    // Hosts whose last transfer went over HTTP/2
+    std::set<std::string> m_multiplexed;
+    int m_active;
+    int m_running[PRIORITY_CLASSES];
+    BandwidthShaper m_shaper;
+
+    static TransferEngine *s_instance;
+    static pthread_once_t s_once;
+};
+
+} // namespace webworks
+
+#endif // FILETRANSFER_ENGINE_H_
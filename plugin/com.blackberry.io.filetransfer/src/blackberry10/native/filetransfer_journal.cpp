@@ -0,0 +1,380 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "filetransfer_journal.hpp"
+#include "filetransfer_curl.hpp"
+
+#include <webworks_json_binding.hpp>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace webworks {
+
+// What a "queued" line holds after the id
+struct JournalRecord {
+    std::string kind;
+    std::string source;
+    std::string target;
+    std::string request;
+};
+
+} // namespace webworks
+
+WEBWORKS_JSON_BINDING_BEGIN(webworks::JournalRecord)
+    WEBWORKS_JSON_FIELD("kind", kind)
+    WEBWORKS_JSON_FIELD("source", source)
+    WEBWORKS_JSON_FIELD("target", target)
+    WEBWORKS_JSON_FIELD("request", request)
+WEBWORKS_JSON_BINDING_END()
+
+namespace webworks {
+
+JournalEntry::JournalEntry() : bytes(0), code(0), attached(false)
+{
+}
+
+TransferJournal *TransferJournal::s_instance = NULL;
+pthread_once_t TransferJournal::s_once = PTHREAD_ONCE_INIT;
+
+TransferJournal& TransferJournal::Instance()
+{
+    pthread_once(&s_once, createInstance);
+    return *s_instance;
+}
+
+void TransferJournal::createInstance()
+{
+    s_instance = new TransferJournal();
+}
+
+TransferJournal::TransferJournal() : m_nextId(1), m_lines(0)
+{
+    pthread_mutex_init(&m_lock, NULL);
+
+    const char *home = getenv("HOME");
+    m_path = std::string(home ? home : "") + "/transferJournal";
+
+    load();
+}
+
+TransferJournal::~TransferJournal()
+{
+    // The journal lives as long as the process
+}
+
+std::string TransferJournal::Queued(const std::string& kind, const std::string& source, const std::string& target,
+                                    const std::string& request)
+{
+    JournalRecord record;
+    record.kind = kind;
+    record.source = source;
+    record.target = target;
+    record.request = request;
+
+    pthread_mutex_lock(&m_lock);
+    const long long key = m_nextId++;
+
+    char id[24];
+    snprintf(id, sizeof(id), "%lld", key);
+
+    JournalEntry& entry = m_entries[key];
+    entry.id = id;
+    entry.kind = kind;
+    entry.source = source;
+    entry.target = target;
+    entry.state = "queued";
+    entry.request = request;
+    entry.attached = true;
+
+    append("queued " + entry.id + " " + json::toJson(record) + "\n");
+    pthread_mutex_unlock(&m_lock);
+
+    return id;
+}
+
+void TransferJournal::Started(const std::string& id)
+{
+    pthread_mutex_lock(&m_lock);
+    const EntryMap::iterator entry = m_entries.find(parseId(id));
+    if (entry != m_entries.end() && entry->second.state == "queued") {
+        entry->second.state = "running";
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+void TransferJournal::Progress(const std::string& id, long long bytes)
+{
+    pthread_mutex_lock(&m_lock);
+    const EntryMap::iterator entry = m_entries.find(parseId(id));
+    if (entry != m_entries.end() && entry->second.bytes != bytes) {
+        entry->second.bytes = bytes;
+
+        char line[64];
+        snprintf(line, sizeof(line), "progress %s %lld\n", id.c_str(), bytes);
+        append(line);
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+void TransferJournal::Finished(const std::string& id, int code)
+{
+    pthread_mutex_lock(&m_lock);
+    const EntryMap::iterator entry = m_entries.find(parseId(id));
+    if (entry != m_entries.end() && entry->second.state != "done" && entry->second.state != "failed") {
+        finish(entry, code);
+
+        const size_t live = liveLines();
+        const size_t stale = m_lines - live;
+        if (!(stale >= MIN_STALE_LINES && stale >= live && compact())) {
+            char line[64];
+            snprintf(line, sizeof(line), "done %s %d\n", id.c_str(), code);
+            append(line);
+        }
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+std::string TransferJournal::Claim(const std::string& kind, const std::string& source, const std::string& target)
+{
+    std::string id;
+
+    pthread_mutex_lock(&m_lock);
+    for (EntryMap::iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+        JournalEntry& entry = it->second;
+        if ((entry.state == "queued" || entry.state == "running") && !entry.attached && entry.kind == kind
+                && entry.source == source && entry.target == target) {
+            entry.attached = true;
+            id = entry.id;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&m_lock);
+
+    return id;
+}
+
+void TransferJournal::Detached(const std::string& id)
+{
+    pthread_mutex_lock(&m_lock);
+    const EntryMap::iterator entry = m_entries.find(parseId(id));
+    if (entry != m_entries.end()) {
+        entry->second.attached = false;
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+std::vector<JournalEntry> TransferJournal::TakeUnfinished()
+{
+    std::vector<JournalEntry> unfinished;
+
+    pthread_mutex_lock(&m_lock);
+    for (std::vector<long long>::const_iterator it = m_unfinished.begin(); it != m_unfinished.end(); ++it) {
+        const EntryMap::const_iterator entry = m_entries.find(*it);
+        if (entry != m_entries.end()) {
+            unfinished.push_back(entry->second);
+        }
+    }
+    m_unfinished.clear();
+    pthread_mutex_unlock(&m_lock);
+
+    return unfinished;
+}
+
+std::vector<JournalEntry> TransferJournal::Entries()
+{
+    std::vector<JournalEntry> entries;
+
+    pthread_mutex_lock(&m_lock);
+    for (EntryMap::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+        entries.push_back(it->second);
+    }
+    pthread_mutex_unlock(&m_lock);
+
+    return entries;
+}
+
+int TransferJournal::ResultCode(const std::string& result)
+{
+    // "<kind> error <code> ...", anything else reports success
+    const std::string::size_type space = result.find(' ');
+    if (space == std::string::npos || result.compare(space + 1, 6, "error ") != 0) {
+        return 0;
+    }
+
+    const int code = atoi(result.c_str() + space + 7);
+    return code > 0 ? code : CONNECTION_ERR;
+}
+
+long long TransferJournal::parseId(const std::string& id)
+{
+    return strtoll(id.c_str(), NULL, 10);
+}
+
+void TransferJournal::load()
+{
+    std::ifstream journal(m_path.c_str());
+    std::string line;
+
+    while (std::getline(journal, line)) {
+        m_lines++;
+
+        const std::string::size_type first = line.find(' ');
+        const std::string::size_type second = first == std::string::npos ? first : line.find(' ', first + 1);
+        if (first == std::string::npos || second == std::string::npos) {
+            // Cut short when the process was killed
+            continue;
+        }
+
+        const std::string type = line.substr(0, first);
+        const std::string id = line.substr(first + 1, second - first - 1);
+        const std::string value = line.substr(second + 1);
+        const long long key = parseId(id);
+
+        if (key <= 0) {
+            continue;
+        }
+        if (key >= m_nextId) {
+            m_nextId = key + 1;
+        }
+
+        if (type == "queued") {
+            JournalRecord record;
+            if (!json::fromJson(value, record) || record.kind != "download") {
+                continue;
+            }
+
+            JournalEntry& entry = m_entries[key];
+            entry.id = id;
+            entry.kind = record.kind;
+            entry.source = record.source;
+            entry.target = record.target;
+            entry.state = "queued";
+            entry.request = record.request;
+        } else if (type == "progress") {
+            const EntryMap::iterator entry = m_entries.find(key);
+            if (entry != m_entries.end()) {
+                entry->second.bytes = strtoll(value.c_str(), NULL, 10);
+            }
+        } else if (type == "done") {
+            // Reported by the run that finished it
+            m_entries.erase(key);
+        }
+    }
+
+    for (EntryMap::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+        m_unfinished.push_back(it->first);
+    }
+
+    if (m_lines > liveLines()) {
+        compact();
+    }
+}
+
+void TransferJournal::finish(EntryMap::iterator entry, int code)
+{
+    entry->second.state = code == 0 ? "done" : "failed";
+    entry->second.code = code;
+    entry->second.request.clear();
+
+    m_finished.push_back(entry->first);
+    if (m_finished.size() > MAX_FINISHED) {
+        m_entries.erase(m_finished.front());
+        m_finished.pop_front();
+    }
+}
+
+bool TransferJournal::append(const std::string& line)
+{
+    // One write per line, so that a killed process leaves whole lines only,
+    // except maybe for the last one
+    const int fd = open(m_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    const bool ok = write(fd, line.data(), line.length()) == static_cast<ssize_t>(line.length());
+    close(fd);
+
+    if (ok) {
+        m_lines++;
+    }
+
+    return ok;
+}
+
+bool TransferJournal::compact()
+{
+    const std::string temp = m_path + ".tmp";
+
+    FILE *journal = fopen(temp.c_str(), "w");
+    if (!journal) {
+        return false;
+    }
+
+    for (EntryMap::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+        const JournalEntry& entry = it->second;
+        if (entry.state == "done" || entry.state == "failed") {
+            continue;
+        }
+
+        JournalRecord record;
+        record.kind = entry.kind;
+        record.source = entry.source;
+        record.target = entry.target;
+        record.request = entry.request;
+
+        fprintf(journal, "queued %s %s\n", entry.id.c_str(), json::toJson(record).c_str());
+        if (entry.bytes > 0) {
+            fprintf(journal, "progress %s %lld\n", entry.id.c_str(), entry.bytes);
+        }
+    }
+
+    bool ok = fflush(journal) == 0 && fsync(fileno(journal)) == 0;
+    ok = fclose(journal) == 0 && ok;
+
+    // Readers see either the old journal or the new one, never half of it
+    if (!ok || rename(temp.c_str(), m_path.c_str()) != 0) {
+        remove(temp.c_str());
+        return false;
+    }
+
+    m_lines = liveLines();
+    return true;
+}
+
+size_t TransferJournal::liveLines() const
+{
+    size_t lines = 0;
+
+    for (EntryMap::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+        const JournalEntry& entry = it->second;
+        if (entry.state != "done" && entry.state != "failed") {
+            lines += entry.bytes > 0 ? 2 : 1;
+        }
+    }
+
+    return lines;
+}
+
+} // namespace webworks
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FILETRANSFER_JOURNAL_H_
+#define FILETRANSFER_JOURNAL_H_
+
+#include <pthread.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace webworks {
+
+// A transfer as the journal knows it
+struct JournalEntry {
+    JournalEntry();
+
+    std::string id;
+    // "download", the only kind kept so far
+    std::string kind;
+    std::string source;
+    std::string target;
+    // "queued", "running", "done" or "failed"
+    std::string state;
+    // Of a download, as far as its .part file is known to hold them
+    long long bytes;
+    // FileTransferErrorCodes of a failed transfer, 0 otherwise
+    int code;
+    // The JSON of what it takes to start the transfer again
+    std::string request;
+    // Whether a transfer with an owner is behind it; not so for those loaded
+    // from the file, or those whose owner went away
+    bool attached;
+};
+
+// What the request of a journaled download keeps: the options that decide
+// what ends up in target, nothing of the page that asked for it
+struct ResumeInfo {
+    std::string source;
+    std::string target;
+    int segments;
+    int minSegmentSize;
+    bool writeBehind;
+    bool cache;
+    std::string digest;
+    std::string priority;
+};
+
+/*
+ * Every background download of the application that has not finished yet,
+ * kept in $HOME/transferJournal so that it outlives the process. Each change is
+ * appended as a line of its own: a transfer is queued along with what it
+ * was started with, makes progress whenever the journal of its .part file
+ * is saved, and is done with the code of its result. The file is rewritten
+ * with only the unfinished transfers when it is loaded, and whenever the
+ * lines of finished ones outnumber them.
+ * Downloads an earlier run of the process left unfinished are handed out
+ * once, to be started again; their .part file lets them go on with a
+ * Range request.
+ * Finished transfers stay listed until the process ends, the latest
+ * MAX_FINISHED of them.
+ */
+class TransferJournal {
+public:
+    static TransferJournal& Instance();
+
+    // Records a transfer about to be submitted; returns its id
+    std::string Queued(const std::string& kind, const std::string& source, const std::string& target,
+                       const std::string& request);
+    void Started(const std::string& id);
+    // Bytes of a download known to be on disk
+    void Progress(const std::string& id, long long bytes);
+    void Finished(const std::string& id, int code);
+    // Id of an unfinished transfer of that kind, source and target that is
+    // not attached, which it now is, or empty
+    std::string Claim(const std::string& kind, const std::string& source, const std::string& target);
+    // The owner of the transfer went away
+    void Detached(const std::string& id);
+    // Downloads left unfinished by an earlier run; handed out only once
+    std::vector<JournalEntry> TakeUnfinished();
+    // Every transfer known, oldest first
+    std::vector<JournalEntry> Entries();
+
+    // The error code of a result event, 0 if it reports success
+    static int ResultCode(const std::string& result);
+
+private:
+    typedef std::map<long long, JournalEntry> EntryMap;
+
+    // Lines of finished transfers tolerated before the file is rewritten
+    static const size_t MIN_STALE_LINES = 32;
+    static const size_t MAX_FINISHED = 64;
+
+    TransferJournal();
+    ~TransferJournal();
+    explicit TransferJournal(TransferJournal const&);
+    void operator=(TransferJournal const&);
+
+    static void createInstance();
+    static long long parseId(const std::string& id);
+    void load();
+    void finish(EntryMap::iterator entry, int code);
+    bool append(const std::string& line);
+    bool compact();
+    size_t liveLines() const;
+
+    std::string m_path;
+    EntryMap m_entries;
+    // Oldest first
+    std::deque<long long> m_finished;
+    std::vector<long long> m_unfinished;
+    long long m_nextId;
+    // Lines in the file, including those of finished transfers
+    size_t m_lines;
+    pthread_mutex_t m_lock;
+
+    static TransferJournal *s_instance;
+    static pthread_once_t s_once;
+};
+
+} // namespace webworks
+
+#endif // FILETRANSFER_JOURNAL_H_
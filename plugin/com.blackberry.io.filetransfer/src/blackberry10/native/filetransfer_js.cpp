@@ -16,16 +16,178 @@
 
 #include "filetransfer_js.hpp"
 #include "filetransfer_curl.hpp"
+#include "filetransfer_engine.hpp"
+#include "filetransfer_journal.hpp"
+#include "filetransfer_progress.hpp"
+#include <webworks_json_binding.hpp>
 #include <pthread.h>
-#include <json/reader.h>
 #include <string>
+#include <vector>
+
+WEBWORKS_JSON_BINDING_BEGIN(webworks::BatchFile)
+    WEBWORKS_JSON_FIELD("filePath", filePath)
+    WEBWORKS_JSON_FIELD("fileKey", fileKey)
+    WEBWORKS_JSON_FIELD("fileName", fileName)
+    WEBWORKS_JSON_FIELD("mimeType", mimeType)
+WEBWORKS_JSON_BINDING_END()
+
+WEBWORKS_JSON_BINDING_BEGIN(webworks::FileUploadInfo)
+    WEBWORKS_JSON_FIELD("callbackId", eventId)
+    WEBWORKS_JSON_FIELD("filePath", sourceFile)
+    WEBWORKS_JSON_FIELD("files", files)
+    WEBWORKS_JSON_FIELD("server", targetURL)
+    WEBWORKS_JSON_FIELD_IN("options", "fileKey", fileKey)
+    WEBWORKS_JSON_FIELD_IN("options", "fileName", fileName)
+    WEBWORKS_JSON_FIELD_IN("options", "mimeType", mimeType)
+    WEBWORKS_JSON_FIELD_IN("options", "chunkedMode", chunkedMode)
+    WEBWORKS_JSON_FIELD_IN("options", "chunkSize", chunkSize)
+    WEBWORKS_JSON_FIELD_IN("options", "compress", compress)
+    WEBWORKS_JSON_FIELD_IN("options", "digest", digest)
+    WEBWORKS_JSON_FIELD_IN("options", "windowGroup", windowGroup)
+    WEBWORKS_JSON_FIELD_IN("options", "params", params)
+    WEBWORKS_JSON_FIELD_IN("options", "progressInterval", progressInterval)
+    WEBWORKS_JSON_FIELD_IN("options", "progressStep", progressStep)
+    WEBWORKS_JSON_FIELD_IN("options", "maxResponseSize", maxResponseSize)
+    WEBWORKS_JSON_FIELD_IN("options", "responseFile", responseFile)
+    WEBWORKS_JSON_FIELD_IN("options", "priority", priority)
+WEBWORKS_JSON_BINDING_END()
+
+WEBWORKS_JSON_BINDING_BEGIN(webworks::FileDownloadInfo)
+    WEBWORKS_JSON_FIELD("callbackId", eventId)
+    WEBWORKS_JSON_FIELD("source", source)
+    WEBWORKS_JSON_FIELD("target", target)
+    WEBWORKS_JSON_FIELD("windowGroup", windowGroup)
+    WEBWORKS_JSON_FIELD_IN("options", "segments", segments)
+    WEBWORKS_JSON_FIELD_IN("options", "minSegmentSize", minSegmentSize)
+    WEBWORKS_JSON_FIELD_IN("options", "writeBehind", writeBehind)
+    WEBWORKS_JSON_FIELD_IN("options", "cache", cache)
+    WEBWORKS_JSON_FIELD_IN("options", "digest", digest)
+    WEBWORKS_JSON_FIELD_IN("options", "progressInterval", progressInterval)
+    WEBWORKS_JSON_FIELD_IN("options", "progressStep", progressStep)
+    WEBWORKS_JSON_FIELD_IN("options", "memory", memory)
+    WEBWORKS_JSON_FIELD_IN("options", "maxMemorySize", maxMemorySize)
+    WEBWORKS_JSON_FIELD_IN("options", "priority", priority)
+    WEBWORKS_JSON_FIELD_IN("options", "background", background)
+WEBWORKS_JSON_BINDING_END()
+
+WEBWORKS_JSON_BINDING_BEGIN(webworks::TransferLimits)
+    WEBWORKS_JSON_FIELD("maxTransfers", maxTransfers)
+    WEBWORKS_JSON_FIELD("maxTransfersPerHost", maxTransfersPerHost)
+    WEBWORKS_JSON_FIELD("maxStreamsPerHost", maxStreamsPerHost)
+    WEBWORKS_JSON_FIELD("cacheSize", cacheSize)
+    WEBWORKS_JSON_FIELD("maxRate", maxRate)
+    WEBWORKS_JSON_FIELD("maxRateHigh", maxRateHigh)
+    WEBWORKS_JSON_FIELD("maxRateNormal", maxRateNormal)
+    WEBWORKS_JSON_FIELD("maxRateLow", maxRateLow)
+WEBWORKS_JSON_BINDING_END()
+
+WEBWORKS_JSON_BINDING_BEGIN(webworks::TransferStats)
+    WEBWORKS_JSON_FIELD_IN("queued", "high", queuedHigh)
+    WEBWORKS_JSON_FIELD_IN("queued", "normal", queuedNormal)
+    WEBWORKS_JSON_FIELD_IN("queued", "low", queuedLow)
+    WEBWORKS_JSON_FIELD_IN("running", "high", runningHigh)
+    WEBWORKS_JSON_FIELD_IN("running", "normal", runningNormal)
+    WEBWORKS_JSON_FIELD_IN("running", "low", runningLow)
+    WEBWORKS_JSON_FIELD("delayed", delayed)
+    WEBWORKS_JSON_FIELD("prompting", prompting)
+    WEBWORKS_JSON_FIELD("rate", rate)
+WEBWORKS_JSON_BINDING_END()
+
+WEBWORKS_JSON_BINDING_BEGIN(webworks::JournalEntry)
+    WEBWORKS_JSON_FIELD("id", id)
+    WEBWORKS_JSON_FIELD("type", kind)
+    WEBWORKS_JSON_FIELD("source", source)
+    WEBWORKS_JSON_FIELD("target", target)
+    WEBWORKS_JSON_FIELD("state", state)
+    WEBWORKS_JSON_FIELD("bytes", bytes)
+    WEBWORKS_JSON_FIELD("code", code)
+WEBWORKS_JSON_BINDING_END()
+
+// Read back as a FileDownloadInfo, so the layout is the same
+WEBWORKS_JSON_BINDING_BEGIN(webworks::ResumeInfo)
+    WEBWORKS_JSON_FIELD("source", source)
+    WEBWORKS_JSON_FIELD("target", target)
+    WEBWORKS_JSON_FIELD_IN("options", "segments", segments)
+    WEBWORKS_JSON_FIELD_IN("options", "minSegmentSize", minSegmentSize)
+    WEBWORKS_JSON_FIELD_IN("options", "writeBehind", writeBehind)
+    WEBWORKS_JSON_FIELD_IN("options", "cache", cache)
+    WEBWORKS_JSON_FIELD_IN("options", "digest", digest)
+    WEBWORKS_JSON_FIELD_IN("options", "priority", priority)
+WEBWORKS_JSON_BINDING_END()
+
+WEBWORKS_JSON_BINDING_BEGIN(webworks::AbortInfo)
+    WEBWORKS_JSON_FIELD("callbackId", eventId)
+    WEBWORKS_JSON_FIELD("id", journalId)
+WEBWORKS_JSON_BINDING_END()
+
+static pthread_once_t s_resumeOnce = PTHREAD_ONCE_INIT;
+
+// With the defaults of the options left out of a request
+static webworks::FileDownloadInfo *newDownloadInfo()
+{
+    webworks::FileDownloadInfo *download_info = new webworks::FileDownloadInfo;
+    download_info->segments = 1;
+    download_info->minSegmentSize = 1024;
+    download_info->writeBehind = false;
+    download_info->cache = false;
+    download_info->progressInterval = 0;
+    download_info->progressStep = 0;
+    download_info->maxMemorySize = 1024;
+    download_info->background = false;
+    return download_info;
+}
+
+static std::string resumeRequest(const webworks::FileDownloadInfo& download_info)
+{
+    webworks::ResumeInfo resume;
+    resume.source = download_info.source;
+    resume.target = download_info.target;
+    resume.segments = download_info.segments;
+    resume.minSegmentSize = download_info.minSegmentSize;
+    resume.writeBehind = download_info.writeBehind;
+    resume.cache = download_info.cache;
+    resume.digest = download_info.digest;
+    resume.priority = download_info.priority;
+    return webworks::json::toJson(resume);
+}
+
+// Starts again the background downloads an earlier run of the application
+// left unfinished; they have no owner and only report to the journal
+static void resumeTransfers()
+{
+    webworks::TransferJournal& journal = webworks::TransferJournal::Instance();
+    const std::vector<webworks::JournalEntry> unfinished = journal.TakeUnfinished();
+
+    for (std::vector<webworks::JournalEntry>::const_iterator it = unfinished.begin(); it != unfinished.end(); ++it) {
+        webworks::FileDownloadInfo *download_info = newDownloadInfo();
+
+        if (!webworks::json::fromJson(it->request, *download_info)) {
+            delete download_info;
+            journal.Finished(it->id, webworks::CONNECTION_ERR);
+            continue;
+        }
+
+        download_info->pParent = NULL;
+        download_info->eventId = it->id;
+        download_info->windowGroup.clear();
+        download_info->background = true;
+
+        webworks::TransferJob *job = new webworks::TransferJob(download_info);
+        job->journalId = it->id;
+        webworks::TransferEngine::Instance().Submit(job);
+    }
+}
 
 FileTransfer::FileTransfer(const std::string& id) : m_id(id)
 {
+    pthread_once(&s_resumeOnce, resumeTransfers);
 }
 
 FileTransfer::~FileTransfer()
 {
+    // Nothing may report to this object once it is gone
+    webworks::TransferEngine::Instance().AbortAll(this);
+    webworks::ProgressReporter::Instance().Forget(this);
 }
 
 char* onGetObjList()
@@ -53,9 +215,19 @@ std::string FileTransfer::InvokeMethod(const std::string& command)
     string jsonObject = command.substr(index + 1, command.length());
 
     if (strCommand == "upload") {
-        return StartUploadThread(jsonObject);
+        return StartUpload(jsonObject);
+    } else if (strCommand == "uploadBatch") {
+        return StartBatchUpload(jsonObject);
     } else if (strCommand == "download") {
-        return StartDownloadThread(jsonObject);
+        return StartDownload(jsonObject);
+    } else if (strCommand == "configure") {
+        return Configure(jsonObject);
+    } else if (strCommand == "abort") {
+        return Abort(jsonObject);
+    } else if (strCommand == "stats") {
+        return Stats();
+    } else if (strCommand == "transfers") {
+        return Transfers();
     }
 
     return "";
@@ -69,124 +241,152 @@ bool FileTransfer::CanDelete()
 // Notifies JavaScript of an event
 void FileTransfer::NotifyEvent(const std::string& eventId, const std::string& event)
 {
-    std::string eventString = m_id + " ";
+    // Results may carry a large response, so it is copied only once
+    std::string eventString;
+    eventString.reserve(m_id.size() + eventId.size() + event.size() + 2);
+    eventString.append(m_id);
+    eventString.append(" ");
     eventString.append(eventId);
     eventString.append(" ");
     eventString.append(event);
     SendPluginEvent(eventString.c_str(), m_pContext);
 }
 
-std::string FileTransfer::StartUploadThread(const std::string& jsonObject)
+std::string FileTransfer::StartUpload(const std::string& jsonObject)
+{
+    return submitUpload(jsonObject, false);
+}
+
+std::string FileTransfer::StartBatchUpload(const std::string& jsonObject)
 {
-    // Parse the JSON
-    Json::Reader reader;
-    Json::Value obj;
-    bool parse = reader.parse(jsonObject, obj);
+    // A batch is an upload listing its files instead of a filePath
+    return submitUpload(jsonObject, true);
+}
 
-    if (!parse) {
+std::string FileTransfer::submitUpload(const std::string& jsonObject, bool batch)
+{
+    // Create a new struct with upload information straight from the JSON text
+    webworks::FileUploadInfo *upload_info = new webworks::FileUploadInfo;
+    upload_info->chunkedMode = false;
+    upload_info->chunkSize = 0;
+    upload_info->compress = false;
+    upload_info->progressInterval = 0;
+    upload_info->progressStep = 0;
+    upload_info->maxResponseSize = -1;
+
+    if (!webworks::json::fromJson(jsonObject, *upload_info)) {
         fprintf(stderr, "%s", "error parsing\n");
+        delete upload_info;
         return "Cannot parse JSON object";
     }
 
-    // Create a new struct with upload information from the JSON object
-    webworks::FileUploadInfo *upload_info = new webworks::FileUploadInfo;
-    upload_info->eventId = obj["callbackId"].asString();
-    upload_info->sourceFile = obj["filePath"].asString();
-    upload_info->targetURL = obj["server"].asString();
-
-    const Json::Value optionsObject = obj["options"];
-    upload_info->fileKey = optionsObject["fileKey"].asString();
-    upload_info->fileName = optionsObject["fileName"].asString();
-    upload_info->mimeType = optionsObject["mimeType"].asString();
-    upload_info->chunkedMode = optionsObject["chunkedMode"].asBool();
-    upload_info->chunkSize = optionsObject["chunkSize"].asInt()*1024;
-    upload_info->windowGroup = optionsObject["windowGroup"].asString();
-
-    const Json::Value paramsObject = optionsObject["params"];
-    const Json::Value::Members paramsKeys = paramsObject.getMemberNames();
-
-    for (unsigned int i = 0; i < paramsKeys.size(); ++i) {
-        const std::string key = paramsKeys[i];
-        upload_info->params.push_back(key);
-        upload_info->params.push_back(paramsObject[key].asString());
+    if (!batch) {
+        upload_info->files.clear();
+    } else if (upload_info->files.empty()) {
+        delete upload_info;
+        return "No files to upload";
     }
 
-    upload_info->pParent = this;
-
-    pthread_attr_t thread_attr;
-    pthread_attr_init(&thread_attr);
-    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+    webworks::TransferPriority priority;
+    if (!webworks::ParsePriority(upload_info->priority, priority)) {
+        delete upload_info;
+        return "Unknown priority";
+    }
 
-    pthread_t thread;
-    pthread_create(&thread, &thread_attr, FileUploadThread, static_cast<void *>(upload_info));
-    pthread_attr_destroy(&thread_attr);
+    upload_info->chunkSize *= 1024;
+    upload_info->pParent = this;
 
-    if (!thread) {
-        return "Cannot create new file transfer thread";
-    }
+    // Uploads are not journaled: one cut short has to start over anyway, and
+    // goes when its owner does
+    webworks::TransferJob *job = new webworks::TransferJob(upload_info);
+    webworks::TransferEngine::Instance().Submit(job);
 
     return "";
 }
 
-void* FileTransfer::FileUploadThread(void *args)
+std::string FileTransfer::StartDownload(const std::string& jsonObject)
 {
-    webworks::FileTransferCurl *file_transfer = new webworks::FileTransferCurl();
-    webworks::FileUploadInfo *upload_info = static_cast<webworks::FileUploadInfo *>(args);
+    // Create a new struct with download information straight from the JSON text
+    webworks::FileDownloadInfo *download_info = newDownloadInfo();
 
-    const std::string result = file_transfer->Upload(upload_info);
-    upload_info->pParent->NotifyEvent(upload_info->eventId, result);
+    if (!webworks::json::fromJson(jsonObject, *download_info)) {
+        fprintf(stderr, "%s", "error parsing\n");
+        delete download_info;
+        return "Cannot parse JSON object";
+    }
+
+    const std::string& memory = download_info->memory;
+    if (!memory.empty() && memory != "base64" && memory != "text") {
+        delete download_info;
+        return "Unknown memory encoding";
+    }
+
+    webworks::TransferPriority priority;
+    if (!webworks::ParsePriority(download_info->priority, priority)) {
+        delete download_info;
+        return "Unknown priority";
+    }
 
-    delete upload_info;
-    delete file_transfer;
-    return NULL;
+    download_info->pParent = this;
+
+    webworks::TransferJob *job = new webworks::TransferJob(download_info);
+
+    // What is kept in memory is lost with the process anyway, and only
+    // background downloads are journaled. A download the journal still has
+    // without an owner is taken over by the engine rather than run twice
+    if (memory.empty()) {
+        webworks::TransferJournal& journal = webworks::TransferJournal::Instance();
+        job->journalId = journal.Claim("download", download_info->source, download_info->target);
+        if (job->journalId.empty() && download_info->background) {
+            job->journalId = journal.Queued("download", download_info->source, download_info->target,
+                                            resumeRequest(*download_info));
+        }
+    }
+    webworks::TransferEngine::Instance().Submit(job);
+
+    return "";
 }
 
-std::string FileTransfer::StartDownloadThread(const std::string& jsonObject)
+std::string FileTransfer::Configure(const std::string& jsonObject)
 {
-    // Parse the JSON
-    Json::Reader reader;
-    Json::Value obj;
-    bool parse = reader.parse(jsonObject, obj);
+    // Options that are left out keep their current value
+    webworks::TransferLimits limits = webworks::TransferEngine::Instance().Limits();
 
-    if (!parse) {
-        fprintf(stderr, "%s", "error parsing\n");
-        return "Cannot parse JSON object";
+    // The result is read as JSON, so an error is too
+    if (!webworks::json::fromJson(jsonObject, limits)) {
+        return "{\"error\":\"Cannot parse JSON object\"}";
     }
 
-    // Create a new struct with upload information from the JSON object
-    webworks::FileDownloadInfo *download_info = new webworks::FileDownloadInfo;
-    download_info->eventId = obj["callbackId"].asString();
-    download_info->source = obj["source"].asString();
-    download_info->target = obj["target"].asString();
-    download_info->windowGroup = obj["windowGroup"].asString();
+    webworks::TransferEngine::Instance().SetLimits(limits);
 
-    download_info->pParent = this;
+    return webworks::json::toJson(webworks::TransferEngine::Instance().Limits());
+}
 
-    pthread_attr_t thread_attr;
-    pthread_attr_init(&thread_attr);
-    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+std::string FileTransfer::Abort(const std::string& jsonObject)
+{
+    webworks::AbortInfo abort_info;
 
-    pthread_t thread;
-    pthread_create(&thread, &thread_attr, FileDownloadThread, static_cast<void *>(download_info));
-    pthread_attr_destroy(&thread_attr);
+    if (!webworks::json::fromJson(jsonObject, abort_info) || abort_info.eventId.empty() == abort_info.journalId.empty()) {
+        return "Cannot parse JSON object";
+    }
 
-    if (!thread) {
-        return "Cannot create new file transfer thread";
+    // The transfer reports ABORT_ERR through its own callback, unless it
+    // finished first; one without an owner only to the journal
+    if (!abort_info.journalId.empty()) {
+        webworks::TransferEngine::Instance().AbortJournaled(abort_info.journalId);
+    } else {
+        webworks::TransferEngine::Instance().Abort(this, abort_info.eventId);
     }
 
     return "";
 }
 
-void* FileTransfer::FileDownloadThread(void *args)
+std::string FileTransfer::Stats()
 {
-    webworks::FileTransferCurl *file_transfer = new webworks::FileTransferCurl();
-    webworks::FileDownloadInfo *download_info = static_cast<webworks::FileDownloadInfo *>(args);
-
-    const std::string result = file_transfer->Download(download_info);
-    download_info->pParent->NotifyEvent(download_info->eventId, result);
-
-    delete download_info;
-    delete file_transfer;
-    return NULL;
+    return webworks::json::toJson(webworks::TransferEngine::Instance().Stats());
 }
 
+std::string FileTransfer::Transfers()
+{
+    return webworks::json::toJson(webworks::TransferJournal::Instance().Entries());
+}
@@ -29,11 +29,16 @@ public:
     virtual std::string InvokeMethod(const std::string& command);
     virtual bool CanDelete();
     void NotifyEvent(const std::string& eventId, const std::string& event);
-    std::string StartUploadThread(const std::string& jsonObject);
-    static void* FileUploadThread(void *args);
-    std::string StartDownloadThread(const std::string& jsonObject);
-    static void* FileDownloadThread(void *args);
+    std::string StartUpload(const std::string& jsonObject);
+    std::string StartBatchUpload(const std::string& jsonObject);
+    std::string StartDownload(const std::string& jsonObject);
+    std::string Configure(const std::string& jsonObject);
+    std::string Stats();
+    std::string Transfers();
+    std::string Abort(const std::string& jsonObject);
 private:
+    std::string submitUpload(const std::string& jsonObject, bool batch);
+
     std::string m_id;
 };
 
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "filetransfer_progress.hpp"
+#include "filetransfer_js.hpp"
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <time.h>
+#include <map>
+#include <string>
+
+namespace webworks {
+
+ProgressThrottle::ProgressThrottle() : intervalMs(0), minBytes(0), lastTime(0), lastBytes(0)
+{
+}
+
+void ProgressThrottle::Start(int interval, curl_off_t bytes)
+{
+    intervalMs = interval;
+    minBytes = bytes;
+    lastTime = Now();
+    lastBytes = 0;
+}
+
+bool ProgressThrottle::Due(curl_off_t done, curl_off_t& rate)
+{
+    if (intervalMs <= 0) {
+        return false;
+    }
+
+    const long long now = Now();
+    const long long elapsed = now - lastTime;
+
+    if (elapsed < intervalMs || done - lastBytes < minBytes) {
+        return false;
+    }
+
+    rate = (done - lastBytes) * 1000 / elapsed;
+    lastTime = now;
+    lastBytes = done;
+
+    return true;
+}
+
+long long ProgressThrottle::Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+ProgressReporter *ProgressReporter::s_instance = NULL;
+pthread_once_t ProgressReporter::s_once = PTHREAD_ONCE_INIT;
+
+ProgressReporter& ProgressReporter::Instance()
+{
+    pthread_once(&s_once, createInstance);
+    return *s_instance;
+}
+
+void ProgressReporter::createInstance()
+{
+    s_instance = new ProgressReporter();
+}
+
+ProgressReporter::ProgressReporter() : m_delivering(false)
+{
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_posted, NULL);
+    pthread_cond_init(&m_delivered, NULL);
+
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+
+    pthread_t thread;
+    pthread_create(&thread, &thread_attr, deliveryThread, this);
+    pthread_attr_destroy(&thread_attr);
+}
+
+ProgressReporter::~ProgressReporter()
+{
+    // The reporter lives as long as the process
+}
+
+void ProgressReporter::Post(FileTransfer *parent, const std::string& eventId, const std::string& event)
+{
+    pthread_mutex_lock(&m_lock);
+    m_latest[TransferKey(parent, eventId)] = event;
+    pthread_cond_signal(&m_posted);
+    pthread_mutex_unlock(&m_lock);
+}
+
+void ProgressReporter::Discard(FileTransfer *parent, const std::string& eventId)
+{
+    pthread_mutex_lock(&m_lock);
+    m_latest.erase(TransferKey(parent, eventId));
+    pthread_mutex_unlock(&m_lock);
+}
+
+void ProgressReporter::Forget(FileTransfer *parent)
+{
+    pthread_mutex_lock(&m_lock);
+    ProgressMap::iterator it = m_latest.lower_bound(TransferKey(parent, ""));
+    while (it != m_latest.end() && it->first.first == parent) {
+        m_latest.erase(it++);
+    }
+
+    // The batch being delivered may still hold events for parent
+    while (m_delivering) {
+        pthread_cond_wait(&m_delivered, &m_lock);
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+void *ProgressReporter::deliveryThread(void *arg)
+{
+    static_cast<ProgressReporter *>(arg)->run();
+    return NULL;
+}
+
+void ProgressReporter::run()
+{
+    ProgressMap batch;
+
+    for (;;) {
+        pthread_mutex_lock(&m_lock);
+        while (m_latest.empty()) {
+            pthread_cond_wait(&m_posted, &m_lock);
+        }
+        batch.swap(m_latest);
+        m_delivering = true;
+        pthread_mutex_unlock(&m_lock);
+
+        for (ProgressMap::const_iterator it = batch.begin(); it != batch.end(); ++it) {
+            it->first.first->NotifyEvent(it->first.second, it->second);
+        }
+        batch.clear();
+
+        pthread_mutex_lock(&m_lock);
+        m_delivering = false;
+        pthread_cond_broadcast(&m_delivered);
+        pthread_mutex_unlock(&m_lock);
+    }
+}
+
+} // namespace webworks
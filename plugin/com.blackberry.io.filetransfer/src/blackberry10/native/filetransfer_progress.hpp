@@ -0,0 +1,89 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FILETRANSFER_PROGRESS_H_
+#define FILETRANSFER_PROGRESS_H_
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <utility>
+
+class FileTransfer;
+
+namespace webworks {
+
+// Decides when a transfer has made enough progress to be worth reporting
+struct ProgressThrottle {
+    ProgressThrottle();
+
+    // Starts the clock; an interval of 0 turns reporting off
+    void Start(int intervalMs, curl_off_t minBytes);
+    // Whether to report done bytes now; if so, rate is set to the bytes per
+    // second since the previous report
+    bool Due(curl_off_t done, curl_off_t& rate);
+
+    static long long Now();
+
+    int intervalMs;
+    curl_off_t minBytes;
+    long long lastTime;
+    curl_off_t lastBytes;
+};
+
+/*
+ * Delivers progress events on a thread of its own, so that a slow bridge
+ * never holds up the transfers. Only the latest progress of each transfer
+ * waits to be sent; older ones are replaced rather than queued.
+ */
+class ProgressReporter {
+public:
+    static ProgressReporter& Instance();
+
+    void Post(FileTransfer *parent, const std::string& eventId, const std::string& event);
+    // Drops what is still waiting, once the transfer is over
+    void Discard(FileTransfer *parent, const std::string& eventId);
+    // Drops everything of parent, and returns once no event is being
+    // delivered to it any more
+    void Forget(FileTransfer *parent);
+
+private:
+    typedef std::pair<FileTransfer *, std::string> TransferKey;
+    typedef std::map<TransferKey, std::string> ProgressMap;
+
+    ProgressReporter();
+    ~ProgressReporter();
+    explicit ProgressReporter(ProgressReporter const&);
+    void operator=(ProgressReporter const&);
+
+    static void createInstance();
+    static void *deliveryThread(void *arg);
+    void run();
+
+    ProgressMap m_latest;
+    bool m_delivering;
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_posted;
+    pthread_cond_t m_delivered;
+
+    static ProgressReporter *s_instance;
+    static pthread_once_t s_once;
+};
+
+} // namespace webworks
+
+#endif // FILETRANSFER_PROGRESS_H_
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "filetransfer_resume.hpp"
+
+#include <curl/curl.h>
+#include <stdio.h>
+#include <fstream>
+#include <string>
+
+namespace webworks {
+
+PartialDownload::PartialDownload() : bytes(0)
+{
+}
+
+std::string PartialDownload::PartPath(const std::string& target)
+{
+    return target + ".part";
+}
+
+std::string PartialDownload::JournalPath(const std::string& target)
+{
+    return target + ".part.journal";
+}
+
+bool PartialDownload::Load(const std::string& target)
+{
+    std::ifstream journal(JournalPath(target).c_str());
+
+    if (!journal.is_open()) {
+        return false;
+    }
+
+    bool haveBytes = false;
+    std::string line;
+
+    while (std::getline(journal, line)) {
+        const std::string::size_type space = line.find(' ');
+        const std::string key = line.substr(0, space);
+        const std::string value = (space == std::string::npos) ? "" : line.substr(space + 1);
+
+        if (key == "url") {
+            url = value;
+        } else if (key == "etag") {
+            etag = value;
+        } else if (key == "modified") {
+            lastModified = value;
+        } else if (key == "bytes") {
+            haveBytes = sscanf(value.c_str(), "%" CURL_FORMAT_CURL_OFF_T, &bytes) == 1 && bytes >= 0;
+        }
+    }
+
+    return haveBytes && !url.empty();
+}
+
+bool PartialDownload::Save(const std::string& target) const
+{
+    const std::string path = JournalPath(target);
+    const std::string temp = path + ".tmp";
+
+    FILE *journal = fopen(temp.c_str(), "w");
+    if (!journal) {
+        return false;
+    }
+
+    fprintf(journal, "url %s\n", url.c_str());
+    fprintf(journal, "etag %s\n", etag.c_str());
+    fprintf(journal, "modified %s\n", lastModified.c_str());
+    fprintf(journal, "bytes %" CURL_FORMAT_CURL_OFF_T "\n", bytes);
+
+    const bool written = !ferror(journal);
+    if (fclose(journal) != 0 || !written) {
+        remove(temp.c_str());
+        return false;
+    }
+
+    return rename(temp.c_str(), path.c_str()) == 0;
+}
+
+void PartialDownload::Remove(const std::string& target, bool removeData)
+{
+    remove(JournalPath(target).c_str());
+
+    if (removeData) {
+        remove(PartPath(target).c_str());
+    }
+}
+
+std::string PartialDownload::Validator() const
+{
+    // If-Range only accepts strong entity tags
+    if (!etag.empty() && etag.compare(0, 2, "W/") != 0) {
+        return etag;
+    }
+
+    return lastModified;
+}
+
+} // namespace webworks
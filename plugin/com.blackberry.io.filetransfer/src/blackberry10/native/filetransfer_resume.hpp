@@ -0,0 +1,57 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FILETRANSFER_RESUME_H_
+#define FILETRANSFER_RESUME_H_
+
+#include <curl/curl.h>
+#include <string>
+
+namespace webworks {
+
+/*
+ * A download that stopped before it was complete. The data received so far
+ * is kept in "<target>.part" and described by the journal next to it,
+ * "<target>.part.journal", so that a later download of the same URL to the
+ * same target can ask the server for the rest only.
+ */
+struct PartialDownload {
+    PartialDownload();
+
+    static std::string PartPath(const std::string& target);
+    static std::string JournalPath(const std::string& target);
+
+    // Reads the journal of target; returns false if there is none or it
+    // cannot be parsed
+    bool Load(const std::string& target);
+    // Replaces the journal of target atomically
+    bool Save(const std::string& target) const;
+    // Removes the journal of target, and the partial data with it if asked to
+    static void Remove(const std::string& target, bool removeData);
+
+    // Value for an If-Range header, empty if the server gave no validator
+    std::string Validator() const;
+
+    std::string url;
+    std::string etag;
+    std::string lastModified;
+    // Bytes of the .part file known to be on disk
+    curl_off_t bytes;
+};
+
+} // namespace webworks
+
+#endif // FILETRANSFER_RESUME_H_
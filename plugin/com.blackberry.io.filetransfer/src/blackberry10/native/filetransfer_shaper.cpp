@@ -0,0 +1,298 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "filetransfer_shaper.hpp"
+
+#include <curl/curl.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace webworks {
+
+static const int SHARE_INTERVAL_MS = 500;
+// Share of the cap over all transfers of each class, relative to low
+static const int CLASS_WEIGHTS[PRIORITY_CLASSES] = { 4, 2, 1 };
+// Lowest rate given to a transfer, so that none of them stalls
+static const curl_off_t MIN_RATE = 1024;
+
+bool ParsePriority(const std::string& name, TransferPriority& priority)
+{
+    if (name == "high") {
+        priority = PRIORITY_HIGH;
+    } else if (name.empty() || name == "normal") {
+        priority = PRIORITY_NORMAL;
+    } else if (name == "low") {
+        priority = PRIORITY_LOW;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+BandwidthShaper::BandwidthShaper() : m_total(0), m_lastUpdate(0), m_rate(0)
+{
+    for (int i = 0; i < PRIORITY_CLASSES; i++) {
+        m_perClass[i] = 0;
+    }
+}
+
+void BandwidthShaper::SetCaps(curl_off_t total, const curl_off_t *perClass)
+{
+    bool changed = total != m_total;
+    m_total = total;
+
+    for (int i = 0; i < PRIORITY_CLASSES; i++) {
+        changed = changed || perClass[i] != m_perClass[i];
+        m_perClass[i] = perClass[i];
+    }
+
+    if (changed) {
+        // What the transfers used says nothing about the new caps
+        for (std::map<CURL *, Flow>::iterator it = m_flows.begin(); it != m_flows.end(); ++it) {
+            it->second.used = -1;
+        }
+        share();
+    }
+}
+
+void BandwidthShaper::Add(CURL *curl, TransferPriority priority, long long now)
+{
+    if (m_flows.empty()) {
+        m_lastUpdate = now;
+    }
+
+    Flow& flow = m_flows[curl];
+    flow.priority = priority;
+    flow.bytes = transferred(curl);
+    flow.since = now;
+    flow.rate = 0;
+    flow.used = -1;
+
+    // A handle used before may still have a rate of its own
+    curl_easy_setopt(curl, CURLOPT_MAX_RECV_SPEED_LARGE, static_cast<curl_off_t>(0));
+    curl_easy_setopt(curl, CURLOPT_MAX_SEND_SPEED_LARGE, static_cast<curl_off_t>(0));
+
+    share();
+}
+
+void BandwidthShaper::Remove(CURL *curl)
+{
+    if (m_flows.erase(curl) > 0) {
+        share();
+    }
+    if (m_flows.empty()) {
+        m_rate = 0;
+    }
+}
+
+void BandwidthShaper::Update(long long now)
+{
+    if (m_flows.empty() || now - m_lastUpdate < SHARE_INTERVAL_MS) {
+        return;
+    }
+
+    curl_off_t total = 0;
+    for (std::map<CURL *, Flow>::iterator it = m_flows.begin(); it != m_flows.end(); ++it) {
+        Flow& flow = it->second;
+        const curl_off_t bytes = transferred(it->first);
+
+        // Counters start again when a transfer does
+        const curl_off_t moved = bytes >= flow.bytes ? bytes - flow.bytes : bytes;
+        total += moved;
+
+        if (now > flow.since) {
+            flow.used = moved * 1000 / (now - flow.since);
+        }
+        flow.bytes = bytes;
+        flow.since = now;
+    }
+
+    m_rate = total * 1000 / (now - m_lastUpdate);
+    m_lastUpdate = now;
+
+    if (capped()) {
+        share();
+    }
+}
+
+long long BandwidthShaper::Due() const
+{
+    return m_flows.empty() ? -1 : m_lastUpdate + SHARE_INTERVAL_MS;
+}
+
+curl_off_t BandwidthShaper::Rate() const
+{
+    return m_rate;
+}
+
+curl_off_t BandwidthShaper::transferred(CURL *curl)
+{
+#if LIBCURL_VERSION_NUM >= 0x073700
+    curl_off_t downloaded = 0;
+    curl_off_t uploaded = 0;
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &uploaded);
+    return downloaded + uploaded;
+#else
+    double downloaded = 0;
+    double uploaded = 0;
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &downloaded);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD, &uploaded);
+    return static_cast<curl_off_t>(downloaded + uploaded);
+#endif
+}
+
+// Shares budget by weight, giving no share more than its bound and what
+// that leaves over to the others
+void BandwidthShaper::fill(std::vector<Share>& shares, curl_off_t budget)
+{
+    std::vector<Share *> open;
+    for (std::vector<Share>::iterator it = shares.begin(); it != shares.end(); ++it) {
+        it->rate = -1;
+        open.push_back(&*it);
+    }
+
+    long long weights = 0;
+    bool settled = true;
+    while (settled && !open.empty()) {
+        settled = false;
+        weights = 0;
+        for (std::vector<Share *>::iterator it = open.begin(); it != open.end(); ++it) {
+            weights += (*it)->weight;
+        }
+
+        // Settling a share under its part only makes the parts of the others
+        // larger, so the whole pass can use the same ones
+        std::vector<Share *> unsettled;
+        for (std::vector<Share *>::iterator it = open.begin(); it != open.end(); ++it) {
+            Share *share = *it;
+            if (share->bound >= 0 && share->bound * weights <= budget * share->weight) {
+                share->rate = share->bound;
+                settled = true;
+            } else {
+                unsettled.push_back(share);
+            }
+        }
+
+        if (settled) {
+            for (std::vector<Share *>::iterator it = open.begin(); it != open.end(); ++it) {
+                if ((*it)->rate >= 0) {
+                    budget -= (*it)->rate;
+                }
+            }
+            open.swap(unsettled);
+        }
+    }
+
+    for (std::vector<Share *>::iterator it = open.begin(); it != open.end(); ++it) {
+        (*it)->rate = budget * (*it)->weight / weights;
+    }
+}
+
+void BandwidthShaper::share()
+{
+    const bool limited = capped();
+    std::vector<Share> shares;
+
+    for (std::map<CURL *, Flow>::iterator it = m_flows.begin(); it != m_flows.end(); ++it) {
+        Flow& flow = it->second;
+
+        Share share;
+        share.curl = it->first;
+        share.priority = flow.priority;
+        share.weight = CLASS_WEIGHTS[flow.priority];
+        share.rate = -1;
+        // A transfer well under its rate is not held back by it, and needs
+        // little more than it used
+        share.demand = -1;
+        if (flow.rate > 0 && flow.used >= 0 && flow.used < flow.rate * 3 / 4) {
+            share.demand = flow.used + flow.used / 4 + MIN_RATE;
+        }
+        share.bound = share.demand;
+        shares.push_back(share);
+    }
+
+    if (limited) {
+        for (int priority = 0; priority < PRIORITY_CLASSES; priority++) {
+            if (m_perClass[priority] <= 0) {
+                continue;
+            }
+
+            std::vector<Share> members;
+            for (std::vector<Share>::iterator it = shares.begin(); it != shares.end(); ++it) {
+                if (it->priority == priority) {
+                    members.push_back(*it);
+                    members.back().weight = 1;
+                }
+            }
+
+            fill(members, m_perClass[priority]);
+
+            std::vector<Share>::iterator member = members.begin();
+            for (std::vector<Share>::iterator it = shares.begin(); it != shares.end(); ++it) {
+                if (it->priority == priority) {
+                    it->bound = (member++)->rate;
+                }
+            }
+        }
+
+        if (m_total > 0) {
+            fill(shares, m_total);
+        } else {
+            for (std::vector<Share>::iterator it = shares.begin(); it != shares.end(); ++it) {
+                it->rate = it->bound;
+            }
+        }
+    }
+
+    for (std::vector<Share>::iterator it = shares.begin(); it != shares.end(); ++it) {
+        Flow& flow = m_flows[it->curl];
+
+        // curl holds a transfer to its rate on average over the last few
+        // seconds, so lowering the rate of one that is under it would stall
+        // it for a while; what it does not use goes to the others anyway
+        if (limited && it->demand >= 0 && it->rate >= it->demand) {
+            continue;
+        }
+
+        curl_off_t rate = 0;
+        if (limited && it->rate >= 0) {
+            rate = it->rate > MIN_RATE ? it->rate : MIN_RATE;
+        }
+
+        if (rate != flow.rate) {
+            curl_easy_setopt(it->curl, CURLOPT_MAX_RECV_SPEED_LARGE, rate);
+            curl_easy_setopt(it->curl, CURLOPT_MAX_SEND_SPEED_LARGE, rate);
+            flow.rate = rate;
+        }
+    }
+}
+
+bool BandwidthShaper::capped() const
+{
+    if (m_total > 0) {
+        return true;
+    }
+    for (int i = 0; i < PRIORITY_CLASSES; i++) {
+        if (m_perClass[i] > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace webworks
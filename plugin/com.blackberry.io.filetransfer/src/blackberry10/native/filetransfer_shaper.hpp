@@ -0,0 +1,104 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FILETRANSFER_SHAPER_H_
+#define FILETRANSFER_SHAPER_H_
+
+#include <curl/curl.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace webworks {
+
+// Classes of transfers, in the order they are started in
+enum TransferPriority {
+    PRIORITY_HIGH,
+    PRIORITY_NORMAL,
+    PRIORITY_LOW,
+    PRIORITY_CLASSES
+};
+
+// Parses "high", "normal" or "low"; an empty name is normal
+bool ParsePriority(const std::string& name, TransferPriority& priority);
+
+/*
+ * Holds running transfers to bandwidth caps, in bytes per second: one over
+ * all of them, and one for each priority class. Each transfer gets a rate
+ * that curl keeps it under. The cap over all is shared by class, a high
+ * transfer getting four times and a normal one twice what a low one gets;
+ * the cap of a class is shared equally by its transfers. A transfer that
+ * used well under its rate, because its server or its network is slower,
+ * is counted for only a little more than it used, and the rest goes to the
+ * others.
+ * Rates are shared out again whenever a transfer starts or ends, and every
+ * SHARE_INTERVAL_MS while transfers run.
+ * Only used by the engine thread.
+ */
+class BandwidthShaper {
+public:
+    BandwidthShaper();
+
+    // 0 for no cap; perClass has one cap for each TransferPriority
+    void SetCaps(curl_off_t total, const curl_off_t *perClass);
+    void Add(CURL *curl, TransferPriority priority, long long now);
+    void Remove(CURL *curl);
+    // Measures the transfers and shares the caps out again when it is time
+    void Update(long long now);
+    // When Update() is due next, or -1 if nothing runs
+    long long Due() const;
+    // Bytes per second of all transfers together, over the last interval
+    curl_off_t Rate() const;
+
+private:
+    struct Flow {
+        TransferPriority priority;
+        // Counted by curl when last measured, and when that was
+        curl_off_t bytes;
+        long long since;
+        // Given by the last share, 0 for none
+        curl_off_t rate;
+        // Measured over the last interval, -1 before the first one
+        curl_off_t used;
+    };
+
+    struct Share {
+        CURL *curl;
+        TransferPriority priority;
+        int weight;
+        // What the transfer needs if it is slower than its rate, else -1
+        curl_off_t demand;
+        // Most it can be given, -1 for no bound
+        curl_off_t bound;
+        // What it is given, -1 for no limit
+        curl_off_t rate;
+    };
+
+    static curl_off_t transferred(CURL *curl);
+    static void fill(std::vector<Share>& shares, curl_off_t budget);
+    void share();
+    bool capped() const;
+
+    curl_off_t m_total;
+    curl_off_t m_perClass[PRIORITY_CLASSES];
+    std::map<CURL *, Flow> m_flows;
+    long long m_lastUpdate;
+    curl_off_t m_rate;
+};
+
+} // namespace webworks
+
+#endif // FILETRANSFER_SHAPER_H_
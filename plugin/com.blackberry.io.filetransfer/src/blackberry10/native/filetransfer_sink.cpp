@@ -0,0 +1,415 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "filetransfer_sink.hpp"
+
+#include <curl/curl.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+namespace webworks {
+
+DownloadSink::DownloadSink()
+    : m_fd(-1), m_ownsFd(false), m_writeBehind(false), m_buffer(NULL), m_used(0), m_start(0), m_allocated(0),
+      m_failed(false), m_queued(0)
+{
+}
+
+DownloadSink::~DownloadSink()
+{
+    Close();
+}
+
+bool DownloadSink::Open(const std::string& path, bool truncate)
+{
+    Close();
+
+    m_fd = open(path.c_str(), O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+    m_ownsFd = true;
+
+    return m_fd >= 0;
+}
+
+void DownloadSink::Attach(int fd, curl_off_t offset)
+{
+    Close();
+
+    m_fd = fd;
+    m_ownsFd = false;
+    m_start = offset;
+}
+
+bool DownloadSink::Close()
+{
+    if (m_fd < 0) {
+        return true;
+    }
+
+    // The writer thread may still hold buffers of this sink
+    bool ok = flushBuffer();
+    ok = drain() && ok;
+
+    if (m_ownsFd && close(m_fd) != 0) {
+        ok = false;
+    }
+
+    delete[] m_buffer;
+    for (size_t i = 0; i < m_spare.size(); i++) {
+        delete[] m_spare[i];
+    }
+    m_spare.clear();
+
+    m_fd = -1;
+    m_buffer = NULL;
+    m_used = 0;
+    m_start = 0;
+    m_allocated = 0;
+    m_failed = false;
+
+    return ok;
+}
+
+bool DownloadSink::IsOpen() const
+{
+    return m_fd >= 0;
+}
+
+void DownloadSink::SetWriteBehind(bool writeBehind)
+{
+    m_writeBehind = writeBehind;
+}
+
+bool DownloadSink::Preallocate(curl_off_t length)
+{
+    if (length <= m_allocated) {
+        return true;
+    }
+
+    if (!Preallocate(m_fd, length)) {
+        return false;
+    }
+
+    m_allocated = length;
+    return true;
+}
+
+bool DownloadSink::Preallocate(int fd, curl_off_t length)
+{
+    const int error = posix_fallocate(fd, 0, length);
+
+    if (error == ENOSPC || error == EFBIG) {
+        return false;
+    }
+
+    // Not every file system can reserve space; the size is set regardless
+    if (error != 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size < length) {
+            return ftruncate(fd, length) == 0;
+        }
+    }
+
+    return true;
+}
+
+bool DownloadSink::Write(const char *data, size_t length)
+{
+    if (!m_writeBehind && m_failed) {
+        return false;
+    }
+
+    while (length > 0) {
+        // Large pieces need not be copied when there is no thread to hand
+        // them to
+        if (!m_writeBehind && m_used == 0 && length >= BUFFER_SIZE) {
+            if (!writeAt(data, length, m_start)) {
+                m_failed = true;
+                return false;
+            }
+            m_start += length;
+            return true;
+        }
+
+        if (!m_buffer) {
+            m_buffer = takeBuffer();
+        }
+
+        const size_t amount = length < BUFFER_SIZE - m_used ? length : BUFFER_SIZE - m_used;
+        memcpy(m_buffer + m_used, data, amount);
+        m_used += amount;
+        data += amount;
+        length -= amount;
+
+        if (m_used == BUFFER_SIZE && !flushBuffer()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool DownloadSink::Truncate(curl_off_t length)
+{
+    // What is queued has to land before it can be cut off
+    m_used = 0;
+    drain();
+    m_failed = false;
+
+    if (ftruncate(m_fd, length) != 0) {
+        return false;
+    }
+
+    m_start = length;
+    m_allocated = 0;
+    return true;
+}
+
+bool DownloadSink::Sync()
+{
+    return flushBuffer() && drain() && fsync(m_fd) == 0;
+}
+
+void DownloadSink::Checkpoint(SinkCheckpoint *checkpoint)
+{
+    if (!flushBuffer()) {
+        checkpoint->Synced(false);
+        delete checkpoint;
+        return;
+    }
+
+    SinkWriter::Instance().Queue(this, checkpoint);
+}
+
+bool DownloadSink::Finish()
+{
+    if (!flushBuffer() || !drain()) {
+        return false;
+    }
+
+    if (m_allocated > m_start && ftruncate(m_fd, m_start) != 0) {
+        return false;
+    }
+
+    m_allocated = 0;
+    return fsync(m_fd) == 0;
+}
+
+bool DownloadSink::flushBuffer()
+{
+    if (m_used == 0) {
+        return m_writeBehind || !m_failed;
+    }
+
+    bool ok;
+    if (m_writeBehind) {
+        ok = SinkWriter::Instance().Queue(this, m_buffer, m_used, m_start);
+        m_buffer = NULL;
+    } else {
+        ok = writeAt(m_buffer, m_used, m_start);
+        m_failed = !ok;
+    }
+
+    m_start += m_used;
+    m_used = 0;
+
+    return ok;
+}
+
+bool DownloadSink::drain()
+{
+    // Checkpoints are queued with or without write-behind
+    const bool written = SinkWriter::Instance().Drain(this);
+
+    return m_writeBehind ? written : !m_failed;
+}
+
+bool DownloadSink::writeAt(const char *data, size_t length, curl_off_t offset)
+{
+    while (length > 0) {
+        const ssize_t written = pwrite(m_fd, data, length, offset);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        data += written;
+        length -= written;
+        offset += written;
+    }
+
+    return true;
+}
+
+char *DownloadSink::takeBuffer()
+{
+    char *buffer = m_writeBehind ? SinkWriter::Instance().TakeSpare(this) : NULL;
+    return buffer ? buffer : new char[BUFFER_SIZE];
+}
+
+SinkWriter *SinkWriter::s_instance = NULL;
+pthread_once_t SinkWriter::s_once = PTHREAD_ONCE_INIT;
+
+SinkWriter& SinkWriter::Instance()
+{
+    pthread_once(&s_once, createInstance);
+    return *s_instance;
+}
+
+void SinkWriter::createInstance()
+{
+    s_instance = new SinkWriter();
+}
+
+SinkWriter::SinkWriter()
+{
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_queuedCond, NULL);
+    pthread_cond_init(&m_writtenCond, NULL);
+
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+
+    pthread_t thread;
+    pthread_create(&thread, &thread_attr, writerThread, this);
+    pthread_attr_destroy(&thread_attr);
+}
+
+SinkWriter::~SinkWriter()
+{
+    // The writer lives as long as the process
+}
+
+bool SinkWriter::Queue(DownloadSink *sink, char *buffer, size_t length, curl_off_t offset)
+{
+    Block block;
+    block.sink = sink;
+    block.buffer = buffer;
+    block.length = length;
+    block.offset = offset;
+    block.checkpoint = NULL;
+
+    pthread_mutex_lock(&m_lock);
+    while (sink->m_queued >= DownloadSink::MAX_QUEUED) {
+        pthread_cond_wait(&m_writtenCond, &m_lock);
+    }
+    sink->m_queued++;
+    m_queue.push_back(block);
+    pthread_cond_signal(&m_queuedCond);
+    const bool ok = !sink->m_failed;
+    pthread_mutex_unlock(&m_lock);
+
+    return ok;
+}
+
+void SinkWriter::Queue(DownloadSink *sink, SinkCheckpoint *checkpoint)
+{
+    Block block;
+    block.sink = sink;
+    block.buffer = NULL;
+    block.length = 0;
+    block.offset = 0;
+    block.checkpoint = checkpoint;
+
+    pthread_mutex_lock(&m_lock);
+    sink->m_queued++;
+    m_queue.push_back(block);
+    pthread_cond_signal(&m_queuedCond);
+    pthread_mutex_unlock(&m_lock);
+}
+
+bool SinkWriter::Drain(DownloadSink *sink)
+{
+    pthread_mutex_lock(&m_lock);
+    while (sink->m_queued > 0) {
+        pthread_cond_wait(&m_writtenCond, &m_lock);
+    }
+    const bool ok = !sink->m_failed;
+    pthread_mutex_unlock(&m_lock);
+
+    return ok;
+}
+
+char *SinkWriter::TakeSpare(DownloadSink *sink)
+{
+    char *buffer = NULL;
+
+    pthread_mutex_lock(&m_lock);
+    if (!sink->m_spare.empty()) {
+        buffer = sink->m_spare.back();
+        sink->m_spare.pop_back();
+    }
+    pthread_mutex_unlock(&m_lock);
+
+    return buffer;
+}
+
+void *SinkWriter::writerThread(void *arg)
+{
+    static_cast<SinkWriter *>(arg)->run();
+    return NULL;
+}
+
+void SinkWriter::run()
+{
+    for (;;) {
+        pthread_mutex_lock(&m_lock);
+        while (m_queue.empty()) {
+            pthread_cond_wait(&m_queuedCond, &m_lock);
+        }
+        const Block block = m_queue.front();
+        m_queue.pop_front();
+        // Without write-behind the failures are the sink's own business
+        const bool skip = block.sink->m_writeBehind && block.sink->m_failed;
+        pthread_mutex_unlock(&m_lock);
+
+        if (block.checkpoint) {
+            // A failed sync only costs the checkpoint, the data may still
+            // get there
+            block.checkpoint->Synced(!skip && fsync(block.sink->m_fd) == 0);
+            delete block.checkpoint;
+
+            pthread_mutex_lock(&m_lock);
+            block.sink->m_queued--;
+            pthread_cond_broadcast(&m_writtenCond);
+            pthread_mutex_unlock(&m_lock);
+            continue;
+        }
+
+        // Once a write has failed the download is lost anyway
+        const bool ok = skip || block.sink->writeAt(block.buffer, block.length, block.offset);
+
+        pthread_mutex_lock(&m_lock);
+        if (!ok) {
+            block.sink->m_failed = true;
+        }
+        block.sink->m_spare.push_back(block.buffer);
+        block.sink->m_queued--;
+        pthread_cond_broadcast(&m_writtenCond);
+        pthread_mutex_unlock(&m_lock);
+    }
+}
+
+} // namespace webworks
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FILETRANSFER_SINK_H_
+#define FILETRANSFER_SINK_H_
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace webworks {
+
+// Work that has to wait until the data written before it is on disk, see
+// DownloadSink::Checkpoint
+class SinkCheckpoint {
+public:
+    virtual ~SinkCheckpoint() {}
+    // Called on SinkWriter's thread; ok is false if the data could not be
+    // synced
+    virtual void Synced(bool ok) = 0;
+};
+
+/*
+ * Where the body of a download goes. Data is collected in a large buffer
+ * that is written out with pwrite once full, instead of one stdio write per
+ * piece curl hands over. With write-behind the full buffers are written by
+ * SinkWriter's thread instead, so a slow disk only holds up the transfer
+ * once MAX_QUEUED buffers are waiting. Nothing is synced until Sync or
+ * Finish is called, or a checkpoint has SinkWriter's thread do it.
+ */
+class DownloadSink {
+public:
+    DownloadSink();
+    ~DownloadSink();
+
+    // Opens a file of its own, emptying it if truncate is set
+    bool Open(const std::string& path, bool truncate);
+    // Writes from offset on into a file that belongs to someone else
+    void Attach(int fd, curl_off_t offset);
+    // Flushes what is buffered and lets go of the file; false if any of the
+    // data could not be written
+    bool Close();
+    bool IsOpen() const;
+    void SetWriteBehind(bool writeBehind);
+
+    // Reserves the disk space for a file of the given length up front; false
+    // only if the space is not there
+    bool Preallocate(curl_off_t length);
+    static bool Preallocate(int fd, curl_off_t length);
+
+    // Takes all of the data or fails; errors of write-behind show up here on
+    // a later call
+    bool Write(const char *data, size_t length);
+    // Drops everything past length, including what is still buffered
+    bool Truncate(curl_off_t length);
+    // Gets what was written onto the disk
+    bool Sync();
+    // The same without waiting for it: SinkWriter's thread syncs the file
+    // once what was written so far has reached it, and then hands over to
+    // checkpoint, which it deletes. Closing or truncating the sink waits for
+    // the checkpoints queued
+    void Checkpoint(SinkCheckpoint *checkpoint);
+    // Syncs and cuts off the space reserved beyond the data
+    bool Finish();
+
+private:
+    static const size_t BUFFER_SIZE = 256 * 1024;
+    static const int MAX_QUEUED = 4;
+
+    friend class SinkWriter;
+
+    DownloadSink(DownloadSink const&);
+    void operator=(DownloadSink const&);
+
+    bool flushBuffer();
+    bool drain();
+    bool writeAt(const char *data, size_t length, curl_off_t offset);
+    char *takeBuffer();
+
+    int m_fd;
+    bool m_ownsFd;
+    bool m_writeBehind;
+    char *m_buffer;
+    size_t m_used;
+    // Where the buffer goes in the file
+    curl_off_t m_start;
+    curl_off_t m_allocated;
+
+    // Shared with the write-behind thread, under its lock
+    bool m_failed;
+    int m_queued;
+    std::vector<char *> m_spare;
+};
+
+/*
+ * The thread behind DownloadSink's write-behind and checkpoints, shared by
+ * all downloads. Buffers are written, and checkpoints synced, in the order
+ * they were queued.
+ */
+class SinkWriter {
+public:
+    static SinkWriter& Instance();
+
+    // Waits while the sink already has its share of buffers queued; false
+    // once an earlier buffer of the sink failed
+    bool Queue(DownloadSink *sink, char *buffer, size_t length, curl_off_t offset);
+    // Does not wait, a checkpoint holds no buffer
+    void Queue(DownloadSink *sink, SinkCheckpoint *checkpoint);
+    // Waits until the buffers of the sink are written; false if any failed
+    bool Drain(DownloadSink *sink);
+    char *TakeSpare(DownloadSink *sink);
+
+private:
+    struct Block {
+        DownloadSink *sink;
+        char *buffer;
+        size_t length;
+        curl_off_t offset;
+        // Instead of a buffer
+        SinkCheckpoint *checkpoint;
+    };
+
+    SinkWriter();
+    ~SinkWriter();
+    explicit SinkWriter(SinkWriter const&);
+    void operator=(SinkWriter const&);
+
+    static void createInstance();
+    static void *writerThread(void *arg);
+    void run();
+
+    std::deque<Block> m_queue;
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_queuedCond;
+    pthread_cond_t m_writtenCond;
+
+    static SinkWriter *s_instance;
+    static pthread_once_t s_once;
+};
+
+} // namespace webworks
+
+#endif // FILETRANSFER_SINK_H_
@@ -0,0 +1,195 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "filetransfer_source.hpp"
+
+#include <curl/curl.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+
+namespace webworks {
+
+UploadSource::UploadSource()
+    : m_fd(-1), m_size(0), m_position(0), m_maxRead(0), m_digest(NULL), m_mappable(true), m_window(NULL), m_windowStart(0),
+      m_windowLength(0)
+{
+}
+
+UploadSource::~UploadSource()
+{
+    Close();
+}
+
+bool UploadSource::Open(const std::string& path)
+{
+    Close();
+
+    m_fd = open(path.c_str(), O_RDONLY);
+    if (m_fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(m_fd, &st) != 0) {
+        Close();
+        return false;
+    }
+
+    m_size = st.st_size;
+    m_position = 0;
+    m_mappable = S_ISREG(st.st_mode);
+
+    return true;
+}
+
+void UploadSource::Close()
+{
+    unmapWindow();
+
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool UploadSource::IsOpen() const
+{
+    return m_fd >= 0;
+}
+
+curl_off_t UploadSource::Size() const
+{
+    return m_size;
+}
+
+void UploadSource::SetMaxRead(size_t maxRead)
+{
+    m_maxRead = maxRead;
+}
+
+void UploadSource::SetDigest(StreamDigest *digest)
+{
+    m_digest = digest;
+}
+
+size_t UploadSource::Read(char *buffer, size_t length)
+{
+    if (m_maxRead > 0 && length > m_maxRead) {
+        length = m_maxRead;
+    }
+
+    if (m_position >= m_size || length == 0) {
+        return 0;
+    }
+
+    if (m_mappable) {
+        const bool inWindow = m_window && m_position >= m_windowStart
+            && m_position < m_windowStart + static_cast<curl_off_t>(m_windowLength);
+
+        if (inWindow || mapWindow(m_position)) {
+            const size_t offset = static_cast<size_t>(m_position - m_windowStart);
+            const size_t available = m_windowLength - offset;
+            const size_t amount = length < available ? length : available;
+
+            memcpy(buffer, m_window + offset, amount);
+            m_position += amount;
+            return hash(buffer, m_position - amount, amount) ? amount : static_cast<size_t>(-1);
+        }
+
+        // Not every file system can map files
+        m_mappable = false;
+    }
+
+    ssize_t amount;
+    do {
+        amount = pread(m_fd, buffer, length, m_position);
+    } while (amount < 0 && errno == EINTR);
+
+    if (amount < 0) {
+        return static_cast<size_t>(-1);
+    }
+
+    m_position += amount;
+    return hash(buffer, m_position - amount, amount) ? static_cast<size_t>(amount) : static_cast<size_t>(-1);
+}
+
+bool UploadSource::Seek(curl_off_t offset)
+{
+    if (offset < 0 || offset > m_size) {
+        return false;
+    }
+
+    m_position = offset;
+    return true;
+}
+
+bool UploadSource::hash(const char *buffer, curl_off_t start, size_t length)
+{
+    if (!m_digest) {
+        return true;
+    }
+
+    // Rewound reads, e.g. after a redirect, were hashed the first time round
+    const curl_off_t hashed = m_digest->Length();
+    if (start <= hashed && start + static_cast<curl_off_t>(length) > hashed) {
+        const size_t skip = static_cast<size_t>(hashed - start);
+        m_digest->Update(buffer + skip, length - skip);
+    }
+
+    return m_digest->Length() < m_size || m_digest->Matches();
+}
+
+bool UploadSource::mapWindow(curl_off_t offset)
+{
+    unmapWindow();
+
+    // Mappings have to start on a page boundary
+    const curl_off_t page = sysconf(_SC_PAGESIZE);
+    const curl_off_t start = offset - offset % page;
+    const curl_off_t left = m_size - start;
+    const size_t length = left < static_cast<curl_off_t>(WINDOW_SIZE) ? static_cast<size_t>(left) : WINDOW_SIZE;
+
+    void *window = mmap(NULL, length, PROT_READ, MAP_SHARED, m_fd, start);
+    if (window == MAP_FAILED) {
+        return false;
+    }
+
+    // The window is read once from front to back
+    posix_madvise(window, length, POSIX_MADV_SEQUENTIAL);
+    posix_madvise(window, length, POSIX_MADV_WILLNEED);
+
+    m_window = static_cast<char *>(window);
+    m_windowStart = start;
+    m_windowLength = length;
+
+    return true;
+}
+
+void UploadSource::unmapWindow()
+{
+    if (m_window) {
+        munmap(m_window, m_windowLength);
+        m_window = NULL;
+        m_windowLength = 0;
+    }
+}
+
+} // namespace webworks
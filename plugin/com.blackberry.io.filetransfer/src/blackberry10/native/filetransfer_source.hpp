@@ -0,0 +1,79 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FILETRANSFER_SOURCE_H_
+#define FILETRANSFER_SOURCE_H_
+
+#include <curl/curl.h>
+#include <stddef.h>
+#include <string>
+
+#include "filetransfer_digest.hpp"
+
+namespace webworks {
+
+/*
+ * The file of an upload, read through a window mapped into memory instead
+ * of stdio. The window is much larger than what curl asks for at a time and
+ * moves along the file, so large files never need to fit in the address
+ * space. Files that cannot be mapped are read with pread instead.
+ */
+class UploadSource {
+public:
+    UploadSource();
+    ~UploadSource();
+
+    bool Open(const std::string& path);
+    void Close();
+    bool IsOpen() const;
+    curl_off_t Size() const;
+
+    // Limits what one Read returns, e.g. to the size of an HTTP chunk; 0 for
+    // no limit
+    void SetMaxRead(size_t maxRead);
+    // Hashes every byte the first time it is read. The read that completes
+    // the file fails if the digest does not match, so the file never gets
+    // to the server whole.
+    void SetDigest(StreamDigest *digest);
+    // Copies up to length bytes from the current position; returns 0 at the
+    // end of the file and (size_t)-1 on error
+    size_t Read(char *buffer, size_t length);
+    bool Seek(curl_off_t offset);
+
+private:
+    static const size_t WINDOW_SIZE = 4 * 1024 * 1024;
+
+    UploadSource(UploadSource const&);
+    void operator=(UploadSource const&);
+
+    bool mapWindow(curl_off_t offset);
+    void unmapWindow();
+    bool hash(const char *buffer, curl_off_t start, size_t length);
+
+    int m_fd;
+    curl_off_t m_size;
+    curl_off_t m_position;
+    size_t m_maxRead;
+    StreamDigest *m_digest;
+    bool m_mappable;
+    char *m_window;
+    curl_off_t m_windowStart;
+    size_t m_windowLength;
+};
+
+} // namespace webworks
+
+#endif // FILETRANSFER_SOURCE_H_
@@ -19,7 +19,8 @@
 
 var _self = {},
     exec = cordova.require("cordova/exec"),
-    _ID = "cordova-plugin-bb-filetransfer";
+    _ID = "cordova-plugin-bb-filetransfer",
+    _transfers = 0;
 
 function defineReadOnlyField(obj, field, value) {
     Object.defineProperty(obj, field, {
@@ -28,18 +29,67 @@ function defineReadOnlyField(obj, field, value) {
     });
 }
 
+// options.onprogress is called with { loaded, total, rate } at most every
+// options.progressInterval ms (250 by default), once options.progressStep
+// more KB were transferred. options.priority is "high", "normal" (the
+// default) or "low": queued transfers start in that order, and higher ones
+// get more of a bandwidth cap set with configure
+function progressOptions(options) {
+    var copy = {},
+        key;
+
+    for (key in options) {
+        if (options.hasOwnProperty(key) && key !== "onprogress") {
+            copy[key] = options[key];
+        }
+    }
+
+    if (typeof options.onprogress === "function" && !copy.progressInterval) {
+        copy.progressInterval = 250;
+    }
+
+    return copy;
+}
+
+function reportProgress(options, args) {
+    if (options && typeof options.onprogress === "function") {
+        options.onprogress({
+            "loaded": args.loaded,
+            "total": args.total,
+            "rate": args.rate
+        });
+    }
+}
+
+// Pairs the code of each part of a batch with its file
+function batchParts(files, codes) {
+    return files.map(function (file, i) {
+        return {
+            "filePath": typeof file === "string" ? file : file.filePath,
+            "sent": codes[i] === 0,
+            "code": codes[i]
+        };
+    });
+}
+
 _self.upload = function (filePath, server, successCallback, errorCallback, options) {
     var args = {
             "filePath": filePath,
             "server": server,
-            "options": options || {}
+            "options": progressOptions(options || {}),
+            "transferId": ++_transfers
         },
         success = function (args) {
             var obj = {};
 
-            if (args.result === "success") {
+            if (args.result === "progress") {
+                reportProgress(options, args);
+            } else if (args.result === "success") {
                 obj.bytesSent = args.bytesSent;
                 obj.responseCode = args.responseCode;
+                obj.digest = args.digest;
+                obj.responseSize = args.responseSize;
+                obj.responseTruncated = args.responseTruncated;
                 obj.response = unescape(args.response);
                 successCallback(obj);
             } else if (args.result === "error") {
@@ -52,21 +102,88 @@ _self.upload = function (filePath, server, successCallback, errorCallback, optio
             }
         };
 
+    // options.compress sends the request gzip compressed, with a
+    // Content-Encoding: gzip header; the server has to decode it. Its
+    // length is not known up front, so it is sent chunked and, as in
+    // chunkedMode, bytesSent is -1.
+    // options.digest is "sha-256", "sha-1", "md5" or "crc32c", optionally
+    // followed by ":" and the expected hex digest; the file is hashed as it
+    // is sent, the result has it as "algorithm:hex", and a file that does
+    // not match fails with INTEGRITY_ERR.
+    // options.maxResponseSize keeps only that many KB of the response, 0
+    // none of it; options.responseFile writes it to that file instead, once
+    // the upload succeeded. The result tells the responseSize in bytes and
+    // whether the response was responseTruncated
     exec(success, errorCallback, _ID, "upload", args);
+
+    return args.transferId;
+};
+
+_self.uploadBatch = function (files, server, successCallback, errorCallback, options) {
+    var args = {
+            "files": files,
+            "server": server,
+            "options": progressOptions(options || {}),
+            "transferId": ++_transfers
+        },
+        success = function (args) {
+            var obj = {};
+
+            if (args.result === "progress") {
+                reportProgress(options, args);
+            } else if (args.result === "success") {
+                obj.bytesSent = args.bytesSent;
+                obj.responseCode = args.responseCode;
+                obj.parts = batchParts(files, args.parts);
+                obj.responseSize = args.responseSize;
+                obj.responseTruncated = args.responseTruncated;
+                obj.response = unescape(args.response);
+                successCallback(obj);
+            } else if (args.result === "error") {
+                obj.code = args.code;
+                obj.source = args.source;
+                obj.target = args.target;
+                obj.http_status = args.http_status;
+                obj.parts = batchParts(files, args.parts);
+                errorCallback(obj);
+            }
+        };
+
+    // Sends all files in one multipart request, each streamed from disk as a
+    // part of its own. files are paths, or objects with a filePath and their
+    // own fileKey, fileName or mimeType; the options are those of upload,
+    // without compress and digest. The result has a part for each file with
+    // sent and code, FILE_NOT_FOUND_ERR for a file that was left out
+    exec(success, errorCallback, _ID, "uploadBatch", args);
+
+    return args.transferId;
 };
 
-_self.download = function (source, target, successCallback, errorCallback) {
+_self.download = function (source, target, successCallback, errorCallback, options) {
     var args = {
             "source": source,
-            "target": target
+            "transferId": ++_transfers
         },
         success = function (args) {
 
             var obj = {};
 
-            if (args.result === "success") {
+            if (args.result === "progress") {
+                reportProgress(options, args);
+            } else if (args.result === "success" && args.data !== undefined) {
+                obj.responseCode = args.responseCode;
+                obj.encoding = args.encoding;
+                obj.digest = args.digest;
+                obj.length = args.length;
+                obj.data = args.data;
+                successCallback(obj);
+            } else if (args.result === "success") {
                 obj.isFile = args.isFile;
                 obj.isDirectory = args.isDirectory;
+                obj.cache = args.cache;
+                obj.cacheHits = args.cacheHits;
+                obj.cacheMisses = args.cacheMisses;
+                obj.digest = args.digest;
                 obj.name = args.name;
                 obj.fullPath = unescape(args.fullPath);
                 successCallback(obj);
@@ -79,12 +196,95 @@ _self.download = function (source, target, successCallback, errorCallback) {
             }
         };
 
+    // options.segments splits large files into that many ranges fetched in
+    // parallel, none smaller than options.minSegmentSize KB; with
+    // options.writeBehind the file is written on a thread of its own.
+    // options.cache keeps the file and reuses it for as long as the server
+    // says it is current; the result tells whether it was a "hit", a "miss"
+    // or "off", along with the hits and misses so far. options.digest works
+    // as for uploads, and keeps the download to a single stream.
+    // options.memory keeps the file in memory instead of writing target,
+    // which may be null; the result has it as data, "base64" encoded or as
+    // "text", with its length in bytes. Files over options.maxMemorySize KB
+    // (1024 by default) fail with TOO_LARGE_ERR. options.background keeps a
+    // download to a file going once the page that started it goes away,
+    // see transfers; otherwise it ends with the page
+    if (target) {
+        args.target = target;
+    }
+
+    if (options) {
+        args.options = progressOptions(options);
+    }
+
     exec(success, errorCallback, _ID, "download", args);
+
+    return args.transferId;
+};
+
+// Stops a transfer started by upload, uploadBatch or download, which
+// return its id. Its errorCallback gets ABORT_ERR, unless it finished first;
+// a download leaves no partial file behind
+_self.abort = function (transferId, successCallback, errorCallback) {
+    var args = {
+            "transferId": transferId
+        };
+
+    exec(successCallback, errorCallback, _ID, "abort", args);
+};
+
+// options.maxTransfers and options.maxTransfersPerHost limit the transfers
+// running at the same time, options.maxStreamsPerHost those to a host that
+// takes them over one HTTP/2 connection, options.cacheSize the disk space of
+// the download cache in KB. options.maxRate caps the bandwidth of all
+// transfers together in KB/s, and options.maxRateHigh, maxRateNormal and
+// maxRateLow that of each priority; 0 lifts a cap. successCallback gets the
+// limits in effect; an unknown option, or one that is not a number, goes to
+// errorCallback and changes nothing
+_self.configure = function (options, successCallback, errorCallback) {
+    var args = {
+            "options": options || {}
+        };
+
+    exec(successCallback, errorCallback, _ID, "configure", args);
+};
+
+// Calls successCallback with the transfers that are queued and running, as
+// { high, normal, low } each, the downloads delayed before a retry, those
+// prompting about a certificate, and the rate of all of them in bytes/s
+_self.stats = function (successCallback, errorCallback) {
+    exec(successCallback, errorCallback, _ID, "stats", {});
+};
+
+// Calls successCallback with the background downloads kept in the journal,
+// each as { id, type, source, target, state, bytes, code }: state is
+// "queued", "running", "done" or "failed" with code, and bytes tells how
+// much of a download is safely on disk. They outlive the page and the
+// application: those it left unfinished are resumed once the plugin is
+// first used again. A download started again while it is being resumed
+// takes it over, rather than running twice. Uploads are not kept, and end
+// with the page
+_self.transfers = function (successCallback, errorCallback) {
+    exec(successCallback, errorCallback, _ID, "transfers", {});
+};
+
+// Stops the download of the journal entry with that id, whichever page
+// started it; if that page is still there, its errorCallback gets ABORT_ERR.
+// The entry is then "failed" with ABORT_ERR, unless it finished first
+_self.abortTransfer = function (id, successCallback, errorCallback) {
+    var args = {
+            "id": id
+        };
+
+    exec(successCallback, errorCallback, _ID, "abortTransfer", args);
 };
 
 defineReadOnlyField(_self, "FILE_NOT_FOUND_ERR", 1);
 defineReadOnlyField(_self, "INVALID_URL_ERR", 2);
 defineReadOnlyField(_self, "CONNECTION_ERR", 3);
 defineReadOnlyField(_self, "PERMISSIONS_ERR", 3);
+defineReadOnlyField(_self, "INTEGRITY_ERR", 5);
+defineReadOnlyField(_self, "ABORT_ERR", 6);
+defineReadOnlyField(_self, "TOO_LARGE_ERR", 7);
 
 module.exports = _self;
@@ -44,25 +44,24 @@ std::string PaymentBPS::GetResultStr()
     return result_str;
 }
 
-BPS_API int PaymentBPS::Purchase(const Json::Value obj, const bool developmentMode)
+BPS_API int PaymentBPS::Purchase(const PurchaseArguments& purchase, const bool developmentMode)
 {
     BPS_API int paymentResponse;
     paymentservice_set_connection_mode(developmentMode);
 
     purchase_arguments_t* args  = NULL;
     paymentservice_purchase_arguments_create(&args);
-    paymentservice_purchase_arguments_set_digital_good_id(args, obj["digitalGoodID"].asCString());
-    paymentservice_purchase_arguments_set_digital_good_sku(args, obj["digitalGoodSKU"].asCString());
-    paymentservice_purchase_arguments_set_digital_good_name(args, obj["digitalGoodName"].asCString());
-    paymentservice_purchase_arguments_set_metadata(args, obj["metaData"].asCString());
-    paymentservice_purchase_arguments_set_app_name(args, obj["purchaseAppName"].asCString());
-    paymentservice_purchase_arguments_set_group_id(args, obj["windowGroup"].asCString() );
-    paymentservice_purchase_arguments_set_app_icon(args, obj["purchaseAppIcon"].asCString());
-
-    Json::Value::Members extraParameters_vector = obj["extraParameters"].getMemberNames();
-    std::vector<std::string>::iterator itr;
-    for ( itr = extraParameters_vector.begin(); itr < extraParameters_vector.end(); ++itr ) {
-        paymentservice_purchase_arguments_set_extra_parameter(args, itr->c_str(), obj["extraParameters"].operator[](itr->c_str()).asCString());
+    paymentservice_purchase_arguments_set_digital_good_id(args, purchase.digitalGoodID.c_str());
+    paymentservice_purchase_arguments_set_digital_good_sku(args, purchase.digitalGoodSKU.c_str());
+    paymentservice_purchase_arguments_set_digital_good_name(args, purchase.digitalGoodName.c_str());
+    paymentservice_purchase_arguments_set_metadata(args, purchase.metaData.c_str());
+    paymentservice_purchase_arguments_set_app_name(args, purchase.purchaseAppName.c_str());
+    paymentservice_purchase_arguments_set_group_id(args, purchase.windowGroup.c_str());
+    paymentservice_purchase_arguments_set_app_icon(args, purchase.purchaseAppIcon.c_str());
+
+    std::map<std::string, std::string>::const_iterator itr;
+    for (itr = purchase.extraParameters.begin(); itr != purchase.extraParameters.end(); ++itr) {
+        paymentservice_purchase_arguments_set_extra_parameter(args, itr->first.c_str(), itr->second.c_str());
     }
 
     paymentResponse = paymentservice_purchase_request_with_arguments(args);
@@ -20,12 +20,24 @@
 #include <bps/bps.h>
 #include <bps/paymentservice.h>
 #include <json/writer.h>
+#include <map>
 #include <string>
 
 class Payment;
 
 namespace webworks {
 
+struct PurchaseArguments {
+    std::string digitalGoodID;
+    std::string digitalGoodSKU;
+    std::string digitalGoodName;
+    std::string metaData;
+    std::string purchaseAppName;
+    std::string purchaseAppIcon;
+    std::string windowGroup;
+    std::map<std::string, std::string> extraParameters;
+};
+
 class PaymentBPS {
 public:
     explicit PaymentBPS();
@@ -33,7 +45,7 @@ public:
     int InitializeEvents();
     int WaitForEvents(bool developmentMode);
     //Method call from JavaScript side
-    BPS_API int Purchase(const Json::Value obj, const bool developmentMode);
+    BPS_API int Purchase(const PurchaseArguments& purchase, const bool developmentMode);
     BPS_API int GetExistingPurchases(const Json::Value obj, const bool developmentMode);
     int GetPrice(const Json::Value obj, const bool developmentMode);
     int CheckExisting(const Json::Value obj, const bool developmentMode);
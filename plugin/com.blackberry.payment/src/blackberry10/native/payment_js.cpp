@@ -16,12 +16,24 @@
 
 #include <json/reader.h>
 #include <stdio.h>
+#include <webworks_json_binding.hpp>
 #include <webworks_utils.hpp>
 #include <string>
 #include <vector>
 #include "payment_js.hpp"
 #include "payment_bps.hpp"
 
+WEBWORKS_JSON_BINDING_BEGIN(webworks::PurchaseArguments)
+    WEBWORKS_JSON_FIELD("digitalGoodID", digitalGoodID)
+    WEBWORKS_JSON_FIELD("digitalGoodSKU", digitalGoodSKU)
+    WEBWORKS_JSON_FIELD("digitalGoodName", digitalGoodName)
+    WEBWORKS_JSON_FIELD("metaData", metaData)
+    WEBWORKS_JSON_FIELD("purchaseAppName", purchaseAppName)
+    WEBWORKS_JSON_FIELD("purchaseAppIcon", purchaseAppIcon)
+    WEBWORKS_JSON_FIELD("windowGroup", windowGroup)
+    WEBWORKS_JSON_FIELD("extraParameters", extraParameters)
+WEBWORKS_JSON_BINDING_END()
+
 Payment::Payment(const std::string& id) : m_id(id)
 {
     developmentMode = false;
@@ -68,6 +80,22 @@ std::string Payment::InvokeMethod(const std::string& command)
     unsigned int index = command.find_first_of(" ");
     string strCommand = command.substr(0, index);
 
+    std::stringstream ss;
+    BPS_API int paymentResponse;
+
+    // Read straight into the arguments, without a Json::Value in between
+    if (strCommand == "purchase") {
+        webworks::PurchaseArguments purchase;
+
+        if (command.length() > index && !webworks::json::fromJson(command.substr(index + 1), purchase)) {
+            return "Cannot parse JSON object";
+        }
+
+        payment->InitializeEvents();
+        paymentResponse = payment->Purchase(purchase, developmentMode);
+        return processResponse(paymentResponse, &ss);
+    }
+
     // Parse JSON object
     Json::Value obj;
 
@@ -80,14 +108,7 @@ std::string Payment::InvokeMethod(const std::string& command)
         }
     }
 
-    std::stringstream ss;
-    BPS_API int paymentResponse;
-
-    if (strCommand == "purchase") {
-        payment->InitializeEvents();
-        paymentResponse = payment->Purchase(obj, developmentMode);
-        return processResponse(paymentResponse, &ss);
-    } else if (strCommand == "getExistingPurchases") {
+    if (strCommand == "getExistingPurchases") {
         payment->InitializeEvents();
         paymentResponse = payment->GetExistingPurchases(obj, developmentMode);
         return processResponse(paymentResponse, &ss);
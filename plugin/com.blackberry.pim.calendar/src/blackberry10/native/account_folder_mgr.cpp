@@ -150,6 +150,23 @@ Json::Value AccountFolderManager::GetAccountJson(const bbpimAccount::Account& ac
 
 Json::Value AccountFolderManager::GetFolderJson(const bbpim::CalendarFolder& folder, bool skipDefaultCheck, bool fresh)
 {
+    const bool isDefault = skipDefaultCheck ? true : IsDefaultFolder(folder, fresh);
+    const bool enterprise = GetAccount(folder.accountId(), false).isEnterprise() == 1 ? true : false;
+    const std::string key = GetFolderKey(folder.accountId(), folder.id());
+
+    // Search results embed the same few folders in every event, so hand out
+    // copies of a frozen value instead of rebuilding it each time
+    if (mutex_lock() == 0) {
+        FolderJsonMap::const_iterator found = m_folderJsonMap.find(key);
+        if (found != m_folderJsonMap.end() && found->second.isDefault == isDefault
+                && found->second.enterprise == enterprise && isSameFolder(found->second.folder, folder)) {
+            Json::Value val = found->second.json;
+            mutex_unlock();
+            return val;
+        }
+        mutex_unlock();
+    }
+
     Json::Value val;
 
     val["id"] = webworks::Utils::intToStr(folder.id());
@@ -160,12 +177,29 @@ Json::Value AccountFolderManager::GetFolderJson(const bbpim::CalendarFolder& fol
     val["type"] = folder.type();
     val["color"] = QString("%1").arg(folder.color(), 6, 16, QChar('0')).toUpper().toStdString();
     val["visible"] = folder.isVisible();
-    val["default"] = skipDefaultCheck ? true : IsDefaultFolder(folder, fresh);
-    val["enterprise"] = GetAccount(folder.accountId(), false).isEnterprise() == 1 ? true : false;
+    val["default"] = isDefault;
+    val["enterprise"] = enterprise;
+    val.freeze();
+
+    if (mutex_lock() == 0) {
+        FolderJsonEntry& entry = m_folderJsonMap[key];
+        entry.folder = folder;
+        entry.isDefault = isDefault;
+        entry.enterprise = enterprise;
+        entry.json = val;
+        mutex_unlock();
+    }
 
     return val;
 }
 
+bool AccountFolderManager::isSameFolder(const bbpim::CalendarFolder& a, const bbpim::CalendarFolder& b)
+{
+    return a.id() == b.id() && a.accountId() == b.accountId() && a.name() == b.name()
+        && a.isReadOnly() == b.isReadOnly() && a.ownerEmail() == b.ownerEmail() && a.type() == b.type()
+        && a.color() == b.color() && a.isVisible() == b.isVisible();
+}
+
 void AccountFolderManager::fetchAccounts()
 {
     if (mutex_lock() == 0) {
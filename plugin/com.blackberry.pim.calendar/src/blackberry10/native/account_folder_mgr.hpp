@@ -33,6 +33,15 @@ namespace bbpimAccount = bb::pim::account;
 typedef std::map<std::string, bbpim::CalendarFolder> FolderMap;
 typedef std::map<bbpim::AccountId, bbpimAccount::Account> AccountMap;
 
+struct FolderJsonEntry {
+    bbpim::CalendarFolder folder;
+    bool isDefault;
+    bool enterprise;
+    Json::Value json; // frozen, copies share its members
+};
+
+typedef std::map<std::string, FolderJsonEntry> FolderJsonMap;
+
 class AccountFolderManager : public ThreadSync {
 public:
     explicit AccountFolderManager(ServiceProvider* provider);
@@ -55,8 +64,10 @@ private:
     void fetchFolders();
     void fetchDefaultAccount();
     void fetchDefaultFolder();
+    static bool isSameFolder(const bbpim::CalendarFolder& a, const bbpim::CalendarFolder& b);
 
     FolderMap m_foldersMap;
+    FolderJsonMap m_folderJsonMap;
     AccountMap m_accountsMap;
     bbpimAccount::Account m_defaultAccount;
     bbpim::CalendarFolder m_defaultFolder;
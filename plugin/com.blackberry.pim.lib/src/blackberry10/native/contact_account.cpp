@@ -47,6 +47,20 @@ bb::pim::account::Account ContactAccount::GetAccount(bb::pim::account::AccountKe
     return _accountMap.value(id);
 }
 
+Json::Value ContactAccount::GetAccountJson(bb::pim::account::AccountKey id, bool fresh)
+{
+    if (fresh) {
+        fetchContactAccounts();
+    }
+
+    QMap<bb::pim::account::AccountKey, Json::Value>::const_iterator found = _accountJsonMap.find(id);
+    if (found != _accountJsonMap.end()) {
+        return found.value();
+    }
+
+    return Account2Json(_accountMap.value(id));
+}
+
 Json::Value ContactAccount::Account2Json(const bb::pim::account::Account& account)
 {
     Json::Value jsonAccount;
@@ -63,10 +77,16 @@ void ContactAccount::fetchContactAccounts()
 
     _accounts.clear();
     _accountMap.clear();
+    _accountJsonMap.clear();
     for (QList<bb::pim::account::Account>::const_iterator it = accounts.begin(); it != accounts.end(); ++it) {
         if ((it->id() != ID_UNIFIED_ACCOUNT) && (it->id() != ID_ENHANCED_ACCOUNT)) {
             _accounts.append(*it);
             _accountMap.insert(it->id(), (bb::pim::account::Account)(*it));
+
+            // every contact lists its source accounts, share one frozen copy
+            Json::Value jsonAccount = Account2Json(*it);
+            jsonAccount.freeze();
+            _accountJsonMap.insert(it->id(), jsonAccount);
         }
     }
 }
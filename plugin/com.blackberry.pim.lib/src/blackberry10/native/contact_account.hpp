@@ -34,6 +34,8 @@ public:
     QList<bb::pim::account::Account> GetContactAccounts(bool fresh = false);
     // get the contact account with the specific id
     bb::pim::account::Account GetAccount(bb::pim::account::AccountKey id, bool fresh = false);
+    // get the serialized account with the specific id, shared with other callers
+    Json::Value GetAccountJson(bb::pim::account::AccountKey id, bool fresh = false);
     // serialize account to json object
     static Json::Value Account2Json(const bb::pim::account::Account& account);
 
@@ -45,6 +47,7 @@ private:
     // Refresh the accounts list and map
     void fetchContactAccounts();
     QMap<bb::pim::account::AccountKey, bb::pim::account::Account> _accountMap;
+    QMap<bb::pim::account::AccountKey, Json::Value> _accountJsonMap;
     QList<bb::pim::account::Account> _accounts;
     bb::pim::account::AccountService _accountService;
     static const int ID_UNIFIED_ACCOUNT = 4;
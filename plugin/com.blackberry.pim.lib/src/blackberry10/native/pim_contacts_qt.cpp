@@ -760,8 +760,7 @@ Json::Value PimContactsQt::populateContact(const bbpim::Contact& contact, const
     // fetch sourceAccounts by sourceSourceIds
     for (int i = 0; i < contact.sourceAccountIds().size(); ++i) {
         bb::pim::account::AccountKey id = contact.sourceAccountIds()[i];
-        bb::pim::account::Account account = _contactAccount.GetAccount(id);
-        contactItem["sourceAccounts"].append(ContactAccount::Account2Json(account));
+        contactItem["sourceAccounts"].append(_contactAccount.GetAccountJson(id));
     }
 
     contactItem["id"] = Utils::intToStr(contact.id());
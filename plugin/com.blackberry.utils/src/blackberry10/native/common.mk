@@ -9,9 +9,13 @@ LDFLAGS+=-Wl,-h,libutils.so
 include ../../../../../../meta.mk
 
 SRCS+=$(WEBWORKS_DIR)/dependencies/JsonCpp/jsoncpp-src-0.6.0-rc2/src/lib_json/json_reader.cpp \
+      $(WEBWORKS_DIR)/dependencies/JsonCpp/jsoncpp-src-0.6.0-rc2/src/lib_json/json_stream_reader.cpp \
       $(WEBWORKS_DIR)/dependencies/JsonCpp/jsoncpp-src-0.6.0-rc2/src/lib_json/json_value.cpp \
       $(WEBWORKS_DIR)/dependencies/JsonCpp/jsoncpp-src-0.6.0-rc2/src/lib_json/json_writer.cpp \
-      webworks_utils.cpp
+      webworks_utils.cpp \
+      webworks_json_binding.cpp \
+      webworks_json_parallel.cpp \
+      webworks_worker_pool.cpp
 
 include $(MKFILES_ROOT)/qtargets.mk
 
@@ -0,0 +1,532 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <json/writer.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string>
+
+#include "webworks_json_binding.hpp"
+
+namespace webworks {
+namespace json {
+
+Parser::Parser(const char *begin, const char *end) : m_current(begin), m_end(end), m_failed(false)
+{
+}
+
+bool Parser::failed() const
+{
+    return m_failed;
+}
+
+bool Parser::fail()
+{
+    m_failed = true;
+    return false;
+}
+
+Parser::TokenType Parser::peek()
+{
+    while (m_current < m_end && (*m_current == ' ' || *m_current == '\t' || *m_current == '\r' || *m_current == '\n')) {
+        m_current++;
+    }
+
+    if (m_failed || m_current == m_end) {
+        return TOKEN_NONE;
+    }
+
+    switch (*m_current) {
+        case '{':
+            return TOKEN_OBJECT;
+        case '[':
+            return TOKEN_ARRAY;
+        case '"':
+            return TOKEN_STRING;
+        case 't':
+        case 'f':
+            return TOKEN_BOOL;
+        case 'n':
+            return TOKEN_NULL;
+        case '-':
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            return TOKEN_NUMBER;
+        default:
+            return TOKEN_NONE;
+    }
+}
+
+bool Parser::expect(char c)
+{
+    peek();
+
+    if (m_failed || m_current == m_end || *m_current != c) {
+        return fail();
+    }
+
+    m_current++;
+    return true;
+}
+
+bool Parser::readLiteral(const char *literal)
+{
+    const size_t length = strlen(literal);
+
+    if (static_cast<size_t>(m_end - m_current) < length || strncmp(m_current, literal, length) != 0) {
+        return fail();
+    }
+
+    m_current += length;
+    return true;
+}
+
+bool Parser::isNull()
+{
+    return peek() == TOKEN_NULL;
+}
+
+bool Parser::readNull()
+{
+    if (peek() != TOKEN_NULL) {
+        return fail();
+    }
+    return readLiteral("null");
+}
+
+bool Parser::beginObject()
+{
+    return expect('{');
+}
+
+bool Parser::nextMember(bool& first, std::string& key)
+{
+    peek();
+
+    if (m_failed || m_current == m_end) {
+        return fail();
+    }
+
+    if (*m_current == '}') {
+        m_current++;
+        return false;
+    }
+
+    if (!first && !expect(',')) {
+        return false;
+    }
+    first = false;
+
+    if (peek() != TOKEN_STRING || !readRawString(key)) {
+        return fail();
+    }
+
+    return expect(':');
+}
+
+bool Parser::beginArray()
+{
+    return expect('[');
+}
+
+bool Parser::nextElement(bool& first)
+{
+    peek();
+
+    if (m_failed || m_current == m_end) {
+        return fail();
+    }
+
+    if (*m_current == ']') {
+        m_current++;
+        return false;
+    }
+
+    if (!first && !expect(',')) {
+        return false;
+    }
+    first = false;
+
+    return true;
+}
+
+static void appendUTF8(std::string& out, unsigned int cp)
+{
+    if (cp <= 0x7f) {
+        out += static_cast<char>(cp);
+    } else if (cp <= 0x7ff) {
+        out += static_cast<char>(0xc0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    } else if (cp <= 0xffff) {
+        out += static_cast<char>(0xe0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    } else {
+        out += static_cast<char>(0xf0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    }
+}
+
+static bool readHex4(const char *&current, const char *end, unsigned int& value)
+{
+    if (end - current < 4) {
+        return false;
+    }
+
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        const char c = *current++;
+        value <<= 4;
+        if (c >= '0' && c <= '9') {
+            value += c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            value += c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            value += c - 'A' + 10;
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Parser::readRawString(std::string& value)
+{
+    // Opening quote has already been peeked
+    m_current++;
+    value.clear();
+
+    while (m_current < m_end) {
+        const char *start = m_current;
+
+        while (m_current < m_end && *m_current != '"' && *m_current != '\\') {
+            m_current++;
+        }
+        value.append(start, m_current - start);
+
+        if (m_current == m_end) {
+            break;
+        }
+
+        if (*m_current++ == '"') {
+            return true;
+        }
+
+        if (m_current == m_end) {
+            break;
+        }
+
+        switch (*m_current++) {
+            case '"': value += '"'; break;
+            case '/': value += '/'; break;
+            case '\\': value += '\\'; break;
+            case 'b': value += '\b'; break;
+            case 'f': value += '\f'; break;
+            case 'n': value += '\n'; break;
+            case 'r': value += '\r'; break;
+            case 't': value += '\t'; break;
+            case 'u': {
+                unsigned int cp;
+                if (!readHex4(m_current, m_end, cp)) {
+                    return fail();
+                }
+                if (cp >= 0xd800 && cp <= 0xdbff) {
+                    unsigned int low;
+                    if (m_end - m_current < 2 || m_current[0] != '\\' || m_current[1] != 'u') {
+                        return fail();
+                    }
+                    m_current += 2;
+                    if (!readHex4(m_current, m_end, low)) {
+                        return fail();
+                    }
+                    cp = 0x10000 + ((cp & 0x3ff) << 10) + (low & 0x3ff);
+                }
+                appendUTF8(value, cp);
+                break;
+            }
+            default:
+                return fail();
+        }
+    }
+
+    return fail();
+}
+
+bool Parser::readNumberToken(std::string& token)
+{
+    const char *start = m_current;
+
+    while (m_current < m_end && ((*m_current >= '0' && *m_current <= '9') || *m_current == '-' || *m_current == '+'
+            || *m_current == '.' || *m_current == 'e' || *m_current == 'E')) {
+        m_current++;
+    }
+
+    token.assign(start, m_current - start);
+    return true;
+}
+
+bool Parser::readString(std::string& value)
+{
+    switch (peek()) {
+        case TOKEN_NULL:
+            value.clear();
+            return readLiteral("null");
+        case TOKEN_STRING:
+            return readRawString(value);
+        case TOKEN_BOOL: {
+            bool b;
+            if (!readBool(b)) {
+                return false;
+            }
+            value = b ? "true" : "false";
+            return true;
+        }
+        default:
+            return fail();
+    }
+}
+
+bool Parser::readBool(bool& value)
+{
+    switch (peek()) {
+        case TOKEN_NULL:
+            value = false;
+            return readLiteral("null");
+        case TOKEN_BOOL:
+            value = (*m_current == 't');
+            return readLiteral(value ? "true" : "false");
+        case TOKEN_NUMBER: {
+            double number;
+            if (!readDouble(number)) {
+                return false;
+            }
+            value = (number != 0.0);
+            return true;
+        }
+        case TOKEN_STRING: {
+            std::string s;
+            if (!readRawString(s)) {
+                return false;
+            }
+            value = !s.empty();
+            return true;
+        }
+        default:
+            return fail();
+    }
+}
+
+bool Parser::readInt64(long long& value)
+{
+    switch (peek()) {
+        case TOKEN_NULL:
+            value = 0;
+            return readLiteral("null");
+        case TOKEN_BOOL: {
+            bool b;
+            if (!readBool(b)) {
+                return false;
+            }
+            value = b ? 1 : 0;
+            return true;
+        }
+        case TOKEN_NUMBER: {
+            std::string token;
+            readNumberToken(token);
+
+            if (token.find_first_of(".eE") != std::string::npos) {
+                char *end;
+                const double d = strtod(token.c_str(), &end);
+                // The fraction is dropped, as in Json::Value::asInt64()
+                if (*end || !(d >= -9223372036854775808.0 && d < 9223372036854775808.0)) {
+                    return fail();
+                }
+                value = static_cast<long long>(d);
+                return true;
+            }
+
+            char *end;
+            errno = 0;
+            value = strtoll(token.c_str(), &end, 10);
+            if (*end || errno == ERANGE) {
+                return fail();
+            }
+            return true;
+        }
+        default:
+            return fail();
+    }
+}
+
+bool Parser::readDouble(double& value)
+{
+    switch (peek()) {
+        case TOKEN_NULL:
+            value = 0.0;
+            return readLiteral("null");
+        case TOKEN_BOOL: {
+            bool b;
+            if (!readBool(b)) {
+                return false;
+            }
+            value = b ? 1.0 : 0.0;
+            return true;
+        }
+        case TOKEN_NUMBER: {
+            std::string token;
+            readNumberToken(token);
+
+            char *end;
+            value = strtod(token.c_str(), &end);
+            if (*end) {
+                return fail();
+            }
+            return true;
+        }
+        default:
+            return fail();
+    }
+}
+
+bool Parser::skipValue()
+{
+    switch (peek()) {
+        case TOKEN_NULL:
+            return readLiteral("null");
+        case TOKEN_BOOL: {
+            bool b;
+            return readBool(b);
+        }
+        case TOKEN_NUMBER: {
+            double d;
+            return readDouble(d);
+        }
+        case TOKEN_STRING: {
+            std::string s;
+            return readRawString(s);
+        }
+        case TOKEN_OBJECT: {
+            bool first = true;
+            std::string key;
+
+            beginObject();
+            while (nextMember(first, key)) {
+                if (!skipValue()) {
+                    return false;
+                }
+            }
+            return !m_failed;
+        }
+        case TOKEN_ARRAY: {
+            bool first = true;
+
+            beginArray();
+            while (nextElement(first)) {
+                if (!skipValue()) {
+                    return false;
+                }
+            }
+            return !m_failed;
+        }
+        default:
+            return fail();
+    }
+}
+
+bool Parser::finish()
+{
+    peek();
+    return !m_failed && m_current == m_end;
+}
+
+Writer::Writer(std::string& out) : m_out(out)
+{
+}
+
+void Writer::separator()
+{
+    if (!m_out.empty()) {
+        const char last = m_out[m_out.size() - 1];
+        if (last != '{' && last != '[' && last != ':') {
+            m_out += ',';
+        }
+    }
+}
+
+void Writer::beginObject()
+{
+    separator();
+    m_out += '{';
+}
+
+void Writer::endObject()
+{
+    m_out += '}';
+}
+
+void Writer::beginArray()
+{
+    separator();
+    m_out += '[';
+}
+
+void Writer::endArray()
+{
+    m_out += ']';
+}
+
+void Writer::key(const char *name)
+{
+    separator();
+    m_out += Json::valueToQuotedString(name);
+    m_out += ':';
+}
+
+void Writer::writeNull()
+{
+    separator();
+    m_out += "null";
+}
+
+void Writer::writeString(const std::string& value)
+{
+    separator();
+    m_out += Json::valueToQuotedString(value.c_str());
+}
+
+void Writer::writeBool(bool value)
+{
+    separator();
+    m_out += value ? "true" : "false";
+}
+
+void Writer::writeInt64(long long value)
+{
+    separator();
+    m_out += Json::valueToString(static_cast<Json::LargestInt>(value));
+}
+
+void Writer::writeDouble(double value)
+{
+    separator();
+    m_out += Json::valueToString(value);
+}
+
+} // namespace json
+} // namespace webworks
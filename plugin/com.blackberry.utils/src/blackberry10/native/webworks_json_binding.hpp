@@ -0,0 +1,433 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WW_JSON_BINDING_HPP_
+#define WW_JSON_BINDING_HPP_
+
+#include <limits.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * Binds plain structs directly to JSON text, without building a Json::Value
+ * tree in between. Fields are declared once, at global scope:
+ *
+ *     WEBWORKS_JSON_BINDING_BEGIN(webworks::FileDownloadInfo)
+ *         WEBWORKS_JSON_FIELD("source", source)
+ *         WEBWORKS_JSON_FIELD_IN("options", "target", target)
+ *     WEBWORKS_JSON_BINDING_END()
+ *
+ * after which webworks::json::fromJson() and webworks::json::toJson() can be
+ * used on the struct. Binding a member whose type has no Traits
+ * specialization fails to compile. Fields declared with WEBWORKS_JSON_FIELD_IN
+ * live in a nested object of the given name, and must be declared next to
+ * the other fields of the same nested object.
+ *
+ * Conversions follow Json::Value: null reads as an empty string, false or 0,
+ * and leaves an object, array or map member untouched; strings accept
+ * booleans, numbers and booleans convert into each other, and anything else
+ * makes the parse fail, as does a number out of the range of its member.
+ */
+
+namespace webworks {
+namespace json {
+
+class Parser {
+public:
+    Parser(const char *begin, const char *end);
+    bool beginObject();
+    bool nextMember(bool& first, std::string& key);
+    bool beginArray();
+    bool nextElement(bool& first);
+    bool readNull();
+    bool readString(std::string& value);
+    bool readBool(bool& value);
+    bool readInt64(long long& value);
+    bool readDouble(double& value);
+    bool skipValue();
+    bool finish();
+    bool isNull();
+    bool failed() const;
+    // Makes the parse fail, e.g. on a value the member cannot hold
+    bool fail();
+private:
+    enum TokenType {
+        TOKEN_NONE = 0,
+        TOKEN_NULL,
+        TOKEN_STRING,
+        TOKEN_BOOL,
+        TOKEN_NUMBER,
+        TOKEN_OBJECT,
+        TOKEN_ARRAY
+    };
+    TokenType peek();
+    bool expect(char c);
+    bool readLiteral(const char *literal);
+    bool readRawString(std::string& value);
+    bool readNumberToken(std::string& token);
+    const char *m_current;
+    const char *m_end;
+    bool m_failed;
+};
+
+class Writer {
+public:
+    explicit Writer(std::string& out);
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+    void key(const char *name);
+    void writeNull();
+    void writeString(const std::string& value);
+    void writeBool(bool value);
+    void writeInt64(long long value);
+    void writeDouble(double value);
+private:
+    void separator();
+    std::string& m_out;
+};
+
+// Specialized for every type that may appear in a binding; left undefined on
+// purpose so that unsupported member types are rejected by the compiler.
+template <typename T>
+struct Traits;
+
+template <>
+struct Traits<std::string> {
+    static bool read(Parser& parser, std::string& value) { return parser.readString(value); }
+    static void write(Writer& writer, const std::string& value) { writer.writeString(value); }
+};
+
+template <>
+struct Traits<bool> {
+    static bool read(Parser& parser, bool& value) { return parser.readBool(value); }
+    static void write(Writer& writer, const bool value) { writer.writeBool(value); }
+};
+
+template <>
+struct Traits<int> {
+    static bool read(Parser& parser, int& value)
+    {
+        long long number;
+        if (!parser.readInt64(number)) {
+            return false;
+        }
+        // Out of range fails, as in Json::Value::asInt(), rather than wraps
+        if (number < INT_MIN || number > INT_MAX) {
+            return parser.fail();
+        }
+        value = static_cast<int>(number);
+        return true;
+    }
+    static void write(Writer& writer, const int value) { writer.writeInt64(value); }
+};
+
+template <>
+struct Traits<long long> {
+    static bool read(Parser& parser, long long& value) { return parser.readInt64(value); }
+    static void write(Writer& writer, const long long value) { writer.writeInt64(value); }
+};
+
+template <>
+struct Traits<double> {
+    static bool read(Parser& parser, double& value) { return parser.readDouble(value); }
+    static void write(Writer& writer, const double value) { writer.writeDouble(value); }
+};
+
+template <typename T>
+struct Traits<std::vector<T> > {
+    static bool read(Parser& parser, std::vector<T>& value)
+    {
+        if (parser.isNull()) {
+            return parser.readNull();
+        }
+
+        if (!parser.beginArray()) {
+            return false;
+        }
+
+        bool first = true;
+        value.clear();
+
+        while (parser.nextElement(first)) {
+            value.push_back(T());
+            if (!Traits<T>::read(parser, value.back())) {
+                return false;
+            }
+        }
+
+        return !parser.failed();
+    }
+
+    static void write(Writer& writer, const std::vector<T>& value)
+    {
+        writer.beginArray();
+        for (typename std::vector<T>::const_iterator it = value.begin(); it != value.end(); ++it) {
+            Traits<T>::write(writer, *it);
+        }
+        writer.endArray();
+    }
+};
+
+template <typename T>
+struct Traits<std::map<std::string, T> > {
+    static bool read(Parser& parser, std::map<std::string, T>& value)
+    {
+        if (parser.isNull()) {
+            return parser.readNull();
+        }
+
+        if (!parser.beginObject()) {
+            return false;
+        }
+
+        bool first = true;
+        std::string key;
+        value.clear();
+
+        while (parser.nextMember(first, key)) {
+            if (!Traits<T>::read(parser, value[key])) {
+                return false;
+            }
+        }
+
+        return !parser.failed();
+    }
+
+    static void write(Writer& writer, const std::map<std::string, T>& value)
+    {
+        writer.beginObject();
+        for (typename std::map<std::string, T>::const_iterator it = value.begin(); it != value.end(); ++it) {
+            writer.key(it->first.c_str());
+            Traits<T>::write(writer, it->second);
+        }
+        writer.endObject();
+    }
+};
+
+// Visitors handed to Traits<T>::visit() by ObjectTraits<T>
+
+template <typename T>
+class FieldReader {
+public:
+    FieldReader(Parser& parser, T& object, const char *group, const std::string& key)
+        : found(false), ok(false), m_parser(parser), m_object(object), m_group(group), m_key(key)
+    {
+    }
+
+    template <typename M>
+    bool field(const char *group, const char *name, M T::*member)
+    {
+        if (!sameGroup(group) || m_key != name) {
+            return true;
+        }
+
+        found = true;
+        ok = Traits<M>::read(m_parser, m_object.*member);
+        return false;
+    }
+
+    bool found;
+    bool ok;
+private:
+    bool sameGroup(const char *group) const
+    {
+        if (!group || !m_group) {
+            return group == m_group;
+        }
+        return strcmp(group, m_group) == 0;
+    }
+
+    Parser& m_parser;
+    T& m_object;
+    const char *m_group;
+    const std::string& m_key;
+};
+
+class GroupFinder {
+public:
+    explicit GroupFinder(const std::string& key) : found(false), m_key(key)
+    {
+    }
+
+    template <typename M, typename T>
+    bool field(const char *group, const char *, M T::*)
+    {
+        if (group && m_key == group) {
+            found = true;
+            return false;
+        }
+        return true;
+    }
+
+    bool found;
+private:
+    const std::string& m_key;
+};
+
+template <typename T>
+class FieldWriter {
+public:
+    FieldWriter(Writer& writer, const T& object) : m_writer(writer), m_object(object), m_group(NULL)
+    {
+    }
+
+    ~FieldWriter()
+    {
+        if (m_group) {
+            m_writer.endObject();
+        }
+    }
+
+    template <typename M>
+    bool field(const char *group, const char *name, M T::*member)
+    {
+        if (group != m_group && (!group || !m_group || strcmp(group, m_group) != 0)) {
+            if (m_group) {
+                m_writer.endObject();
+            }
+            if (group) {
+                m_writer.key(group);
+                m_writer.beginObject();
+            }
+            m_group = group;
+        }
+
+        m_writer.key(name);
+        Traits<M>::write(m_writer, m_object.*member);
+        return true;
+    }
+private:
+    Writer& m_writer;
+    const T& m_object;
+    const char *m_group;
+};
+
+// Base of the Traits specializations generated by WEBWORKS_JSON_BINDING_BEGIN
+template <typename T>
+struct ObjectTraits {
+    static bool read(Parser& parser, T& value)
+    {
+        if (parser.isNull()) {
+            return parser.readNull();
+        }
+        return readMembers(parser, value, NULL);
+    }
+
+    static void write(Writer& writer, const T& value)
+    {
+        writer.beginObject();
+        {
+            FieldWriter<T> fieldWriter(writer, value);
+            Traits<T>::visit(fieldWriter);
+        }
+        writer.endObject();
+    }
+
+private:
+    static bool readMembers(Parser& parser, T& value, const char *group)
+    {
+        if (!parser.beginObject()) {
+            return false;
+        }
+
+        bool first = true;
+        std::string key;
+
+        while (parser.nextMember(first, key)) {
+            FieldReader<T> reader(parser, value, group, key);
+            Traits<T>::visit(reader);
+
+            if (reader.found) {
+                if (!reader.ok) {
+                    return false;
+                }
+                continue;
+            }
+
+            if (!group) {
+                GroupFinder finder(key);
+                Traits<T>::visit(finder);
+
+                if (finder.found) {
+                    const std::string nested(key);
+                    if (parser.isNull()) {
+                        if (!parser.readNull()) {
+                            return false;
+                        }
+                    } else if (!readMembers(parser, value, nested.c_str())) {
+                        return false;
+                    }
+                    continue;
+                }
+            }
+
+            if (!parser.skipValue()) {
+                return false;
+            }
+        }
+
+        return !parser.failed();
+    }
+};
+
+template <typename T>
+bool fromJson(const std::string& text, T& value)
+{
+    Parser parser(text.data(), text.data() + text.size());
+    return Traits<T>::read(parser, value) && parser.finish();
+}
+
+template <typename T>
+std::string toJson(const T& value)
+{
+    std::string out;
+    Writer writer(out);
+    Traits<T>::write(writer, value);
+    return out;
+}
+
+} // namespace json
+} // namespace webworks
+
+#define WEBWORKS_JSON_BINDING_BEGIN(Type) \
+    namespace webworks { \
+    namespace json { \
+    template <> \
+    struct Traits<Type> : public ObjectTraits<Type> { \
+        typedef Type BoundType; \
+        template <typename Visitor> \
+        static bool visit(Visitor& visitor) \
+        { \
+            return true
+
+#define WEBWORKS_JSON_FIELD(name, member) \
+            && visitor.field(static_cast<const char *>(NULL), name, &BoundType::member)
+
+#define WEBWORKS_JSON_FIELD_IN(group, name, member) \
+            && visitor.field(group, name, &BoundType::member)
+
+#define WEBWORKS_JSON_BINDING_END() \
+            ; \
+        } \
+    }; \
+    } \
+    }
+
+#endif // WW_JSON_BINDING_HPP_
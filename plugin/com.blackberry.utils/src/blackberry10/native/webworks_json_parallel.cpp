@@ -0,0 +1,231 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <json/reader.h>
+#include <string>
+#include <vector>
+
+#include "webworks_json_parallel.hpp"
+#include "webworks_worker_pool.hpp"
+
+namespace webworks {
+
+// Groups per thread, so that a thread stuck with large elements does not
+// hold up the others for long
+static const int GROUPS_PER_THREAD = 4;
+
+struct ParseGroup {
+    const char * const *bounds;
+    Json::Value *values;
+    size_t first;
+    size_t last;
+    bool ok;
+};
+
+static inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+bool JsonParallelReader::Parse(const std::string& document, Json::Value& root, int threads)
+{
+    std::string errors;
+    return Parse(document, root, errors, threads);
+}
+
+bool JsonParallelReader::Parse(const std::string& document, Json::Value& root, std::string& errors, int threads)
+{
+    const char *begin = document.data();
+    const char *end = begin + document.size();
+    std::vector<const char *> bounds;
+
+    if (threads <= 0) {
+        threads = WorkerPool::Instance().Concurrency();
+    }
+
+    if (threads > 1 && document.size() >= MIN_PARALLEL_SIZE && splitArray(begin, end, bounds)) {
+        const size_t count = bounds.size() / 2;
+        std::vector<Json::Value> values(count);
+
+        size_t groupCount = static_cast<size_t>(threads) * GROUPS_PER_THREAD;
+        if (groupCount > count) {
+            groupCount = count;
+        }
+
+        std::vector<ParseGroup> groups(groupCount);
+        std::vector<void *> args(groupCount);
+        for (size_t i = 0; i < groupCount; i++) {
+            groups[i].bounds = &bounds[0];
+            groups[i].values = &values[0];
+            groups[i].first = count * i / groupCount;
+            groups[i].last = count * (i + 1) / groupCount;
+            groups[i].ok = false;
+            args[i] = &groups[i];
+        }
+
+        if (groupCount > 0) {
+            WorkerPool::Instance().Run(parseGroup, &args[0], static_cast<int>(groupCount));
+        }
+
+        bool ok = true;
+        for (size_t i = 0; i < groupCount && ok; i++) {
+            ok = groups[i].ok;
+        }
+
+        if (ok) {
+            Json::Value array(Json::arrayValue);
+            if (count > 0) {
+                array.resize(static_cast<Json::ArrayIndex>(count));
+            }
+            for (size_t i = 0; i < count; i++) {
+                array[static_cast<Json::ArrayIndex>(i)].swap(values[i]);
+            }
+            root.swap(array);
+            errors.clear();
+            return true;
+        }
+        // Fall through so that the error is the one the serial parser reports
+    }
+
+    Json::Reader reader;
+    const bool ok = reader.parse(document, root);
+    errors = reader.getFormattedErrorMessages();
+    return ok;
+}
+
+void JsonParallelReader::parseGroup(void *arg)
+{
+    ParseGroup *group = static_cast<ParseGroup *>(arg);
+    const size_t count = group->last - group->first;
+    if (count == 0) {
+        group->ok = true;
+        return;
+    }
+
+    // Json::Reader stops after the first value of a range, so an element
+    // such as "1 2" is parsed as part of an array of the whole group, which
+    // fails on it as the serial parse does
+    const char *start = group->bounds[2 * group->first];
+    const char *stop = group->bounds[2 * group->last - 1];
+    std::string slice;
+    slice.reserve(stop - start + 2);
+    slice += '[';
+    slice.append(start, stop);
+    slice += ']';
+
+    Json::Reader reader;
+    Json::Value array;
+    if (!reader.parse(slice.data(), slice.data() + slice.size(), array, false) || array.size() != count) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        group->values[group->first + i].swap(array[static_cast<Json::ArrayIndex>(i)]);
+    }
+
+    group->ok = true;
+}
+
+// Stores the [start, end) range of each element of the top-level array in
+// bounds. Only looks at strings and nesting; whatever is inside an element is
+// left to Json::Reader. Returns false when the document is not a single array
+// or may contain comments.
+bool JsonParallelReader::splitArray(const char *begin, const char *end, std::vector<const char *>& bounds)
+{
+    const char *p = begin;
+
+    while (p < end && isSpace(*p)) {
+        p++;
+    }
+    if (p == end || *p != '[') {
+        return false;
+    }
+    p++;
+
+    while (p < end && isSpace(*p)) {
+        p++;
+    }
+
+    bool closed = false;
+    if (p < end && *p == ']') {
+        p++;
+        closed = true;
+    }
+
+    while (!closed && p < end) {
+        const char *start = p;
+        int depth = 0;
+
+        for (; p < end; p++) {
+            const char c = *p;
+
+            if (c == '"') {
+                for (p++; p < end && *p != '"'; p++) {
+                    if (*p == '\\') {
+                        p++;
+                    }
+                }
+                if (p >= end) {
+                    return false;
+                }
+            } else if (c == '[' || c == '{') {
+                depth++;
+            } else if (c == ']' || c == '}') {
+                if (depth == 0) {
+                    if (c != ']') {
+                        return false;
+                    }
+                    closed = true;
+                    break;
+                }
+                depth--;
+            } else if (c == ',' && depth == 0) {
+                break;
+            } else if (c == '/') {
+                return false;
+            }
+        }
+
+        if (p >= end) {
+            return false;
+        }
+
+        // Reject empty elements such as "[1,,2]"
+        const char *last = p;
+        while (last > start && isSpace(last[-1])) {
+            last--;
+        }
+        if (last == start) {
+            return false;
+        }
+
+        bounds.push_back(start);
+        bounds.push_back(p);
+        p++;
+    }
+
+    if (!closed) {
+        return false;
+    }
+
+    while (p < end && isSpace(*p)) {
+        p++;
+    }
+
+    return p == end;
+}
+
+} // namespace webworks
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WW_JSON_PARALLEL_HPP_
+#define WW_JSON_PARALLEL_HPP_
+
+#include <json/value.h>
+#include <string>
+#include <vector>
+
+namespace webworks {
+
+/*
+ * Drop-in replacement for Json::Reader().parse(document, root) that parses
+ * the elements of a large top-level array concurrently on the WorkerPool.
+ *
+ * A quick scan first finds where each element starts and ends, tracking
+ * only strings and nesting. The elements are then parsed in contiguous
+ * groups, each as an array of its own with one Json::Reader, and moved into
+ * the result in order, which gives the same Value as the serial path. Documents below
+ * MIN_PARALLEL_SIZE, documents that are not arrays, and documents containing
+ * comments are parsed serially; so are invalid documents, in order to
+ * report the same errors as Json::Reader.
+ */
+class JsonParallelReader {
+public:
+    static const size_t MIN_PARALLEL_SIZE = 256 * 1024;
+
+    // threads <= 0 uses WorkerPool::Concurrency()
+    static bool Parse(const std::string& document, Json::Value& root, int threads = 0);
+    static bool Parse(const std::string& document, Json::Value& root, std::string& errors, int threads = 0);
+
+private:
+    static bool splitArray(const char *begin, const char *end, std::vector<const char *>& bounds);
+    static void parseGroup(void *arg);
+};
+
+} // namespace webworks
+
+#endif // WW_JSON_PARALLEL_HPP_
@@ -41,13 +41,13 @@ int Utils::strToInt(const std::string& val) {
 
 std::string Utils::toBase64(const unsigned char *input, const size_t size)
 {
-    size_t outputSize = size * 4;
+    // Four characters for every three bytes, and the terminating null
+    size_t outputSize = (size + 2) / 3 * 4 + 1;
     char *output = new char[outputSize];
-    outputSize = b64_ntop(input, size, output, outputSize);
-    output[outputSize] = 0;
+    const int written = b64_ntop(input, size, output, outputSize);
 
-    std::string outputString(output);
-    delete output;
+    std::string outputString(output, written > 0 ? written : 0);
+    delete[] output;
 
     return outputString;
 }
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+#include <list>
+
+#include "webworks_worker_pool.hpp"
+
+namespace webworks {
+
+WorkerPool *WorkerPool::s_instance = NULL;
+pthread_once_t WorkerPool::s_once = PTHREAD_ONCE_INIT;
+
+WorkerPool& WorkerPool::Instance()
+{
+    pthread_once(&s_once, createInstance);
+    return *s_instance;
+}
+
+void WorkerPool::createInstance()
+{
+    s_instance = new WorkerPool();
+}
+
+WorkerPool::WorkerPool() : m_threads(0)
+{
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_work, NULL);
+    pthread_cond_init(&m_finished, NULL);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        cpus = 1;
+    }
+
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+
+    // The thread calling Run() does its share of the work
+    for (long i = 1; i < cpus; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &thread_attr, workerThread, this) == 0) {
+            m_threads++;
+        }
+    }
+
+    pthread_attr_destroy(&thread_attr);
+}
+
+WorkerPool::~WorkerPool()
+{
+    // Never destroyed, the workers may still be waiting on the conditions
+}
+
+int WorkerPool::Concurrency() const
+{
+    return m_threads + 1;
+}
+
+void WorkerPool::Run(WorkerJob job, void **args, int count)
+{
+    if (count <= 0) {
+        return;
+    }
+
+    Batch batch;
+    batch.job = job;
+    batch.args = args;
+    batch.count = count;
+    batch.next = 0;
+    batch.done = 0;
+
+    pthread_mutex_lock(&m_lock);
+    m_batches.push_back(&batch);
+    pthread_cond_broadcast(&m_work);
+
+    while (runNext(&batch)) {
+    }
+
+    while (batch.done < batch.count) {
+        pthread_cond_wait(&m_finished, &m_lock);
+    }
+    pthread_mutex_unlock(&m_lock);
+}
+
+// Called with m_lock held; releases it while the job runs
+bool WorkerPool::runNext(Batch *batch)
+{
+    if (batch->next >= batch->count) {
+        return false;
+    }
+
+    const int index = batch->next++;
+    if (batch->next == batch->count) {
+        m_batches.remove(batch);
+    }
+
+    pthread_mutex_unlock(&m_lock);
+    batch->job(batch->args[index]);
+    pthread_mutex_lock(&m_lock);
+
+    if (++batch->done == batch->count) {
+        pthread_cond_broadcast(&m_finished);
+    }
+
+    return true;
+}
+
+void *WorkerPool::workerThread(void *arg)
+{
+    WorkerPool *pool = static_cast<WorkerPool *>(arg);
+
+    pthread_mutex_lock(&pool->m_lock);
+    for (;;) {
+        while (pool->m_batches.empty()) {
+            pthread_cond_wait(&pool->m_work, &pool->m_lock);
+        }
+        pool->runNext(pool->m_batches.front());
+    }
+
+    return NULL;
+}
+
+} // namespace webworks
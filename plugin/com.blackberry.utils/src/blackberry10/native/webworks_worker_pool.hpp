@@ -0,0 +1,73 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WW_WORKER_POOL_HPP_
+#define WW_WORKER_POOL_HPP_
+
+#include <pthread.h>
+#include <list>
+
+namespace webworks {
+
+typedef void (*WorkerJob)(void *arg);
+
+/*
+ * Process-wide pool of worker threads, one per online CPU, started on first
+ * use and kept for the lifetime of the process. Meant for short CPU bound
+ * jobs; anything that blocks on I/O should keep using its own thread.
+ */
+class WorkerPool {
+public:
+    static WorkerPool& Instance();
+
+    // Number of threads available to Run(), including the calling thread
+    int Concurrency() const;
+
+    // Calls job(args[i]) for every i, spread over the pool and the calling
+    // thread, and returns once all of them have completed
+    void Run(WorkerJob job, void **args, int count);
+
+private:
+    struct Batch {
+        WorkerJob job;
+        void **args;
+        int count;
+        int next;
+        int done;
+    };
+
+    WorkerPool();
+    ~WorkerPool();
+    explicit WorkerPool(WorkerPool const&);
+    void operator=(WorkerPool const&);
+
+    static void createInstance();
+    static void *workerThread(void *arg);
+    bool runNext(Batch *batch);
+
+    std::list<Batch *> m_batches;
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_work;
+    pthread_cond_t m_finished;
+    int m_threads;
+
+    static WorkerPool *s_instance;
+    static pthread_once_t s_once;
+};
+
+} // namespace webworks
+
+#endif // WW_WORKER_POOL_HPP_
@@ -0,0 +1,644 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs transfers against the server of server.js and reports how they went:
+ * throughput, completion latency, and the threads, memory and descriptors
+ * the process needed for them. Transfers go either through FileTransfer and
+ * the TransferEngine, as those of an application do, or through the blocking
+ * FileTransferCurl::Upload and Download, on a thread for each one under way.
+ * A run is either a number of transfers, or goes on for a duration and
+ * reports every interval as well, to soak the plugin.
+ */
+
+#include "filetransfer_curl.hpp"
+#include "filetransfer_journal.hpp"
+#include "filetransfer_js.hpp"
+
+#include <plugin.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+SendPluginEv SendPluginEvent;
+
+namespace {
+
+struct Options {
+    Options();
+
+    // Of the server, e.g. https://localhost:8481
+    std::string url;
+    // "engine" or "blocking"
+    std::string mode;
+    // "download" or "upload"
+    std::string op;
+    int count;
+    int concurrency;
+    long long size;
+    // Injected by the server: ms before it answers, and KB/s of each
+    // transfer, 0 for none
+    int latency;
+    int bandwidth;
+    // Soak for that many seconds instead of running count transfers
+    int duration;
+    int interval;
+    std::string dir;
+    // JSON merged into the options of each transfer, and the limits the
+    // engine is configured with; engine mode only
+    std::string transferOptions;
+    std::string limits;
+};
+
+Options::Options()
+    : mode("engine"), op("download"), count(100), concurrency(8), size(1024 * 1024), latency(0), bandwidth(0),
+      duration(0), interval(10), dir("/tmp/filetransfer-bench")
+{
+}
+
+// What the process used, as sampled while the transfers run
+struct Usage {
+    Usage() : threads(0), rssKB(0), fds(0) {}
+
+    int threads;
+    long rssKB;
+    int fds;
+};
+
+// Transfers of a run, or of an interval of a soak
+struct Tally {
+    Tally() : completed(0), failed(0), bytes(0) {}
+
+    int completed;
+    int failed;
+    long long bytes;
+    // ms from submit to result, of every completed transfer
+    std::vector<double> latencies;
+};
+
+Options s_options;
+pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t s_changed = PTHREAD_COND_INITIALIZER;
+std::map<std::string, double> s_started;
+// Files of finished downloads, removed by the main thread
+std::deque<std::string> s_finished;
+int s_inFlight = 0;
+int s_next = 0;
+double s_deadline = 0;
+bool s_stopSampling = false;
+Tally s_total;
+Tally s_interval;
+Usage s_peak;
+std::string s_firstError;
+
+double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+// Whether another transfer should start; s_lock must be held
+bool more()
+{
+    if (s_options.duration > 0) {
+        return now() < s_deadline;
+    }
+
+    return s_next < s_options.count;
+}
+
+std::string number(long long value)
+{
+    char text[24];
+    snprintf(text, sizeof(text), "%lld", value);
+    return text;
+}
+
+std::string targetOf(int index)
+{
+    return s_options.dir + "/download-" + number(index);
+}
+
+std::string sourceUrl()
+{
+    std::string url = s_options.url + (s_options.op == "download" ? "/file/" + number(s_options.size) : "/upload")
+                      + "?latency=" + number(s_options.latency) + "&rate=" + number(s_options.bandwidth);
+    return url;
+}
+
+std::string sourceFile()
+{
+    return s_options.dir + "/upload.bin";
+}
+
+Usage sample()
+{
+    Usage usage;
+
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status) {
+        char line[256];
+        while (fgets(line, sizeof(line), status)) {
+            if (strncmp(line, "Threads:", 8) == 0) {
+                usage.threads = atoi(line + 8);
+            } else if (strncmp(line, "VmRSS:", 6) == 0) {
+                usage.rssKB = atol(line + 6);
+            }
+        }
+        fclose(status);
+    }
+
+    DIR *fds = opendir("/proc/self/fd");
+    if (fds) {
+        while (readdir(fds)) {
+            usage.fds++;
+        }
+        closedir(fds);
+        // ".", ".." and the descriptor of the listing itself
+        usage.fds -= 3;
+    }
+
+    return usage;
+}
+
+long peakRssKB()
+{
+    long peak = 0;
+
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status) {
+        char line[256];
+        while (fgets(line, sizeof(line), status)) {
+            if (strncmp(line, "VmHWM:", 6) == 0) {
+                peak = atol(line + 6);
+            }
+        }
+        fclose(status);
+    }
+
+    return peak;
+}
+
+void *samplerThread(void *)
+{
+    for (;;) {
+        const Usage usage = sample();
+
+        pthread_mutex_lock(&s_lock);
+        const bool stop = s_stopSampling;
+        s_peak.threads = std::max(s_peak.threads, usage.threads);
+        s_peak.fds = std::max(s_peak.fds, usage.fds);
+        pthread_mutex_unlock(&s_lock);
+
+        if (stop) {
+            break;
+        }
+
+        usleep(20 * 1000);
+    }
+
+    return NULL;
+}
+
+// Records the result of a transfer that started at start; s_lock must be held
+void finish(int index, double start, const std::string& result)
+{
+    const double latency = now() - start;
+
+    if (webworks::TransferJournal::ResultCode(result) == 0) {
+        s_total.completed++;
+        s_total.bytes += s_options.size;
+        s_total.latencies.push_back(latency);
+        s_interval.completed++;
+        s_interval.bytes += s_options.size;
+        s_interval.latencies.push_back(latency);
+    } else {
+        s_total.failed++;
+        s_interval.failed++;
+        if (s_firstError.empty()) {
+            s_firstError = result.substr(0, 200);
+        }
+    }
+
+    if (s_options.op == "download") {
+        s_finished.push_back(targetOf(index));
+    }
+
+    s_inFlight--;
+    pthread_cond_broadcast(&s_changed);
+}
+
+void onEvent(const char *event, void *)
+{
+    // "bench <callbackId> <kind> <success|error> ..."
+    const std::string text(event);
+    const std::string::size_type first = text.find(' ');
+    const std::string::size_type second = first == std::string::npos ? first : text.find(' ', first + 1);
+    if (second == std::string::npos) {
+        return;
+    }
+
+    const std::string eventId = text.substr(first + 1, second - first - 1);
+    const std::string result = text.substr(second + 1);
+    const std::string::size_type kind = result.find(' ');
+    if (kind == std::string::npos
+            || (result.compare(kind + 1, 8, "success ") != 0 && result.compare(kind + 1, 6, "error ") != 0)) {
+        // Progress
+        return;
+    }
+
+    pthread_mutex_lock(&s_lock);
+    const std::map<std::string, double>::iterator started = s_started.find(eventId);
+    if (started != s_started.end()) {
+        finish(atoi(eventId.c_str()), started->second, result);
+        s_started.erase(started);
+    }
+    pthread_mutex_unlock(&s_lock);
+}
+
+std::string command(int index)
+{
+    const std::string eventId = number(index);
+    std::string options = s_options.transferOptions;
+
+    if (s_options.op == "download") {
+        return "download {\"callbackId\":\"" + eventId + "\",\"source\":\"" + sourceUrl() + "\",\"target\":\""
+               + targetOf(index) + "\",\"options\":" + (options.empty() ? "{}" : options) + "}";
+    }
+
+    // The fields index.js always sends, before those of the caller
+    std::string uploadOptions = "{\"fileKey\":\"file\",\"fileName\":\"upload.bin\","
+                                "\"mimeType\":\"application/octet-stream\"";
+    if (options.length() > 2) {
+        uploadOptions += "," + options.substr(1, options.length() - 2);
+    }
+    uploadOptions += "}";
+
+    return "upload {\"callbackId\":\"" + eventId + "\",\"filePath\":\"" + sourceFile() + "\",\"server\":\""
+           + sourceUrl() + "\",\"options\":" + uploadOptions + "}";
+}
+
+void removeFinished()
+{
+    std::deque<std::string> finished;
+
+    pthread_mutex_lock(&s_lock);
+    finished.swap(s_finished);
+    pthread_mutex_unlock(&s_lock);
+
+    for (std::deque<std::string>::const_iterator it = finished.begin(); it != finished.end(); ++it) {
+        unlink(it->c_str());
+    }
+}
+
+double percentile(std::vector<double>& values, double fraction)
+{
+    if (values.empty()) {
+        return 0;
+    }
+
+    std::sort(values.begin(), values.end());
+    return values[static_cast<size_t>((values.size() - 1) * fraction + 0.5)];
+}
+
+void report(const char *label, Tally& tally, double ms)
+{
+    const Usage usage = sample();
+    const double seconds = ms / 1000.0;
+
+    printf("%s completed=%d failed=%d seconds=%.2f throughput=%.2fMB/s transfers=%.1f/s p50=%.1fms p99=%.1fms "
+           "threads=%d rss=%ldKB fds=%d\n",
+           label, tally.completed, tally.failed, seconds, seconds > 0 ? tally.bytes / seconds / (1024 * 1024) : 0,
+           seconds > 0 ? tally.completed / seconds : 0, percentile(tally.latencies, 0.5),
+           percentile(tally.latencies, 0.99), usage.threads, usage.rssKB, usage.fds);
+    fflush(stdout);
+}
+
+// Prints the interval of a soak that is over, if any; s_lock must be held
+void tick(double begin, double& last)
+{
+    if (s_options.duration <= 0 || now() - last < s_options.interval * 1000.0) {
+        return;
+    }
+
+    char label[32];
+    snprintf(label, sizeof(label), "t=%.0fs", (now() - begin) / 1000.0);
+
+    report(label, s_interval, now() - last);
+    s_interval = Tally();
+    last = now();
+}
+
+void waitChanged()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    struct timespec until;
+    until.tv_sec = tv.tv_sec + 1;
+    until.tv_nsec = tv.tv_usec * 1000;
+    pthread_cond_timedwait(&s_changed, &s_lock, &until);
+}
+
+void runEngine(double begin)
+{
+    FileTransfer transfer("bench");
+    transfer.m_pContext = NULL;
+
+    if (!s_options.limits.empty()) {
+        printf("limits %s\n", transfer.InvokeMethod("configure " + s_options.limits).c_str());
+    }
+
+    double last = begin;
+
+    pthread_mutex_lock(&s_lock);
+    for (;;) {
+        while (s_inFlight < s_options.concurrency && more()) {
+            const int index = s_next++;
+            s_inFlight++;
+            s_started[number(index)] = now();
+            pthread_mutex_unlock(&s_lock);
+
+            const std::string error = transfer.InvokeMethod(command(index));
+
+            pthread_mutex_lock(&s_lock);
+            if (!error.empty()) {
+                s_started.erase(number(index));
+                finish(index, now(), s_options.op + " error 0 " + error);
+            }
+        }
+
+        if (s_inFlight == 0 && !more()) {
+            break;
+        }
+
+        waitChanged();
+        tick(begin, last);
+
+        pthread_mutex_unlock(&s_lock);
+        removeFinished();
+        pthread_mutex_lock(&s_lock);
+    }
+    pthread_mutex_unlock(&s_lock);
+
+    removeFinished();
+}
+
+void *blockingThread(void *)
+{
+    webworks::FileTransferCurl curl;
+
+    pthread_mutex_lock(&s_lock);
+    while (more()) {
+        const int index = s_next++;
+        s_inFlight++;
+        pthread_mutex_unlock(&s_lock);
+
+        const double start = now();
+        std::string result;
+
+        // The defaults FileTransfer gives what JavaScript leaves out
+        if (s_options.op == "download") {
+            webworks::FileDownloadInfo info;
+            info.pParent = NULL;
+            info.eventId = number(index);
+            info.source = sourceUrl();
+            info.target = targetOf(index);
+            info.segments = 1;
+            info.minSegmentSize = 1024;
+            info.writeBehind = false;
+            info.cache = false;
+            info.progressInterval = 0;
+            info.progressStep = 0;
+            info.maxMemorySize = 1024;
+
+            result = curl.Download(&info);
+        } else {
+            webworks::FileUploadInfo info;
+            info.pParent = NULL;
+            info.eventId = number(index);
+            info.sourceFile = sourceFile();
+            info.targetURL = sourceUrl();
+            info.fileKey = "file";
+            info.fileName = "upload.bin";
+            info.mimeType = "application/octet-stream";
+            info.chunkedMode = false;
+            info.chunkSize = 0;
+            info.compress = false;
+            info.progressInterval = 0;
+            info.progressStep = 0;
+            info.maxResponseSize = -1;
+
+            result = curl.Upload(&info);
+        }
+
+        pthread_mutex_lock(&s_lock);
+        finish(index, start, result);
+    }
+    pthread_mutex_unlock(&s_lock);
+
+    return NULL;
+}
+
+void runBlocking(double begin)
+{
+    std::vector<pthread_t> threads(s_options.concurrency);
+    for (size_t i = 0; i < threads.size(); i++) {
+        pthread_create(&threads[i], NULL, blockingThread, NULL);
+    }
+
+    double last = begin;
+
+    pthread_mutex_lock(&s_lock);
+    while (s_inFlight > 0 || more()) {
+        waitChanged();
+        tick(begin, last);
+
+        pthread_mutex_unlock(&s_lock);
+        removeFinished();
+        pthread_mutex_lock(&s_lock);
+    }
+    pthread_mutex_unlock(&s_lock);
+
+    for (size_t i = 0; i < threads.size(); i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    removeFinished();
+}
+
+bool writeSource()
+{
+    FILE *file = fopen(sourceFile().c_str(), "w");
+    if (!file) {
+        return false;
+    }
+
+    char block[64 * 1024];
+    for (size_t i = 0; i < sizeof(block); i++) {
+        block[i] = static_cast<char>(i * 31 + 7);
+    }
+
+    for (long long left = s_options.size; left > 0; left -= sizeof(block)) {
+        fwrite(block, 1, std::min(left, static_cast<long long>(sizeof(block))), file);
+    }
+
+    return fclose(file) == 0;
+}
+
+long long parseSize(const char *text)
+{
+    char *end = NULL;
+    long long size = strtoll(text, &end, 10);
+
+    if (*end == 'k' || *end == 'K') {
+        size *= 1024;
+    } else if (*end == 'm' || *end == 'M') {
+        size *= 1024 * 1024;
+    }
+
+    return size;
+}
+
+void usage()
+{
+    fprintf(stderr,
+            "usage: filetransfer_bench --url <server> [options]\n"
+            "  --mode engine|blocking   through the TransferEngine, or FileTransferCurl on threads (engine)\n"
+            "  --op download|upload     (download)\n"
+            "  --count N                transfers to run (100)\n"
+            "  --concurrency N          transfers submitted at the same time (8)\n"
+            "  --size N[K|M]            bytes of each transfer (1M)\n"
+            "  --latency MS             server delay before each response (0)\n"
+            "  --bandwidth KBPS         server rate of each transfer, 0 for no cap (0)\n"
+            "  --duration S             soak for S seconds instead of running --count transfers\n"
+            "  --interval S             report every S seconds of a soak (10)\n"
+            "  --dir PATH               scratch directory (/tmp/filetransfer-bench)\n"
+            "  --options JSON           options of each transfer, engine mode only\n"
+            "  --limits JSON            configure the engine with these limits\n");
+}
+
+bool parseOptions(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++) {
+        const std::string name = argv[i];
+
+        if (i + 1 >= argc) {
+            return false;
+        }
+
+        const char *value = argv[++i];
+
+        if (name == "--url") {
+            s_options.url = value;
+        } else if (name == "--mode") {
+            s_options.mode = value;
+        } else if (name == "--op") {
+            s_options.op = value;
+        } else if (name == "--count") {
+            s_options.count = atoi(value);
+        } else if (name == "--concurrency") {
+            s_options.concurrency = atoi(value);
+        } else if (name == "--size") {
+            s_options.size = parseSize(value);
+        } else if (name == "--latency") {
+            s_options.latency = atoi(value);
+        } else if (name == "--bandwidth") {
+            s_options.bandwidth = atoi(value);
+        } else if (name == "--duration") {
+            s_options.duration = atoi(value);
+        } else if (name == "--interval") {
+            s_options.interval = atoi(value);
+        } else if (name == "--dir") {
+            s_options.dir = value;
+        } else if (name == "--options") {
+            s_options.transferOptions = value;
+        } else if (name == "--limits") {
+            s_options.limits = value;
+        } else {
+            return false;
+        }
+    }
+
+    return !s_options.url.empty() && (s_options.mode == "engine" || s_options.mode == "blocking")
+           && (s_options.op == "download" || s_options.op == "upload") && s_options.concurrency > 0
+           && s_options.size > 0 && s_options.interval > 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (!parseOptions(argc, argv)) {
+        usage();
+        return 2;
+    }
+
+    SendPluginEvent = onEvent;
+
+    if (s_options.op == "upload" && !writeSource()) {
+        fprintf(stderr, "cannot write %s\n", sourceFile().c_str());
+        return 1;
+    }
+
+    printf("mode=%s op=%s %s=%d concurrency=%d size=%lld latency=%dms bandwidth=%dKB/s\n", s_options.mode.c_str(),
+           s_options.op.c_str(), s_options.duration > 0 ? "duration" : "count",
+           s_options.duration > 0 ? s_options.duration : s_options.count, s_options.concurrency, s_options.size,
+           s_options.latency, s_options.bandwidth);
+    fflush(stdout);
+
+    pthread_t sampler;
+    pthread_create(&sampler, NULL, samplerThread, NULL);
+
+    const double begin = now();
+    s_deadline = begin + s_options.duration * 1000.0;
+
+    if (s_options.mode == "engine") {
+        runEngine(begin);
+    } else {
+        runBlocking(begin);
+    }
+
+    const double elapsed = now() - begin;
+
+    pthread_mutex_lock(&s_lock);
+    s_stopSampling = true;
+    pthread_mutex_unlock(&s_lock);
+    pthread_join(sampler, NULL);
+
+    report("total", s_total, elapsed);
+    printf("peak threads=%d rss=%ldKB fds=%d\n", s_peak.threads, peakRssKB(), s_peak.fds);
+
+    if (!s_firstError.empty()) {
+        printf("first error: %s\n", s_firstError.c_str());
+    }
+
+    if (s_options.op == "upload") {
+        unlink(sourceFile().c_str());
+    }
+
+    return s_total.failed == 0 ? 0 : 1;
+}
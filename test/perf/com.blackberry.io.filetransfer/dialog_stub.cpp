@@ -0,0 +1,36 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "dialog_bps.hpp"
+
+namespace webworks {
+
+// There is nobody to ask on a desktop: the certificate dialog is always
+// dismissed, so only the domains of verifiedDomainList get through
+DialogBPS::DialogBPS() : m_dialog(0)
+{
+}
+
+DialogBPS::~DialogBPS()
+{
+}
+
+int DialogBPS::Show(DialogConfig *)
+{
+    return 2;
+}
+
+} // namespace webworks
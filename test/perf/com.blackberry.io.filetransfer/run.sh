@@ -0,0 +1,82 @@
+#!/bin/sh
+#
+#  Copyright 2012 Research In Motion Limited.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Runs filetransfer_bench against a server.js of its own, over HTTPS with a
+# self-signed certificate that verifiedDomainList lets through, or over
+# plain HTTP with --http. Every other argument goes to filetransfer_bench.
+#
+#   ./run.sh --op upload --concurrency 16 --size 4M
+#   ./run.sh --http --latency 50 --bandwidth 2000 --duration 600
+#
+# HTTP_PORT and HTTPS_PORT choose the ports of the server (8480 and 8481).
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+HTTP_PORT=${HTTP_PORT:-8480}
+HTTPS_PORT=${HTTPS_PORT:-8481}
+SCHEME=https
+
+if [ "$1" = "--http" ]; then
+    SCHEME=http
+    shift
+fi
+
+if [ ! -x "$HERE/filetransfer_bench" ]; then
+    make -C "$HERE" || exit 1
+fi
+
+WORK=$(mktemp -d /tmp/filetransfer-bench.XXXXXX) || exit 1
+SERVER=
+
+cleanup() {
+    if [ -n "$SERVER" ]; then
+        kill "$SERVER" 2>/dev/null
+    fi
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj "/CN=localhost" \
+    -addext "subjectAltName=DNS:localhost" \
+    -keyout "$WORK/key.pem" -out "$WORK/cert.pem" 2>/dev/null || exit 1
+
+node "$HERE/server.js" --http "$HTTP_PORT" --https "$HTTPS_PORT" \
+    --key "$WORK/key.pem" --cert "$WORK/cert.pem" > "$WORK/server.log" 2>&1 &
+SERVER=$!
+
+# The plugin keeps its state in $HOME: the certificate of the server is
+# accepted the way the dialog remembers it, so no transfer needs a prompt
+mkdir -p "$WORK/home" "$WORK/files"
+echo "localhost:$HTTPS_PORT,1" > "$WORK/home/verifiedDomainList"
+
+tries=0
+until curl -s -o /dev/null "http://localhost:$HTTP_PORT/file/1"; do
+    tries=$((tries + 1))
+    if [ $tries -ge 50 ] || ! kill -0 "$SERVER" 2>/dev/null; then
+        echo "server.js did not start:" >&2
+        cat "$WORK/server.log" >&2
+        exit 1
+    fi
+    sleep 0.1
+done
+
+if [ "$SCHEME" = "https" ]; then
+    URL="https://localhost:$HTTPS_PORT"
+else
+    URL="http://localhost:$HTTP_PORT"
+fi
+
+HOME="$WORK/home" "$HERE/filetransfer_bench" --url "$URL" --dir "$WORK/files" "$@"
@@ -0,0 +1,183 @@
+/*
+ *  Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Stands in for the servers filetransfer_bench transfers to and from, over
+// HTTP and HTTPS:
+//   GET /file/<bytes>  a file of that size, with Range and If-Range
+//   POST /upload       reads the request body and answers with its length
+// Both take ?latency=<ms> to wait before answering and ?rate=<KB/s> to send
+// or read the body no faster than that.
+//
+//   node server.js --http 8480 --https 8481 --key key.pem --cert cert.pem
+
+var http = require('http'),
+    https = require('https'),
+    fs = require('fs'),
+    url = require('url'),
+    CHUNK = 16 * 1024,
+    PATTERN_SIZE = 64 * 1024,
+    pattern = Buffer.alloc ? Buffer.alloc(PATTERN_SIZE) : new Buffer(PATTERN_SIZE),
+    args = {},
+    i;
+
+for (i = 0; i < PATTERN_SIZE; i++) {
+    pattern[i] = (i * 31 + 7) & 0xff;
+}
+
+for (i = 2; i + 1 < process.argv.length; i += 2) {
+    args[process.argv[i].replace(/^--/, "")] = process.argv[i + 1];
+}
+
+// The bytes of a file from start, at most length of them
+function slice(start, length) {
+    var offset = start % PATTERN_SIZE;
+
+    return pattern.slice(offset, offset + Math.min(length, PATTERN_SIZE - offset, CHUNK));
+}
+
+// Writes bytes start to end - 1 of a file, rate KB/s at most
+function send(res, start, end, rate) {
+    var sent = 0,
+        begin = Date.now();
+
+    function next() {
+        var chunk,
+            written,
+            due;
+
+        while (start + sent < end) {
+            chunk = slice(start + sent, end - start - sent);
+            sent += chunk.length;
+            written = res.write(chunk);
+
+            // A whole chunk fills the buffer of the socket, so the pace has
+            // to be kept whether or not it drains first
+            if (rate > 0) {
+                due = begin + sent / rate;
+                if (due > Date.now()) {
+                    setTimeout(next, due - Date.now());
+                    return;
+                }
+            }
+
+            if (!written) {
+                res.once("drain", next);
+                return;
+            }
+        }
+
+        res.end();
+    }
+
+    next();
+}
+
+function serveFile(req, res, size, rate) {
+    var etag = '"' + size + '"',
+        range = /^bytes=(\d*)-(\d*)$/.exec(req.headers.range || ""),
+        ifRange = req.headers["if-range"],
+        start = 0,
+        end = size,
+        headers = {
+            "Content-Type": "application/octet-stream",
+            "Accept-Ranges": "bytes",
+            "ETag": etag
+        };
+
+    if (range && (!ifRange || ifRange === etag)) {
+        if (range[1]) {
+            start = parseInt(range[1], 10);
+            end = range[2] ? Math.min(parseInt(range[2], 10) + 1, size) : size;
+        } else {
+            start = Math.max(size - parseInt(range[2], 10), 0);
+        }
+
+        if (start >= end) {
+            res.writeHead(416, {"Content-Range": "bytes */" + size});
+            res.end();
+            return;
+        }
+
+        headers["Content-Range"] = "bytes " + start + "-" + (end - 1) + "/" + size;
+    }
+
+    headers["Content-Length"] = end - start;
+    res.writeHead(headers["Content-Range"] ? 206 : 200, headers);
+
+    if (req.method === "HEAD") {
+        res.end();
+    } else {
+        send(res, start, end, rate);
+    }
+}
+
+function readUpload(req, res, rate) {
+    var received = 0,
+        begin = Date.now();
+
+    req.on("data", function (chunk) {
+        var due;
+
+        received += chunk.length;
+
+        if (rate > 0) {
+            due = begin + received / rate;
+            if (due > Date.now()) {
+                req.pause();
+                setTimeout(function () {
+                    req.resume();
+                }, due - Date.now());
+            }
+        }
+    });
+
+    req.on("end", function () {
+        res.writeHead(200, {"Content-Type": "text/plain"});
+        res.end("received " + received + "\n");
+    });
+}
+
+function handle(req, res) {
+    var parsed = url.parse(req.url, true),
+        latency = parseInt(parsed.query.latency, 10) || 0,
+        // KB/s, as bytes per ms
+        rate = (parseInt(parsed.query.rate, 10) || 0) * 1024 / 1000,
+        file = /^\/file\/(\d+)$/.exec(parsed.pathname);
+
+    setTimeout(function () {
+        if (file && (req.method === "GET" || req.method === "HEAD")) {
+            serveFile(req, res, parseInt(file[1], 10), rate);
+        } else if (parsed.pathname === "/upload" && (req.method === "POST" || req.method === "PUT")) {
+            readUpload(req, res, rate);
+        } else {
+            res.writeHead(404, {"Content-Type": "text/plain"});
+            res.end("not found\n");
+        }
+    }, latency);
+}
+
+if (args.http) {
+    http.createServer(handle).listen(parseInt(args.http, 10), "127.0.0.1");
+}
+
+if (args.https) {
+    https.createServer({
+        key: fs.readFileSync(args.key),
+        cert: fs.readFileSync(args.cert)
+    }, handle).listen(parseInt(args.https, 10), "127.0.0.1");
+}
+
+console.log("listening" + (args.http ? " http=" + args.http : "") + (args.https ? " https=" + args.https : ""));
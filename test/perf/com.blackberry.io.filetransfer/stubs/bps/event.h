@@ -0,0 +1,24 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Included by dialog_bps.hpp; nothing of it is used on a desktop
+
+#ifndef BENCH_BPS_EVENT_H_
+#define BENCH_BPS_EVENT_H_
+
+typedef struct bps_event_t bps_event_t;
+
+#endif // BENCH_BPS_EVENT_H_
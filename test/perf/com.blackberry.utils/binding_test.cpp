@@ -0,0 +1,350 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that structs bound with WEBWORKS_JSON_BINDING_BEGIN read what
+ * Json::Reader reads, write what it reads back the same, and reject what
+ * their members cannot hold.
+ */
+
+#include <json/reader.h>
+#include <json/value.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "jsontest.h"
+#include "webworks_json_binding.hpp"
+
+namespace {
+
+struct Address {
+    Address() : zip(0) {}
+
+    std::string city;
+    int zip;
+};
+
+struct Person {
+    Person() : age(0), id(0), score(0), active(false), limit(0) {}
+
+    std::string name;
+    int age;
+    long long id;
+    double score;
+    bool active;
+    std::vector<std::string> tags;
+    std::map<std::string, std::string> params;
+    std::vector<Address> addresses;
+    Address home;
+    std::string mode;
+    int limit;
+};
+
+} // namespace
+
+WEBWORKS_JSON_BINDING_BEGIN(Address)
+    WEBWORKS_JSON_FIELD("city", city)
+    WEBWORKS_JSON_FIELD("zip", zip)
+WEBWORKS_JSON_BINDING_END()
+
+WEBWORKS_JSON_BINDING_BEGIN(Person)
+    WEBWORKS_JSON_FIELD("name", name)
+    WEBWORKS_JSON_FIELD("age", age)
+    WEBWORKS_JSON_FIELD("id", id)
+    WEBWORKS_JSON_FIELD("score", score)
+    WEBWORKS_JSON_FIELD("active", active)
+    WEBWORKS_JSON_FIELD("tags", tags)
+    WEBWORKS_JSON_FIELD("params", params)
+    WEBWORKS_JSON_FIELD("addresses", addresses)
+    WEBWORKS_JSON_FIELD("home", home)
+    WEBWORKS_JSON_FIELD_IN("options", "mode", mode)
+    WEBWORKS_JSON_FIELD_IN("options", "limit", limit)
+WEBWORKS_JSON_BINDING_END()
+
+using webworks::json::fromJson;
+using webworks::json::toJson;
+
+namespace {
+
+struct BindingTest : JsonTest::TestCase {
+    Person person;
+
+    // The string a bound member reads from a JSON string literal, and the one
+    // Json::Reader reads from it
+    bool readString(const std::string& literal, std::string& bound, std::string& reader)
+    {
+        Person read;
+        if (!fromJson("{\"name\":" + literal + "}", read)) {
+            return false;
+        }
+        bound = read.name;
+
+        Json::Value value;
+        Json::Reader().parse("[" + literal + "]", value);
+        reader = value[0u].asString();
+        return true;
+    }
+
+    bool reads(const std::string& text)
+    {
+        Person read;
+        return fromJson(text, read);
+    }
+};
+
+} // namespace
+
+JSONTEST_FIXTURE(BindingTest, roundTrip)
+{
+    person.name = "Jane \"JD\" Doe\n";
+    person.age = -42;
+    person.id = 9007199254740993LL;
+    person.score = 0.25;
+    person.active = true;
+    person.tags.push_back("a");
+    person.tags.push_back("");
+    person.params["key"] = "value";
+    person.params["\xc3\xa9t\xc3\xa9"] = "\xf0\x9f\x98\x80";
+    person.addresses.resize(2);
+    person.addresses[0].city = "Waterloo";
+    person.addresses[0].zip = 12345;
+    person.home.city = "Ottawa";
+    person.mode = "fast";
+    person.limit = 7;
+
+    const std::string text = toJson(person);
+
+    Person read;
+    JSONTEST_ASSERT(fromJson(text, read)) << text;
+    JSONTEST_ASSERT(read.name == person.name);
+    JSONTEST_ASSERT_EQUAL(person.age, read.age);
+    JSONTEST_ASSERT(read.id == person.id);
+    JSONTEST_ASSERT_EQUAL(person.score, read.score);
+    JSONTEST_ASSERT_EQUAL(person.active, read.active);
+    JSONTEST_ASSERT(read.tags == person.tags);
+    JSONTEST_ASSERT(read.params == person.params);
+    JSONTEST_ASSERT_EQUAL(2u, static_cast<unsigned int>(read.addresses.size()));
+    JSONTEST_ASSERT(read.addresses[0].city == "Waterloo");
+    JSONTEST_ASSERT_EQUAL(12345, read.addresses[0].zip);
+    JSONTEST_ASSERT(read.addresses[1].city.empty());
+    JSONTEST_ASSERT(read.home.city == "Ottawa");
+    JSONTEST_ASSERT(read.mode == "fast");
+    JSONTEST_ASSERT_EQUAL(7, read.limit);
+
+    // What is written is plain JSON, with the grouped members nested
+    Json::Value value;
+    JSONTEST_ASSERT(Json::Reader().parse(text, value)) << text;
+    JSONTEST_ASSERT(value["name"].asString() == person.name);
+    JSONTEST_ASSERT(value["options"]["mode"].asString() == "fast");
+    JSONTEST_ASSERT_EQUAL(7, value["options"]["limit"].asInt());
+    JSONTEST_ASSERT(value["params"]["\xc3\xa9t\xc3\xa9"].asString() == "\xf0\x9f\x98\x80");
+    JSONTEST_ASSERT(toJson(read) == text);
+}
+
+JSONTEST_FIXTURE(BindingTest, escapes)
+{
+    const char *literals[] = {
+        "\"plain\"",
+        "\"\\\"\\\\\\/\\b\\f\\n\\r\\t\"",
+        "\"\\u0041\\u00e9\\u20ac\"",
+        "\"\\ud83d\\ude00 and \\uD834\\uDD1E\"",
+        "\"\xc3\xa9 as is\""
+    };
+
+    for (size_t i = 0; i < sizeof(literals) / sizeof(literals[0]); i++) {
+        std::string bound;
+        std::string reader;
+        JSONTEST_ASSERT(readString(literals[i], bound, reader)) << literals[i];
+        JSONTEST_ASSERT(bound == reader) << literals[i];
+    }
+
+    std::string bound;
+    std::string reader;
+    readString("\"\\ud83d\\ude00\"", bound, reader);
+    JSONTEST_ASSERT(bound == "\xf0\x9f\x98\x80");
+
+    // Json::Reader drops \u0000 on its way through a C string; the binding keeps it
+    JSONTEST_ASSERT(readString("\"a\\u0000b\"", bound, reader));
+    JSONTEST_ASSERT(bound == std::string("a\0b", 3));
+
+    // Control characters are escaped on the way out, and read back
+    person.name = std::string("\x01\x1f\"\\\t", 5);
+    Person read;
+    JSONTEST_ASSERT(fromJson(toJson(person), read)) << toJson(person);
+    JSONTEST_ASSERT(read.name == person.name);
+}
+
+JSONTEST_FIXTURE(BindingTest, badEscapes)
+{
+    // A high surrogate needs a second \u escape
+    JSONTEST_ASSERT(!reads("{\"name\":\"\\ud83d\"}"));
+    JSONTEST_ASSERT(!reads("{\"name\":\"\\ud83dx\"}"));
+    JSONTEST_ASSERT(!reads("{\"name\":\"\\ud83d\\u12\"}"));
+    JSONTEST_ASSERT(!reads("{\"name\":\"\\u12g4\"}"));
+    JSONTEST_ASSERT(!reads("{\"name\":\"\\u12\"}"));
+    JSONTEST_ASSERT(!reads("{\"name\":\"\\x41\"}"));
+    JSONTEST_ASSERT(!reads("{\"name\":\"unterminated}"));
+    JSONTEST_ASSERT(!reads("{\"name\":\"ends in \\"));
+}
+
+JSONTEST_FIXTURE(BindingTest, conversions)
+{
+    Person read;
+    JSONTEST_ASSERT(fromJson("{\"name\":true,\"age\":1.9,\"id\":true,\"score\":false,\"active\":2}", read));
+    JSONTEST_ASSERT(read.name == "true");
+    JSONTEST_ASSERT_EQUAL(1, read.age);
+    JSONTEST_ASSERT(read.id == 1);
+    JSONTEST_ASSERT_EQUAL(0.0, read.score);
+    JSONTEST_ASSERT_EQUAL(true, read.active);
+
+    JSONTEST_ASSERT(fromJson("{\"age\":2147483647,\"id\":-9223372036854775808}", read));
+    JSONTEST_ASSERT_EQUAL(2147483647, read.age);
+    JSONTEST_ASSERT(read.id == -9223372036854775807LL - 1);
+
+    JSONTEST_ASSERT(fromJson("{\"age\":-2147483648,\"id\":1e18}", read));
+    JSONTEST_ASSERT_EQUAL(-2147483647 - 1, read.age);
+    JSONTEST_ASSERT(read.id == 1000000000000000000LL);
+
+    // Null reads as the default, and leaves objects alone
+    read.home.city = "kept";
+    JSONTEST_ASSERT(fromJson("{\"name\":null,\"age\":null,\"active\":null,\"home\":null,\"tags\":null,\"options\":null}", read));
+    JSONTEST_ASSERT(read.name.empty());
+    JSONTEST_ASSERT_EQUAL(0, read.age);
+    JSONTEST_ASSERT_EQUAL(false, read.active);
+    JSONTEST_ASSERT(read.home.city == "kept");
+}
+
+JSONTEST_FIXTURE(BindingTest, typeMismatches)
+{
+    JSONTEST_ASSERT(!reads("{\"name\":5}"));
+    JSONTEST_ASSERT(!reads("{\"name\":{}}"));
+    JSONTEST_ASSERT(!reads("{\"name\":[]}"));
+    JSONTEST_ASSERT(!reads("{\"age\":\"5\"}"));
+    JSONTEST_ASSERT(!reads("{\"age\":[5]}"));
+    JSONTEST_ASSERT(!reads("{\"score\":\"0.5\"}"));
+    JSONTEST_ASSERT(!reads("{\"active\":[]}"));
+    JSONTEST_ASSERT(!reads("{\"tags\":\"a\"}"));
+    JSONTEST_ASSERT(!reads("{\"tags\":[1]}"));
+    JSONTEST_ASSERT(!reads("{\"params\":[]}"));
+    JSONTEST_ASSERT(!reads("{\"params\":{\"a\":{}}}"));
+    JSONTEST_ASSERT(!reads("{\"home\":[]}"));
+    JSONTEST_ASSERT(!reads("{\"home\":{\"zip\":\"1\"}}"));
+    JSONTEST_ASSERT(!reads("{\"addresses\":[{\"city\":1}]}"));
+    JSONTEST_ASSERT(!reads("{\"options\":[]}"));
+    JSONTEST_ASSERT(!reads("{\"options\":{\"limit\":\"7\"}}"));
+    JSONTEST_ASSERT(!reads("[]"));
+    JSONTEST_ASSERT(!reads("\"person\""));
+}
+
+JSONTEST_FIXTURE(BindingTest, outOfRange)
+{
+    // Rather than wrap around, as a plain cast would
+    JSONTEST_ASSERT(!reads("{\"age\":3e9}"));
+    JSONTEST_ASSERT(!reads("{\"age\":2147483648}"));
+    JSONTEST_ASSERT(!reads("{\"age\":-2147483649}"));
+    JSONTEST_ASSERT(!reads("{\"age\":-3e9}"));
+    JSONTEST_ASSERT(!reads("{\"id\":9223372036854775808}"));
+    JSONTEST_ASSERT(!reads("{\"id\":1e19}"));
+    JSONTEST_ASSERT(!reads("{\"id\":-1e19}"));
+    JSONTEST_ASSERT(!reads("{\"id\":1e400}"));
+    JSONTEST_ASSERT(!reads("{\"home\":{\"zip\":1e10}}"));
+    JSONTEST_ASSERT(!reads("{\"options\":{\"limit\":4294967296}}"));
+}
+
+JSONTEST_FIXTURE(BindingTest, unknownFields)
+{
+    Person read;
+    JSONTEST_ASSERT(fromJson("{\"extra\":{\"a\":[1,{\"b\":\"}]\"}],\"c\":null},\"name\":\"Jane\","
+                             "\"more\":[true,false,-1.5e3,\"\\\"\"],\"options\":{\"other\":{},\"mode\":\"slow\"},"
+                             "\"home\":{\"street\":\"Main\",\"city\":\"Ottawa\"}}", read));
+    JSONTEST_ASSERT(read.name == "Jane");
+    JSONTEST_ASSERT(read.mode == "slow");
+    JSONTEST_ASSERT(read.home.city == "Ottawa");
+
+    // Skipped, but still has to be valid
+    JSONTEST_ASSERT(!reads("{\"extra\":[1,}"));
+    JSONTEST_ASSERT(!reads("{\"extra\":{\"a\"}}"));
+    JSONTEST_ASSERT(!reads("{\"extra\":tru}"));
+    JSONTEST_ASSERT(!reads("{\"extra\":\"\\ud83d\"}"));
+    JSONTEST_ASSERT(!reads("{\"options\":{\"other\":[}}"));
+}
+
+JSONTEST_FIXTURE(BindingTest, nesting)
+{
+    Person read;
+    JSONTEST_ASSERT(fromJson("{\"addresses\":[{\"city\":\"A\",\"zip\":1},{},{\"zip\":3}],"
+                             "\"params\":{\"x\":\"1\",\"y\":true},\"tags\":[],"
+                             "\"options\":{\"limit\":2}}", read));
+    JSONTEST_ASSERT_EQUAL(3u, static_cast<unsigned int>(read.addresses.size()));
+    JSONTEST_ASSERT(read.addresses[0].city == "A");
+    JSONTEST_ASSERT_EQUAL(1, read.addresses[0].zip);
+    JSONTEST_ASSERT_EQUAL(0, read.addresses[1].zip);
+    JSONTEST_ASSERT_EQUAL(3, read.addresses[2].zip);
+    JSONTEST_ASSERT(read.params["x"] == "1");
+    JSONTEST_ASSERT(read.params["y"] == "true");
+    JSONTEST_ASSERT(read.tags.empty());
+    JSONTEST_ASSERT_EQUAL(2, read.limit);
+
+    std::vector<std::vector<int> > matrix;
+    JSONTEST_ASSERT(fromJson("[[1,2],[],[3]]", matrix));
+    JSONTEST_ASSERT_EQUAL(3u, static_cast<unsigned int>(matrix.size()));
+    JSONTEST_ASSERT_EQUAL(2, matrix[0][1]);
+    JSONTEST_ASSERT(toJson(matrix) == "[[1,2],[],[3]]");
+
+    std::map<std::string, std::vector<Address> > byCountry;
+    JSONTEST_ASSERT(fromJson("{\"ca\":[{\"city\":\"Waterloo\"}],\"us\":[]}", byCountry));
+    JSONTEST_ASSERT(byCountry["ca"][0].city == "Waterloo");
+    JSONTEST_ASSERT(toJson(byCountry) == "{\"ca\":[{\"city\":\"Waterloo\",\"zip\":0}],\"us\":[]}");
+}
+
+JSONTEST_FIXTURE(BindingTest, malformed)
+{
+    JSONTEST_ASSERT(!reads(""));
+    JSONTEST_ASSERT(!reads("   "));
+    JSONTEST_ASSERT(!reads("{"));
+    JSONTEST_ASSERT(!reads("{\"name\":\"a\""));
+    JSONTEST_ASSERT(!reads("{\"name\" \"a\"}"));
+    JSONTEST_ASSERT(!reads("{\"name\":}"));
+    JSONTEST_ASSERT(!reads("{name:\"a\"}"));
+    JSONTEST_ASSERT(!reads("{\"name\":\"a\",}"));
+    JSONTEST_ASSERT(!reads("{,}"));
+    JSONTEST_ASSERT(!reads("{\"name\":\"a\" \"age\":1}"));
+    JSONTEST_ASSERT(!reads("{\"tags\":[\"a\",]}"));
+    JSONTEST_ASSERT(!reads("{\"tags\":[\"a\" \"b\"]}"));
+    JSONTEST_ASSERT(!reads("{\"age\":1-2}"));
+    JSONTEST_ASSERT(!reads("{\"age\":-}"));
+    JSONTEST_ASSERT(!reads("{\"age\":.5}"));
+    JSONTEST_ASSERT(!reads("{} x"));
+    JSONTEST_ASSERT(!reads("{}{}"));
+
+    JSONTEST_ASSERT(reads(" \r\n\t{ } \n"));
+}
+
+int main(int argc, const char *argv[])
+{
+    JsonTest::Runner runner;
+    JSONTEST_REGISTER_FIXTURE(runner, BindingTest, roundTrip);
+    JSONTEST_REGISTER_FIXTURE(runner, BindingTest, escapes);
+    JSONTEST_REGISTER_FIXTURE(runner, BindingTest, badEscapes);
+    JSONTEST_REGISTER_FIXTURE(runner, BindingTest, conversions);
+    JSONTEST_REGISTER_FIXTURE(runner, BindingTest, typeMismatches);
+    JSONTEST_REGISTER_FIXTURE(runner, BindingTest, outOfRange);
+    JSONTEST_REGISTER_FIXTURE(runner, BindingTest, unknownFields);
+    JSONTEST_REGISTER_FIXTURE(runner, BindingTest, nesting);
+    JSONTEST_REGISTER_FIXTURE(runner, BindingTest, malformed);
+    return runner.runCommandLine(argc, argv);
+}
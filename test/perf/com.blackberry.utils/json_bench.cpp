@@ -0,0 +1,184 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Times Json::Reader against JsonParallelReader on a large array of
+ * contact-like objects, such as a bulk import brings in, and reports how
+ * the parallel parse scales with the number of threads. Each result is
+ * checked against the serial one.
+ */
+
+#include <json/reader.h>
+#include <json/value.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+
+#include "webworks_json_parallel.hpp"
+#include "webworks_worker_pool.hpp"
+
+using webworks::JsonParallelReader;
+
+namespace {
+
+double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Takes a suffix of K or M
+long long parseSize(const char *text)
+{
+    char *suffix = NULL;
+    long long size = strtoll(text, &suffix, 10);
+
+    if (*suffix == 'K' || *suffix == 'k') {
+        size *= 1024;
+    } else if (*suffix == 'M' || *suffix == 'm') {
+        size *= 1024 * 1024;
+    }
+
+    return size;
+}
+
+std::string contacts(long long size)
+{
+    std::string document = "[";
+    char element[512];
+
+    for (int i = 0; static_cast<long long>(document.size()) < size; i++) {
+        snprintf(element, sizeof(element),
+                 "%s{\"id\":\"%d\",\"name\":{\"givenName\":\"Jane\",\"familyName\":\"Doe %d\"},"
+                 "\"emails\":[{\"type\":\"work\",\"value\":\"jane.%d@example.com\"}],"
+                 "\"phoneNumbers\":[{\"type\":\"mobile\",\"value\":\"+1 519 555 %04d\"}],"
+                 "\"note\":\"Met at the \\\"conference\\\", \\u00e9t\\u00e9 %d\",\"favorite\":%s,\"rank\":%d.5}",
+                 i > 0 ? "," : "", i, i, i, i % 10000, i, i % 2 ? "true" : "false", i);
+        document += element;
+    }
+
+    return document + "]";
+}
+
+// Best of runs, in seconds
+double timeSerial(const std::string& document, Json::Value& root, int runs)
+{
+    double best = 0;
+
+    for (int i = 0; i < runs; i++) {
+        Json::Reader reader;
+        Json::Value value;
+        const double start = now();
+        if (!reader.parse(document, value)) {
+            fprintf(stderr, "serial parse failed: %s\n", reader.getFormattedErrorMessages().c_str());
+            exit(1);
+        }
+        const double elapsed = now() - start;
+        if (i == 0 || elapsed < best) {
+            best = elapsed;
+        }
+        root.swap(value);
+    }
+
+    return best;
+}
+
+double timeParallel(const std::string& document, const Json::Value& expected, int threads, int runs)
+{
+    double best = 0;
+
+    for (int i = 0; i < runs; i++) {
+        Json::Value value;
+        const double start = now();
+        if (!JsonParallelReader::Parse(document, value, threads)) {
+            fprintf(stderr, "parallel parse failed\n");
+            exit(1);
+        }
+        const double elapsed = now() - start;
+        if (i == 0 || elapsed < best) {
+            best = elapsed;
+        }
+        if (!(value == expected)) {
+            fprintf(stderr, "parallel parse with %d threads differs from the serial one\n", threads);
+            exit(1);
+        }
+    }
+
+    return best;
+}
+
+void usage()
+{
+    fprintf(stderr, "usage: json_bench [--size 20M] [--runs 3] [--threads 1,2,4,8]\n");
+    exit(2);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    long long size = 20 * 1024 * 1024;
+    int runs = 3;
+    std::vector<int> threads;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage();
+        }
+        if (!strcmp(argv[i], "--size")) {
+            size = parseSize(argv[++i]);
+        } else if (!strcmp(argv[i], "--runs")) {
+            runs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--threads")) {
+            for (char *count = strtok(argv[++i], ","); count; count = strtok(NULL, ",")) {
+                threads.push_back(atoi(count));
+            }
+        } else {
+            usage();
+        }
+    }
+
+    if (runs < 1) {
+        usage();
+    }
+    if (threads.empty()) {
+        const int counts[] = { 1, 2, 4, 8 };
+        threads.assign(counts, counts + sizeof(counts) / sizeof(counts[0]));
+    }
+
+    const std::string document = contacts(size);
+    Json::Value expected;
+    const double serial = timeSerial(document, expected, runs);
+    const double megabytes = document.size() / (1024.0 * 1024.0);
+
+    printf("%.1f MB, %u elements, %d CPUs for the worker pool, best of %d runs\n",
+           megabytes, expected.size(), webworks::WorkerPool::Instance().Concurrency(), runs);
+    printf("%-10s %8s %10s %8s\n", "reader", "ms", "MB/s", "speedup");
+    printf("%-10s %8.1f %10.1f %8.2f\n", "serial", serial * 1000, megabytes / serial, 1.0);
+
+    for (size_t i = 0; i < threads.size(); i++) {
+        const double parallel = timeParallel(document, expected, threads[i], runs);
+        char name[32];
+        snprintf(name, sizeof(name), "parallel/%d", threads[i]);
+        printf("%-10s %8.1f %10.1f %8.2f\n", name, parallel * 1000, megabytes / parallel, serial / parallel);
+    }
+
+    return 0;
+}
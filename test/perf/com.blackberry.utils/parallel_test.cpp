@@ -0,0 +1,148 @@
+/*
+ * Copyright 2012 Research In Motion Limited.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that JsonParallelReader gives what Json::Reader gives, for valid
+ * documents and for broken ones, with any number of threads. The documents
+ * are repeated up to MIN_PARALLEL_SIZE, so that they take the parallel path.
+ */
+
+#include <json/reader.h>
+#include <json/value.h>
+#include <string>
+
+#include "jsontest.h"
+#include "webworks_json_parallel.hpp"
+
+using webworks::JsonParallelReader;
+
+namespace {
+
+const int THREADS[] = { 1, 2, 4, 8 };
+
+// An array of element, repeated until the document takes the parallel path;
+// broken, if given, takes the place of one element halfway through
+std::string bigArray(const std::string& element, const std::string& broken = "")
+{
+    const size_t count = JsonParallelReader::MIN_PARALLEL_SIZE / (element.size() + 1) + 1;
+    std::string document = "[";
+
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            document += ",\n";
+        }
+        document += !broken.empty() && i == count / 2 ? broken : element;
+    }
+
+    return document + "]";
+}
+
+struct ParallelReaderTest : JsonTest::TestCase {
+    // Both readers agree on the result, the Value and the errors
+    void checkSame(const std::string& document)
+    {
+        Json::Reader reader;
+        Json::Value serial;
+        const bool serialOk = reader.parse(document, serial);
+        const std::string serialErrors = reader.getFormattedErrorMessages();
+
+        for (size_t i = 0; i < sizeof(THREADS) / sizeof(THREADS[0]); i++) {
+            Json::Value parallel;
+            std::string errors;
+            const bool ok = JsonParallelReader::Parse(document, parallel, errors, THREADS[i]);
+
+            JSONTEST_ASSERT_EQUAL(serialOk, ok) << "threads " << THREADS[i];
+            JSONTEST_ASSERT(serialErrors == errors) << serialErrors << " != " << errors;
+            if (serialOk && ok) {
+                JSONTEST_ASSERT(serial == parallel) << "threads " << THREADS[i];
+            }
+        }
+    }
+};
+
+} // namespace
+
+JSONTEST_FIXTURE(ParallelReaderTest, scalars)
+{
+    checkSame(bigArray("12345"));
+    checkSame(bigArray("-1.5e3"));
+    checkSame(bigArray("true"));
+    checkSame(bigArray("null"));
+    checkSame(bigArray("\"text\""));
+}
+
+JSONTEST_FIXTURE(ParallelReaderTest, strings)
+{
+    // Delimiters in strings are not where elements end
+    checkSame(bigArray("\"a, b], {c}\""));
+    checkSame(bigArray("\"quote \\\" and backslash \\\\\""));
+    checkSame(bigArray("\"\\u00e9\\ud83d\\ude00\\n\\t\""));
+    checkSame(bigArray("\"\\\\\""));
+}
+
+JSONTEST_FIXTURE(ParallelReaderTest, nesting)
+{
+    checkSame(bigArray("{\"name\": \"Jane\", \"phones\": [\"1\", \"2\"], \"address\": {\"city\": \"Waterloo\"}}"));
+    checkSame(bigArray("[[1, 2], [], {}, [[[]]]]"));
+    checkSame(bigArray("  {  }  "));
+}
+
+JSONTEST_FIXTURE(ParallelReaderTest, serialCases)
+{
+    // Not arrays, small, empty, or with comments
+    checkSame("{\"a\": 1}");
+    checkSame("[1, 2, 3]");
+    checkSame("[]");
+    checkSame("  [ ]  ");
+    checkSame(bigArray("1 /* comment */"));
+    checkSame(bigArray("1 // comment\n"));
+}
+
+JSONTEST_FIXTURE(ParallelReaderTest, malformed)
+{
+    // Json::Reader stops after the first value of a range, which must not
+    // let anything that follows it in an element through
+    checkSame(bigArray("12345", "1 2"));
+    checkSame(bigArray("12345", "\"a\" \"b\""));
+    checkSame(bigArray("12345", "{\"a\": 1} {\"b\": 2}"));
+    checkSame(bigArray("12345", "[1] 2"));
+    checkSame(bigArray("12345", "true false"));
+
+    checkSame(bigArray("12345", ""));
+    checkSame(bigArray("12345", "{\"a\": }"));
+    checkSame(bigArray("12345", "[1}"));
+    checkSame(bigArray("12345", "{]"));
+    checkSame(bigArray("12345", "tru"));
+    checkSame(bigArray("12345", "\"unterminated"));
+    checkSame(bigArray("12345") + " x");
+    checkSame(bigArray("12345") + "]");
+    checkSame(bigArray("12345").substr(1));
+    std::string unclosed = bigArray("12345");
+    checkSame(unclosed.substr(0, unclosed.size() - 1));
+    std::string trailing = bigArray("12345");
+    checkSame(trailing.insert(trailing.size() - 1, ","));
+}
+
+int main(int argc, const char *argv[])
+{
+    JsonTest::Runner runner;
+    JSONTEST_REGISTER_FIXTURE(runner, ParallelReaderTest, scalars);
+    JSONTEST_REGISTER_FIXTURE(runner, ParallelReaderTest, strings);
+    JSONTEST_REGISTER_FIXTURE(runner, ParallelReaderTest, nesting);
+    JSONTEST_REGISTER_FIXTURE(runner, ParallelReaderTest, serialCases);
+    JSONTEST_REGISTER_FIXTURE(runner, ParallelReaderTest, malformed);
+    return runner.runCommandLine(argc, argv);
+}
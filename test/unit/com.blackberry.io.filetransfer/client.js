@@ -47,6 +47,8 @@ describe("io.filetransfer client", function () {
             expect(client.FILE_NOT_FOUND_ERR).toEqual(1);
             expect(client.INVALID_URL_ERR).toEqual(2);
             expect(client.CONNECTION_ERR).toEqual(3);
+            expect(client.ABORT_ERR).toEqual(6);
+            expect(client.TOO_LARGE_ERR).toEqual(7);
         });
 
     });
@@ -61,10 +63,11 @@ describe("io.filetransfer client", function () {
             var expected_args = {
                 "filePath": filePath,
                 "server": server,
-                "options": options
+                "options": options,
+                "transferId": 1
             };
 
-            client.upload(filePath, server, callback, callback, options);
+            expect(client.upload(filePath, server, callback, callback, options)).toEqual(1);
             expect(cordova.exec).toHaveBeenCalledWith(jasmine.any(Function), jasmine.any(Function), _ID, "upload", expected_args);
         });
 
@@ -75,11 +78,17 @@ describe("io.filetransfer client", function () {
                     "result": "success",
                     "bytesSent": "someBytesSent",
                     "responseCode": "someResponseCode",
+                    "digest": "crc32c:e3069283",
+                    "responseSize": 20,
+                    "responseTruncated": true,
                     "response": escape("someResponse!")
                 },
                 expected_args = {
                     "bytesSent": "someBytesSent",
                     "responseCode": "someResponseCode",
+                    "digest": "crc32c:e3069283",
+                    "responseSize": 20,
+                    "responseTruncated": true,
                     "response": "someResponse!"
                 };
 
@@ -111,6 +120,82 @@ describe("io.filetransfer client", function () {
             expect(success).not.toHaveBeenCalled();
             expect(failure).toHaveBeenCalledWith(expected_args);
         });
+
+        it("should call onprogress on progress events", function () {
+            var success = jasmine.createSpy(),
+                failure = jasmine.createSpy(),
+                onprogress = jasmine.createSpy(),
+                mocked_args = {
+                    "result": "progress",
+                    "loaded": 10,
+                    "total": 100,
+                    "rate": 5
+                },
+                expected_args = {
+                    "filePath": filePath,
+                    "server": server,
+                    "options": { "progressInterval": 250 },
+                    "transferId": 1
+                };
+
+            client.upload(filePath, server, success, failure, { "onprogress": onprogress });
+            expect(cordova.exec).toHaveBeenCalledWith(jasmine.any(Function), jasmine.any(Function), _ID, "upload", expected_args);
+
+            successCB(mocked_args);
+
+            expect(onprogress).toHaveBeenCalledWith({ "loaded": 10, "total": 100, "rate": 5 });
+            expect(success).not.toHaveBeenCalled();
+            expect(failure).not.toHaveBeenCalled();
+        });
+    });
+
+    describe("io.filetransfer uploadBatch", function () {
+        var files = ["a", { "filePath": "b", "fileName": "c" }],
+            server = "d";
+
+        it("should call cordova.exec", function () {
+            var callback = function () {},
+                expected_args = {
+                    "files": files,
+                    "server": server,
+                    "options": {},
+                    "transferId": 1
+                };
+
+            client.uploadBatch(files, server, callback, callback);
+            expect(cordova.exec).toHaveBeenCalledWith(jasmine.any(Function), jasmine.any(Function), _ID, "uploadBatch", expected_args);
+        });
+
+        it("should report each part on success", function () {
+            var success = jasmine.createSpy(),
+                failure = jasmine.createSpy(),
+                mocked_args = {
+                    "result": "success",
+                    "bytesSent": 100,
+                    "responseCode": 200,
+                    "parts": [0, 1],
+                    "responseSize": 13,
+                    "responseTruncated": false,
+                    "response": escape("someResponse!")
+                },
+                expected_args = {
+                    "bytesSent": 100,
+                    "responseCode": 200,
+                    "parts": [
+                        { "filePath": "a", "sent": true, "code": 0 },
+                        { "filePath": "b", "sent": false, "code": 1 }
+                    ],
+                    "responseSize": 13,
+                    "responseTruncated": false,
+                    "response": "someResponse!"
+                };
+
+            client.uploadBatch(files, server, success, failure);
+            successCB(mocked_args);
+
+            expect(success).toHaveBeenCalledWith(expected_args);
+            expect(failure).not.toHaveBeenCalled();
+        });
     });
 
     describe("io.filetransfer download", function () {
@@ -121,13 +206,27 @@ describe("io.filetransfer client", function () {
         it("should call cordova.exec", function () {
             var expected_args = {
                 "source": source,
-                "target": target
+                "target": target,
+                "transferId": 1
             };
 
             client.download(source, target, callback, callback);
             expect(cordova.exec).toHaveBeenCalledWith(jasmine.any(Function), jasmine.any(Function), _ID, "download", expected_args);
         });
 
+        it("should pass download options to cordova.exec", function () {
+            var options = { "segments": 4, "minSegmentSize": 512 },
+                expected_args = {
+                    "source": source,
+                    "target": target,
+                    "transferId": 1,
+                    "options": options
+                };
+
+            client.download(source, target, callback, callback, options);
+            expect(cordova.exec).toHaveBeenCalledWith(jasmine.any(Function), jasmine.any(Function), _ID, "download", expected_args);
+        });
+
         it("should call success callback on success event", function () {
             var success = jasmine.createSpy(),
                 failure = jasmine.createSpy(),
@@ -135,12 +234,20 @@ describe("io.filetransfer client", function () {
                     "result": "success",
                     "isFile": true,
                     "isDirectory": false,
+                    "cache": "hit",
+                    "cacheHits": 2,
+                    "cacheMisses": 1,
+                    "digest": "sha-256:15e2b0d3c33891ebb0f1ef609ec419420c20e320ce94c65fbc8c3312448eb225",
                     "name": "someName",
                     "fullPath": escape("someFullPath!")
                 },
                 expected_args = {
                     "isFile": true,
                     "isDirectory": false,
+                    "cache": "hit",
+                    "cacheHits": 2,
+                    "cacheMisses": 1,
+                    "digest": "sha-256:15e2b0d3c33891ebb0f1ef609ec419420c20e320ce94c65fbc8c3312448eb225",
                     "name": "someName",
                     "fullPath": "someFullPath!"
                 };
@@ -153,6 +260,38 @@ describe("io.filetransfer client", function () {
         });
 
 
+        it("should hand over a download kept in memory", function () {
+            var success = jasmine.createSpy(),
+                failure = jasmine.createSpy(),
+                mocked_args = {
+                    "result": "success",
+                    "responseCode": 200,
+                    "encoding": "base64",
+                    "digest": null,
+                    "length": 3,
+                    "data": "YWJj"
+                },
+                expected_args = {
+                    "responseCode": 200,
+                    "encoding": "base64",
+                    "digest": null,
+                    "length": 3,
+                    "data": "YWJj"
+                };
+
+            client.download(source, null, success, failure, { "memory": "base64" });
+            expect(cordova.exec).toHaveBeenCalledWith(jasmine.any(Function), jasmine.any(Function), _ID, "download", {
+                "source": source,
+                "transferId": 1,
+                "options": { "memory": "base64" }
+            });
+
+            successCB(mocked_args);
+
+            expect(success).toHaveBeenCalledWith(expected_args);
+            expect(failure).not.toHaveBeenCalled();
+        });
+
         it("should call failure callback on error event", function () {
             var success = jasmine.createSpy(),
                 failure = jasmine.createSpy(),
@@ -175,4 +314,54 @@ describe("io.filetransfer client", function () {
             expect(failure).toHaveBeenCalledWith(expected_args);
         });
     });
+
+    describe("io.filetransfer abort", function () {
+        it("should give each transfer an id to abort it with", function () {
+            var callback = function () {},
+                first = client.download("a", "b", callback, callback),
+                second = client.upload("c", "d", callback, callback);
+
+            expect(second).not.toEqual(first);
+
+            client.abort(second, callback, callback);
+            expect(cordova.exec).toHaveBeenCalledWith(callback, callback, _ID, "abort", { "transferId": second });
+        });
+    });
+
+    describe("io.filetransfer configure", function () {
+        it("should call cordova.exec", function () {
+            var options = { "maxTransfers": 4 },
+                callback = function () {};
+
+            client.configure(options, callback, callback);
+            expect(cordova.exec).toHaveBeenCalledWith(callback, callback, _ID, "configure", { "options": options });
+        });
+    });
+
+    describe("io.filetransfer stats", function () {
+        it("should call cordova.exec", function () {
+            var callback = function () {};
+
+            client.stats(callback, callback);
+            expect(cordova.exec).toHaveBeenCalledWith(callback, callback, _ID, "stats", {});
+        });
+    });
+
+    describe("io.filetransfer transfers", function () {
+        it("should call cordova.exec", function () {
+            var callback = function () {};
+
+            client.transfers(callback, callback);
+            expect(cordova.exec).toHaveBeenCalledWith(callback, callback, _ID, "transfers", {});
+        });
+    });
+
+    describe("io.filetransfer abortTransfer", function () {
+        it("should call cordova.exec", function () {
+            var callback = function () {};
+
+            client.abortTransfer("12", callback, callback);
+            expect(cordova.exec).toHaveBeenCalledWith(callback, callback, _ID, "abortTransfer", { "id": "12" });
+        });
+    });
 });
@@ -179,6 +179,66 @@ describe("io.filetransfer index", function () {
             expect(params.filePath).toEqual("/ROOT/../app/native/persistent/test.txt");
             expect(mockedPluginResult.noResult).toHaveBeenCalled();
         });
+
+        it("should translate the response file path", function () {
+            var params,
+                mocked_args = {
+                    "filePath": encodeURIComponent(JSON.stringify("1")),
+                    "callbackId": encodeURIComponent(JSON.stringify("123")),
+                    "server": encodeURIComponent(JSON.stringify("3")),
+                    "options": encodeURIComponent(JSON.stringify({ "responseFile": "local:///persistent/response.json" }))
+                };
+
+            JNEXT.invoke = jasmine.createSpy().andCallFake(function () {
+                params = JSON.parse(arguments[1].substring(7, arguments[1].length));
+            });
+
+            index.upload(null, null, mocked_args, null);
+
+            expect(params.options.responseFile).toEqual("/ROOT/../app/native/persistent/response.json");
+        });
+    });
+
+    describe("filetransfer uploadBatch", function () {
+        it("should call JNEXT.invoke with the files and default params", function () {
+            var mocked_args = {
+                    "files": encodeURIComponent(JSON.stringify(["a.jpg", { "filePath": "b.png", "mimeType": "image/png" }])),
+                    "server": encodeURIComponent(JSON.stringify("3")),
+                    "callbackId": encodeURIComponent(JSON.stringify("1"))
+                },
+                expected_args = {
+                    "files": [{ "filePath": "a.jpg" }, { "filePath": "b.png", "mimeType": "image/png" }],
+                    "server": "3",
+                    "options": {
+                        "fileKey": "file",
+                        "mimeType": "image/jpeg",
+                        "params": {},
+                        "chunkedMode": true,
+                        "chunkSize": 1024,
+                        "windowGroup" : 42
+                    },
+                    "callbackId": "1"
+                };
+
+            index.uploadBatch(null, null, mocked_args);
+
+            expect(JNEXT.invoke).toHaveBeenCalledWith("0", "uploadBatch " + JSON.stringify(expected_args));
+            expect(mockedPluginResult.noResult).toHaveBeenCalled();
+            expect(mockedPluginResult.error).not.toHaveBeenCalled();
+        });
+
+        it("should fail without files", function () {
+            var mocked_args = {
+                    "files": encodeURIComponent(JSON.stringify([])),
+                    "server": encodeURIComponent(JSON.stringify("3")),
+                    "callbackId": encodeURIComponent(JSON.stringify("1"))
+                };
+
+            index.uploadBatch(null, null, mocked_args);
+
+            expect(JNEXT.invoke).not.toHaveBeenCalled();
+            expect(mockedPluginResult.error).toHaveBeenCalled();
+        });
     });
 
     describe("filetransfer download", function () {
@@ -202,6 +262,28 @@ describe("io.filetransfer index", function () {
             expect(mockedPluginResult.error).not.toHaveBeenCalled();
         });
 
+        it("should pass segment options to JNEXT.invoke", function () {
+            var options = { "segments": 4, "minSegmentSize": 512 },
+                mocked_args = {
+                    "source": encodeURIComponent(JSON.stringify("2")),
+                    "target": encodeURIComponent(JSON.stringify("3")),
+                    "callbackId": encodeURIComponent(JSON.stringify("123")),
+                    "options": encodeURIComponent(JSON.stringify(options))
+                },
+                expected_args = {
+                    "source": "2",
+                    "target": "3",
+                    "callbackId": "123",
+                    "options": options,
+                    "windowGroup": 42
+                };
+
+            index.download(null, null, mocked_args, null);
+
+            expect(JNEXT.invoke).toHaveBeenCalledWith("0", "download " + JSON.stringify(expected_args));
+            expect(mockedPluginResult.noResult).toHaveBeenCalled();
+        });
+
         it("should call failure callback with null parameters", function () {
             var mocked_args = {
                     "filePath": encodeURIComponent(JSON.stringify("")),
@@ -233,5 +315,251 @@ describe("io.filetransfer index", function () {
             expect(params.target).toEqual("/ROOT/../app/native/persistent/test.txt");
             expect(mockedPluginResult.noResult).toHaveBeenCalled();
         });
+
+        it("should not need a target to keep the file in memory", function () {
+            var mocked_args = {
+                    "source": encodeURIComponent(JSON.stringify("2")),
+                    "callbackId": encodeURIComponent(JSON.stringify("123")),
+                    "options": encodeURIComponent(JSON.stringify({ "memory": "text" }))
+                },
+                expected_args = {
+                    "source": "2",
+                    "callbackId": "123",
+                    "options": { "memory": "text" },
+                    "windowGroup": 42
+                };
+
+            index.download(null, null, mocked_args, null);
+
+            expect(JNEXT.invoke).toHaveBeenCalledWith("0", "download " + JSON.stringify(expected_args));
+            expect(mockedPluginResult.error).not.toHaveBeenCalled();
+        });
+
+        it("should fail for an unknown memory encoding", function () {
+            var mocked_args = {
+                    "source": encodeURIComponent(JSON.stringify("2")),
+                    "callbackId": encodeURIComponent(JSON.stringify("123")),
+                    "options": encodeURIComponent(JSON.stringify({ "memory": "hex" }))
+                };
+
+            index.download(null, null, mocked_args, null);
+
+            expect(JNEXT.invoke).not.toHaveBeenCalled();
+            expect(mockedPluginResult.error).toHaveBeenCalled();
+        });
+
+        it("should fail for an unknown priority", function () {
+            var mocked_args = {
+                    "source": encodeURIComponent(JSON.stringify("2")),
+                    "target": encodeURIComponent(JSON.stringify("3")),
+                    "callbackId": encodeURIComponent(JSON.stringify("123")),
+                    "options": encodeURIComponent(JSON.stringify({ "priority": "urgent" }))
+                };
+
+            index.download(null, null, mocked_args, null);
+
+            expect(JNEXT.invoke).not.toHaveBeenCalled();
+            expect(mockedPluginResult.error).toHaveBeenCalled();
+        });
+    });
+
+    describe("filetransfer abort", function () {
+        var download_args,
+            env = { "webview": { "id": 1 } };
+
+        beforeEach(function () {
+            download_args = {
+                "source": encodeURIComponent(JSON.stringify("2")),
+                "target": encodeURIComponent(JSON.stringify("3")),
+                "transferId": encodeURIComponent(JSON.stringify(7))
+            };
+            mockedPluginResult.callbackId = "123";
+        });
+
+        it("should not pass the transfer id to JNEXT", function () {
+            var params;
+
+            JNEXT.invoke = jasmine.createSpy("JNEXT.invoke").andCallFake(function () {
+                params = JSON.parse(arguments[1].substring(9, arguments[1].length));
+            });
+
+            index.download(null, null, download_args, env);
+
+            expect(params.transferId).toBeUndefined();
+        });
+
+        it("should abort the transfer by its callback id", function () {
+            index.download(null, null, download_args, env);
+            index.abort(null, null, { "transferId": encodeURIComponent(JSON.stringify(7)) }, env);
+
+            expect(JNEXT.invoke).toHaveBeenCalledWith("0", "abort " + JSON.stringify({ "callbackId": "123" }));
+            expect(mockedPluginResult.ok).toHaveBeenCalledWith(true, false);
+        });
+
+        it("should fail for an unknown transfer", function () {
+            index.abort(null, null, { "transferId": encodeURIComponent(JSON.stringify(8)) }, env);
+
+            expect(JNEXT.invoke).not.toHaveBeenCalled();
+            expect(mockedPluginResult.error).toHaveBeenCalled();
+        });
+
+        it("should not abort the transfer of another webview with the same id", function () {
+            index.download(null, null, download_args, env);
+            JNEXT.invoke.reset();
+
+            index.abort(null, null, { "transferId": encodeURIComponent(JSON.stringify(7)) }, { "webview": { "id": 2 } });
+
+            expect(JNEXT.invoke).not.toHaveBeenCalled();
+            expect(mockedPluginResult.error).toHaveBeenCalled();
+        });
+
+        it("should not keep a transfer that failed its checks", function () {
+            download_args.options = encodeURIComponent(JSON.stringify({ "priority": "urgent" }));
+            index.download(null, null, download_args, env);
+
+            index.abort(null, null, { "transferId": encodeURIComponent(JSON.stringify(7)) }, env);
+
+            expect(JNEXT.invoke).not.toHaveBeenCalled();
+            expect(mockedPluginResult.ok).not.toHaveBeenCalled();
+        });
+    });
+
+    describe("filetransfer abortTransfer", function () {
+        it("should abort the transfer by its journal id", function () {
+            index.abortTransfer(null, null, { "id": encodeURIComponent(JSON.stringify("12")) }, null);
+
+            expect(JNEXT.invoke).toHaveBeenCalledWith("0", "abort " + JSON.stringify({ "id": "12" }));
+            expect(mockedPluginResult.ok).toHaveBeenCalledWith(true, false);
+        });
+
+        it("should fail without an id", function () {
+            index.abortTransfer(null, null, {}, null);
+            index.abortTransfer(null, null, { "id": encodeURIComponent(JSON.stringify(12)) }, null);
+
+            expect(JNEXT.invoke).not.toHaveBeenCalled();
+            expect(mockedPluginResult.error.callCount).toEqual(2);
+        });
+    });
+
+    describe("filetransfer configure", function () {
+        it("should call JNEXT.invoke and return the limits", function () {
+            var limits = {
+                    "maxTransfers": 4,
+                    "maxTransfersPerHost": 2,
+                    "maxStreamsPerHost": 16,
+                    "cacheSize": 10240
+                },
+                mocked_args = {
+                    "options": encodeURIComponent(JSON.stringify(limits))
+                };
+
+            JNEXT.invoke = jasmine.createSpy("JNEXT.invoke").andReturn(JSON.stringify(limits));
+
+            index.configure(null, null, mocked_args, null);
+
+            expect(JNEXT.invoke).toHaveBeenCalledWith("0", "configure " + JSON.stringify(limits));
+            expect(mockedPluginResult.ok).toHaveBeenCalledWith(limits, false);
+            expect(mockedPluginResult.error).not.toHaveBeenCalled();
+        });
+
+        it("should fail if a limit is not positive", function () {
+            var mocked_args = {
+                    "options": encodeURIComponent(JSON.stringify({ "maxTransfers": 0 }))
+                };
+
+            index.configure(null, null, mocked_args, null);
+
+            expect(JNEXT.invoke).not.toHaveBeenCalled();
+            expect(mockedPluginResult.error).toHaveBeenCalled();
+        });
+
+        it("should take 0 to lift a bandwidth cap", function () {
+            var limits = { "maxRate": 0, "maxRateLow": 100 },
+                mocked_args = {
+                    "options": encodeURIComponent(JSON.stringify(limits))
+                };
+
+            JNEXT.invoke = jasmine.createSpy("JNEXT.invoke").andReturn(JSON.stringify(limits));
+
+            index.configure(null, null, mocked_args, null);
+
+            expect(JNEXT.invoke).toHaveBeenCalledWith("0", "configure " + JSON.stringify(limits));
+            expect(mockedPluginResult.error).not.toHaveBeenCalled();
+        });
+
+        it("should fail if a limit is not a number", function () {
+            var mocked_args = {
+                    "options": encodeURIComponent(JSON.stringify({ "maxTransfers": "4" }))
+                };
+
+            index.configure(null, null, mocked_args, null);
+
+            expect(JNEXT.invoke).not.toHaveBeenCalled();
+            expect(mockedPluginResult.error).toHaveBeenCalled();
+        });
+
+        it("should fail on an unknown option", function () {
+            var mocked_args = {
+                    "options": encodeURIComponent(JSON.stringify({ "maxTransfer": 4 }))
+                };
+
+            index.configure(null, null, mocked_args, null);
+
+            expect(JNEXT.invoke).not.toHaveBeenCalled();
+            expect(mockedPluginResult.error).toHaveBeenCalled();
+        });
+
+        it("should pass on an error from the native side", function () {
+            var mocked_args = {
+                    "options": encodeURIComponent(JSON.stringify({ "cacheSize": 1e12 }))
+                };
+
+            JNEXT.invoke = jasmine.createSpy("JNEXT.invoke").andReturn(JSON.stringify({ "error": "Cannot parse JSON object" }));
+
+            index.configure(null, null, mocked_args, null);
+
+            expect(mockedPluginResult.error).toHaveBeenCalledWith("Cannot parse JSON object", false);
+            expect(mockedPluginResult.ok).not.toHaveBeenCalled();
+        });
+    });
+
+    describe("filetransfer stats", function () {
+        it("should call JNEXT.invoke and return the stats", function () {
+            var stats = {
+                    "queued": { "high": 0, "normal": 2, "low": 1 },
+                    "running": { "high": 1, "normal": 0, "low": 0 },
+                    "delayed": 0,
+                    "prompting": 0,
+                    "rate": 4096
+                };
+
+            JNEXT.invoke = jasmine.createSpy("JNEXT.invoke").andReturn(JSON.stringify(stats));
+
+            index.stats(null, null, {}, null);
+
+            expect(JNEXT.invoke).toHaveBeenCalledWith("0", "stats");
+            expect(mockedPluginResult.ok).toHaveBeenCalledWith(stats, false);
+        });
+    });
+
+    describe("filetransfer transfers", function () {
+        it("should call JNEXT.invoke and return the journal", function () {
+            var transfers = [{
+                    "id": "1",
+                    "type": "download",
+                    "source": "http://127.0.0.1/file",
+                    "target": "/accounts/1000/shared/downloads/file",
+                    "state": "running",
+                    "bytes": 4194304,
+                    "code": 0
+                }];
+
+            JNEXT.invoke = jasmine.createSpy("JNEXT.invoke").andReturn(JSON.stringify(transfers));
+
+            index.transfers(null, null, {}, null);
+
+            expect(JNEXT.invoke).toHaveBeenCalledWith("0", "transfers");
+            expect(mockedPluginResult.ok).toHaveBeenCalledWith(transfers, false);
+        });
     });
 });